@@ -0,0 +1,2553 @@
+/**
+ * \file benchmark.cpp
+ * \brief Benchmarks implementation.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <list>
+#include <malloc.h>
+#include <sstream>
+
+#include "pthread.h"
+
+#include "benchmark.h"
+#include "legacymapreader.h"
+#include "logger.h"
+#include "compressor.h"
+#include "distanceengine.h"
+#include "map.h"
+#include "missingset.h"
+#include "neighborfilter.h"
+#include "neighboriterator.h"
+#include "quantizedpoints.h"
+#include "pathdictionary.h"
+#include "shuffler.h"
+#include "stringpool.h"
+#include "track.h"
+#include "trackstore.h"
+#include "utils.h"
+
+#ifdef BENCHMARK
+
+using namespace std;
+
+
+/// \brief Write the current map in the legacy text format.
+static bool writeLegacyMap(const string& path) {
+    Map*            map(Map::getInstance());
+    ofstream        file(path.c_str(), ios::out | ios::trunc);
+    unsigned long   i(0);
+    unsigned short  j(0);
+
+    if (!file)  return false;
+
+    file << map->getSize() << endl;
+
+    while (i < map->getSize()) {
+        Track track(map->getTrack(i));
+
+        file << track.getCode() << " " << track.getArtistID() << " " << track.getTitleID();
+        file << " " << track.getLength();
+
+        for (j = 0; j < map->getDimensions(); j++)
+            file << " " << track.getCoordinate(j);
+
+        file << " " << findAndReplace(track.getPath(), " ", "|") << endl;
+        i++;
+    }
+
+    return true;
+}
+
+
+/**
+ * \brief Read a legacy text map with streams, as earlier versions did.
+ *
+ * Used as a reference for LegacyMapReader.
+ */
+static unsigned long readLegacyMapWithStreams(const string& path, TrackStore& tracks, ANNpointArray points, unsigned short dimensions) {
+    ifstream        file(path.c_str(), ios::in);
+    string          line, newPath;
+    unsigned long   total(0), length(0);
+    unsigned int    ID(0);
+    ANNidx          i(0);
+    unsigned short  j(0);
+    ANNcoord        coordinate;
+    short           code;
+
+    getline(file, line);
+    {stringstream stream(line);
+    stream >> total;}
+
+    while (!file.eof() && i < (ANNidx)total && i < (ANNidx)tracks.getSize()) {
+        Track newTrack(&tracks, i);
+        getline(file, line);
+        stringstream stream(line);
+
+        stream >> code;
+        newTrack.setCode((MuseekCode)code);
+
+        if (code != ARTIST_NOT_FOUND && code != NOTHING_FOUND) {
+            stream >> ID;
+            newTrack.setArtistID(ID);
+        }
+
+        if (code != ARTIST_NOT_FOUND && code != TITLE_NOT_FOUND && code != NOTHING_FOUND) {
+            stream >> ID;
+            newTrack.setTitleID(ID);
+        }
+
+        stream >> length;
+        newTrack.setLength(length);
+
+        if (code != NOTHING_FOUND && code != ARTIST_NOT_FOUND) {
+            for (j = 0; j < dimensions; j++) {
+                stream >> coordinate;
+                points[i][j] = coordinate;
+            }
+        }
+
+        stream >> newPath;
+        tracks.setPath(i, findAndReplace(newPath, "|", " "));
+
+        i++;
+    }
+
+    return i;
+}
+
+
+/// \brief Track as stored before the columnar TrackStore, for comparison purposes.
+struct LegacyTrack {
+    unsigned long   artistID,
+                    length,
+                    titleID,
+                    year;
+    std::string     album,
+                    artist,
+                    genre,
+                    path,
+                    title;
+    ANNidx          id;
+    MuseekCode      code;
+    bool            alreadyPlayed;
+};
+
+
+/// \brief Attributes of the i-th track of the synthetic library.
+static void syntheticTrack(unsigned long i, string& artist, string& album, string& genre, string& title, string& path) {
+    ostringstream stream;
+
+    stream << "Artist " << i / 100;
+    artist = stream.str();
+
+    stream << " - Album " << i / 10;
+    album = stream.str();
+
+    stream.str("");
+    stream << "Genre " << i / 100 % 50;
+    genre = stream.str();
+
+    stream.str("");
+    stream << "Track " << i;
+    title = stream.str();
+
+    stream.str("");
+    stream << "C:\\Music\\" << artist << "\\" << album << "\\" << title << ".mp3";
+    path = stream.str();
+}
+
+
+/// \return Number of bytes currently allocated on the CRT heap.
+static unsigned long heapUsage() {
+    _HEAPINFO       info;
+    unsigned long   usage(0);
+
+    info._pentry = NULL;
+
+    while (_heapwalk(&info) == _HEAPOK) {
+        if (info._useflag == _USEDENTRY)
+            usage += info._size;
+    }
+
+    return usage;
+}
+
+
+/// \return Size of a file, in bytes; 0 if it cannot be opened.
+static unsigned long fileSize(const string& path) {
+    HANDLE          file(CreateFileA(path.c_str(), 0, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL));
+    unsigned long   size(0);
+
+    if (file == INVALID_HANDLE_VALUE)   return 0;
+
+    size = GetFileSize(file, NULL);
+    CloseHandle(file);
+
+    return size;
+}
+
+
+/// \brief Log a measured duration.
+static void logDuration(const string& label, double seconds) {
+    Logger* logger(Logger::getInstance());
+
+    logger->log("[BENCHMARK] " + label + ": ");
+    logger->log(seconds * 1000);
+    logger->log(" ms\n");
+}
+
+
+/**
+ * \brief Run a benchmark by name.
+ *
+ * \param name Name of the benchmark.
+ * \return False if there is no benchmark with this name, true otherwise.
+ */
+bool runBenchmark(const string& name) {
+    Logger* logger(Logger::getInstance());
+
+    if (name == "map_load")
+        benchmarkMapLoad(1000000);
+    else if (name == "legacy_map_load")
+        benchmarkLegacyMapLoad(500000);
+    else if (name == "library_check")
+        benchmarkLibraryCheck(10);
+    else if (name == "track_memory")
+        benchmarkTrackMemory(1000000);
+    else if (name == "path_dictionary")
+        benchmarkPathDictionary(100000, 1000000);
+    else if (name == "track_lookup")
+        benchmarkTrackLookup(100000, 1000000);
+    else if (name == "track_append")
+        benchmarkTrackAppend(100000, 10000);
+    else if (name == "missing_coordinates")
+        benchmarkMissingCoordinates(200000, 20000, 25);
+    else if (name == "coordinate_modes")
+        benchmarkCoordinateModes(100000, 1000, 10);
+    else if (name == "packed_map") {
+        benchmarkPackedMap(100000);
+        benchmarkPackedMap(1000000);
+        benchmarkPackedMap(5000000);
+    }
+    else if (name == "map_snapshots")
+        benchmarkMapSnapshots(100000, 10);
+    else if (name == "delta_rescan")
+        benchmarkDeltaRescan(100000, 100);
+    else if (name == "lazy_load") {
+        benchmarkLazyLoad(100000);
+        benchmarkLazyLoad(1000000);
+    }
+    else if (name == "persisted_tree") {
+        benchmarkPersistedTree(100000, 1000);
+        benchmarkPersistedTree(1000000, 1000);
+    }
+    else if (name == "query_throughput")
+        benchmarkQueryThroughput(100000, 20000, 10);
+    else if (name == "batch_queries")
+        benchmarkBatchQueries(1000000, 20000, 10);
+    else if (name == "local_pick")
+        benchmarkLocalPick(100000, 200);
+    else if (name == "remote_pick")
+        benchmarkRemotePick(100000, 200);
+    else if (name == "index_backends")
+        benchmarkIndexBackends(1000000, 10000, 10);
+    else if (name == "latency_target")
+        benchmarkLatencyTarget(1000000, 10000);
+    else if (name == "simd_scan")
+        benchmarkSimdScan(1000, 10);
+    else if (name == "delta_updates") {
+        benchmarkDeltaUpdates(100000, 1000);
+        benchmarkDeltaUpdates(1000000, 1000);
+    }
+    else if (name == "compact_index")
+        benchmarkCompactIndex(1000000, 10000, 10);
+    else if (name == "hnsw") {
+        benchmarkHnsw(100000, 10000, 10);
+        benchmarkHnsw(1000000, 10000, 10);
+    }
+    else {
+        logger->log("[WARNING] Unknown benchmark (" + name + ").\n\n");
+        return false;
+    }
+
+    Map::getInstance()->clear();
+    logger->log("\n");
+
+    return true;
+}
+
+
+/**
+ * \brief Fill the current map with a synthetic library.
+ *
+ * \param n Number of tracks.
+ */
+void createSyntheticMap(unsigned long n) {
+    fillSyntheticMap(Map::getInstance(), n);
+}
+
+
+/**
+ * \brief Fill a map with a synthetic library.
+ *
+ * Coordinates are normally distributed around a few random centers, as real tracks cluster by genre.
+ * All tracks have coordinates; artists, albums and genres repeat, and paths share long prefixes,
+ * as in a real library.
+ *
+ * \param map   Map to fill; it is cleared first.
+ * \param n     Number of tracks.
+ */
+void fillSyntheticMap(Map* map, unsigned long n) {
+    unsigned short  dimensions(map->getDimensions());
+    unsigned long   clusters(max(n / 1000, 1UL)), i(0);
+    unsigned short  j(0);
+    vector<double>  centers(clusters * dimensions);
+    string          artist, album, genre, title, path;
+
+    srand(0);
+    for (i = 0; i < centers.size(); i++)
+        centers[i] = 2. * rand() / RAND_MAX - 1.;
+
+    map->clear();
+    map->setSize(n);
+
+    for (i = 0; i < n; i++) {
+        syntheticTrack(i, artist, album, genre, title, path);
+
+        Track newTrack(map->insert(path));
+        newTrack.setArtist(artist);
+        newTrack.setAlbum(album);
+        newTrack.setGenre(genre);
+        newTrack.setTitle(title);
+        newTrack.setCode(ALL_FOUND);
+        newTrack.setArtistID(i / 100);
+        newTrack.setTitleID(i);
+        newTrack.setLength(180 + i % 120);
+
+        // Box-Muller transform around the track's cluster center
+        unsigned long center((rand() % clusters) * dimensions);
+
+        for (j = 0; j < dimensions; j++) {
+            double u(max((double)rand() / RAND_MAX, 1e-9)), v((double)rand() / RAND_MAX);
+            map->setCoordinate(i, j, centers[center + j] + 0.1 * sqrt(-2 * log(u)) * cos(2 * PI * v));
+        }
+    }
+}
+
+
+/**
+ * \brief Compare loading times of the text and binary map formats.
+ *
+ * \param n Number of tracks in the synthetic library.
+ */
+void benchmarkMapLoad(unsigned long n) {
+    Map*    map(Map::getInstance());
+    Logger* logger(Logger::getInstance());
+    string  directory(Shuffler::getInstance()->getConfigDirectory());
+    string  textPath(directory + "benchmark_map.txt");
+    string  binaryPath(directory + "benchmark_map.bin");
+    double  start;
+
+    logger->log("[BENCHMARK] Map load, ");
+    logger->log(n);
+    logger->log(" tracks\n");
+
+    createSyntheticMap(n);
+    writeLegacyMap(textPath);
+    map->writeBinary(binaryPath);
+
+    start = currentTime();
+    map->readText(textPath);
+    logDuration("text format", currentTime() - start);
+
+    start = currentTime();
+    map->readBinary(binaryPath);
+    logDuration("binary format", currentTime() - start);
+
+    map->clear();
+    DeleteFileA(textPath.c_str());
+    DeleteFileA(binaryPath.c_str());
+}
+
+
+/**
+ * \brief Compare the legacy text map reader with the stream-based reference.
+ *
+ * Outputs of both readers are checked for equality.
+ *
+ * \param n Number of tracks in the synthetic library.
+ */
+void benchmarkLegacyMapLoad(unsigned long n) {
+    Map*            map(Map::getInstance());
+    Logger*         logger(Logger::getInstance());
+    string          path(Shuffler::getInstance()->getConfigDirectory() + "benchmark_map.txt");
+    unsigned short  dimensions(map->getDimensions()), workers(1), j(0);
+    unsigned long   i(0), mismatches(0);
+    double          start;
+
+    logger->log("[BENCHMARK] Legacy map load, ");
+    logger->log(n);
+    logger->log(" tracks\n");
+
+    createSyntheticMap(n);
+    writeLegacyMap(path);
+    map->clear();
+
+    // Reference
+    TrackStore      reference;
+    ANNpointArray   referencePoints(annAllocPts(n, dimensions));
+
+    reference.resize(n);
+
+    start = currentTime();
+    readLegacyMapWithStreams(path, reference, referencePoints, dimensions);
+    logDuration("streams", currentTime() - start);
+
+    // Scanner, on one thread then on all processors
+    TrackStore      tracks;
+    ANNpointArray   points(annAllocPts(n, dimensions));
+
+    while (true) {
+        LegacyMapReader reader(dimensions);
+
+        tracks.clear();
+
+        start = currentTime();
+        reader.open(path);
+        reader.read(tracks, points, workers);
+        logDuration(workers ? "scanner, 1 thread" : "scanner, all threads", currentTime() - start);
+
+        if (!workers)   break;
+        workers = 0;
+    }
+
+    // Check output
+    for (i = 0; i < n; i++) {
+        if (i >= tracks.getSize()
+        ||  tracks.getPath(i)       != reference.getPath(i)
+        ||  tracks.getCode(i)       != reference.getCode(i)
+        ||  tracks.getArtistID(i)   != reference.getArtistID(i)
+        ||  tracks.getTitleID(i)    != reference.getTitleID(i)
+        ||  tracks.getLength(i)     != reference.getLength(i))
+            mismatches++;
+
+        for (j = 0; j < dimensions; j++) {
+            if (points[i][j] != referencePoints[i][j])
+                mismatches++;
+        }
+    }
+
+    logger->log("[BENCHMARK] Mismatches: ");
+    logger->log(mismatches);
+    logger->log("\n");
+
+    annDeallocPts(referencePoints);
+    annDeallocPts(points);
+    DeleteFileA(path.c_str());
+}
+
+
+/**
+ * \brief Compare the cost of both ways to detect library changes at startup.
+ *
+ * Works on the actual media library: fingerprinting its files is compared to opening it.
+ *
+ * \param runs Number of runs of each method.
+ */
+void benchmarkLibraryCheck(unsigned int runs) {
+    Logger*             logger(Logger::getInstance());
+    LibraryFingerprint  fingerprint;
+    unsigned int        i(0);
+    double              start;
+
+    logger->log("[BENCHMARK] Library check, ");
+    logger->log(runs);
+    logger->log(" runs\n");
+
+    start = currentTime();
+    for (i = 0; i < runs; i++)
+        Map::fingerprintLibrary(fingerprint);
+    logDuration("fingerprint", (currentTime() - start) / runs);
+
+    start = currentTime();
+    for (i = 0; i < runs; i++)
+        Map::countLibraryRecords();
+    logDuration("open library", (currentTime() - start) / runs);
+}
+
+/**
+ * \brief Compare memory used per track by the former vector of tracks and by the TrackStore.
+ *
+ * Only attributes are accounted for; coordinates and indexes are left out.
+ *
+ * \param n Number of tracks in the synthetic library.
+ */
+void benchmarkTrackMemory(unsigned long n) {
+    Logger*         logger(Logger::getInstance());
+    unsigned long   i(0), before(0), after(0);
+    string          artist, album, genre, title, path;
+
+    logger->log("[BENCHMARK] Track memory, ");
+    logger->log(n);
+    logger->log(" tracks\n");
+
+    // One object per track, with five strings each, grown as the former Map::insert() did
+    {
+        vector<LegacyTrack> tracks;
+
+        before = heapUsage();
+
+        for (i = 0; i < n; i++) {
+            LegacyTrack track;
+
+            syntheticTrack(i, artist, album, genre, title, path);
+            track.artistID      = i / 100;
+            track.length        = 180 + i % 120;
+            track.titleID       = i;
+            track.year          = 2000;
+            track.album         = album;
+            track.artist        = artist;
+            track.genre         = genre;
+            track.path          = path;
+            track.title         = title;
+            track.id            = i;
+            track.code          = ALL_FOUND;
+            track.alreadyPlayed = false;
+
+            tracks.push_back(track);
+        }
+
+        after = heapUsage();
+    }
+
+    logger->log("[BENCHMARK] vector<Track>: ");
+    logger->log((double)(after - before) / n);
+    logger->log(" bytes per track\n");
+
+    // Columns
+    {
+        TrackStore tracks;
+
+        before = heapUsage();
+        tracks.reserve(n);
+
+        for (i = 0; i < n; i++) {
+            Track track(&tracks, i);
+
+            syntheticTrack(i, artist, album, genre, title, path);
+            tracks.resize(i + 1);
+            tracks.setPath(i, path);
+            track.setArtistID(i / 100);
+            track.setLength(180 + i % 120);
+            track.setTitleID(i);
+            track.setYear(2000);
+            track.setAlbum(album);
+            track.setArtist(artist);
+            track.setGenre(genre);
+            track.setTitle(title);
+            track.setCode(ALL_FOUND);
+        }
+
+        tracks.rebuildPaths();
+        after = heapUsage();
+
+        logger->log("[BENCHMARK] TrackStore: ");
+        logger->log((double)(after - before) / n);
+        logger->log(" bytes per track (");
+        logger->log((double)tracks.getMemoryUsage() / n);
+        logger->log(" accounted for by the store)\n");
+    }
+}
+
+/**
+ * \brief Compare memory used per path of pooled paths indexed by a std::map and of the
+ * front-coded PathDictionary, and time getting paths back from the dictionary.
+ *
+ * Tracks are found by path through the hash index of Map, see benchmarkTrackLookup().
+ *
+ * \param n         Number of tracks in the synthetic library.
+ * \param lookups   Number of paths to get, of IDs in random order.
+ */
+void benchmarkPathDictionary(unsigned long n, unsigned long lookups) {
+    Logger*                 logger(Logger::getInstance());
+    unsigned long           i(0), before(0), after(0), misses(0);
+    string                  artist, album, genre, title;
+    vector<string>          paths(n);
+    vector<unsigned long>   queries(lookups);
+    double                  start(0);
+
+    logger->log("[BENCHMARK] Path dictionary, ");
+    logger->log(n);
+    logger->log(" paths\n");
+
+    for (i = 0; i < n; i++)
+        syntheticTrack(i, artist, album, genre, title, paths[i]);
+
+    srand(0);
+    for (i = 0; i < lookups; i++)
+        queries[i] = ((unsigned long)rand() * (RAND_MAX + 1UL) + rand()) % n;
+
+    // Pooled strings, indexed by a tree, as the map did
+    {
+        StringPool                                  pool;
+        map<const char*, ANNidx, StringLess>        index;
+
+        before = heapUsage();
+
+        for (i = 0; i < n; i++)
+            index[pool.store(paths[i])] = i;
+
+        after = heapUsage();
+
+        logger->log("[BENCHMARK] StringPool and std::map: ");
+        logger->log((double)(after - before) / n);
+        logger->log(" bytes per path\n");
+    }
+
+    // Front-coded dictionary
+    {
+        PathDictionary          dictionary;
+        vector<const char*>     pointers(n);
+        vector<unsigned long>   lengths(n);
+        string                  path;
+
+        for (i = 0; i < n; i++) {
+            pointers[i] = paths[i].data();
+            lengths[i]  = paths[i].size();
+        }
+
+        before = heapUsage();
+        dictionary.build(pointers, lengths);
+        after = heapUsage();
+
+        logger->log("[BENCHMARK] PathDictionary: ");
+        logger->log((double)(after - before) / n);
+        logger->log(" bytes per path\n");
+
+        start = currentTime();
+
+        for (i = 0; i < lookups; i++) {
+            dictionary.get(queries[i], path);
+
+            if (path != paths[queries[i]])
+                misses++;
+        }
+
+        logger->log("[BENCHMARK] PathDictionary: ");
+        logger->log((currentTime() - start) * 1e6 / lookups);
+        logger->log(" us per path\n");
+
+        for (i = 0; i < n; i++) {
+            if (dictionary.get(i) != paths[i])
+                misses++;
+        }
+    }
+
+    logger->log("[BENCHMARK] Mismatches: ");
+    logger->log(misses);
+    logger->log("\n");
+}
+
+/**
+ * \brief Compare finding tracks by path with the former std::map index and with Map::findTrack(),
+ * by path and by artist name and title.
+ *
+ * \param n         Number of tracks in the synthetic library.
+ * \param lookups   Number of lookups, of existing tracks in random order.
+ */
+void benchmarkTrackLookup(unsigned long n, unsigned long lookups) {
+    Map*                    map(Map::getInstance());
+    Logger*                 logger(Logger::getInstance());
+    unsigned long           i(0), misses(0);
+    string                  artist, album, genre, title, path;
+    vector<string>          paths(n), names(n);
+    vector<unsigned long>   queries(lookups);
+    std::map<string, ANNidx> fileIndex;
+    double                  start(0);
+
+    logger->log("[BENCHMARK] Track lookup, ");
+    logger->log(n);
+    logger->log(" tracks\n");
+
+    createSyntheticMap(n);
+
+    start = currentTime();
+    map->buildIndexes();
+    logDuration("building indexes", currentTime() - start);
+
+    for (i = 0; i < n; i++) {
+        syntheticTrack(i, artist, album, genre, title, paths[i]);
+        names[i] = artist + " - " + title;
+        fileIndex[paths[i]] = i;
+    }
+
+    srand(0);
+    for (i = 0; i < lookups; i++)
+        queries[i] = ((unsigned long)rand() * (RAND_MAX + 1UL) + rand()) % n;
+
+    // Former index
+    start = currentTime();
+
+    for (i = 0; i < lookups; i++) {
+        std::map<string, ANNidx>::iterator j(fileIndex.find(paths[queries[i]]));
+
+        if (j == fileIndex.end() || j->second != (ANNidx)queries[i])
+            misses++;
+    }
+
+    logger->log("[BENCHMARK] std::map, by path: ");
+    logger->log((currentTime() - start) * 1e6 / lookups);
+    logger->log(" us per lookup\n");
+
+    // Hash indexes
+    start = currentTime();
+
+    for (i = 0; i < lookups; i++) {
+        if (map->findTrack(string(), paths[queries[i]]).getId() != (ANNidx)queries[i])
+            misses++;
+    }
+
+    logger->log("[BENCHMARK] Map::findTrack(), by path: ");
+    logger->log((currentTime() - start) * 1e6 / lookups);
+    logger->log(" us per lookup\n");
+
+    start = currentTime();
+
+    for (i = 0; i < lookups; i++) {
+        if (map->findTrack(names[queries[i]], string()).getId() != (ANNidx)queries[i])
+            misses++;
+    }
+
+    logger->log("[BENCHMARK] Map::findTrack(), by artist and title: ");
+    logger->log((currentTime() - start) * 1e6 / lookups);
+    logger->log(" us per lookup\n");
+
+    // Case and blanks do not matter, and misses are reported as such
+    for (i = 0; i < n; i += 101) {
+        if (map->findTrack(string(), foldCase(paths[i])).getId() != (ANNidx)i
+        ||  map->findTrack("  " + names[i] + " ", string()).getId() != (ANNidx)i)
+            misses++;
+    }
+
+    if (map->findTrack("Nobody - Nothing", "C:\\Nowhere.mp3").isValid())
+        misses++;
+
+    logger->log("[BENCHMARK] Mismatches: ");
+    logger->log(misses);
+    logger->log("\n");
+}
+
+/**
+ * \brief Measure appending tracks one by one, as when they are added while the player runs.
+ *
+ * The former storage, which reallocated and copied all points on each append, is measured on
+ * fewer tracks, since it takes quadratic time.
+ *
+ * \param n         Number of tracks to append to the map.
+ * \param legacyN   Number of tracks to append to the former storage.
+ */
+void benchmarkTrackAppend(unsigned long n, unsigned long legacyN) {
+    Map*            map(Map::getInstance());
+    Logger*         logger(Logger::getInstance());
+    unsigned short  dimensions(map->getDimensions()), j(0);
+    unsigned long   i(0), mismatches(0);
+    string          artist, album, genre, title, path;
+    double          start(0);
+
+    logger->log("[BENCHMARK] Track append, ");
+    logger->log(n);
+    logger->log(" tracks\n");
+
+    // Former storage: one contiguous block, reallocated on each append
+    {
+        ANNcoord*       coordinates(NULL);
+        ANNpointArray   points(NULL);
+
+        start = currentTime();
+
+        for (i = 0; i < legacyN; i++) {
+            ANNcoord*       newCoordinates(new ANNcoord[(i + 1) * dimensions]);
+            ANNpointArray   newPoints(new ANNpoint[i + 1]);
+            unsigned long   k(0);
+
+            for (k = 0; k <= i; k++)
+                newPoints[k] = newCoordinates + k * dimensions;
+
+            if (i)  memcpy(newCoordinates, coordinates, i * dimensions * sizeof(ANNcoord));
+
+            for (j = 0; j < dimensions; j++)
+                newPoints[i][j] = (ANNcoord)j;
+
+            delete[] points;
+            delete[] coordinates;
+            points      = newPoints;
+            coordinates = newCoordinates;
+        }
+
+        logger->log("[BENCHMARK] reallocation, ");
+        logger->log(legacyN);
+        logger->log(" tracks: ");
+        logger->log((currentTime() - start) * 1e6 / legacyN);
+        logger->log(" us per track\n");
+
+        delete[] points;
+        delete[] coordinates;
+    }
+
+    // Chunked storage, through the map
+    ANNpoint first(NULL);
+
+    map->clear();
+    start = currentTime();
+
+    for (i = 0; i < n; i++) {
+        syntheticTrack(i, artist, album, genre, title, path);
+        map->addTrack(artist, title, path);
+        map->getTrack(i).setCode(ALL_FOUND);
+
+        for (j = 0; j < dimensions; j++)
+            map->setCoordinate(i, j, (ANNcoord)j);
+
+        if (i == 0)     first = map->getPoint(0);
+    }
+
+    logger->log("[BENCHMARK] Map::addTrack(), ");
+    logger->log(n);
+    logger->log(" tracks: ");
+    logger->log((currentTime() - start) * 1e6 / n);
+    logger->log(" us per track\n");
+
+    // Points must not have moved
+    if (map->getPoint(0) != first)  mismatches++;
+
+    for (i = 0; i < n; i++) {
+        if (map->getPoint(i)[dimensions - 1] != dimensions - 1)
+            mismatches++;
+    }
+
+    logger->log("[BENCHMARK] Mismatches: ");
+    logger->log(mismatches);
+    logger->log("\n");
+}
+
+
+/**
+ * \brief Measure the bookkeeping of tracks missing coordinates during a library rescan.
+ *
+ * All tracks are marked as they are inserted, then taken in batches and unmarked as if the
+ * server had answered; no HTTP query is made. The former list, whose removals are linear,
+ * is measured on fewer tracks, since it takes quadratic time.
+ *
+ * \param n                 Number of tracks for the missing set.
+ * \param legacyN           Number of tracks for the former list.
+ * \param tracksPerQuery    Number of tracks per batch.
+ */
+void benchmarkMissingCoordinates(unsigned long n, unsigned long legacyN, unsigned long tracksPerQuery) {
+    Logger*         logger(Logger::getInstance());
+    unsigned long   i(0), batches(0);
+    double          start(0);
+
+    logger->log("[BENCHMARK] Missing coordinates, ");
+    logger->log(n);
+    logger->log(" tracks\n");
+
+    // Former list: copied for the download, then searched on each removal
+    {
+        list<ANNidx> missing;
+
+        start = currentTime();
+
+        for (i = 0; i < legacyN; i++)
+            missing.push_back(i);
+
+        list<ANNidx> indices(missing);
+
+        while (!indices.empty()) {
+            list<ANNidx> batch;
+
+            while (!indices.empty() && batch.size() < tracksPerQuery) {
+                batch.push_back(indices.front());
+                indices.pop_front();
+            }
+
+            while (!batch.empty()) {
+                missing.remove(batch.front());
+                batch.pop_front();
+            }
+        }
+
+        logger->log("[BENCHMARK] std::list, ");
+        logger->log(legacyN);
+        logger->log(" tracks: ");
+        logger->log((currentTime() - start) * 1e3);
+        logger->log(" ms\n");
+    }
+
+    // Missing set
+    MissingSet      missing;
+    vector<ANNidx>  batch;
+
+    start = currentTime();
+
+    for (i = 0; i < n; i++)
+        missing.mark(i);
+
+    missing.requeue();
+
+    while (missing.nextBatch(tracksPerQuery, batch)) {
+        for (i = 0; i < batch.size(); i++)
+            missing.unmark(batch[i]);
+
+        batches++;
+    }
+
+    logger->log("[BENCHMARK] MissingSet, ");
+    logger->log(n);
+    logger->log(" tracks: ");
+    logger->log((currentTime() - start) * 1e3);
+    logger->log(" ms, ");
+    logger->log(batches);
+    logger->log(" batches, ");
+    logger->log(missing.getMemoryUsage());
+    logger->log(" bytes\n");
+
+    logger->log("[BENCHMARK] Tracks left: ");
+    logger->log(missing.getCount());
+    logger->log("\n");
+}
+
+
+/**
+ * \brief Compare representations of coordinates for nearest neighbor searches (see CoordinateMode).
+ *
+ * Recall is the fraction of the exact k nearest neighbors found, the k-dimensional tree over
+ * ANNcoord values with no error bound being exact. Memory is the size of coordinates searched on,
+ * k-dimensional tree excluded.
+ *
+ * \param n         Number of tracks in the synthetic library.
+ * \param queries   Number of queries, from tracks spread over the library.
+ * \param k         Number of nearest neighbors per query.
+ */
+void benchmarkCoordinateModes(unsigned long n, unsigned long queries, int k) {
+    Map*                map(Map::getInstance());
+    Logger*             logger(Logger::getInstance());
+    unsigned short      dimensions(map->getDimensions());
+    unsigned long       i(0), q(0);
+    int                 j(0), l(0);
+    double              start(0);
+    ANNpointArray       points(new ANNpoint[n]);
+    vector<ANNidx>      exact(queries * k);
+    ANNdistArray        distances(new ANNdist[k]);
+    NeighborQuery       query;
+
+    logger->log("[BENCHMARK] Coordinate modes, ");
+    logger->log(n);
+    logger->log(" tracks, ");
+    logger->log(k);
+    logger->log(" nearest neighbors\n");
+
+    createSyntheticMap(n);
+
+    for (i = 0; i < n; i++)
+        points[i] = map->getPoint(i);
+
+    // Reference: k-dimensional tree
+    {
+        start = currentTime();
+        ANNkd_tree tree(points, n, dimensions);
+        logDuration("double, build", currentTime() - start);
+
+        start = currentTime();
+
+        for (q = 0; q < queries; q++)
+            tree.annkSearch(points[q * (n / queries)], k, &exact[q * k], distances, 0);
+
+        logger->log("[BENCHMARK] double: ");
+        logger->log((currentTime() - start) * 1e6 / queries);
+        logger->log(" us per query, ");
+        logger->log(dimensions * sizeof(ANNcoord));
+        logger->log(" bytes per track, recall 1\n");
+    }
+
+    // Compact copies
+    CoordinateMode  modes[] = {COORDINATES_FLOAT, COORDINATES_INT8};
+    const char*     names[] = {"float", "int8"};
+
+    for (l = 0; l < 2; l++) {
+        QuantizedPoints compact;
+        unsigned long   found(0);
+
+        start = currentTime();
+        compact.build(modes[l], points, n, dimensions);
+        logDuration(string(names[l]) + ", build", currentTime() - start);
+
+        start = currentTime();
+
+        for (q = 0; q < queries; q++) {
+            query.reset(k);
+            compact.search(points[q * (n / queries)], k, query, points);
+
+            for (j = 0; j < k; j++) {
+                if (find(&exact[q * k], &exact[q * k] + k, query.getId(j)) != &exact[q * k] + k)
+                    found++;
+            }
+        }
+
+        logger->log("[BENCHMARK] ");
+        logger->log(names[l]);
+        logger->log(": ");
+        logger->log((currentTime() - start) * 1e6 / queries);
+        logger->log(" us per query, ");
+        logger->log((double)compact.getMemoryUsage() / n);
+        logger->log(" bytes per track, recall ");
+        logger->log((double)found / (queries * k));
+        logger->log("\n");
+    }
+
+    delete[] points;
+    delete[] distances;
+}
+
+
+/**
+ * \brief Compare size and loading time of the text, binary and packed map formats.
+ *
+ * Packed map files are written with each codec available. Coordinates read back from them
+ * are checked against the original ones, within half a quantization step.
+ *
+ * \param n Number of tracks in the synthetic library.
+ */
+void benchmarkPackedMap(unsigned long n) {
+    Map*                map(Map::getInstance());
+    Logger*             logger(Logger::getInstance());
+    Compressor*         compressor(Compressor::getInstance());
+    string              directory(Shuffler::getInstance()->getConfigDirectory());
+    string              textPath(directory + "benchmark_map.txt");
+    string              binaryPath(directory + "benchmark_map.bin");
+    string              packedPath(directory + "benchmark_map.pak");
+    unsigned short      dimensions(map->getDimensions()), j(0);
+    unsigned long       i(0);
+    double              start(0);
+    vector<ANNcoord>    coordinates;
+
+    logger->log("[BENCHMARK] Packed map, ");
+    logger->log(n);
+    logger->log(" tracks\n");
+
+    createSyntheticMap(n);
+
+    // Keep a sample of coordinates, to check them once read back
+    for (i = 0; i < n; i += 997) {
+        for (j = 0; j < dimensions; j++)
+            coordinates.push_back(map->getPoint(i)[j]);
+    }
+
+    writeLegacyMap(textPath);
+    map->writeBinary(binaryPath);
+
+    start = currentTime();
+    map->readText(textPath);
+    logDuration("text format, load", currentTime() - start);
+    logger->log("[BENCHMARK] text format, size: ");
+    logger->log((double)fileSize(textPath));
+    logger->log(" bytes\n");
+
+    start = currentTime();
+    map->readBinary(binaryPath);
+    logDuration("binary format, load", currentTime() - start);
+    logger->log("[BENCHMARK] binary format, size: ");
+    logger->log((double)fileSize(binaryPath));
+    logger->log(" bytes\n");
+
+    CompressionCodec    codecs[] = {COMPRESSION_NONE, COMPRESSION_ZLIB, COMPRESSION_ZSTD};
+    const char*         names[] = {"packed format, no compression", "packed format, zlib", "packed format, zstd"};
+    unsigned short      k(0);
+
+    for (k = 0; k < 3; k++) {
+        if (!compressor->isAvailable(codecs[k]))    continue;
+
+        double          error(0);
+        unsigned long   sample(0);
+
+        map->setMapCompression(codecs[k]);
+
+        start = currentTime();
+        map->writePacked(packedPath);
+        logDuration(string(names[k]) + ", write", currentTime() - start);
+
+        start = currentTime();
+        map->readPacked(packedPath);
+        logDuration(string(names[k]) + ", load", currentTime() - start);
+
+        for (i = 0; i < n; i += 997) {
+            for (j = 0; j < dimensions; j++)
+                error = max(error, fabs(map->getPoint(i)[j] - coordinates[sample++]));
+        }
+
+        logger->log("[BENCHMARK] ");
+        logger->log(names[k]);
+        logger->log(", size: ");
+        logger->log((double)fileSize(packedPath));
+        logger->log(" bytes, largest coordinate error: ");
+        logger->log(error);
+        logger->log("\n");
+    }
+
+    map->setMapCompression(COMPRESSION_NONE);
+    map->clear();
+    DeleteFileA(textPath.c_str());
+    DeleteFileA(binaryPath.c_str());
+    DeleteFileA(packedPath.c_str());
+}
+
+
+/// State shared with the thread selecting next tracks in benchmarkMapSnapshots().
+struct SnapshotReader {
+    volatile bool   stop;
+    unsigned long   selections,
+                    failures;
+    double          longest;        ///< Longest selection, in seconds
+};
+
+
+/**
+ * \brief Select next tracks continuously, as NextTrackPreparation does, until asked to stop.
+ *
+ * Each selection pins the current map, finds the previous track in it by path, and picks
+ * one of its nearest neighbors; the selected track keeps its map pinned until the next one.
+ */
+static void* selectNextTracks(void* data) {
+    SnapshotReader* reader((SnapshotReader*)data);
+    Track           previous;
+    NeighborQuery   neighbors;
+
+    while (!reader->stop) {
+        double  start(currentTime());
+        Map*    map(Map::acquire());
+        Track   playing(map->findTrack(previous));
+
+        if (!playing.isValid())
+            playing = map->getTrack(rand() % map->getSize());
+
+        if (map->findNearestNeighbors(playing, 5, neighbors) < 2 || neighbors.getId(1) >= (ANNidx)map->getSize())
+            reader->failures++;
+        else {
+            Track next(map->getTrack(neighbors.getId(1)));
+
+            if (next.getPath().empty() || !next.hasCoordinates())
+                reader->failures++;
+
+            previous = next;
+        }
+
+        map->release();
+
+        reader->selections++;
+        reader->longest = max(reader->longest, currentTime() - start);
+    }
+
+    return NULL;
+}
+
+
+/**
+ * \brief Select next tracks on one thread while another one rescans the library repeatedly.
+ *
+ * Each rescan builds a synthetic map aside, and publishes it; replaced maps must be deleted
+ * once the selecting thread no longer refers to them. Selections must never fail, and never
+ * wait for a rescan.
+ *
+ * \param n         Number of tracks in the synthetic library.
+ * \param rescans   Number of rescans.
+ */
+void benchmarkMapSnapshots(unsigned long n, unsigned int rescans) {
+    Logger*         logger(Logger::getInstance());
+    SnapshotReader  reader = {false, 0, 0, 0};
+    pthread_t       thread;
+    unsigned int    r(0);
+    double          start(0), building(0);
+
+    logger->log("[BENCHMARK] Map snapshots, ");
+    logger->log(n);
+    logger->log(" tracks, ");
+    logger->log(rescans);
+    logger->log(" rescans\n");
+
+    // Initial map
+    Map* map(Map::create());
+    fillSyntheticMap(map, n);
+    map->buildIndexes();
+    map->buildTree();
+    Map::publish(map);
+
+    if (pthread_create(&thread, NULL, selectNextTracks, &reader) != 0) {
+        logger->log("[ERROR] Unable to start the selecting thread.\n");
+        return;
+    }
+
+    start = currentTime();
+
+    for (r = 0; r < rescans; r++) {
+        double rescanStart(currentTime());
+
+        map = Map::create();
+        fillSyntheticMap(map, n);
+        map->buildIndexes();
+        map->buildTree();
+
+        building += currentTime() - rescanStart;
+        Map::publish(map);
+    }
+
+    reader.stop = true;
+    pthread_join(thread, NULL);
+
+    logDuration("rescan, average", building / max(rescans, 1U));
+    logger->log("[BENCHMARK] Selections during rescans: ");
+    logger->log(reader.selections);
+    logger->log(" (");
+    logger->log((currentTime() - start) * 1e6 / max(reader.selections, 1UL));
+    logger->log(" us each), longest ");
+    logger->log(reader.longest * 1000);
+    logger->log(" ms\n");
+    logger->log("[BENCHMARK] Failed selections: ");
+    logger->log(reader.failures);
+    logger->log("\n");
+
+    // The selecting thread is done: all replaced maps must be gone
+    logger->log("[BENCHMARK] Replaced maps released: ");
+    logger->log(Map::synchronize(1000) ? "yes" : "no");
+    logger->log("\n");
+}
+
+
+/**
+ * \brief Rescan a synthetic library in which a few tracks were added, edited and removed.
+ *
+ * The rescan starts from the current map, as LibraryScan does; no HTTP query is made. Only
+ * added and edited tracks must be queued for download, and other tracks must keep their IDs.
+ *
+ * \param n         Number of tracks in the synthetic library.
+ * \param changes   Number of tracks added, of tracks edited, and of tracks removed.
+ */
+void benchmarkDeltaRescan(unsigned long n, unsigned long changes) {
+    Map*            current(Map::getInstance());
+    Logger*         logger(Logger::getInstance());
+    unsigned long   i(0), queued(0), moved(0);
+    string          artist, album, genre, title, path;
+    double          start(0);
+
+    logger->log("[BENCHMARK] Delta rescan, ");
+    logger->log(n);
+    logger->log(" tracks, ");
+    logger->log(changes);
+    logger->log(" added, edited and removed\n");
+
+    createSyntheticMap(n);
+
+    // Stamps of the files, as of the previous scan
+    for (i = 0; i < n; i++) {
+        syntheticTrack(i, artist, album, genre, title, path);
+        current->update(path, Map::stampFile(i, 4000 + i));
+    }
+
+    // The first tracks are edited, the last ones removed, and new ones added
+    Map*            map(Map::create());
+    vector<bool>    seen;
+
+    start = currentTime();
+    map->copyTracks(*current);
+    seen.resize(map->getSize(), false);
+
+    for (i = 0; i < n; i++) {
+        unsigned long k(i < n - changes ? i : i + changes);
+
+        syntheticTrack(k, artist, album, genre, title, path);
+
+        Track track(map->update(path, Map::stampFile(k, 4000 + k + (i < changes ? 1 : 0))));
+        track.setArtist(artist);
+        track.setTitle(title);
+
+        if ((unsigned long)track.getId() >= seen.size())
+            seen.resize(track.getId() + 1, false);
+        seen[track.getId()] = true;
+    }
+
+    for (i = 0; i < seen.size(); i++) {
+        if (!seen[i])   map->remove(i);
+    }
+
+    map->buildIndexes();
+    logDuration("rescan, without downloads", currentTime() - start);
+
+    // Tracks to download, and tracks that changed ID
+    for (i = 0; i < map->getSize(); i++) {
+        Track track(map->getTrack(i));
+
+        if (track.getCode() == UNTESTED)    queued++;
+
+        if (i < n - changes && track.getPath() != current->getTrack(i).getPath())
+            moved++;
+    }
+
+    logger->log("[BENCHMARK] Tracks queued for download: ");
+    logger->log(queued);
+    logger->log(" (expected ");
+    logger->log(2 * changes);
+    logger->log("), tracks whose ID changed: ");
+    logger->log(moved);
+    logger->log(", map size: ");
+    logger->log(map->getSize());
+    logger->log("\n");
+
+    map->removeReference();
+}
+
+
+/**
+ * \brief Compare eager and lazy loads of a binary map file.
+ *
+ * For each mode, measures the time until load() returns, the time of the first nearest
+ * neighbor search right after, and the time until the search structure is built.
+ * The map file is stamped with the current media library, so that load() does not
+ * propose to rescan it.
+ *
+ * \param n Number of tracks in the synthetic library.
+ */
+void benchmarkLazyLoad(unsigned long n) {
+    Map*    map(Map::getInstance());
+    Logger* logger(Logger::getInstance());
+    string  filename("benchmark_map.bin");
+    string  path(Shuffler::getInstance()->getConfigDirectory() + filename);
+    bool            lazyLoading(map->isLazyLoading());
+    NeighborQuery   query;
+    double          start(0);
+    int             mode(0);
+
+    logger->log("[BENCHMARK] Lazy load, ");
+    logger->log(n);
+    logger->log(" tracks\n");
+
+    createSyntheticMap(n);
+    map->updateLibraryFingerprint();
+    map->writeBinary(path);
+
+    for (mode = 0; mode < 2; mode++) {
+        logger->log(mode ? "[BENCHMARK] Lazy:\n" : "[BENCHMARK] Eager:\n");
+
+        map->clear();
+        map->setLazyLoading(mode != 0);
+
+        start = currentTime();
+        if (!map->load(filename)) {
+            logger->log("[WARNING] Unable to load benchmark map file (" + path + ").\n\n");
+            break;
+        }
+        logDuration("load", currentTime() - start);
+
+        start = currentTime();
+        map->findNearestNeighbors(map->getPoint(rand() % n), 10, query);
+        logDuration("first search", currentTime() - start);
+
+        start = currentTime();
+        while (!map->isSearchReady() && currentTime() - start < 60)
+            Sleep(1);
+        logDuration("until search structure is built", currentTime() - start);
+    }
+
+    map->setLazyLoading(lazyLoading);
+    map->clear();
+    DeleteFileA(path.c_str());
+}
+
+
+/**
+ * \brief Compare eager loads of a map file in COORDINATES_DOUBLE mode, with and without its tree file.
+ *
+ * The first load builds the k-dimensional tree and writes the tree file; the second one reads it.
+ * Nearest neighbors found with both trees are compared. The map file is stamped with the current
+ * media library, so that load() does not propose to rescan it.
+ *
+ * \param n         Number of tracks in the synthetic library.
+ * \param queries   Number of queries, from tracks spread over the library.
+ */
+void benchmarkPersistedTree(unsigned long n, unsigned long queries) {
+    Map*            map(Map::getInstance());
+    Logger*         logger(Logger::getInstance());
+    string          filename("benchmark_map.bin");
+    string          path(Shuffler::getInstance()->getConfigDirectory() + filename);
+    string          treePath(path + MAP_TREE_EXTENSION);
+    CoordinateMode  coordinateMode(map->getCoordinateMode());
+    bool            lazyLoading(map->isLazyLoading());
+    const int       k(10);
+    vector<ANNidx>  expected(queries * k);
+    NeighborQuery   query;
+    unsigned long   q(0), mismatches(0);
+    double          start(0);
+    int             j(0);
+
+    logger->log("[BENCHMARK] Persisted tree, ");
+    logger->log(n);
+    logger->log(" tracks\n");
+
+    map->setCoordinateMode(COORDINATES_DOUBLE);
+    map->setLazyLoading(false);
+
+    createSyntheticMap(n);
+    map->updateLibraryFingerprint();
+    map->writeBinary(path);
+    DeleteFileA(treePath.c_str());
+
+    // Without tree file: the tree is built, then written
+    map->clear();
+    start = currentTime();
+    map->load(filename);
+    logDuration("load, tree built and written", currentTime() - start);
+
+    logger->log("[BENCHMARK] Tree file: ");
+    logger->log((double)fileSize(treePath));
+    logger->log(" bytes\n");
+
+    for (q = 0; q < queries; q++) {
+        map->findNearestNeighbors((ANNidx)(q * (n / queries)), k, query);
+
+        for (j = 0; j < k; j++)
+            expected[q * k + j] = j < query.getCount() ? query.getId(j) : ANN_NULL_IDX;
+    }
+
+    // With tree file
+    map->clear();
+    start = currentTime();
+    map->load(filename);
+    logDuration("load, tree read", currentTime() - start);
+
+    for (q = 0; q < queries; q++) {
+        map->findNearestNeighbors((ANNidx)(q * (n / queries)), k, query);
+
+        for (j = 0; j < k; j++)
+            if ((j < query.getCount() ? query.getId(j) : ANN_NULL_IDX) != expected[q * k + j])  mismatches++;
+    }
+
+    logger->log("[BENCHMARK] Neighbors differing between both trees: ");
+    logger->log(mismatches);
+    logger->log(" out of ");
+    logger->log(queries * k);
+    logger->log("\n");
+
+    map->setCoordinateMode(coordinateMode);
+    map->setLazyLoading(lazyLoading);
+    map->clear();
+    DeleteFileA(path.c_str());
+    DeleteFileA(treePath.c_str());
+}
+
+
+/// Work of a searching thread in benchmarkQueryThroughput().
+struct QuerySearcher {
+    Map*                        map;
+    const vector<ANNidx>*       expected;       ///< Nearest neighbors found by a single thread, k per query
+    unsigned long               first,          ///< First query of the thread
+                                count,          ///< Number of queries of the thread
+                                stride;         ///< Distance between tracks queried
+    int                         k;
+    unsigned long               mismatches;
+};
+
+
+/// \brief Search nearest neighbors of a range of tracks, with a context of its own, and compare results.
+static void* searchNeighbors(void* data) {
+    QuerySearcher*  searcher((QuerySearcher*)data);
+    NeighborQuery   query;
+    unsigned long   q(0);
+    int             j(0);
+
+    for (q = searcher->first; q < searcher->first + searcher->count; q++) {
+        searcher->map->findNearestNeighbors((ANNidx)(q * searcher->stride), searcher->k, query);
+
+        for (j = 0; j < searcher->k; j++) {
+            ANNidx id(j < query.getCount() ? query.getId(j) : ANN_NULL_IDX);
+            if (id != (*searcher->expected)[q * searcher->k + j])   searcher->mismatches++;
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+ * \brief Measure nearest neighbor searches per second, from several threads at once.
+ *
+ * Each thread searches with its own NeighborQuery; results must match the ones of a single
+ * thread. k-dimensional tree searches are serialized (ANN keeps their state in globals),
+ * so only the other coordinate modes may scale with threads.
+ *
+ * \param n         Number of tracks in the synthetic library.
+ * \param queries   Number of queries, shared among threads.
+ * \param k         Number of nearest neighbors per query.
+ */
+void benchmarkQueryThroughput(unsigned long n, unsigned long queries, int k) {
+    Map*                map(Map::getInstance());
+    Logger*             logger(Logger::getInstance());
+    CoordinateMode      coordinateMode(map->getCoordinateMode());
+    CoordinateMode      modes[] = {COORDINATES_DOUBLE, COORDINATES_FLOAT, COORDINATES_INT8};
+    const char*         names[] = {"double", "float", "int8"};
+    const unsigned int  maxThreads(8);
+    unsigned long       stride(max(n / queries, 1UL)), q(0);
+    vector<ANNidx>      expected(queries * k);
+    NeighborQuery       query;
+    double              start(0);
+    unsigned int        threads(0), t(0);
+    int                 l(0), j(0);
+
+    logger->log("[BENCHMARK] Query throughput, ");
+    logger->log(n);
+    logger->log(" tracks, ");
+    logger->log(k);
+    logger->log(" nearest neighbors\n");
+
+    createSyntheticMap(n);
+    queries = min(queries, n / stride);
+
+    for (l = 0; l < 3; l++) {
+        map->setCoordinateMode(modes[l]);
+        map->buildTree();
+
+        // Reference results, from a single thread
+        for (q = 0; q < queries; q++) {
+            map->findNearestNeighbors((ANNidx)(q * stride), k, query);
+
+            for (j = 0; j < k; j++)
+                expected[q * k + j] = j < query.getCount() ? query.getId(j) : ANN_NULL_IDX;
+        }
+
+        for (threads = 1; threads <= maxThreads; threads *= 2) {
+            pthread_t       handles[maxThreads];
+            QuerySearcher   searchers[maxThreads];
+            unsigned long   mismatches(0);
+            bool            failed(false);
+
+            start = currentTime();
+
+            for (t = 0; t < threads; t++) {
+                QuerySearcher searcher = {map, &expected, t * queries / threads, (t + 1) * queries / threads - t * queries / threads, stride, k, 0};
+                searchers[t] = searcher;
+
+                if (pthread_create(&handles[t], NULL, searchNeighbors, &searchers[t]) != 0) {
+                    logger->log("[ERROR] Unable to start a searching thread.\n");
+                    failed = true;
+                    break;
+                }
+            }
+
+            if (failed)     threads = t;
+
+            for (t = 0; t < threads; t++) {
+                pthread_join(handles[t], NULL);
+                mismatches += searchers[t].mismatches;
+            }
+
+            if (failed)     break;
+
+            logger->log("[BENCHMARK] ");
+            logger->log(names[l]);
+            logger->log(", ");
+            logger->log(threads);
+            logger->log(" threads: ");
+            logger->log(queries / max(currentTime() - start, 1e-9));
+            logger->log(" queries per second, ");
+            logger->log(mismatches);
+            logger->log(" neighbors differing from a single thread\n");
+        }
+    }
+
+    map->setCoordinateMode(coordinateMode);
+}
+
+
+/**
+ * \brief Measure batched nearest neighbor searches, with an increasing number of worker threads.
+ *
+ * Results of each batch must match the ones of a single worker. k-dimensional tree searches
+ * are serialized (ANN keeps their state in globals), so only the other coordinate modes may
+ * scale with workers.
+ *
+ * \param n         Number of tracks in the synthetic library.
+ * \param queries   Number of queries of the batch, from tracks spread over the library.
+ * \param k         Number of nearest neighbors per query.
+ */
+void benchmarkBatchQueries(unsigned long n, unsigned long queries, int k) {
+    Map*                map(Map::getInstance());
+    Logger*             logger(Logger::getInstance());
+    CoordinateMode      coordinateMode(map->getCoordinateMode());
+    CoordinateMode      modes[] = {COORDINATES_DOUBLE, COORDINATES_FLOAT, COORDINATES_INT8};
+    const char*         names[] = {"double", "float", "int8"};
+    unsigned short      workers[] = {1, 2, 4, 8, 0};
+    unsigned long       stride(max(n / queries, 1UL)), q(0), i(0);
+    vector<ANNidx>      tracks, ids, expected;
+    vector<ANNdist>     distances;
+    double              start(0), single(0);
+    int                 l(0), w(0);
+
+    logger->log("[BENCHMARK] Batch queries, ");
+    logger->log(n);
+    logger->log(" tracks, ");
+    logger->log(queries);
+    logger->log(" queries, ");
+    logger->log(k);
+    logger->log(" nearest neighbors\n");
+
+    createSyntheticMap(n);
+    queries = min(queries, n / stride);
+
+    for (q = 0; q < queries; q++)
+        tracks.push_back((ANNidx)(q * stride));
+
+    ids.resize(queries * k);
+    distances.resize(queries * k);
+
+    for (l = 0; l < 3; l++) {
+        map->setCoordinateMode(modes[l]);
+        map->buildTree();
+
+        for (w = 0; w < 5; w++) {
+            unsigned long mismatches(0);
+
+            start = currentTime();
+            map->findNearestNeighbors(&tracks[0], queries, k, &ids[0], &distances[0], workers[w]);
+
+            double elapsed(max(currentTime() - start, 1e-9));
+
+            if (w == 0) {
+                expected    = ids;
+                single      = elapsed;
+            }
+
+            for (i = 0; i < ids.size(); i++)
+                if (ids[i] != expected[i])  mismatches++;
+
+            logger->log("[BENCHMARK] ");
+            logger->log(names[l]);
+            logger->log(", ");
+            if (workers[w] == 0)
+                logger->log("one worker per processor: ");
+            else {
+                logger->log(workers[w]);
+                logger->log(workers[w] == 1 ? " worker: " : " workers: ");
+            }
+            logger->log(queries / elapsed);
+            logger->log(" queries per second, speedup ");
+            logger->log(single / elapsed);
+            logger->log(", ");
+            logger->log(mismatches);
+            logger->log(" neighbors differing from a single worker\n");
+        }
+    }
+
+    map->setCoordinateMode(coordinateMode);
+}
+
+
+/// Accept tracks not played recently, as the local pick of NextTrackPreparation does.
+class UnplayedTracks : public NeighborFilter {
+    const Map*  map;
+
+    public:
+    UnplayedTracks(const Map*);
+
+    bool accept(ANNidx)     const;
+};
+
+
+UnplayedTracks::UnplayedTracks(const Map* newMap) :
+        map(newMap) {
+}
+
+
+bool UnplayedTracks::accept(ANNidx i) const {
+    return !map->isAlreadyPlayed(i);
+}
+
+
+/**
+ * \brief Compare local picks searching history length + 1 neighbors with the neighbor iterator.
+ *
+ * Before each pick, the nearest tracks of the playing one are marked as played, as many as
+ * the history holds: this is the worst case of the former pick, which then finds no track.
+ *
+ * \param n         Number of tracks in the synthetic library.
+ * \param picks     Number of picks per history length, from tracks spread over the library.
+ */
+void benchmarkLocalPick(unsigned long n, unsigned long picks) {
+    Map*                map(Map::getInstance());
+    Logger*             logger(Logger::getInstance());
+    CoordinateMode      coordinateMode(map->getCoordinateMode());
+    CoordinateMode      modes[] = {COORDINATES_DOUBLE, COORDINATES_FLOAT};
+    const char*         names[] = {"double", "float"};
+    int                 histories[] = {10, 100, 1000, 10000};
+    unsigned long       stride(max(n / picks, 1UL)), p(0);
+    UnplayedTracks      unplayed(map);
+    NeighborQuery       query;
+    NeighborIterator    iterator;
+    int                 l(0), h(0), i(0);
+
+    logger->log("[BENCHMARK] Local pick, ");
+    logger->log(n);
+    logger->log(" tracks\n");
+
+    createSyntheticMap(n);
+    picks = min(picks, n / stride);
+
+    for (l = 0; l < 2; l++) {
+        map->setCoordinateMode(modes[l]);
+        map->buildTree();
+
+        for (h = 0; h < 4; h++) {
+            int             history(histories[h]);
+            double          former(0), iterated(0);
+            unsigned long   formerEmpty(0), iteratedEmpty(0);
+
+            for (p = 0; p < picks; p++) {
+                ANNidx      playing((ANNidx)(p * stride)), neighbor(ANN_NULL_IDX);
+                ANNdist     distance(0);
+                ANNpoint    point(map->getPoint(playing));
+                double      start(0);
+                int         found(0);
+
+                // History: the playing track and its nearest neighbors
+                found = map->findNearestNeighbors(point, history, query);
+                for (i = 0; i < found; i++)
+                    map->getTrack(query.getId(i)).setAlreadyPlayed(true);
+                map->getTrack(playing).setAlreadyPlayed(true);
+
+                // Former pick
+                start = currentTime();
+                found = map->findNearestNeighbors(point, history + 1, query);
+
+                i = 1;
+                while (i < found && map->isAlreadyPlayed(query.getId(i)))
+                    i++;
+
+                if (i >= found)     formerEmpty++;
+                former += currentTime() - start;
+
+                // Neighbor iterator
+                start = currentTime();
+                iterator.start(map, point, &unplayed);
+                if (!iterator.next(neighbor, distance))     iteratedEmpty++;
+                iterated += currentTime() - start;
+
+                // Clear the history
+                found = map->findNearestNeighbors(point, history, query);
+                for (i = 0; i < found; i++)
+                    map->getTrack(query.getId(i)).setAlreadyPlayed(false);
+                map->getTrack(playing).setAlreadyPlayed(false);
+            }
+
+            logger->log("[BENCHMARK] ");
+            logger->log(names[l]);
+            logger->log(", history of ");
+            logger->log(history);
+            logger->log(" tracks: former pick ");
+            logger->log(former * 1e6 / picks);
+            logger->log(" us (");
+            logger->log(formerEmpty);
+            logger->log(" empty), iterator ");
+            logger->log(iterated * 1e6 / picks);
+            logger->log(" us (");
+            logger->log(iteratedEmpty);
+            logger->log(" empty)\n");
+        }
+    }
+
+    map->setCoordinateMode(coordinateMode);
+}
+
+
+/**
+ * \brief Compare remote picks around a random point of a sphere with picks within a shell.
+ *
+ * For each radius, measures the time per pick, and how far picked tracks are from the
+ * requested distance to the playing track, relative to it; shell picks that find no track
+ * are counted, the shuffler falling back to the sphere then.
+ *
+ * \param n         Number of tracks in the synthetic library.
+ * \param picks     Number of picks per setting, from tracks spread over the library.
+ */
+void benchmarkRemotePick(unsigned long n, unsigned long picks) {
+    Map*                map(Map::getInstance());
+    Logger*             logger(Logger::getInstance());
+    CoordinateMode      coordinateMode(map->getCoordinateMode());
+    CoordinateMode      modes[] = {COORDINATES_DOUBLE, COORDINATES_FLOAT};
+    const char*         names[] = {"double", "float"};
+    double              radii[] = {0.5, 1.5, 3.};
+    int                 limits[] = {1000, 10000, 100000};
+    const double        width(0.2);
+    unsigned long       stride(max(n / picks, 1UL)), p(0);
+    NeighborQuery       query;
+    int                 l(0), r(0), m(0);
+
+    logger->log("[BENCHMARK] Remote pick, ");
+    logger->log(n);
+    logger->log(" tracks\n");
+
+    createSyntheticMap(n);
+    picks = min(picks, n / stride);
+
+    for (l = 0; l < 2; l++) {
+        map->setCoordinateMode(modes[l]);
+        map->buildTree();
+
+        for (r = 0; r < 3; r++) {
+            double radius(radii[r]);
+
+            // Sphere around the origin
+            {
+                double  elapsed(0), error(0);
+
+                for (p = 0; p < picks; p++) {
+                    ANNpoint    playing(map->getPoint((ANNidx)(p * stride)));
+                    double      start(currentTime());
+                    ANNpoint    remotePoint(randomPointOnSphere(map->getDimensions(), radius));
+                    int         found(map->findNearestNeighbors(remotePoint, 3, query));
+
+                    elapsed += currentTime() - start;
+                    delete[] remotePoint;
+
+                    if (found > 1)
+                        error += fabs(sqrt(annDist(map->getDimensions(), playing, map->getPoint(query.getId(1)))) - radius) / radius;
+                }
+
+                logger->log("[BENCHMARK] ");
+                logger->log(names[l]);
+                logger->log(", radius ");
+                logger->log(radius);
+                logger->log(", sphere: ");
+                logger->log(elapsed * 1e6 / picks);
+                logger->log(" us per pick, relative distance error ");
+                logger->log(error / picks);
+                logger->log("\n");
+            }
+
+            // Shell around the playing track
+            for (m = 0; m < 3; m++) {
+                double          elapsed(0), error(0);
+                unsigned long   empty(0), candidates(0);
+
+                for (p = 0; p < picks; p++) {
+                    ANNpoint    playing(map->getPoint((ANNidx)(p * stride)));
+                    double      start(currentTime());
+                    int         found(map->findInShell(playing, radius * (1 - width), radius * (1 + width), limits[m], query));
+
+                    elapsed     += currentTime() - start;
+                    candidates  += found;
+
+                    if (found == 0) {
+                        empty++;
+                        continue;
+                    }
+
+                    int picked((((unsigned long)rand() << 15) ^ rand()) % found);
+                    error += fabs(sqrt(query.getDistance(picked)) - radius) / radius;
+                }
+
+                logger->log("[BENCHMARK] ");
+                logger->log(names[l]);
+                logger->log(", radius ");
+                logger->log(radius);
+                logger->log(", shell visiting ");
+                logger->log(limits[m]);
+                logger->log(" tracks: ");
+                logger->log(elapsed * 1e6 / picks);
+                logger->log(" us per pick, relative distance error ");
+                logger->log(error / max(picks - empty, 1UL));
+                logger->log(", ");
+                logger->log((double)candidates / picks);
+                logger->log(" candidates per pick, ");
+                logger->log(empty);
+                logger->log(" empty shells\n");
+            }
+        }
+    }
+
+    map->setCoordinateMode(coordinateMode);
+}
+
+
+/// \brief Search structure compared by benchmarkIndexBackends().
+struct IndexConfiguration {
+    const char*     name;
+    IndexBackend    backend;
+    ANNsplitRule    splitRule;
+    ANNshrinkRule   shrinkRule;
+    bool            prioritySearch;
+};
+
+
+/// \return Value below which a fraction of sorted values lie.
+static double percentile(const vector<double>& sorted, double fraction) {
+    if (sorted.empty())     return 0;
+
+    return sorted[min(sorted.size() - 1, (size_t)(fraction * sorted.size()))];
+}
+
+
+/**
+ * \brief Compare search structures of COORDINATES_DOUBLE mode (see IndexBackend).
+ *
+ * The current map file is used if it can be read, a synthetic library otherwise. For each
+ * configuration, reports the build time, the heap grown by the structure, query latency
+ * percentiles through findNearestNeighbors(), and recall against brute force, which is exact.
+ * The current error bound applies. Brute force keeps no copy of the points: it is built before
+ * each measure, so that memory only counts the structure measured.
+ *
+ * \param n         Number of tracks in the synthetic library, if the map file cannot be read.
+ * \param queries   Number of queries, from tracks spread over the map.
+ * \param k         Number of nearest neighbors per query.
+ */
+void benchmarkIndexBackends(unsigned long n, unsigned long queries, int k) {
+    static const IndexConfiguration configurations[] = {
+        {"brute force",                     INDEX_BRUTE_FORCE,  ANN_KD_SUGGEST,     ANN_BD_SUGGEST,     false},
+        {"kd, suggest",                     INDEX_KD_TREE,      ANN_KD_SUGGEST,     ANN_BD_SUGGEST,     false},
+        {"kd, std",                         INDEX_KD_TREE,      ANN_KD_STD,         ANN_BD_SUGGEST,     false},
+        {"kd, midpt",                       INDEX_KD_TREE,      ANN_KD_MIDPT,       ANN_BD_SUGGEST,     false},
+        {"kd, fair",                        INDEX_KD_TREE,      ANN_KD_FAIR,        ANN_BD_SUGGEST,     false},
+        {"kd, sl_midpt",                    INDEX_KD_TREE,      ANN_KD_SL_MIDPT,    ANN_BD_SUGGEST,     false},
+        {"kd, sl_fair",                     INDEX_KD_TREE,      ANN_KD_SL_FAIR,     ANN_BD_SUGGEST,     false},
+        {"kd, suggest, priority",           INDEX_KD_TREE,      ANN_KD_SUGGEST,     ANN_BD_SUGGEST,     true},
+        {"bd, suggest, suggest",            INDEX_BD_TREE,      ANN_KD_SUGGEST,     ANN_BD_SUGGEST,     false},
+        {"bd, suggest, simple",             INDEX_BD_TREE,      ANN_KD_SUGGEST,     ANN_BD_SIMPLE,      false},
+        {"bd, suggest, centroid",           INDEX_BD_TREE,      ANN_KD_SUGGEST,     ANN_BD_CENTROID,    false},
+        {"bd, suggest, suggest, priority",  INDEX_BD_TREE,      ANN_KD_SUGGEST,     ANN_BD_SUGGEST,     true}
+    };
+
+    Map*                map(Map::getInstance());
+    Logger*             logger(Logger::getInstance());
+    CoordinateMode      coordinateMode(map->getCoordinateMode());
+    IndexBackend        indexBackend(map->getIndexBackend());
+    ANNsplitRule        splitRule(map->getSplitRule());
+    ANNshrinkRule       shrinkRule(map->getShrinkRule());
+    bool                prioritySearch(map->isPrioritySearch());
+    vector<ANNidx>      targets, exact;
+    vector<double>      latencies;
+    NeighborQuery       query;
+    unsigned long       i(0), q(0), step(0), found(0), baseline(0);
+    size_t              c(0);
+    int                 j(0);
+    double              start(0), buildTime(0);
+
+    map->clear();
+
+    if (map->readBinary(Shuffler::getInstance()->getConfigDirectory() + MAP_FILE))
+        logger->log("[BENCHMARK] Index backends, current map, ");
+    else {
+        createSyntheticMap(n);
+        logger->log("[BENCHMARK] Index backends, synthetic map, ");
+    }
+
+    logger->log(map->getSize());
+    logger->log(" tracks, ");
+    logger->log(k);
+    logger->log(" nearest neighbors\n");
+
+    k = min(k, (int)map->getSize());
+    if (k <= 0 || queries == 0)     return;
+
+    // Queries from tracks with coordinates, spread over the map
+    step = max(map->getSize() / queries, 1UL);
+
+    for (i = 0; i < map->getSize() && targets.size() < queries; i += step) {
+        if (map->hasCoordinates(i))
+            targets.push_back(i);
+    }
+
+    if (targets.empty())    return;
+
+    exact.resize(targets.size() * k);
+    latencies.resize(targets.size());
+
+    map->setCoordinateMode(COORDINATES_DOUBLE);
+    map->setIndexBackend(INDEX_BRUTE_FORCE);
+    map->buildTree();
+
+    for (q = 0; q < targets.size(); q++) {
+        map->findNearestNeighbors(targets[q], k, query);
+
+        for (j = 0; j < k; j++)
+            exact[q * k + j] = query.getId(j);
+    }
+
+    for (c = 0; c < sizeof(configurations) / sizeof(configurations[0]); c++) {
+        const IndexConfiguration& configuration(configurations[c]);
+
+        map->setIndexBackend(INDEX_BRUTE_FORCE);
+        map->buildTree();
+        baseline = heapUsage();
+
+        map->setIndexBackend(configuration.backend);
+        map->setSplitRule(configuration.splitRule);
+        map->setShrinkRule(configuration.shrinkRule);
+        map->setPrioritySearch(configuration.prioritySearch);
+
+        start = currentTime();
+        map->buildTree();
+        buildTime = currentTime() - start;
+
+        found = 0;
+
+        for (q = 0; q < targets.size(); q++) {
+            start = currentTime();
+            map->findNearestNeighbors(targets[q], k, query);
+            latencies[q] = currentTime() - start;
+
+            for (j = 0; j < query.getCount(); j++) {
+                if (find(&exact[q * k], &exact[q * k] + k, query.getId(j)) != &exact[q * k] + k)
+                    found++;
+            }
+        }
+
+        sort(latencies.begin(), latencies.end());
+
+        logger->log("[BENCHMARK] ");
+        logger->log(configuration.name);
+        logger->log(": build ");
+        logger->log(buildTime * 1000);
+        logger->log(" ms, ");
+        logger->log(((double)heapUsage() - baseline) / 1024);
+        logger->log(" KB, p50 ");
+        logger->log(percentile(latencies, 0.5) * 1e6);
+        logger->log(" us, p90 ");
+        logger->log(percentile(latencies, 0.9) * 1e6);
+        logger->log(" us, p99 ");
+        logger->log(percentile(latencies, 0.99) * 1e6);
+        logger->log(" us, max ");
+        logger->log(latencies.back() * 1e6);
+        logger->log(" us, recall ");
+        logger->log((double)found / (targets.size() * k));
+        logger->log("\n");
+    }
+
+    map->setCoordinateMode(coordinateMode);
+    map->setIndexBackend(indexBackend);
+    map->setSplitRule(splitRule);
+    map->setShrinkRule(shrinkRule);
+    map->setPrioritySearch(prioritySearch);
+}
+
+
+/**
+ * \brief Measure tree searches calibrated to latency targets (see Map::setLatencyTarget()).
+ *
+ * Calibration is logged by the map on each build; searches are then timed through
+ * findNearestNeighbors(), and compared with the exact ones, found with no target.
+ *
+ * \param n         Number of tracks in the synthetic library.
+ * \param queries   Number of queries, from tracks spread over the library.
+ */
+void benchmarkLatencyTarget(unsigned long n, unsigned long queries) {
+    const unsigned long targets[] = {0, 50, 20, 10, 5};
+
+    Map*                map(Map::getInstance());
+    Logger*             logger(Logger::getInstance());
+    CoordinateMode      coordinateMode(map->getCoordinateMode());
+    IndexBackend        indexBackend(map->getIndexBackend());
+    unsigned long       latencyTarget(map->getLatencyTarget());
+    const int           k(CALIBRATION_NEIGHBORS);
+    vector<ANNidx>      exact(queries * k);
+    vector<double>      latencies(queries);
+    NeighborQuery       query;
+    unsigned long       q(0), found(0);
+    size_t              t(0);
+    int                 j(0);
+    double              start(0);
+
+    logger->log("[BENCHMARK] Latency target, ");
+    logger->log(n);
+    logger->log(" tracks\n");
+
+    map->setCoordinateMode(COORDINATES_DOUBLE);
+    map->setIndexBackend(INDEX_KD_TREE);
+    createSyntheticMap(n);
+
+    for (t = 0; t < sizeof(targets) / sizeof(targets[0]); t++) {
+        map->setLatencyTarget(targets[t]);
+        map->buildTree();
+
+        found = 0;
+
+        for (q = 0; q < queries; q++) {
+            start = currentTime();
+            map->findNearestNeighbors((ANNidx)(q * (n / queries)), k, query);
+            latencies[q] = currentTime() - start;
+
+            for (j = 0; j < query.getCount(); j++) {
+                if (t == 0)
+                    exact[q * k + j] = query.getId(j);
+                else if (find(&exact[q * k], &exact[q * k] + k, query.getId(j)) != &exact[q * k] + k)
+                    found++;
+            }
+        }
+
+        sort(latencies.begin(), latencies.end());
+
+        logger->log("[BENCHMARK] Target ");
+        logger->log(targets[t]);
+        logger->log(" us: p50 ");
+        logger->log(percentile(latencies, 0.5) * 1e6);
+        logger->log(" us, p99 ");
+        logger->log(percentile(latencies, 0.99) * 1e6);
+        logger->log(" us, recall ");
+        logger->log(t == 0 ? 1. : (double)found / (queries * k));
+        logger->log("\n");
+    }
+
+    map->setCoordinateMode(coordinateMode);
+    map->setIndexBackend(indexBackend);
+    map->setLatencyTarget(latencyTarget);
+}
+
+
+/**
+ * \brief Find the library size up to which vectorized scans beat the k-dimensional tree.
+ *
+ * For each size, queries are timed through findNearestNeighbors() with the k-dimensional tree
+ * (build time reported apart), then with INDEX_SIMD_SCAN and each instruction set supported.
+ * Coordinates being clustered as in real libraries, the tree prunes better than with uniform points.
+ *
+ * \param queries   Number of queries per setting, from tracks spread over the library.
+ * \param k         Number of nearest neighbors per query.
+ */
+void benchmarkSimdScan(unsigned long queries, int k) {
+    const unsigned long sizes[] = {10000, 30000, 100000, 300000, 1000000};
+
+    Map*                map(Map::getInstance());
+    Logger*             logger(Logger::getInstance());
+    DistanceEngine*     engine(DistanceEngine::getInstance());
+    CoordinateMode      coordinateMode(map->getCoordinateMode());
+    IndexBackend        indexBackend(map->getIndexBackend());
+    unsigned long       latencyTarget(map->getLatencyTarget());
+    unsigned long       n(0), q(0), crossover(0);
+    size_t              s(0);
+    int                 set(0);
+    double              start(0), treeTime(0), scanTime(0), bestScanTime(0);
+    NeighborQuery       query;
+
+    logger->log("[BENCHMARK] Vectorized scan against k-dimensional tree, ");
+    logger->log(k);
+    logger->log(" nearest neighbors, best instructions: ");
+    logger->log(DistanceEngine::getName(engine->getSupportedInstructionSet()));
+    logger->log("\n");
+
+    map->setCoordinateMode(COORDINATES_DOUBLE);
+    map->setLatencyTarget(0);
+
+    for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        n = sizes[s];
+        createSyntheticMap(n);
+
+        logger->log("[BENCHMARK] ");
+        logger->log(n);
+        logger->log(" tracks\n");
+
+        map->setIndexBackend(INDEX_KD_TREE);
+        start = currentTime();
+        map->buildTree();
+        logDuration("kd-tree, build", currentTime() - start);
+
+        start = currentTime();
+
+        for (q = 0; q < queries; q++)
+            map->findNearestNeighbors((ANNidx)(q * (n / queries)), k, query);
+
+        treeTime = (currentTime() - start) / queries;
+
+        logger->log("[BENCHMARK] kd-tree: ");
+        logger->log(treeTime * 1e6);
+        logger->log(" us per query\n");
+
+        map->setIndexBackend(INDEX_SIMD_SCAN);
+        map->buildTree();
+        bestScanTime = 0;
+
+        for (set = INSTRUCTIONS_SCALAR; set <= engine->getSupportedInstructionSet(); set++) {
+            engine->setInstructionSet((InstructionSet)set);
+            start = currentTime();
+
+            for (q = 0; q < queries; q++)
+                map->findNearestNeighbors((ANNidx)(q * (n / queries)), k, query);
+
+            scanTime = (currentTime() - start) / queries;
+            if (bestScanTime == 0 || scanTime < bestScanTime)  bestScanTime = scanTime;
+
+            logger->log("[BENCHMARK] Scan, ");
+            logger->log(DistanceEngine::getName((InstructionSet)set));
+            logger->log(": ");
+            logger->log(scanTime * 1e6);
+            logger->log(" us per query\n");
+        }
+
+        engine->setInstructionSet(engine->getSupportedInstructionSet());
+
+        if (bestScanTime < treeTime)    crossover = n;
+    }
+
+    logger->log("[BENCHMARK] Largest library where the scan is faster: ");
+    logger->log(crossover);
+    logger->log(crossover ? " tracks\n" : " tracks (none)\n");
+
+    map->setCoordinateMode(coordinateMode);
+    map->setIndexBackend(indexBackend);
+    map->setLatencyTarget(latencyTarget);
+}
+
+
+/**
+ * \brief Compare the graph of INDEX_HNSW with the exact k-dimensional tree.
+ *
+ * The exact neighbors come from the k-dimensional tree without latency target; the graph is then
+ * searched with an increasing number of candidates (ef), reporting throughput and recall for each.
+ *
+ * \param n         Number of tracks of the synthetic map.
+ * \param queries   Number of queries per setting, from tracks spread over the library.
+ * \param k         Number of nearest neighbors per query.
+ */
+void benchmarkHnsw(unsigned long n, unsigned long queries, int k) {
+    const int efs[] = {16, 32, 64, 128, 256};
+
+    Map*                map(Map::getInstance());
+    Logger*             logger(Logger::getInstance());
+    CoordinateMode      coordinateMode(map->getCoordinateMode());
+    IndexBackend        indexBackend(map->getIndexBackend());
+    unsigned long       latencyTarget(map->getLatencyTarget());
+    int                 graphEf(map->getGraphEf());
+    vector<ANNidx>      targets, exact;
+    NeighborQuery       query;
+    unsigned long       q(0), found(0), baseline(0);
+    size_t              e(0);
+    int                 j(0);
+    double              start(0), elapsed(0);
+
+    createSyntheticMap(n);
+
+    logger->log("[BENCHMARK] HNSW graph, synthetic map, ");
+    logger->log(map->getSize());
+    logger->log(" tracks, ");
+    logger->log(k);
+    logger->log(" nearest neighbors\n");
+
+    k = min(k, (int)map->getSize());
+    if (k <= 0 || queries == 0 || map->getSize() < queries)    return;
+
+    for (q = 0; q < queries; q++)
+        targets.push_back((ANNidx)(q * (map->getSize() / queries)));
+
+    exact.resize(targets.size() * k);
+
+    map->setCoordinateMode(COORDINATES_DOUBLE);
+    map->setLatencyTarget(0);
+
+    // Exact neighbors
+    map->setIndexBackend(INDEX_KD_TREE);
+    start = currentTime();
+    map->buildTree();
+    logDuration("kd-tree, build", currentTime() - start);
+
+    start = currentTime();
+
+    for (q = 0; q < targets.size(); q++) {
+        map->findNearestNeighbors(targets[q], k, query);
+
+        for (j = 0; j < k; j++)
+            exact[q * k + j] = query.getId(j);
+    }
+
+    elapsed = currentTime() - start;
+
+    logger->log("[BENCHMARK] kd-tree: ");
+    logger->log(targets.size() / elapsed);
+    logger->log(" queries per second\n");
+
+    // Graph
+    map->setIndexBackend(INDEX_SIMD_SCAN);
+    map->buildTree();
+    baseline = heapUsage();
+
+    map->setIndexBackend(INDEX_HNSW);
+    start = currentTime();
+    map->buildTree();
+    logDuration("HNSW, build", currentTime() - start);
+
+    logger->log("[BENCHMARK] HNSW, memory: ");
+    logger->log(((double)heapUsage() - baseline) / 1024);
+    logger->log(" KB\n");
+
+    for (e = 0; e < sizeof(efs) / sizeof(efs[0]); e++) {
+        map->setGraphEf(efs[e]);
+        found = 0;
+        start = currentTime();
+
+        for (q = 0; q < targets.size(); q++) {
+            map->findNearestNeighbors(targets[q], k, query);
+
+            for (j = 0; j < query.getCount(); j++) {
+                if (find(&exact[q * k], &exact[q * k] + k, query.getId(j)) != &exact[q * k] + k)
+                    found++;
+            }
+        }
+
+        elapsed = currentTime() - start;
+
+        logger->log("[BENCHMARK] HNSW, ef ");
+        logger->log(efs[e]);
+        logger->log(": ");
+        logger->log(targets.size() / elapsed);
+        logger->log(" queries per second, recall ");
+        logger->log((double)found / (targets.size() * k));
+        logger->log("\n");
+    }
+
+    map->setCoordinateMode(coordinateMode);
+    map->setIndexBackend(indexBackend);
+    map->setLatencyTarget(latencyTarget);
+    map->setGraphEf(graphEf);
+}
+
+
+/**
+ * \brief Measure resolving tracks one at a time against the kd-tree, with its delta (see Map::indexCoordinates()).
+ *
+ * Resolving a track used to rebuild the tree: its build time is the cost before. Tracks are then
+ * moved one by one, as downloaded coordinates would, each followed by indexCoordinates(); queries
+ * are timed with a full delta and after it is merged, and compared with a scan of the points.
+ *
+ * \param n         Number of tracks of the synthetic map.
+ * \param queries   Number of queries per setting, from tracks spread over the library.
+ */
+void benchmarkDeltaUpdates(unsigned long n, unsigned long queries) {
+    Map*                map(Map::getInstance());
+    Logger*             logger(Logger::getInstance());
+    CoordinateMode      coordinateMode(map->getCoordinateMode());
+    IndexBackend        indexBackend(map->getIndexBackend());
+    unsigned long       latencyTarget(map->getLatencyTarget());
+    unsigned long       updates(DELTA_MERGE_SIZE - 1), u(0), q(0), found(0);
+    unsigned short      j(0), dimensions(map->getDimensions());
+    vector<ANNidx>      results;
+    vector<double>      latencies;
+    NeighborQuery       query;
+    const int           k(10);
+    int                 r(0);
+    double              start(0), elapsed(0), worst(0);
+
+    createSyntheticMap(n);
+    if (map->getSize() < 2 * max(queries, updates))    return;
+
+    logger->log("[BENCHMARK] Delta updates, synthetic map, ");
+    logger->log(map->getSize());
+    logger->log(" tracks\n");
+
+    map->setCoordinateMode(COORDINATES_DOUBLE);
+    map->setIndexBackend(INDEX_KD_TREE);
+    map->setLatencyTarget(0);
+
+    start = currentTime();
+    map->buildTree();
+    logDuration("Rebuild per resolved track (before)", currentTime() - start);
+
+    // Move tracks next to others, one at a time
+    latencies.resize(updates);
+
+    for (u = 0; u < updates; u++) {
+        ANNidx  moved((ANNidx)(2 * u + 1)), target((ANNidx)(n - 2 - 2 * u));
+
+        start = currentTime();
+
+        for (j = 0; j < dimensions; j++)
+            map->setCoordinate(moved, j, map->getPoint(target)[j] + 1e-3);
+
+        map->indexCoordinates();
+        latencies[u] = currentTime() - start;
+        worst = max(worst, latencies[u]);
+    }
+
+    sort(latencies.begin(), latencies.end());
+
+    logger->log("[BENCHMARK] Resolved track (after): p50 ");
+    logger->log(percentile(latencies, 0.5) * 1e6);
+    logger->log(" us, p99 ");
+    logger->log(percentile(latencies, 0.99) * 1e6);
+    logger->log(" us, max ");
+    logger->log(worst * 1e6);
+    logger->log(" us\n");
+
+    // Searches with the full delta
+    results.resize(queries * k);
+    start = currentTime();
+
+    for (q = 0; q < queries; q++) {
+        map->findNearestNeighbors((ANNidx)(n - 2 - 2 * (q % updates)), k, query);
+
+        for (r = 0; r < k; r++)
+            results[q * k + r] = r < query.getCount() ? query.getId(r) : ANN_NULL_IDX;
+    }
+
+    elapsed = currentTime() - start;
+
+    logger->log("[BENCHMARK] Queries with ");
+    logger->log(updates);
+    logger->log(" changed tracks: ");
+    logger->log(elapsed / queries * 1e6);
+    logger->log(" us per query\n");
+
+    // One more change starts the merge; the next one waits for it
+    start = currentTime();
+    map->setCoordinate(0, 0, map->getPoint(0)[0]);
+    map->indexCoordinates();
+    map->setCoordinate(0, 0, map->getPoint(0)[0]);
+    logDuration("Merge in background", currentTime() - start);
+
+    // The merged tree is exact
+    start = currentTime();
+
+    for (q = 0; q < queries; q++) {
+        map->findNearestNeighbors((ANNidx)(n - 2 - 2 * (q % updates)), k, query);
+
+        for (r = 0; r < query.getCount(); r++) {
+            if (find(&results[q * k], &results[q * k] + k, query.getId(r)) != &results[q * k] + k)
+                found++;
+        }
+    }
+
+    elapsed = currentTime() - start;
+
+    logger->log("[BENCHMARK] Queries once merged: ");
+    logger->log(elapsed / queries * 1e6);
+    logger->log(" us per query, recall with the delta ");
+    logger->log((double)found / (queries * k));
+    logger->log("\n");
+
+    map->setCoordinateMode(coordinateMode);
+    map->setIndexBackend(indexBackend);
+    map->setLatencyTarget(latencyTarget);
+}
+
+
+/**
+ * \brief Compare a kd-tree over all tracks with the one the map builds over tracks with coordinates.
+ *
+ * 30% of the tracks of a synthetic map are left without coordinates (NOTHING_FOUND, at the origin),
+ * as when the server does not know them. The tree over all tracks is built here, as the map used
+ * to; both are timed, with queries from tracks with coordinates, and neighbors without coordinates
+ * are counted.
+ *
+ * \param n         Number of tracks of the synthetic map.
+ * \param queries   Number of queries per tree.
+ * \param k         Number of nearest neighbors per query.
+ */
+void benchmarkCompactIndex(unsigned long n, unsigned long queries, int k) {
+    Map*                map(Map::getInstance());
+    Logger*             logger(Logger::getInstance());
+    CoordinateMode      coordinateMode(map->getCoordinateMode());
+    IndexBackend        indexBackend(map->getIndexBackend());
+    unsigned long       latencyTarget(map->getLatencyTarget());
+    unsigned short      dimensions(map->getDimensions()), j(0);
+    unsigned long       i(0), q(0), junk(0), baseline(0);
+    vector<ANNpoint>    rows;
+    vector<ANNidx>      targets, ids(k);
+    vector<ANNdist>     distances(k);
+    NeighborQuery       query;
+    ANNkd_tree*         tree(NULL);
+    double              start(0), elapsed(0);
+    int                 r(0);
+
+    createSyntheticMap(n);
+
+    for (i = 0; i < map->getSize(); i++) {
+        if (i % 10 < 3) {
+            map->getTrack(i).setCode(NOTHING_FOUND);
+
+            for (j = 0; j < dimensions; j++)
+                map->setCoordinate(i, j, 0);
+        } else if (targets.size() < queries && i % (max(map->getSize() / queries, 1UL)) == 3)
+            targets.push_back(i);
+
+        rows.push_back(map->getPoint(i));
+    }
+
+    k = min(k, (int)map->getSize());
+    if (k <= 0 || targets.empty())     return;
+
+    logger->log("[BENCHMARK] Compact index, synthetic map, ");
+    logger->log(map->getSize());
+    logger->log(" tracks, 30% without coordinates\n");
+
+    map->setCoordinateMode(COORDINATES_DOUBLE);
+    map->setIndexBackend(INDEX_KD_TREE);
+    map->setLatencyTarget(0);
+
+    // Before: all tracks
+    baseline = heapUsage();
+    start = currentTime();
+    tree = new ANNkd_tree(&rows[0], (int)rows.size(), dimensions);
+    logDuration("All tracks, build", currentTime() - start);
+
+    logger->log("[BENCHMARK] All tracks, memory: ");
+    logger->log(((double)heapUsage() - baseline) / 1024);
+    logger->log(" KB\n");
+
+    start = currentTime();
+
+    for (q = 0; q < targets.size(); q++) {
+        tree->annkSearch(map->getPoint(targets[q]), k, &ids[0], &distances[0], 0);
+
+        for (r = 0; r < k; r++) {
+            if (!map->hasCoordinates(ids[r]))    junk++;
+        }
+    }
+
+    elapsed = currentTime() - start;
+    delete tree;
+
+    logger->log("[BENCHMARK] All tracks: ");
+    logger->log(elapsed / targets.size() * 1e6);
+    logger->log(" us per query, neighbors without coordinates ");
+    logger->log((double)junk / (targets.size() * k));
+    logger->log("\n");
+
+    // After: tracks with coordinates
+    baseline = heapUsage();
+    start = currentTime();
+    map->buildTree();
+    logDuration("Tracks with coordinates, build", currentTime() - start);
+
+    logger->log("[BENCHMARK] Tracks with coordinates, memory: ");
+    logger->log(((double)heapUsage() - baseline) / 1024);
+    logger->log(" KB\n");
+
+    junk = 0;
+    start = currentTime();
+
+    for (q = 0; q < targets.size(); q++) {
+        map->findNearestNeighbors(targets[q], k, query);
+
+        for (r = 0; r < query.getCount(); r++) {
+            if (!map->hasCoordinates(query.getId(r)))    junk++;
+        }
+    }
+
+    elapsed = currentTime() - start;
+
+    logger->log("[BENCHMARK] Tracks with coordinates: ");
+    logger->log(elapsed / targets.size() * 1e6);
+    logger->log(" us per query, neighbors without coordinates ");
+    logger->log((double)junk / (targets.size() * k));
+    logger->log("\n");
+
+    map->setCoordinateMode(coordinateMode);
+    map->setIndexBackend(indexBackend);
+    map->setLatencyTarget(latencyTarget);
+}
+
+#endif
\ No newline at end of file
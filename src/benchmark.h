@@ -0,0 +1,51 @@
+#ifndef BENCHMARK_H
+    #define BENCHMARK_H
+
+    /**
+     * \file benchmark.h
+     * \brief Benchmarks headers.
+     *
+     * Benchmarks are only built if BENCHMARK is defined (see constants.h).
+     * They are run at startup, before the map is loaded, if the config file contains:
+     *      BENCHMARK <name>
+     * Benchmarks work on a synthetic library, unless stated otherwise; results are written
+     * to the log file, and the map is left empty afterwards.
+     */
+
+    #include <string>
+
+    #include "constants.h"
+
+    class Map;
+
+    #ifdef BENCHMARK
+    bool    runBenchmark(const std::string&);
+    void    createSyntheticMap(unsigned long);
+    void    fillSyntheticMap(Map*, unsigned long);
+
+    void    benchmarkMapLoad(unsigned long);
+    void    benchmarkLegacyMapLoad(unsigned long);
+    void    benchmarkLibraryCheck(unsigned int);
+    void    benchmarkTrackMemory(unsigned long);
+    void    benchmarkPathDictionary(unsigned long, unsigned long);
+    void    benchmarkTrackLookup(unsigned long, unsigned long);
+    void    benchmarkTrackAppend(unsigned long, unsigned long);
+    void    benchmarkMissingCoordinates(unsigned long, unsigned long, unsigned long);
+    void    benchmarkCoordinateModes(unsigned long, unsigned long, int);
+    void    benchmarkPackedMap(unsigned long);
+    void    benchmarkMapSnapshots(unsigned long, unsigned int);
+    void    benchmarkDeltaRescan(unsigned long, unsigned long);
+    void    benchmarkLazyLoad(unsigned long);
+    void    benchmarkPersistedTree(unsigned long, unsigned long);
+    void    benchmarkQueryThroughput(unsigned long, unsigned long, int);
+    void    benchmarkBatchQueries(unsigned long, unsigned long, int);
+    void    benchmarkLocalPick(unsigned long, unsigned long);
+    void    benchmarkRemotePick(unsigned long, unsigned long);
+    void    benchmarkIndexBackends(unsigned long, unsigned long, int);
+    void    benchmarkLatencyTarget(unsigned long, unsigned long);
+    void    benchmarkSimdScan(unsigned long, int);
+    void    benchmarkHnsw(unsigned long, unsigned long, int);
+    void    benchmarkDeltaUpdates(unsigned long, unsigned long);
+    void    benchmarkCompactIndex(unsigned long, unsigned long, int);
+    #endif
+#endif
\ No newline at end of file
@@ -0,0 +1,168 @@
+/**
+ * \file compressor.cpp
+ * \brief Compressor class implementation.
+ */
+
+#include <windows.h>
+
+#include "compressor.h"
+#include "logger.h"
+
+using namespace std;
+
+
+Compressor* Compressor::instance = NULL;
+
+
+/// \brief Default constructor; load the compression libraries that are installed.
+Compressor::Compressor() :
+        zlib(LoadLibraryA(ZLIB_LIBRARY)),
+        zstd(LoadLibraryA(ZSTD_LIBRARY)),
+        zlibCompress(NULL),
+        zlibUncompress(NULL),
+        zlibCompressBound(NULL),
+        zstdCompress(NULL),
+        zstdDecompress(NULL),
+        zstdCompressBound(NULL),
+        zstdIsError(NULL) {
+    if (zlib) {
+        zlibCompress        = (ZlibCompress)GetProcAddress(zlib, "compress2");
+        zlibUncompress      = (ZlibUncompress)GetProcAddress(zlib, "uncompress");
+        zlibCompressBound   = (ZlibCompressBound)GetProcAddress(zlib, "compressBound");
+    }
+
+    if (zstd) {
+        zstdCompress        = (ZstdCompress)GetProcAddress(zstd, "ZSTD_compress");
+        zstdDecompress      = (ZstdDecompress)GetProcAddress(zstd, "ZSTD_decompress");
+        zstdCompressBound   = (ZstdCompressBound)GetProcAddress(zstd, "ZSTD_compressBound");
+        zstdIsError         = (ZstdIsError)GetProcAddress(zstd, "ZSTD_isError");
+    }
+
+    #ifdef DEBUG
+    Logger* logger = Logger::getInstance();
+
+    if (!isAvailable(COMPRESSION_ZLIB))
+        logger->log("[WARNING] zlib is not available (" ZLIB_LIBRARY ").\n\n");
+    #endif
+}
+
+
+/// \brief Destructor.
+Compressor::~Compressor() {
+    if (zlib)   FreeLibrary(zlib);
+    if (zstd)   FreeLibrary(zstd);
+}
+
+
+/// \return Unique instance of Compressor class.
+Compressor* Compressor::getInstance() {
+    if (instance == NULL)
+        instance = new Compressor;
+
+    return instance;
+}
+
+
+/// \brief Delete the unique instance of Compressor class.
+void Compressor::kill() {
+    if (instance != NULL) {
+        delete instance;
+        instance = NULL;
+    }
+}
+
+
+/// \return True if blocks can be compressed and decompressed with this codec, false otherwise.
+bool Compressor::isAvailable(CompressionCodec codec) const {
+    switch (codec) {
+        case COMPRESSION_NONE:
+            return true;
+
+        case COMPRESSION_ZLIB:
+            return zlibCompress && zlibUncompress && zlibCompressBound;
+
+        case COMPRESSION_ZSTD:
+            return zstdCompress && zstdDecompress && zstdCompressBound && zstdIsError;
+    }
+
+    return false;
+}
+
+
+/**
+ * \brief Compress a block.
+ *
+ * \param codec     Compression codec.
+ * \param raw       Data to compress.
+ * \param packed    Compressed data (modified).
+ * \return True if the block was compressed, false otherwise.
+ */
+bool Compressor::compress(CompressionCodec codec, const vector<char>& raw, vector<char>& packed) const {
+    if (!isAvailable(codec))    return false;
+
+    const unsigned char*    source(raw.empty() ? NULL : (const unsigned char*)&raw[0]);
+    unsigned long           size(0);
+
+    switch (codec) {
+        case COMPRESSION_NONE:
+            packed = raw;
+            return true;
+
+        case COMPRESSION_ZLIB:
+            size = zlibCompressBound(raw.size());
+            packed.resize(size);
+
+            if (zlibCompress((unsigned char*)&packed[0], &size, source, raw.size(), ZLIB_LEVEL) != 0)
+                return false;
+
+            packed.resize(size);
+            return true;
+
+        case COMPRESSION_ZSTD:
+            packed.resize(zstdCompressBound(raw.size()));
+            size = zstdCompress(&packed[0], packed.size(), source, raw.size(), ZSTD_LEVEL);
+
+            if (zstdIsError(size))  return false;
+
+            packed.resize(size);
+            return true;
+    }
+
+    return false;
+}
+
+
+/**
+ * \brief Decompress a block.
+ *
+ * \param codec     Compression codec.
+ * \param packed    Compressed data.
+ * \param raw       Decompressed data; must be sized to the exact size of the original data (modified).
+ * \return True if the block was decompressed to the expected size, false otherwise.
+ */
+bool Compressor::decompress(CompressionCodec codec, const vector<char>& packed, vector<char>& raw) const {
+    if (!isAvailable(codec))    return false;
+    if (raw.empty())            return true;
+
+    const unsigned char*    source(packed.empty() ? NULL : (const unsigned char*)&packed[0]);
+    unsigned long           size(raw.size());
+
+    switch (codec) {
+        case COMPRESSION_NONE:
+            if (packed.size() != raw.size())    return false;
+
+            raw = packed;
+            return true;
+
+        case COMPRESSION_ZLIB:
+            return zlibUncompress((unsigned char*)&raw[0], &size, source, packed.size()) == 0
+                && size == raw.size();
+
+        case COMPRESSION_ZSTD:
+            size = zstdDecompress(&raw[0], raw.size(), source, packed.size());
+
+            return !zstdIsError(size) && size == raw.size();
+    }
+
+    return false;
+}
\ No newline at end of file
@@ -0,0 +1,65 @@
+#ifndef COMPRESSOR_H
+    #define COMPRESSOR_H
+
+    /**
+     * \file compressor.h
+     * \brief Compressor class headers.
+     */
+
+    #include <vector>
+
+    #include "constants.h"
+
+    #define ZLIB_LIBRARY            "zlibwapi.dll"
+    #define ZSTD_LIBRARY            "libzstd.dll"
+    #define ZLIB_LEVEL              6
+    #define ZSTD_LEVEL              3
+
+
+    /**
+     * \brief Block compression, through the compression libraries found at runtime.
+     *
+     * zlib is shipped with the plugin as zlibwapi.dll (WINAPI calling convention); Zstandard
+     * is only used if libzstd.dll is installed. Both are loaded on first use, so that the plugin
+     * still starts without them. This class is a singleton.
+     */
+    class Compressor {
+        // zlib (zlibwapi.dll)
+        typedef int             (WINAPI* ZlibCompress)(unsigned char*, unsigned long*, const unsigned char*, unsigned long, int);
+        typedef int             (WINAPI* ZlibUncompress)(unsigned char*, unsigned long*, const unsigned char*, unsigned long);
+        typedef unsigned long   (WINAPI* ZlibCompressBound)(unsigned long);
+
+        // Zstandard (libzstd.dll)
+        typedef size_t          (__cdecl* ZstdCompress)(void*, size_t, const void*, size_t, int);
+        typedef size_t          (__cdecl* ZstdDecompress)(void*, size_t, const void*, size_t);
+        typedef size_t          (__cdecl* ZstdCompressBound)(size_t);
+        typedef unsigned int    (__cdecl* ZstdIsError)(size_t);
+
+        static Compressor*      instance;
+
+        HMODULE                 zlib,
+                                zstd;
+        ZlibCompress            zlibCompress;
+        ZlibUncompress          zlibUncompress;
+        ZlibCompressBound       zlibCompressBound;
+        ZstdCompress            zstdCompress;
+        ZstdDecompress          zstdDecompress;
+        ZstdCompressBound       zstdCompressBound;
+        ZstdIsError             zstdIsError;
+
+        Compressor();
+        Compressor(const Compressor&);
+        ~Compressor();
+
+        void operator=(const Compressor&);
+
+        public:
+        static Compressor*      getInstance();
+        static void             kill();
+
+        bool    isAvailable(CompressionCodec)                                                   const;
+
+        bool    compress(CompressionCodec, const std::vector<char>&, std::vector<char>&)        const;
+        bool    decompress(CompressionCodec, const std::vector<char>&, std::vector<char>&)      const;
+    };
+#endif
\ No newline at end of file
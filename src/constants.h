@@ -9,6 +9,7 @@
     #include <windows.h>
 
     #define DEBUG               // Comment out this line to ignore all debug instructions
+    //#define BENCHMARK         // Uncomment this line to build benchmarks (see benchmark.h)
     
     // Plugin constants
     #define GPPHDR_VER              0x10    // Plugin version (don't touch this !)
@@ -20,7 +21,11 @@
     #define SCRIPT_URL          "http://www.musicexplorer.org/services_museek/getCoordinatesInPackagesNoXML.php"
     #define CONFIG_FILE         "museek.conf"
     #define LOG_FILE            "museek.log"
-    #define MAP_FILE            "map.txt"
+    #define MAP_FILE            "map.bin"
+    #define LEGACY_MAP_FILE     "map.txt"
+
+    // Map file compaction, once its journal reaches this fraction of its size
+    #define JOURNAL_COMPACTION_RATIO    0.25
 
     /* Codes for Winamp buttons
      *  Usage:
@@ -59,7 +64,8 @@
      * See Coordinate_Server_Format_Description.txt.
      */
     enum MuseekCode {
-        UNTESTED = -4,              ///< Database not queried yet
+        REMOVED = -5,               ///< Track no longer in the library; its row may be reused
+        UNTESTED,                   ///< Database not queried yet
         NOTHING_FOUND,              ///< No matching at all
         TITLE_NOT_FOUND,            ///< Artist found, title not found
         ARTIST_NOT_FOUND,           ///< Artist not found, title found
@@ -85,6 +91,53 @@
     };
 
 
+    /**
+     * \brief Representation of coordinates nearest neighbors are searched on.
+     *
+     * Coordinates themselves are always kept as ANNcoord, as ANN requires.
+     */
+    enum CoordinateMode {
+        COORDINATES_DOUBLE,         ///< k-dimensional tree over ANNcoord values
+        COORDINATES_FLOAT,          ///< Linear scan over float values
+        COORDINATES_INT8            ///< Linear scan over 8-bit codes, then re-ranking of the best candidates
+    };
+
+
+    /**
+     * \brief Search structure built over ANNcoord values, in COORDINATES_DOUBLE mode.
+     *
+     * Values are stored in tree files: do not renumber them.
+     */
+    enum IndexBackend {
+        INDEX_KD_TREE,              ///< k-dimensional tree (ANNkd_tree)
+        INDEX_BD_TREE,              ///< Box-decomposition tree (ANNbd_tree), more robust to clustered points
+        INDEX_BRUTE_FORCE,          ///< Linear scan (ANNbruteForce), nothing to build
+        INDEX_SIMD_SCAN,            ///< Linear scan with vector instructions (DistanceEngine), nothing to build
+        INDEX_HNSW                  ///< Hierarchical navigable small world graph (HnswIndex), approximate but grows incrementally
+    };
+
+
+    /// \brief Vector instructions used to compute distances (see DistanceEngine), from the oldest.
+    enum InstructionSet {
+        INSTRUCTIONS_SCALAR,        ///< No vector instructions
+        INSTRUCTIONS_SSE2,          ///< 2 coordinates at once
+        INSTRUCTIONS_AVX2,          ///< 4 coordinates at once, with fused multiply-add
+        INSTRUCTIONS_AVX512         ///< 8 coordinates at once, with fused multiply-add
+    };
+
+
+    /**
+     * \brief Compression of the blocks of a packed map file (see mapformat.h).
+     *
+     * Values are stored in map files: do not renumber them.
+     */
+    enum CompressionCodec {
+        COMPRESSION_NONE,           ///< Blocks are stored as is
+        COMPRESSION_ZLIB,           ///< zlib, through zlibwapi.dll
+        COMPRESSION_ZSTD            ///< Zstandard, through libzstd.dll, if installed
+    };
+
+
     // Other constants
     #define PI 3.141592
 #endif
\ No newline at end of file
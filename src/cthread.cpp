@@ -25,7 +25,9 @@ CThread::CThread() : started(false) {
 
 /// \brief Start thread.
 bool CThread::start() {
-    return (pthread_create(&thread, NULL, CThread::thread_func, (void*)this) == 0);
+    started = (pthread_create(&thread, NULL, CThread::thread_func, (void*)this) == 0);
+
+    return started;
 }
 
 
@@ -35,7 +37,10 @@ void CThread::stop() {
 }
 
 
-/// \brief Wait for thread to be done.
+/// \brief Wait for thread to be done; does nothing if the thread wasn't started.
 void CThread::wait() {
+    if (!started)   return;
+
     pthread_join(thread, NULL);
+    started = false;
 }
\ No newline at end of file
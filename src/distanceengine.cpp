@@ -0,0 +1,379 @@
+/**
+ * \file distanceengine.cpp
+ * \brief DistanceEngine class implementation.
+ */
+
+#include <algorithm>
+#include <intrin.h>
+#include <emmintrin.h>
+
+#include "distanceengine.h"
+#include "neighborfilter.h"
+
+// Intrinsics known to the compiler
+#if defined(_MSC_VER) && _MSC_VER >= 1700
+    #include <immintrin.h>
+    #define DISTANCE_ENGINE_AVX2
+#endif
+
+#if defined(_MSC_VER) && _MSC_VER >= 1910
+    #define DISTANCE_ENGINE_AVX512
+#endif
+
+using namespace std;
+
+
+DistanceEngine* DistanceEngine::instance = NULL;
+
+
+/**
+ * \brief Compute squared distances without vector instructions.
+ *
+ * \param query     Reference point.
+ * \param rows      Points to compare with the reference point.
+ * \param count     Number of points.
+ * \param d         Number of coordinates per point.
+ * \param distances Squared distances, one per point (modified).
+ */
+static void scalarDistances(const ANNcoord* query, const ANNpoint* rows, unsigned long count, unsigned short d, ANNdist* distances) {
+    unsigned long   i(0);
+    unsigned short  j(0);
+
+    for (i = 0; i < count; i++) {
+        const ANNcoord* row(rows[i]);
+        ANNdist         distance(0);
+
+        for (j = 0; j < d; j++)
+            distance += ANN_POW(query[j] - row[j]);
+
+        distances[i] = distance;
+    }
+}
+
+
+/// \brief Compute squared distances with SSE2 instructions (see scalarDistances()).
+static void sse2Distances(const ANNcoord* query, const ANNpoint* rows, unsigned long count, unsigned short d, ANNdist* distances) {
+    unsigned long   i(0);
+    unsigned short  j(0);
+
+    for (i = 0; i < count; i++) {
+        const ANNcoord* row(rows[i]);
+        __m128d         sum0(_mm_setzero_pd()), sum1(_mm_setzero_pd());
+
+        // Two sums, so that additions do not wait for each other
+        for (j = 0; j + 4 <= d; j += 4) {
+            __m128d difference0(_mm_sub_pd(_mm_loadu_pd(query + j), _mm_loadu_pd(row + j)));
+            __m128d difference1(_mm_sub_pd(_mm_loadu_pd(query + j + 2), _mm_loadu_pd(row + j + 2)));
+
+            sum0 = _mm_add_pd(sum0, _mm_mul_pd(difference0, difference0));
+            sum1 = _mm_add_pd(sum1, _mm_mul_pd(difference1, difference1));
+        }
+
+        sum0 = _mm_add_pd(sum0, sum1);
+
+        ANNdist distance(_mm_cvtsd_f64(_mm_add_sd(sum0, _mm_unpackhi_pd(sum0, sum0))));
+
+        for (; j < d; j++)
+            distance += ANN_POW(query[j] - row[j]);
+
+        distances[i] = distance;
+    }
+}
+
+
+#ifdef DISTANCE_ENGINE_AVX2
+/// \brief Compute squared distances with AVX2 and FMA instructions (see scalarDistances()).
+static void avx2Distances(const ANNcoord* query, const ANNpoint* rows, unsigned long count, unsigned short d, ANNdist* distances) {
+    unsigned long   i(0);
+    unsigned short  j(0);
+
+    for (i = 0; i < count; i++) {
+        const ANNcoord* row(rows[i]);
+        __m256d         sum0(_mm256_setzero_pd()), sum1(_mm256_setzero_pd());
+
+        for (j = 0; j + 8 <= d; j += 8) {
+            __m256d difference0(_mm256_sub_pd(_mm256_loadu_pd(query + j), _mm256_loadu_pd(row + j)));
+            __m256d difference1(_mm256_sub_pd(_mm256_loadu_pd(query + j + 4), _mm256_loadu_pd(row + j + 4)));
+
+            sum0 = _mm256_fmadd_pd(difference0, difference0, sum0);
+            sum1 = _mm256_fmadd_pd(difference1, difference1, sum1);
+        }
+
+        if (j + 4 <= d) {
+            __m256d difference(_mm256_sub_pd(_mm256_loadu_pd(query + j), _mm256_loadu_pd(row + j)));
+
+            sum0 = _mm256_fmadd_pd(difference, difference, sum0);
+            j += 4;
+        }
+
+        sum0 = _mm256_add_pd(sum0, sum1);
+
+        __m128d sum(_mm_add_pd(_mm256_castpd256_pd128(sum0), _mm256_extractf128_pd(sum0, 1)));
+        ANNdist distance(_mm_cvtsd_f64(_mm_add_sd(sum, _mm_unpackhi_pd(sum, sum))));
+
+        for (; j < d; j++)
+            distance += ANN_POW(query[j] - row[j]);
+
+        distances[i] = distance;
+    }
+
+    // Avoid the penalty of SSE instructions following AVX ones
+    _mm256_zeroupper();
+}
+#endif
+
+
+#ifdef DISTANCE_ENGINE_AVX512
+/// \brief Compute squared distances with AVX-512 instructions (see scalarDistances()).
+static void avx512Distances(const ANNcoord* query, const ANNpoint* rows, unsigned long count, unsigned short d, ANNdist* distances) {
+    unsigned long   i(0);
+    unsigned short  j(0);
+    __mmask8        tail((__mmask8)((1 << (d % 8)) - 1));
+
+    for (i = 0; i < count; i++) {
+        const ANNcoord* row(rows[i]);
+        __m512d         sum(_mm512_setzero_pd());
+
+        for (j = 0; j + 8 <= d; j += 8) {
+            __m512d difference(_mm512_sub_pd(_mm512_loadu_pd(query + j), _mm512_loadu_pd(row + j)));
+
+            sum = _mm512_fmadd_pd(difference, difference, sum);
+        }
+
+        // Remaining coordinates, masked rather than read past the point
+        if (tail) {
+            __m512d difference(_mm512_sub_pd(_mm512_maskz_loadu_pd(tail, query + j), _mm512_maskz_loadu_pd(tail, row + j)));
+
+            sum = _mm512_fmadd_pd(difference, difference, sum);
+        }
+
+        distances[i] = _mm512_reduce_add_pd(sum);
+    }
+
+    _mm256_zeroupper();
+}
+#endif
+
+
+/// \brief Default constructor; detect the instructions supported by the CPU and the system.
+DistanceEngine::DistanceEngine() :
+        supported(detectInstructionSet()),
+        instructionSet(INSTRUCTIONS_SCALAR),
+        kernel(scalarDistances) {
+    setInstructionSet(supported);
+}
+
+
+/// \brief Destructor.
+DistanceEngine::~DistanceEngine() {
+}
+
+
+/// \return Unique instance of DistanceEngine class.
+DistanceEngine* DistanceEngine::getInstance() {
+    if (instance == NULL)
+        instance = new DistanceEngine;
+
+    return instance;
+}
+
+
+/// \brief Delete the unique instance of DistanceEngine class.
+void DistanceEngine::kill() {
+    if (instance != NULL) {
+        delete instance;
+        instance = NULL;
+    }
+}
+
+
+/**
+ * \brief Find the best instructions supported by the CPU, the system and the compiler.
+ *
+ * AVX2 and AVX-512 also require the system to save the wider registers (XCR0, see _xgetbv()).
+ *
+ * \return Best instruction set.
+ */
+InstructionSet DistanceEngine::detectInstructionSet() {
+    int             features[4];
+    int             leaves(0);
+    InstructionSet  best(INSTRUCTIONS_SCALAR);
+
+    __cpuid(features, 0);
+    leaves = features[0];
+
+    if (leaves < 1)     return best;
+
+    __cpuid(features, 1);
+    if (features[3] & (1 << 26))    best = INSTRUCTIONS_SSE2;
+
+    #ifdef DISTANCE_ENGINE_AVX2
+    bool        osxsave((features[2] & (1 << 27)) != 0),
+                avx((features[2] & (1 << 28)) != 0),
+                fma((features[2] & (1 << 12)) != 0);
+
+    if (best < INSTRUCTIONS_SSE2 || !osxsave || !avx || !fma || leaves < 7)    return best;
+
+    unsigned __int64 enabled(_xgetbv(0));
+    if ((enabled & 0x6) != 0x6)     return best;
+
+    __cpuidex(features, 7, 0);
+    if (!(features[1] & (1 << 5)))  return best;
+
+    best = INSTRUCTIONS_AVX2;
+
+    #ifdef DISTANCE_ENGINE_AVX512
+    if ((features[1] & (1 << 16)) && (enabled & 0xE6) == 0xE6)
+        best = INSTRUCTIONS_AVX512;
+    #endif
+    #endif
+
+    return best;
+}
+
+
+/// \return Name of an instruction set, for logs.
+const char* DistanceEngine::getName(InstructionSet set) {
+    switch (set) {
+        case INSTRUCTIONS_SCALAR:   return "scalar";
+        case INSTRUCTIONS_SSE2:     return "SSE2";
+        case INSTRUCTIONS_AVX2:     return "AVX2";
+        case INSTRUCTIONS_AVX512:   return "AVX-512";
+    }
+
+    return "unknown";
+}
+
+
+/// \return Instructions distances are computed with.
+InstructionSet DistanceEngine::getInstructionSet() const {
+    return instructionSet;
+}
+
+
+/// \return Best instructions supported by the CPU, the system and the compiler.
+InstructionSet DistanceEngine::getSupportedInstructionSet() const {
+    return supported;
+}
+
+
+/**
+ * \brief Choose the instructions distances are computed with; the best supported ones are used by default.
+ *
+ * Not thread-safe: only meant to compare instruction sets (see benchmarkSimdScan()).
+ *
+ * \param set Instruction set.
+ * \return True if the instructions are supported, false otherwise (nothing changes then).
+ */
+bool DistanceEngine::setInstructionSet(InstructionSet set) {
+    if (set > supported)    return false;
+
+    switch (set) {
+        #ifdef DISTANCE_ENGINE_AVX512
+        case INSTRUCTIONS_AVX512:
+            kernel = avx512Distances;
+            break;
+        #endif
+
+        #ifdef DISTANCE_ENGINE_AVX2
+        case INSTRUCTIONS_AVX2:
+            kernel = avx2Distances;
+            break;
+        #endif
+
+        case INSTRUCTIONS_SSE2:
+            kernel = sse2Distances;
+            break;
+
+        default:
+            kernel = scalarDistances;
+    }
+
+    instructionSet = set;
+    return true;
+}
+
+
+/**
+ * \brief Compute the squared distance between two points.
+ *
+ * \param first     First point.
+ * \param second    Second point.
+ * \param d         Number of coordinates per point.
+ * \return Squared distance.
+ */
+ANNdist DistanceEngine::distance(const ANNcoord* first, const ANNcoord* second, unsigned short d) const {
+    ANNpoint    row((ANNpoint)second);
+    ANNdist     result(0);
+
+    kernel(first, &row, 1, d, &result);
+    return result;
+}
+
+
+/**
+ * \brief Compute squared distances between a point and consecutive points of an array.
+ *
+ * \param query     Reference point.
+ * \param rows      Points to compare with the reference point.
+ * \param count     Number of points.
+ * \param d         Number of coordinates per point.
+ * \param results   Squared distances, one per point (modified).
+ */
+void DistanceEngine::distances(const ANNcoord* query, const ANNpoint* rows, unsigned long count, unsigned short d, ANNdist* results) const {
+    kernel(query, rows, count, d, results);
+}
+
+
+/**
+ * \brief Find nearest neighbors of a point by comparing it with all points.
+ *
+ * Distances are computed by blocks of SCAN_BLOCK_SIZE points; the best points are kept in a
+ * heap taken from the context, which must have been reset() for k neighbors. Results are the
+ * same as ANN's with no error bound, up to rounding and ties.
+ *
+ * \param query     Reference point.
+ * \param k         Number of nearest neighbors to search.
+ * \param context   Indices of ordered nearest neighbors and their squared distances to the
+ *                  reference point; ANN_NULL_IDX if there are fewer than k points (modified).
+ * \param points    Points searched.
+ * \param n         Number of points.
+ * \param d         Number of coordinates per point.
+ * \param filter    Points to consider, NULL for all of them.
+ */
+void DistanceEngine::search(ANNpoint query, int k, NeighborQuery& context, ANNpointArray points, unsigned long n, unsigned short d, const NeighborFilter* filter) const {
+    vector<pair<ANNdist, ANNidx> >&     heap(context.getRanked());          // Best points so far, worst first
+    ANNidxArray                         ids(context.getIdArray());
+    ANNdistArray                        dists(context.getDistanceArray());
+    ANNdist                             block[SCAN_BLOCK_SIZE];
+    unsigned long                       wanted(min((unsigned long)max(k, 0), n)), first(0), count(0), i(0);
+
+    heap.clear();
+    heap.reserve(wanted + 1);
+
+    for (first = 0; first < n && wanted; first += count) {
+        count = min(n - first, (unsigned long)SCAN_BLOCK_SIZE);
+        kernel(query, points + first, count, d, block);
+
+        for (i = 0; i < count; i++) {
+            if (heap.size() == wanted && block[i] >= heap.front().first)    continue;
+            if (filter && !filter->accept(first + i))                       continue;
+
+            if (heap.size() < wanted) {
+                heap.push_back(make_pair(block[i], (ANNidx)(first + i)));
+                push_heap(heap.begin(), heap.end());
+            } else {
+                pop_heap(heap.begin(), heap.end());
+                heap.back() = make_pair(block[i], (ANNidx)(first + i));
+                push_heap(heap.begin(), heap.end());
+            }
+        }
+    }
+
+    sort_heap(heap.begin(), heap.end());
+
+    for (i = 0; i < (unsigned long)max(k, 0); i++) {
+        ids[i]      = i < heap.size() ? heap[i].second : ANN_NULL_IDX;
+        dists[i]    = i < heap.size() ? heap[i].first : ANN_DIST_INF;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,59 @@
+#ifndef DISTANCEENGINE_H
+    #define DISTANCEENGINE_H
+
+    /**
+     * \file distanceengine.h
+     * \brief DistanceEngine class headers.
+     */
+
+    #include "ANN.h"
+
+    #include "constants.h"
+    #include "neighborquery.h"
+
+    class NeighborFilter;
+
+    #define SCAN_BLOCK_SIZE     256     ///< Points whose distances are computed at once by search()
+
+
+    /**
+     * \brief Squared distances between points, computed with the best vector instructions of the CPU.
+     *
+     * Instructions are chosen at runtime, from the features reported by the CPU and enabled by
+     * the system; instructions the compiler has no intrinsics for are never used. Distances are
+     * squared distances between ANNcoord values, as ANN computes them, up to rounding.
+     * This class is a singleton; its methods may be called from several threads at once,
+     * setInstructionSet() aside.
+     */
+    class DistanceEngine {
+        typedef void    (*DistanceKernel)(const ANNcoord*, const ANNpoint*, unsigned long, unsigned short, ANNdist*);
+
+        static DistanceEngine*  instance;
+
+        InstructionSet          supported,
+                                instructionSet;
+        DistanceKernel          kernel;
+
+        DistanceEngine();
+        DistanceEngine(const DistanceEngine&);
+        ~DistanceEngine();
+
+        void operator=(const DistanceEngine&);
+
+        static InstructionSet   detectInstructionSet();
+
+        public:
+        static DistanceEngine*  getInstance();
+        static void             kill();
+
+        static const char*      getName(InstructionSet);
+
+        InstructionSet  getInstructionSet()                                 const;
+        InstructionSet  getSupportedInstructionSet()                        const;
+        bool            setInstructionSet(InstructionSet);
+
+        ANNdist         distance(const ANNcoord*, const ANNcoord*, unsigned short)  const;
+        void            distances(const ANNcoord*, const ANNpoint*, unsigned long, unsigned short, ANNdist*)    const;
+        void            search(ANNpoint, int, NeighborQuery&, ANNpointArray, unsigned long, unsigned short, const NeighborFilter* filter = NULL)    const;
+    };
+#endif
\ No newline at end of file
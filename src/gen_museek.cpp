@@ -25,7 +25,8 @@ WNDPROC     lpWndProcOld = 0;
 DWORD
     WA_MENUITEM_SHUFFLE_ON_LIBRARY  = 0,
     WA_MENUITEM_SHUFFLE_ON_PLAYLIST = 0,
-    WA_MENUITEM_RESCAN_LIBRARY      = 0;
+    WA_MENUITEM_RESCAN_LIBRARY      = 0,
+    WA_IPC_MAP_PUBLISHED            = 0;
 
 
 // Plugin information
@@ -68,6 +69,10 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam)
 	    else if (lParam == IPC_STOPPLAYING)
             shuffler->onStopPlaying();
 
+        // A library scan has published a new map
+        else if (WA_IPC_MAP_PUBLISHED && lParam == (LPARAM)(WA_IPC_MAP_PUBLISHED))
+            shuffler->onMapPublished();
+
         // Status changed (Play/Pause)
         else if (lParam == IPC_CB_MISC && wParam == IPC_CB_MISC_TITLE) {
             int playing = SendMessage(plugin.hwndParent, WM_WA_IPC, 0, IPC_ISPLAYING);
@@ -117,14 +122,26 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam)
  * \return 0 if everything is OK, 1 otherwise.
  */
 int init() {
+    #ifdef DEBUG
+    double start(currentTime());
+    #endif
+
     // We need the address of the Winamp Routine
 	if (IsWindowUnicode(plugin.hwndParent))
         lpWndProcOld = (WNDPROC)SetWindowLongPtrW(plugin.hwndParent, GWLP_WNDPROC, (LONG)WndProc);
 	else
 		lpWndProcOld = (WNDPROC)SetWindowLongPtrA(plugin.hwndParent, GWLP_WNDPROC, (LONG)WndProc);
 
+    // Message sent by the library scan, so the shuffler follows the new map on this thread
+    WA_IPC_MAP_PUBLISHED = SendMessage(plugin.hwndParent, WM_WA_IPC, (WPARAM)&"museek_map_published", IPC_REGISTER_WINAMP_IPCMESSAGE);
+
     // Load map, config and add menu entries
     Shuffler* shuffler = Shuffler::getInstance();
+
+    #ifdef DEBUG
+    shuffler->setInitTime(start);
+    #endif
+
     shuffler->loadConfig();
     shuffler->loadMap();
     shuffler->createMenuEntries();
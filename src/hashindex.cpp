@@ -0,0 +1,188 @@
+/**
+ * \file hashindex.cpp
+ * \brief HashIndex class implementation.
+ */
+
+#include <algorithm>
+
+#include "hashindex.h"
+
+using namespace std;
+
+
+/// \brief Default constructor.
+HashIndex::HashIndex() :
+        slots(),
+        count(0) {
+}
+
+
+/// \brief Destructor.
+HashIndex::~HashIndex() {
+}
+
+
+/// \return Number of IDs in the index.
+unsigned long HashIndex::getSize() const {
+    return count;
+}
+
+
+/// \return Number of bytes allocated by the index.
+unsigned long HashIndex::getMemoryUsage() const {
+    return slots.capacity() * sizeof(Slot);
+}
+
+
+/**
+ * \brief Start a lookup.
+ *
+ * \param hash Hash of the key to look for.
+ * \return Slot to start probing from; see next().
+ */
+unsigned long HashIndex::first(DWORD hash) const {
+    if (slots.empty())  return 0;
+
+    return hash & (slots.size() - 1);
+}
+
+
+/**
+ * \brief Get the next candidate for a key.
+ *
+ * \param hash  Hash of the key to look for.
+ * \param slot  Slot to probe from; moved past the candidate.
+ * \param id    ID of the candidate (modified only on success).
+ * \return True if there is a candidate, false if all of them were returned.
+ */
+bool HashIndex::next(DWORD hash, unsigned long& slot, ANNidx& id) const {
+    if (slots.empty())  return false;
+
+    unsigned long mask(slots.size() - 1);
+
+    // There is always an empty slot, hence this ends
+    while (slots[slot].id != HASH_INDEX_EMPTY) {
+        const Slot& current(slots[slot]);
+
+        slot = (slot + 1) & mask;
+
+        if (current.hash == hash) {
+            id = current.id;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/**
+ * \brief Add an ID to the index.
+ *
+ * \param hash  Hash of the key of the ID.
+ * \param id    ID.
+ */
+void HashIndex::insert(DWORD hash, ANNidx id) {
+    if (2 * (count + 1) > slots.size())
+        rehash(max((unsigned long)(2 * slots.size()), (unsigned long)HASH_INDEX_MIN_SLOTS));
+
+    unsigned long mask(slots.size() - 1), slot(hash & mask);
+
+    while (slots[slot].id != HASH_INDEX_EMPTY)
+        slot = (slot + 1) & mask;
+
+    slots[slot].hash    = hash;
+    slots[slot].id      = id;
+    count++;
+}
+
+
+/**
+ * \brief Remove an ID from the index.
+ *
+ * Following slots of the same cluster are shifted back, so that no tombstone is needed.
+ *
+ * \param hash  Hash of the key of the ID, as when it was inserted.
+ * \param id    ID.
+ * \return True if the ID was found and removed, false otherwise.
+ */
+bool HashIndex::remove(DWORD hash, ANNidx id) {
+    if (slots.empty())  return false;
+
+    unsigned long mask(slots.size() - 1), slot(hash & mask);
+
+    while (slots[slot].id != HASH_INDEX_EMPTY
+    &&    (slots[slot].hash != hash || slots[slot].id != (DWORD)id))
+        slot = (slot + 1) & mask;
+
+    if (slots[slot].id == HASH_INDEX_EMPTY)     return false;
+
+    // Fill the hole with the next slot that may move there
+    unsigned long hole(slot), next((slot + 1) & mask);
+
+    while (slots[next].id != HASH_INDEX_EMPTY) {
+        unsigned long home(slots[next].hash & mask);
+
+        // Move the slot unless its home lies cyclically in (hole, next]
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            slots[hole] = slots[next];
+            hole = next;
+        }
+
+        next = (next + 1) & mask;
+    }
+
+    slots[hole].id = HASH_INDEX_EMPTY;
+    count--;
+
+    return true;
+}
+
+
+/**
+ * \brief Allocate slots for n IDs at once.
+ *
+ * \param n Number of IDs.
+ */
+void HashIndex::reserve(unsigned long n) {
+    unsigned long size(HASH_INDEX_MIN_SLOTS);
+
+    while (size < 2 * n)    size *= 2;
+
+    if (size > slots.size())
+        rehash(size);
+}
+
+
+/// \brief Remove all IDs, and free slots.
+void HashIndex::clear() {
+    vector<Slot>().swap(slots);
+    count = 0;
+}
+
+
+/**
+ * \brief Move all IDs to a new array of slots.
+ *
+ * \param size New number of slots; a power of two.
+ */
+void HashIndex::rehash(unsigned long size) {
+    vector<Slot>    previous(size);
+    unsigned long   mask(size - 1), i(0);
+
+    for (i = 0; i < size; i++)
+        previous[i].id = HASH_INDEX_EMPTY;
+
+    previous.swap(slots);
+
+    for (i = 0; i < previous.size(); i++) {
+        if (previous[i].id == HASH_INDEX_EMPTY)     continue;
+
+        unsigned long slot(previous[i].hash & mask);
+
+        while (slots[slot].id != HASH_INDEX_EMPTY)
+            slot = (slot + 1) & mask;
+
+        slots[slot] = previous[i];
+    }
+}
\ No newline at end of file
@@ -0,0 +1,62 @@
+#ifndef HASHINDEX_H
+    #define HASHINDEX_H
+
+    /**
+     * \file hashindex.h
+     * \brief HashIndex class headers.
+     */
+
+    #include <vector>
+
+    #include "ANN.h"
+
+    #include "constants.h"
+
+    #define HASH_INDEX_EMPTY        0xFFFFFFFFUL    ///< ID of empty slots
+    #define HASH_INDEX_MIN_SLOTS    16              ///< Minimal number of slots
+
+
+    /**
+     * \brief Hash table from keys to track IDs, with open addressing.
+     *
+     * Only hashes of keys are stored, next to IDs, in a single array of slots probed linearly;
+     * there are at least twice as many slots as IDs. Several IDs may share a hash, or even a key:
+     * lookups return all candidates with the requested hash, one by one, and the caller has to
+     * check their actual key. Typical use:
+     *      unsigned long   slot(index.first(hash));
+     *      ANNidx          id;
+     *
+     *      while (index.next(hash, slot, id)) {
+     *          if (keyOf(id) == key)   return id;
+     *      }
+     *
+     * This class is not thread-safe.
+     */
+    class HashIndex {
+        /// \brief A slot of the table.
+        struct Slot {
+            DWORD hash;
+            DWORD id;   ///< HASH_INDEX_EMPTY if the slot is empty
+        };
+
+        std::vector<Slot>   slots;
+        unsigned long       count;
+
+        void            rehash(unsigned long);
+
+        public:
+        HashIndex();
+        ~HashIndex();
+
+        unsigned long   getSize()                                           const;
+        unsigned long   getMemoryUsage()                                    const;
+
+        unsigned long   first(DWORD)                                        const;
+        bool            next(DWORD, unsigned long&, ANNidx&)                const;
+
+        void            insert(DWORD, ANNidx);
+        bool            remove(DWORD, ANNidx);
+        void            reserve(unsigned long);
+        void            clear();
+    };
+#endif
\ No newline at end of file
@@ -0,0 +1,570 @@
+/**
+ * \file hnswindex.cpp
+ * \brief HnswIndex class implementation.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+
+#include "distanceengine.h"
+#include "hnswindex.h"
+#include "mapformat.h"
+#include "neighborfilter.h"
+
+using namespace std;
+
+
+/// \brief Default constructor; the graph is empty, with default settings.
+HnswIndex::HnswIndex() :
+        dimensions(0),
+        maxLinks(HNSW_LINKS),
+        efConstruction(HNSW_EF_CONSTRUCTION),
+        levelFactor(1 / log((double)HNSW_LINKS)),
+        size(0),
+        entryPoint(ANN_NULL_IDX),
+        topLevel(-1),
+        levels(),
+        baseLinks(),
+        upperLinks(),
+        scratch() {
+}
+
+
+/// \brief Destructor.
+HnswIndex::~HnswIndex() {
+}
+
+
+/// \return Number of points inserted.
+unsigned long HnswIndex::getSize() const {
+    return size;
+}
+
+
+/// \return Number of bytes allocated by the graph, scratch space aside.
+unsigned long HnswIndex::getMemoryUsage() const {
+    unsigned long   usage(levels.capacity() + baseLinks.capacity() * sizeof(ANNidx)
+                        + upperLinks.capacity() * sizeof(vector<ANNidx>));
+    unsigned long   i(0);
+
+    for (i = 0; i < upperLinks.size(); i++)
+        usage += upperLinks[i].capacity() * sizeof(ANNidx);
+
+    return usage;
+}
+
+
+/// \return Neighbors per point on levels above 0 (M).
+unsigned short HnswIndex::getMaxLinks() const {
+    return maxLinks;
+}
+
+
+/// \return Candidates considered when inserting a point.
+unsigned short HnswIndex::getEfConstruction() const {
+    return efConstruction;
+}
+
+
+/// \return True if the point was inserted, false otherwise.
+bool HnswIndex::contains(ANNidx i) const {
+    return i >= 0 && (unsigned long)i < levels.size() && levels[i] >= 0;
+}
+
+
+/**
+ * \brief Empty the graph, and set its parameters.
+ *
+ * \param newDimensions     Number of coordinates per point.
+ * \param newMaxLinks       Neighbors per point on levels above 0 (M), from 2 to HNSW_MAX_LINKS.
+ * \param newEfConstruction Candidates considered when inserting a point.
+ */
+void HnswIndex::reset(unsigned short newDimensions, unsigned short newMaxLinks, unsigned short newEfConstruction) {
+    clear();
+
+    dimensions      = newDimensions;
+    maxLinks        = max((unsigned short)2, min(newMaxLinks, (unsigned short)HNSW_MAX_LINKS));
+    efConstruction  = max(newEfConstruction, maxLinks);
+    levelFactor     = 1 / log((double)maxLinks);
+}
+
+
+/**
+ * \brief Make room for points up to a given index, so that inserting them does not reallocate.
+ *
+ * \param n Number of points.
+ */
+void HnswIndex::reserve(unsigned long n) {
+    if (n <= levels.size())     return;
+
+    levels.resize(n, -1);
+    baseLinks.resize(n * (2 * maxLinks + 1), 0);
+    upperLinks.resize(n);
+}
+
+
+/**
+ * \brief Insert a point.
+ *
+ * The point is linked to the closest points found on each of its levels, which are linked
+ * back to it; points with too many links then keep the best ones.
+ *
+ * \param i         Index of the point; nothing happens if it is already inserted.
+ * \param points    Current points, this one included.
+ */
+void HnswIndex::insert(ANNidx i, ANNpointArray points) {
+    if (i < 0 || contains(i))   return;
+
+    // Grow geometrically, as points are appended one at a time
+    if ((unsigned long)i >= levels.size())
+        reserve(max((unsigned long)i + 1, (unsigned long)levels.size() * 3 / 2));
+
+    ANNpoint                            point(points[i]);
+    int                                 level(randomLevel()), l(0);
+    ANNidx                              entry(entryPoint);
+    vector<pair<ANNdist, ANNidx> >      neighbors;
+    size_t                              j(0);
+
+    levels[i] = (signed char)level;
+    if (level > 0)  upperLinks[i].assign(level * (maxLinks + 1), 0);
+    size++;
+
+    if (topLevel < 0) {
+        entryPoint  = i;
+        topLevel    = level;
+        return;
+    }
+
+    if (topLevel > level)
+        entry = searchGreedy(point, entryPoint, topLevel, level, points);
+
+    for (l = min(level, topLevel); l >= 0; l--) {
+        searchLevel(point, entry, l, efConstruction, scratch, points, NULL);
+
+        neighbors = scratch.getRanked();
+        sort(neighbors.begin(), neighbors.end());
+
+        // The nearest point found is where the next level is searched from
+        entry = neighbors.front().second;
+
+        selectNeighbors(neighbors, maxLinks, points);
+
+        ANNidx* links(getLinks(i, l));
+
+        for (j = 0; j < neighbors.size(); j++) {
+            links[++links[0]] = neighbors[j].second;
+            link(neighbors[j].second, i, l, points);
+        }
+    }
+
+    if (level > topLevel) {
+        entryPoint  = i;
+        topLevel    = level;
+    }
+}
+
+
+/// \brief Remove all points, and free memory; settings are kept.
+void HnswIndex::clear() {
+    vector<signed char>().swap(levels);
+    vector<ANNidx>().swap(baseLinks);
+    vector<vector<ANNidx> >().swap(upperLinks);
+
+    size        = 0;
+    entryPoint  = ANN_NULL_IDX;
+    topLevel    = -1;
+}
+
+
+/// \brief Exchange the contents of two graphs.
+void HnswIndex::swap(HnswIndex& other) {
+    std::swap(dimensions, other.dimensions);
+    std::swap(maxLinks, other.maxLinks);
+    std::swap(efConstruction, other.efConstruction);
+    std::swap(levelFactor, other.levelFactor);
+    std::swap(size, other.size);
+    std::swap(entryPoint, other.entryPoint);
+    std::swap(topLevel, other.topLevel);
+    levels.swap(other.levels);
+    baseLinks.swap(other.baseLinks);
+    upperLinks.swap(other.upperLinks);
+}
+
+
+/**
+ * \brief Find nearest neighbors of a point.
+ *
+ * \param query     Reference point.
+ * \param k         Number of nearest neighbors to search.
+ * \param ef        Candidates considered on level 0; at least k are.
+ * \param context   Indices of ordered nearest neighbors and their squared distances to the
+ *                  reference point; ANN_NULL_IDX if fewer than k were found (modified). The
+ *                  context must have been reset() for k neighbors.
+ * \param points    Current points.
+ * \param filter    Points to return, NULL for all of them; other points are still traversed.
+ */
+void HnswIndex::search(ANNpoint query, int k, int ef, NeighborQuery& context, ANNpointArray points, const NeighborFilter* filter) const {
+    vector<pair<ANNdist, ANNidx> >&     results(context.getRanked());
+    ANNidxArray                         ids(context.getIdArray());
+    ANNdistArray                        dists(context.getDistanceArray());
+    int                                 i(0);
+
+    results.clear();
+
+    if (topLevel >= 0 && k > 0) {
+        ANNidx entry(searchGreedy(query, entryPoint, topLevel, 0, points));
+
+        searchLevel(query, entry, 0, max(ef, k), context, points, filter);
+        sort_heap(results.begin(), results.end());
+    }
+
+    for (i = 0; i < k; i++) {
+        ids[i]      = i < (int)results.size() ? results[i].second : ANN_NULL_IDX;
+        dists[i]    = i < (int)results.size() ? results[i].first : ANN_DIST_INF;
+    }
+}
+
+
+/**
+ * \brief Read the graph from a tree file (see mapformat.h).
+ *
+ * The graph is checked as it is read, so that a damaged file is rejected rather than searched.
+ *
+ * \param file      Stream, positioned at the MapGraphHeader.
+ * \param maxPoints Number of points of the map; the graph may not refer to more.
+ * \return True if the graph was read, false otherwise (the graph is then empty).
+ */
+bool HnswIndex::read(istream& file, unsigned long maxPoints) {
+    MapGraphHeader  header;
+    unsigned long   i(0), j(0);
+    int             l(0);
+
+    clear();
+    file.read((char*)&header, sizeof(header));
+
+    if (!file
+    ||  header.maxLinks < 2 || header.maxLinks > HNSW_MAX_LINKS
+    ||  header.capacity > maxPoints
+    ||  header.size > header.capacity
+    ||  (header.size && (header.entryPoint >= header.capacity || header.topLevel > HNSW_MAX_LEVEL)))
+        return false;
+
+    reset(dimensions, (unsigned short)header.maxLinks, (unsigned short)header.efConstruction);
+    reserve(header.capacity);
+
+    if (header.capacity) {
+        file.read((char*)&levels[0], levels.size());
+        file.read((char*)&baseLinks[0], baseLinks.size() * sizeof(ANNidx));
+    }
+
+    for (i = 0; i < levels.size() && file; i++) {
+        if (levels[i] < -1 || levels[i] > HNSW_MAX_LEVEL)   break;
+        if (levels[i] >= 0)                 size++;
+
+        if (levels[i] > 0) {
+            upperLinks[i].resize(levels[i] * (maxLinks + 1));
+            file.read((char*)&upperLinks[i][0], upperLinks[i].size() * sizeof(ANNidx));
+        }
+    }
+
+    if (!file || i < levels.size() || size != header.size || (size && levels[header.entryPoint] != (signed char)header.topLevel)) {
+        clear();
+        return false;
+    }
+
+    // Links must refer to points of their level
+    for (i = 0; i < levels.size(); i++) {
+        for (l = 0; l <= levels[i]; l++) {
+            const ANNidx* links(getLinks(i, l));
+
+            if (links[0] < 0 || links[0] > linksPerLevel(l)) {
+                clear();
+                return false;
+            }
+
+            for (j = 1; j <= (unsigned long)links[0]; j++) {
+                if (links[j] < 0 || (unsigned long)links[j] >= levels.size() || levels[links[j]] < l) {
+                    clear();
+                    return false;
+                }
+            }
+        }
+    }
+
+    if (size) {
+        entryPoint  = header.entryPoint;
+        topLevel    = header.topLevel;
+    }
+
+    return true;
+}
+
+
+/**
+ * \brief Write the graph to a tree file (see mapformat.h).
+ *
+ * \param file Stream, positioned after the MapTreeHeader.
+ * \return True if the graph was written, false otherwise.
+ */
+bool HnswIndex::write(ostream& file) const {
+    MapGraphHeader  header;
+    unsigned long   used(levels.size()), i(0);
+
+    // Room reserved past the last point inserted is not written
+    while (used > 0 && levels[used - 1] < 0)
+        used--;
+
+    header.maxLinks         = maxLinks;
+    header.efConstruction   = efConstruction;
+    header.capacity         = used;
+    header.size             = size;
+    header.entryPoint       = size ? entryPoint : 0;
+    header.topLevel         = size ? topLevel : 0;
+
+    file.write((const char*)&header, sizeof(header));
+
+    if (used) {
+        file.write((const char*)&levels[0], used);
+        file.write((const char*)&baseLinks[0], used * (2 * maxLinks + 1) * sizeof(ANNidx));
+    }
+
+    for (i = 0; i < used; i++) {
+        if (!upperLinks[i].empty())
+            file.write((const char*)&upperLinks[i][0], upperLinks[i].size() * sizeof(ANNidx));
+    }
+
+    return !file.fail();
+}
+
+
+/// \return Maximal number of links of a point on a level.
+unsigned short HnswIndex::linksPerLevel(int level) const {
+    return level == 0 ? 2 * maxLinks : maxLinks;
+}
+
+
+/// \return Links of a point on a level: their count, followed by the neighbors.
+ANNidx* HnswIndex::getLinks(ANNidx i, int level) {
+    if (level == 0)     return &baseLinks[i * (2 * maxLinks + 1)];
+
+    return &upperLinks[i][(level - 1) * (maxLinks + 1)];
+}
+
+
+/// \return Links of a point on a level: their count, followed by the neighbors.
+const ANNidx* HnswIndex::getLinks(ANNidx i, int level) const {
+    if (level == 0)     return &baseLinks[i * (2 * maxLinks + 1)];
+
+    return &upperLinks[i][(level - 1) * (maxLinks + 1)];
+}
+
+
+/**
+ * \brief Draw the level of a new point.
+ *
+ * Levels follow an exponential distribution, such that each level holds about 1 / M of
+ * the points of the level below.
+ *
+ * \return Level, from 0 to HNSW_MAX_LEVEL.
+ */
+int HnswIndex::randomLevel() const {
+    // rand() may only give 15 bits
+    double uniform(((((unsigned long)rand() & 0x7FFF) << 15 | (rand() & 0x7FFF)) + 1.) / (1 << 30));
+
+    return min((int)(-log(uniform) * levelFactor), HNSW_MAX_LEVEL);
+}
+
+
+/**
+ * \brief Descend levels greedily, moving to the closest neighbor until none is closer.
+ *
+ * \param query     Reference point.
+ * \param entry     Point the descent starts from.
+ * \param fromLevel Level of the entry point.
+ * \param toLevel   Level the descent stops at, excluded.
+ * \param points    Current points.
+ * \return Closest point found on level toLevel + 1.
+ */
+ANNidx HnswIndex::searchGreedy(ANNpoint query, ANNidx entry, int fromLevel, int toLevel, ANNpointArray points) const {
+    const DistanceEngine*   engine(DistanceEngine::getInstance());
+    ANNidx                  current(entry);
+    ANNdist                 best(engine->distance(query, points[current], dimensions));
+    ANNpoint                rows[HNSW_MAX_LINKS];
+    ANNdist                 distances[HNSW_MAX_LINKS];
+    int                     level(0);
+    ANNidx                  j(0);
+    bool                    moved(true);
+
+    for (level = fromLevel; level > toLevel; level--) {
+        moved = true;
+
+        while (moved) {
+            const ANNidx* links(getLinks(current, level));
+
+            moved = false;
+
+            for (j = 1; j <= links[0]; j++)
+                rows[j - 1] = points[links[j]];
+
+            engine->distances(query, rows, links[0], dimensions, distances);
+
+            for (j = 1; j <= links[0]; j++) {
+                if (distances[j - 1] < best) {
+                    best    = distances[j - 1];
+                    current = links[j];
+                    moved   = true;
+                }
+            }
+        }
+    }
+
+    return current;
+}
+
+
+/**
+ * \brief Explore a level best first, from an entry point.
+ *
+ * \param query     Reference point.
+ * \param entry     Point the exploration starts from.
+ * \param level     Level explored.
+ * \param ef        Number of closest points kept.
+ * \param context   Closest points found, as a heap with the farthest first (see NeighborQuery::getRanked()).
+ * \param points    Current points.
+ * \param filter    Points to keep, NULL for all of them; other points are still explored.
+ */
+void HnswIndex::searchLevel(ANNpoint query, ANNidx entry, int level, unsigned long ef, NeighborQuery& context, ANNpointArray points, const NeighborFilter* filter) const {
+    const DistanceEngine*               engine(DistanceEngine::getInstance());
+    vector<pair<ANNdist, ANNidx> >&     results(context.getRanked());       // Farthest first
+    vector<pair<ANNdist, ANNidx> >&     frontier(context.getFrontier());    // Closest first
+    greater<pair<ANNdist, ANNidx> >     closer;
+    ANNdist                             distance(engine->distance(query, points[entry], dimensions));
+    ANNidx                              neighbors[2 * HNSW_MAX_LINKS];
+    ANNpoint                            rows[2 * HNSW_MAX_LINKS];
+    ANNdist                             distances[2 * HNSW_MAX_LINKS];
+    ANNidx                              j(0), count(0);
+
+    results.clear();
+    frontier.clear();
+    context.startVisits(levels.size());
+    context.visit(entry);
+
+    frontier.push_back(make_pair(distance, entry));
+    if (!filter || filter->accept(entry))   results.push_back(make_pair(distance, entry));
+
+    while (!frontier.empty()) {
+        pair<ANNdist, ANNidx> current(frontier.front());
+
+        pop_heap(frontier.begin(), frontier.end(), closer);
+        frontier.pop_back();
+
+        // Points left are all farther than the ones kept
+        if (results.size() >= ef && current.first > results.front().first)  break;
+
+        const ANNidx* links(getLinks(current.second, level));
+
+        // Distances to new neighbors at once, so that their points are loaded together
+        for (j = 1, count = 0; j <= links[0]; j++) {
+            if (!context.visit(links[j]))   continue;
+
+            neighbors[count]    = links[j];
+            rows[count]         = points[links[j]];
+            count++;
+        }
+
+        engine->distances(query, rows, count, dimensions, distances);
+
+        for (j = 0; j < count; j++) {
+            ANNidx neighbor(neighbors[j]);
+
+            distance = distances[j];
+            if (results.size() >= ef && distance >= results.front().first)  continue;
+
+            frontier.push_back(make_pair(distance, neighbor));
+            push_heap(frontier.begin(), frontier.end(), closer);
+
+            if (filter && !filter->accept(neighbor))    continue;
+
+            results.push_back(make_pair(distance, neighbor));
+            push_heap(results.begin(), results.end());
+
+            if (results.size() > ef) {
+                pop_heap(results.begin(), results.end());
+                results.pop_back();
+            }
+        }
+    }
+}
+
+
+/**
+ * \brief Choose the neighbors of a point among candidates, with the heuristic of the paper.
+ *
+ * A candidate is kept if it is closer to the point than to any candidate kept so far, so that
+ * links spread in all directions rather than into the closest cluster only.
+ *
+ * \param candidates    Candidates with their squared distance to the point, sorted by distance;
+ *                      replaced by the neighbors kept (modified).
+ * \param count         Number of neighbors kept at most.
+ * \param points        Current points.
+ */
+void HnswIndex::selectNeighbors(vector<pair<ANNdist, ANNidx> >& candidates, unsigned short count, ANNpointArray points) const {
+    const DistanceEngine*               engine(DistanceEngine::getInstance());
+    vector<pair<ANNdist, ANNidx> >      kept;
+    size_t                              i(0), j(0);
+
+    kept.reserve(count);
+
+    for (i = 0; i < candidates.size() && kept.size() < count; i++) {
+        ANNpoint candidate(points[candidates[i].second]);
+
+        for (j = 0; j < kept.size(); j++) {
+            if (engine->distance(candidate, points[kept[j].second], dimensions) < candidates[i].first)
+                break;
+        }
+
+        if (j == kept.size())   kept.push_back(candidates[i]);
+    }
+
+    candidates.swap(kept);
+}
+
+
+/**
+ * \brief Link a point to a new neighbor on a level.
+ *
+ * If the point has as many links as allowed already, the best ones are kept (see selectNeighbors()).
+ *
+ * \param i         Index of the point.
+ * \param neighbor  Index of the new neighbor.
+ * \param level     Level of the link.
+ * \param points    Current points.
+ */
+void HnswIndex::link(ANNidx i, ANNidx neighbor, int level, ANNpointArray points) {
+    const DistanceEngine*               engine(DistanceEngine::getInstance());
+    ANNidx*                             links(getLinks(i, level));
+    unsigned short                      capacity(linksPerLevel(level));
+    vector<pair<ANNdist, ANNidx> >      candidates;
+    ANNidx                              j(0);
+
+    if (links[0] < capacity) {
+        links[++links[0]] = neighbor;
+        return;
+    }
+
+    candidates.reserve(capacity + 1);
+    candidates.push_back(make_pair(engine->distance(points[i], points[neighbor], dimensions), neighbor));
+
+    for (j = 1; j <= links[0]; j++)
+        candidates.push_back(make_pair(engine->distance(points[i], points[links[j]], dimensions), links[j]));
+
+    sort(candidates.begin(), candidates.end());
+    selectNeighbors(candidates, capacity, points);
+
+    links[0] = (ANNidx)candidates.size();
+
+    for (j = 0; j < links[0]; j++)
+        links[j + 1] = candidates[j].second;
+}
\ No newline at end of file
@@ -0,0 +1,87 @@
+#ifndef HNSWINDEX_H
+    #define HNSWINDEX_H
+
+    /**
+     * \file hnswindex.h
+     * \brief HnswIndex class headers.
+     */
+
+    #include <iostream>
+    #include <vector>
+
+    #include "ANN.h"
+
+    #include "constants.h"
+    #include "neighborquery.h"
+
+    class NeighborFilter;
+
+    #define HNSW_LINKS              16      ///< Default neighbors per point on levels above 0 (M); twice as many on level 0
+    #define HNSW_EF_CONSTRUCTION    100     ///< Default candidates considered when inserting a point
+    #define HNSW_EF                 64      ///< Default candidates considered by searches
+    #define HNSW_MAX_LEVEL          16      ///< Highest level of a point
+    #define HNSW_MAX_LINKS          255     ///< Highest M
+
+
+    /**
+     * \brief Hierarchical navigable small world graph over the points of a map (Malkov & Yashunin).
+     *
+     * Each point is linked to close points on level 0, and on a few levels above, drawn at random
+     * with exponentially decreasing probability. Searches descend greedily from the entry point
+     * to level 0, then explore it best first, keeping ef candidates; more candidates give better
+     * recall at the cost of speed. Neighbors are chosen by the heuristic of the paper, which keeps
+     * links between clusters.
+     *
+     * Points are referred to by their index, and are not copied: the caller passes the current
+     * point array to each call. Points are inserted one at a time, so that the graph grows as
+     * coordinates arrive; points cannot be removed, and moving one only degrades searches.
+     *
+     * Searches may run concurrently, each with its own NeighborQuery; other methods are not thread-safe.
+     */
+    class HnswIndex {
+        unsigned short                      dimensions,
+                                            maxLinks,       ///< Neighbors per point on levels above 0 (M)
+                                            efConstruction;
+        double                              levelFactor;    ///< 1 / ln(M), see randomLevel()
+        unsigned long                       size;           ///< Number of points inserted
+        ANNidx                              entryPoint;
+        int                                 topLevel;       ///< Level of the entry point, -1 if the graph is empty
+        std::vector<signed char>            levels;         ///< Level of each point, -1 if it is not inserted
+        std::vector<ANNidx>                 baseLinks;      ///< Per point: count, then 2M neighbors on level 0
+        std::vector<std::vector<ANNidx> >   upperLinks;     ///< Per point: count, then M neighbors, for each level above 0
+        NeighborQuery                       scratch;        ///< Context of the searches made by insert()
+
+        HnswIndex(const HnswIndex&);
+        void operator=(const HnswIndex&);
+
+        unsigned short  linksPerLevel(int)                                                      const;
+        ANNidx*         getLinks(ANNidx, int);
+        const ANNidx*   getLinks(ANNidx, int)                                                   const;
+        int             randomLevel()                                                           const;
+        ANNidx          searchGreedy(ANNpoint, ANNidx, int, int, ANNpointArray)                 const;
+        void            searchLevel(ANNpoint, ANNidx, int, unsigned long, NeighborQuery&, ANNpointArray, const NeighborFilter*)   const;
+        void            selectNeighbors(std::vector<std::pair<ANNdist, ANNidx> >&, unsigned short, ANNpointArray)    const;
+        void            link(ANNidx, ANNidx, int, ANNpointArray);
+
+        public:
+        HnswIndex();
+        ~HnswIndex();
+
+        unsigned long   getSize()                                                               const;
+        unsigned long   getMemoryUsage()                                                        const;
+        unsigned short  getMaxLinks()                                                           const;
+        unsigned short  getEfConstruction()                                                     const;
+        bool            contains(ANNidx)                                                        const;
+
+        void            reset(unsigned short, unsigned short, unsigned short);
+        void            reserve(unsigned long);
+        void            insert(ANNidx, ANNpointArray);
+        void            clear();
+        void            swap(HnswIndex&);
+
+        void            search(ANNpoint, int, int, NeighborQuery&, ANNpointArray, const NeighborFilter* filter = NULL)   const;
+
+        bool            read(std::istream&, unsigned long);
+        bool            write(std::ostream&)                                                    const;
+    };
+#endif
\ No newline at end of file
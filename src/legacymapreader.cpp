@@ -0,0 +1,437 @@
+/**
+ * \file legacymapreader.cpp
+ * \brief LegacyMapReader class implementation.
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "legacymapreader.h"
+#include "trackstore.h"
+
+using namespace std;
+
+
+/// Powers of ten which are exactly representable as doubles.
+static const double powersOf10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+
+/// \return True if c is a whitespace, as understood by input streams (newlines excluded).
+static inline bool isBlank(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+
+/// \return True if c is a decimal digit.
+static inline bool isDigit(char c) {
+    return '0' <= c && c <= '9';
+}
+
+
+/// \brief Constructor.
+LegacyMapReader::LegacyMapReader(unsigned short newDimensions) :
+        file(),
+        body(NULL),
+        total(0),
+        dimensions(newDimensions) {
+}
+
+
+/// \brief Destructor.
+LegacyMapReader::~LegacyMapReader() {
+}
+
+
+/// \return Number of tracks announced in the first line of the file.
+unsigned long LegacyMapReader::getTotal() const {
+    return total;
+}
+
+
+/**
+ * \brief Map the file in memory and read its first line.
+ *
+ * \param path Absolute path to the file.
+ * \return True if the file was successfully opened, false otherwise.
+ */
+bool LegacyMapReader::open(const string& path) {
+    if (!file.open(path))   return false;
+
+    const char* p(file.getData());
+    const char* end(p + file.getSize());
+    const char* lineEnd((const char*)memchr(p, '\n', end - p));
+    long        value(0);
+
+    if (!lineEnd)   lineEnd = end;
+
+    parseInteger(p, lineEnd, value);
+
+    total   = max(value, 0L);
+    body    = min(lineEnd + 1, end);
+
+    return true;
+}
+
+
+/**
+ * \brief Parse all tracks of the file.
+ *
+ * \param tracks    Storage for tracks; resized to the number of tracks read.
+ * \param points    Storage for at least getTotal() points.
+ * \param workers   Number of threads to use; 0 means one per processor.
+ * \return Number of tracks actually read, which may be less than getTotal() if the file is truncated.
+ */
+unsigned long LegacyMapReader::read(TrackStore& tracks, ANNpointArray points, unsigned short workers) {
+    tracks.resize(body ? total : 0);
+
+    if (!body || !total)    return 0;
+
+    if (workers == 0) {
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        workers = (unsigned short)max(info.dwNumberOfProcessors, (DWORD)1);
+    }
+
+    workers = (unsigned short)min((unsigned long)workers, total);
+
+    // Split the file into chunks of the same number of lines
+    const char*             end(file.getData() + file.getSize());
+    const char*             p(body);
+    vector<const char*>     starts(workers + 1, end);
+    vector<unsigned long>   firsts(workers + 1, total);
+    unsigned long           line(0), read(0);
+    unsigned short          k(0);
+
+    while (k < workers) {
+        unsigned long first(k * total / workers);
+
+        while (line < first && p < end) {
+            const char* lineEnd((const char*)memchr(p, '\n', end - p));
+
+            p = lineEnd ? lineEnd + 1 : end;
+            line++;
+        }
+
+        starts[k] = p;
+        firsts[k] = first;
+        k++;
+    }
+
+    // Parse chunks in parallel; the calling thread handles the last one
+    ChunkParser* parsers(new ChunkParser[workers]);
+
+    for (k = 0; k < workers; k++) {
+        parsers[k].setChunk(starts[k], starts[k + 1], firsts[k], firsts[k + 1] - firsts[k]);
+        parsers[k].setStorage(&tracks, points, dimensions);
+    }
+
+    vector<bool> started(workers, false);
+
+    for (k = 0; k + 1 < workers; k++)
+        started[k] = parsers[k].start();
+
+    for (k = 0; k < workers; k++) {
+        if (started[k])     parsers[k].wait();
+        else                parsers[k].run();
+    }
+
+    // Tracks read form a contiguous prefix, even if the file is truncated
+    vector<const char*>     paths(total, "");
+    vector<unsigned long>   pathLengths(total, 0);
+
+    for (k = 0; k < workers; k++) {
+        parsers[k].getPaths(paths, pathLengths);
+        read += parsers[k].getParsed();
+    }
+
+    paths.resize(read);
+    pathLengths.resize(read);
+
+    tracks.resize(read);
+    tracks.buildPaths(paths, pathLengths);
+
+    // Paths point into parsers until now
+    delete[] parsers;
+
+    return read;
+}
+
+
+/**
+ * \brief Parse an integer, skipping leading blanks.
+ *
+ * \param p     Position to start from; updated to the first character after the integer.
+ * \param end   End of the line.
+ * \param value Parsed value (modified only on success).
+ * \return True if an integer was parsed, false otherwise.
+ */
+bool LegacyMapReader::parseInteger(const char*& p, const char* end, long& value) {
+    const char* q(p);
+    bool        negative(false);
+    long        result(0);
+
+    while (q < end && isBlank(*q))  q++;
+
+    if (q < end && (*q == '-' || *q == '+')) {
+        negative = (*q == '-');
+        q++;
+    }
+
+    if (q == end || !isDigit(*q))   return false;
+
+    while (q < end && isDigit(*q)) {
+        result = 10 * result + (*q - '0');
+        q++;
+    }
+
+    value   = negative ? -result : result;
+    p       = q;
+
+    return true;
+}
+
+
+/**
+ * \brief Parse a floating-point number, skipping leading blanks.
+ *
+ * Numbers with at most 15 significant digits and a small exponent (which covers
+ * everything written by the legacy format) are converted exactly with a single
+ * multiplication or division; others are handed to strtod().
+ *
+ * \param p     Position to start from; updated to the first character after the number.
+ * \param end   End of the line.
+ * \param value Parsed value (modified only on success).
+ * \return True if a number was parsed, false otherwise.
+ */
+bool LegacyMapReader::parseDouble(const char*& p, const char* end, double& value) {
+    const char* q(p);
+    const char* start;
+    bool        negative(false), found(false);
+    ULONGLONG   mantissa(0);
+    int         digits(0), exponent(0);
+
+    while (q < end && isBlank(*q))  q++;
+    start = q;
+
+    if (q < end && (*q == '-' || *q == '+')) {
+        negative = (*q == '-');
+        q++;
+    }
+
+    // Integer part
+    while (q < end && isDigit(*q)) {
+        if (digits < 19) {
+            mantissa = 10 * mantissa + (*q - '0');
+            if (mantissa)   digits++;
+        } else
+            exponent++;
+
+        found = true;
+        q++;
+    }
+
+    // Fractional part
+    if (q < end && *q == '.') {
+        q++;
+
+        while (q < end && isDigit(*q)) {
+            if (digits < 19) {
+                mantissa = 10 * mantissa + (*q - '0');
+                if (mantissa)   digits++;
+                exponent--;
+            }
+
+            found = true;
+            q++;
+        }
+    }
+
+    if (!found)     return false;
+
+    // Exponent
+    if (q < end && (*q == 'e' || *q == 'E')) {
+        const char* r(q + 1);
+        long        e(0);
+
+        if (parseInteger(r, end, e) && !isBlank(q[1])) {
+            exponent   += (int)max(min(e, 10000L), -10000L);
+            q           = r;
+        }
+    }
+
+    // Fast path: both operands are exact, so is the correctly rounded result
+    if (digits <= 15 && -22 <= exponent && exponent <= 22) {
+        double result((double)(LONGLONG)mantissa);
+
+        if (exponent < 0)   result /= powersOf10[-exponent];
+        else                result *= powersOf10[exponent];
+
+        value   = negative ? -result : result;
+        p       = q;
+
+        return true;
+    }
+
+    // Slow path; long tokens (many digits) are copied to the heap
+    char buffer[64];
+
+    if (q - start >= (long)sizeof(buffer)) {
+        string token(start, q);
+
+        value   = strtod(token.c_str(), NULL);
+        p       = q;
+
+        return true;
+    }
+
+    memcpy(buffer, start, q - start);
+    buffer[q - start] = '\0';
+
+    value   = strtod(buffer, NULL);
+    p       = q;
+
+    return true;
+}
+
+
+/// \brief Default constructor.
+LegacyMapReader::ChunkParser::ChunkParser() :
+        begin(NULL),
+        end(NULL),
+        tracks(NULL),
+        points(NULL),
+        first(0),
+        count(0),
+        parsed(0),
+        dimensions(0),
+        paths(),
+        pathLengths() {
+}
+
+
+/// \brief Destructor.
+LegacyMapReader::ChunkParser::~ChunkParser() {
+}
+
+
+/// \return Number of tracks parsed by the last run.
+unsigned long LegacyMapReader::ChunkParser::getParsed() const {
+    return parsed;
+}
+
+
+/**
+ * \brief Set the lines to parse.
+ *
+ * \param newBegin  Beginning of the first line.
+ * \param newEnd    End of the chunk.
+ * \param newFirst  Index of the track stored in the first line.
+ * \param newCount  Number of lines in the chunk.
+ */
+void LegacyMapReader::ChunkParser::setChunk(const char* newBegin, const char* newEnd, ANNidx newFirst, unsigned long newCount) {
+    begin   = newBegin;
+    end     = newEnd;
+    first   = newFirst;
+    count   = newCount;
+}
+
+
+/**
+ * \brief Set where parsed tracks and coordinates are written.
+ *
+ * \param newTracks     Storage for tracks, with room for all tracks of the chunk.
+ * \param newPoints     Storage for points, indexed by track index.
+ * \param newDimensions Number of coordinates per point.
+ */
+void LegacyMapReader::ChunkParser::setStorage(TrackStore* newTracks, ANNpointArray newPoints, unsigned short newDimensions) {
+    tracks      = newTracks;
+    points      = newPoints;
+    dimensions  = newDimensions;
+}
+
+
+/// \brief Parse all lines of the chunk.
+void LegacyMapReader::ChunkParser::run() {
+    const char* p(begin);
+    long        value(0);
+
+    parsed = 0;
+    paths.clear();
+    pathLengths.clear();
+    pathLengths.reserve(count);
+
+    while (parsed < count && p < end) {
+        const char* lineEnd((const char*)memchr(p, '\n', end - p));
+        ANNidx      i(first + parsed);
+        short       code(UNTESTED);
+
+        if (!lineEnd)   lineEnd = end;
+
+        // Extract MuseekCode
+        if (parseInteger(p, lineEnd, value))
+            code = (short)value;
+        tracks->setCode(i, (MuseekCode)code);
+
+        // Extract artist ID
+        if (code != ARTIST_NOT_FOUND && code != NOTHING_FOUND && parseInteger(p, lineEnd, value))
+            tracks->setArtistID(i, value);
+
+        // Extract title ID
+        if (code != ARTIST_NOT_FOUND && code != TITLE_NOT_FOUND && code != NOTHING_FOUND && parseInteger(p, lineEnd, value))
+            tracks->setTitleID(i, value);
+
+        // Extract length
+        if (parseInteger(p, lineEnd, value))
+            tracks->setLength(i, value);
+
+        // Extract coordinates
+        if (code != NOTHING_FOUND && code != ARTIST_NOT_FOUND) {
+            unsigned short j(0);
+
+            while (j < dimensions && parseDouble(p, lineEnd, points[i][j]))
+                j++;
+        }
+
+        // Extract path, where spaces were replaced by '|'
+        while (p < lineEnd && isBlank(*p))  p++;
+
+        const char* pathEnd(p);
+        while (pathEnd < lineEnd && !isBlank(*pathEnd))     pathEnd++;
+
+        unsigned long position(paths.size());
+
+        paths.append(p, pathEnd);
+        replace(paths.begin() + position, paths.end(), '|', ' ');
+        pathLengths.push_back(pathEnd - p);
+
+        p = lineEnd + 1;
+        parsed++;
+    }
+}
+
+
+/**
+ * \brief Get parsed paths, so that they can be stored all at once.
+ *
+ * The track store is not thread-safe; hence this must be called once all chunks are parsed.
+ * Returned paths remain valid until the parser is destroyed or run again.
+ *
+ * \param allPaths      Path of each track (modified only for tracks of this chunk).
+ * \param allLengths    Length of each path (idem).
+ */
+void LegacyMapReader::ChunkParser::getPaths(vector<const char*>& allPaths, vector<unsigned long>& allLengths) const {
+    unsigned long i(0), position(0);
+
+    while (i < pathLengths.size()) {
+        allPaths[first + i]     = paths.data() + position;
+        allLengths[first + i]   = pathLengths[i];
+
+        position += pathLengths[i];
+        i++;
+    }
+}
@@ -0,0 +1,80 @@
+#ifndef LEGACYMAPREADER_H
+    #define LEGACYMAPREADER_H
+
+    /**
+     * \file legacymapreader.h
+     * \brief LegacyMapReader class headers.
+     */
+
+    #include <string>
+    #include <vector>
+
+    #include "ANN.h"
+
+    #include "constants.h"
+    #include "cthread.h"
+    #include "mappedfile.h"
+
+    class TrackStore;
+
+
+    /**
+     * \brief Parallel reader for the legacy text map format.
+     *
+     * The first line of the file holds the number of tracks; then each track is stored
+     * in a different line with the following pattern:
+     *      MuseekCode [artistID] [titleID] length [coordinate1 ... coordinateN] path
+     * where spaces in path are replaced by '|'.
+     *
+     * The file is mapped in memory and split into line-aligned chunks, which are parsed
+     * in parallel by a hand-written scanner; no stream nor temporary string is involved.
+     * Parsed coordinates are written in place into storage allocated by the caller, and parsed
+     * attributes into a track store; paths are only handed to the store once all threads are done.
+     */
+    class LegacyMapReader {
+        /// \brief Thread parsing one chunk of lines.
+        class ChunkParser : public CThread {
+            const char*     begin;
+            const char*     end;
+            TrackStore*     tracks;
+            ANNpointArray   points;
+            ANNidx          first;
+            unsigned long   count,
+                            parsed;
+            unsigned short  dimensions;
+            std::string     paths;          ///< Parsed paths, one after the other
+            std::vector<unsigned long>  pathLengths;
+
+            public:
+            ChunkParser();
+            ~ChunkParser();
+
+            unsigned long   getParsed()     const;
+            void            getPaths(std::vector<const char*>&, std::vector<unsigned long>&)  const;
+
+            void            setChunk(const char*, const char*, ANNidx, unsigned long);
+            void            setStorage(TrackStore*, ANNpointArray, unsigned short);
+            void            run();
+        };
+
+        MappedFile          file;
+        const char*         body;
+        unsigned long       total;
+        unsigned short      dimensions;
+
+        LegacyMapReader(const LegacyMapReader&);
+        void operator=(const LegacyMapReader&);
+
+        public:
+        LegacyMapReader(unsigned short);
+        ~LegacyMapReader();
+
+        unsigned long       getTotal()  const;
+
+        bool                open(const std::string&);
+        unsigned long       read(TrackStore&, ANNpointArray, unsigned short workers = 0);
+
+        static bool         parseInteger(const char*&, const char*, long&);
+        static bool         parseDouble(const char*&, const char*, double&);
+    };
+#endif
@@ -3,6 +3,9 @@
  * \brief Map class implementation.
  */
 
+#include <algorithm>
+#include <climits>
+#include <cstddef>
 #include <fstream>
 #include <sstream>
 //#include <windows.h>  // Needed for progress bar
@@ -12,10 +15,16 @@
 #include "wa_ipc.h"
 #include "nde/NDE.h"
 
+#include "compressor.h"
 #include "constants.h"
+#include "distanceengine.h"
 #include "logger.h"
 #include "gen_museek.h"
+#include "legacymapreader.h"
 #include "map.h"
+#include "mapformat.h"
+#include "mappedfile.h"
+#include "packedmapfile.h"
 #include "shuffler.h"
 #include "track.h"
 #include "utils.h"
@@ -23,7 +32,10 @@
 using namespace std;
 
 
-Map* Map::instance = NULL;
+Map*            Map::instance = NULL;
+pthread_mutex_t Map::instanceLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t Map::treeSearchLock = PTHREAD_MUTEX_INITIALIZER;
+unsigned long   Map::retiredMaps = 0;
 HINSTANCE g_inst;
 
 extern winampGeneralPurposePlugin   plugin;
@@ -45,14 +57,45 @@ static size_t writer(char* data, size_t size, size_t nmemb, string* buffer) {
 
 /// \brief Default constructor.
 Map::Map() :
-        allocatedPoints(0),
+        parent(NULL),
+        references(1),
+        readers(0),
+        retired(false),
         dimensions(32),
         tracksPerQuery(25),
-        points(NULL),
+        points(),
+        mappedFile(NULL),
+        coordinateMode(COORDINATES_DOUBLE),
+        indexBackend(INDEX_KD_TREE),
+        splitRule(ANN_KD_SUGGEST),
+        shrinkRule(ANN_BD_SUGGEST),
+        prioritySearch(false),
+        searchIndex(NULL),
         kDimensionalTree(NULL),
+        simdScan(false),
+        graph(),
+        graphLinks(HNSW_LINKS),
+        graphEfConstruction(HNSW_EF_CONSTRUCTION),
+        graphEf(HNSW_EF),
+        treeOwnsPoints(false),
+        searchReady(0),
+        merging(0),
+        lazyLoading(true),
+        generation(0),
+        baseSize(0),
+        mapCompression(COMPRESSION_NONE),
         errorBound(0),
-        resultsID(NULL),
-        distances(NULL) {
+        searchErrorBound(0),
+        maxPointsVisited(0),
+        latencyTarget(0),
+        compaction(this),
+        indexing(this) {
+    memset(&library, 0, sizeof(library));
+    points.setDimensions(dimensions);
+    pthread_rwlock_init(&searchLock, NULL);
+
+    // Detect vector instructions before threads may search
+    DistanceEngine::getInstance();
 }
 
 
@@ -62,32 +105,183 @@ Map::Map() :
  * Deallocate memory for coordinates, and clean up curl.
  */
 Map::~Map() {
-    delete kDimensionalTree;
+    indexing.wait();
+    compaction.wait();
 
-    if (resultsID && distances) {
-        delete[] resultsID;
-        delete[] distances;
-    }
-
-    annDeallocPts(points);
+    releasePoints();
+    pthread_rwlock_destroy(&searchLock);
 }
 
 
-/// \return Unique instance of Map class.
+/**
+ * \brief Get the current map.
+ *
+ * The map is not pinned: threads that may run while a rescan publishes a new map
+ * must use acquire() instead.
+ *
+ * \return Current map.
+ */
 Map* Map::getInstance() {
+    pthread_mutex_lock(&instanceLock);
+
     if (instance == NULL)
         instance = new Map;
 
-    return instance;
+    Map* map(instance);
+    pthread_mutex_unlock(&instanceLock);
+
+    return map;
 }
 
 
-/// \brief Delete the unique instance of Map class.
+/// \brief Drop the current map; it is deleted once no track refers to it anymore.
 void Map::kill() {
-    if (instance != NULL) {
-        delete instance;
-        instance = NULL;
+    pthread_mutex_lock(&instanceLock);
+    Map* map(instance);
+    instance = NULL;
+    pthread_mutex_unlock(&instanceLock);
+
+    if (map != NULL)
+        map->removeReference();
+}
+
+
+/**
+ * \brief Create an empty map with the settings of the current one.
+ *
+ * The new map is meant to be filled, then made current with publish().
+ *
+ * \return New map, with one reference held by the caller.
+ */
+Map* Map::create() {
+    Map* current(acquire());
+    Map* map(new Map);
+
+    map->parent         = current->parent;
+    map->tracksPerQuery = current->tracksPerQuery;
+    map->errorBound     = current->errorBound;
+    map->latencyTarget  = current->latencyTarget;
+    map->coordinateMode = current->coordinateMode;
+    map->indexBackend   = current->indexBackend;
+    map->splitRule      = current->splitRule;
+    map->shrinkRule     = current->shrinkRule;
+    map->prioritySearch = current->prioritySearch;
+    map->graphLinks     = current->graphLinks;
+    map->graphEf        = current->graphEf;
+    map->graphEfConstruction = current->graphEfConstruction;
+    map->mapCompression = current->mapCompression;
+    map->lazyLoading    = current->lazyLoading;
+    map->setDimensions(current->dimensions);
+
+    current->release();
+    return map;
+}
+
+
+/**
+ * \brief Pin the current map, so that it remains valid even if another one is published.
+ *
+ * \return Current map, to be unpinned with release().
+ */
+Map* Map::acquire() {
+    pthread_mutex_lock(&instanceLock);
+
+    if (instance == NULL)
+        instance = new Map;
+
+    Map* map(instance);
+    map->addReference();
+    InterlockedIncrement(&map->readers);
+    pthread_mutex_unlock(&instanceLock);
+
+    return map;
+}
+
+
+/**
+ * \brief Make a map the current one.
+ *
+ * Readers of the previous map keep it until they release it; it is deleted afterwards.
+ *
+ * \param map  New current map; the caller's reference to it is handed over.
+ */
+void Map::publish(Map* map) {
+    pthread_mutex_lock(&instanceLock);
+    Map* previous(instance);
+    instance = map;
+
+    if (previous != NULL) {
+        previous->retired = true;
+        retiredMaps++;
+    }
+
+    pthread_mutex_unlock(&instanceLock);
+
+    if (previous != NULL)
+        previous->removeReference();
+}
+
+
+/**
+ * \brief Wait until all maps replaced by publish() have been deleted.
+ *
+ * The map file cannot be overwritten while a replaced map still maps it.
+ *
+ * \param timeout  Maximum time to wait, in milliseconds.
+ * \return True if no replaced map remains, false on timeout.
+ */
+bool Map::synchronize(DWORD timeout) {
+    DWORD start(GetTickCount());
+
+    while (true) {
+        pthread_mutex_lock(&instanceLock);
+        unsigned long remaining(retiredMaps);
+        pthread_mutex_unlock(&instanceLock);
+
+        if (remaining == 0)                         return true;
+        if (GetTickCount() - start >= timeout)      return false;
+
+        Sleep(10);
+    }
+}
+
+
+/// \brief Add a reference to the map, such as the one of a track (see removeReference()).
+void Map::addReference() {
+    InterlockedIncrement(&references);
+}
+
+
+/**
+ * \brief Unpin a map pinned by acquire().
+ *
+ * Map files detached meanwhile are unmapped with the last reader (see detachMappedFile()):
+ * tracks only pin the map, they hold no point.
+ */
+void Map::release() {
+    if (InterlockedDecrement(&readers) == 0)    releaseRetiredMappings();
+
+    removeReference();
+}
+
+
+/// \brief Remove a reference to the map; the map is deleted with the last one.
+void Map::removeReference() {
+    if (InterlockedDecrement(&references) > 0)  return;
+
+    if (retired) {
+        pthread_mutex_lock(&instanceLock);
+        retiredMaps--;
+        pthread_mutex_unlock(&instanceLock);
     }
+
+    delete this;
+}
+
+
+/// \return Representation of coordinates nearest neighbors are searched on.
+CoordinateMode Map::getCoordinateMode() const {
+    return coordinateMode;
 }
 
 
@@ -97,12 +291,57 @@ unsigned short Map::getDimensions() const {
 }
 
 
+/// \return Search structure built in COORDINATES_DOUBLE mode.
+IndexBackend Map::getIndexBackend() const {
+    return indexBackend;
+}
+
+
+/// \return Candidates considered by searches of the graph of INDEX_HNSW.
+int Map::getGraphEf() const {
+    return graphEf;
+}
+
+
+/// \return Target 99th percentile of tree searches, in microseconds; 0 for none (see setLatencyTarget()).
+unsigned long Map::getLatencyTarget() const {
+    return latencyTarget;
+}
+
+
+/// \return Rule used to split cells of trees.
+ANNsplitRule Map::getSplitRule() const {
+    return splitRule;
+}
+
+
+/// \return Rule used to shrink cells of box-decomposition trees.
+ANNshrinkRule Map::getShrinkRule() const {
+    return shrinkRule;
+}
+
+
+/**
+ * \param i Index of the track.
+ * \return MuseekCode of the track.
+ */
+MuseekCode Map::getCode(ANNidx i) const {
+    return tracks.getCode(i);
+}
+
+
+/// \return True if the track has coordinates in the map; never downloads them, see TrackStore::hasCoordinates().
+bool Map::hasCoordinates(ANNidx i) const {
+    return tracks.hasCoordinates(i);
+}
+
+
 /**
  * \param k Index of the point.
  * \return The point at the given index.
  */
 ANNpoint Map::getPoint(ANNidx k) {
-    if (!(tracks[k].hasCoordinates()))
+    if (!(getTrack(k).hasCoordinates()))
         return NULL;
 
     return points[k];
@@ -111,7 +350,34 @@ ANNpoint Map::getPoint(ANNidx k) {
 
 /// \return Number of tracks in current map.
 unsigned int Map::getSize() const {
-    return tracks.size();
+    return tracks.getSize();
+}
+
+
+/// \return True if the track has been played recently, false otherwise.
+bool Map::isAlreadyPlayed(ANNidx i) const {
+    return tracks.isAlreadyPlayed(i);
+}
+
+
+/// \return True if load() builds the search structure in background (see setLazyLoading()).
+bool Map::isLazyLoading() const {
+    return lazyLoading;
+}
+
+
+/// \return True if trees are searched with annkPriSearch() (see setPrioritySearch()).
+bool Map::isPrioritySearch() const {
+    return prioritySearch;
+}
+
+
+/**
+ * \return True if the search structure is built, false if searches are still made over
+ *         a window of tracks (see setLazyLoading()).
+ */
+bool Map::isSearchReady() const {
+    return searchReady != 0;
 }
 
 
@@ -119,42 +385,40 @@ unsigned int Map::getSize() const {
  * \param k Index of the track.
  * \return The track at the given index.
  */
-Track* Map::getTrack(ANNidx k) {
-    return &(tracks[k]);
+Track Map::getTrack(ANNidx k) {
+    return Track(this, &tracks, k);
 }
 
 
 /**
- * \brief Add a single track to the map.
+ * \brief Pick a track at random, among those still in the library.
  *
- * This should only be used for debugging purposes, unless one finds a better way to implement it;
- * indeed, the current implementation has a linear time cost.
+ * \return A random track; an invalid track if there is none (see Track::isValid()).
  */
-void Map::addTrack(string artist, string title, string path) {
-    ANNpointArray  newPoints = annAllocPts(tracks.size() + 1, dimensions);
-    unsigned int   i(0), j(0);
+Track Map::getRandomTrack() {
+    unsigned long n(tracks.getSize()), attempts(0);
 
-    while (i < tracks.size()) {
-        while (j < dimensions) {
-            newPoints[i][j] = points[i][j];
-            j++;
-        }
+    while (attempts < n) {
+        ANNidx i(rand() % n);
 
-        j = 0;
-        i++;
+        if (tracks.getCode(i) != REMOVED)   return getTrack(i);
+        attempts++;
     }
-    
-    annDeallocPts(points);
-    points = newPoints;
+
+    return Track();
+}
 
 
-    Track newTrack(i);
+/**
+ * \brief Add a single track to the map.
+ *
+ * This takes amortized constant time; the track is not part of the k-dimensional tree
+ * until it is rebuilt.
+ */
+void Map::addTrack(string artist, string title, string path) {
+    Track newTrack(insert(path));
         newTrack.setArtist(artist);
         newTrack.setTitle(title);
-        newTrack.setPath(path);
-
-    missingCoordinates.push_back(tracks.size());
-    tracks.push_back(newTrack);
 }
 
 
@@ -166,10 +430,7 @@ void Map::addTrack(string artist, string title, string path) {
  * This method is provided only for convenience.
  */
 bool Map::downloadCoordinates(ANNidx index) {
-    list<ANNidx> indices;
-    indices.push_back(index);
-
-    return downloadCoordinates(indices);
+    return downloadCoordinates(vector<ANNidx>(1, index));
 }
 
 
@@ -178,9 +439,61 @@ bool Map::downloadCoordinates(ANNidx index) {
  *
  * \param indices Indices of tracks in the map.
  */
-bool Map::downloadCoordinates(list<ANNidx> indices) {
+bool Map::downloadCoordinates(const vector<ANNidx>& indices) {
     if (indices.empty())    return true;
 
+    // A merge of the delta may go on: new coordinates are appended to the delta. A structure
+    // prepared after a lazy load would miss them though.
+    if (!searchReady)   indexing.wait();
+    compaction.wait();
+
+    // Split queries into N tracks each
+    vector<ANNidx>  batch;
+    unsigned long   i(0);
+
+    for (i = 0; i < indices.size(); i += tracksPerQuery) {
+        batch.assign(indices.begin() + i, indices.begin() + min((unsigned long)indices.size(), i + tracksPerQuery));
+        queryCoordinates(batch);
+    }
+
+    // Update search structure
+    indexCoordinates();
+
+    return true;
+}
+
+
+/**
+ * \brief Download coordinates for all tracks that still don't have ones.
+ *
+ * Tracks are queried in batches taken from the set of missing coordinates; those left
+ * without coordinates by a previous call are tried again. The search structure is brought up
+ * to date afterwards (see indexCoordinates()), and built if it was not yet.
+ */
+bool Map::downloadMissingCoordinates() {
+    if (!searchReady)   indexing.wait();
+    compaction.wait();
+
+    vector<ANNidx> batch;
+
+    missingCoordinates.requeue();
+
+    while (missingCoordinates.nextBatch(tracksPerQuery, batch))
+        queryCoordinates(batch);
+
+    // Update search structure
+    indexCoordinates();
+
+    return true;
+}
+
+
+/**
+ * \brief Query the server for coordinates of a batch of tracks, in a single HTTP request.
+ *
+ * \param batch Indices of tracks in the map, at most tracksPerQuery of them.
+ */
+void Map::queryCoordinates(const vector<ANNidx>& batch) {
     // TODO: make this work
     /* Display a progress bar
     InitCommonControls();
@@ -202,124 +515,237 @@ bool Map::downloadCoordinates(list<ANNidx> indices) {
                             response,
                             error;
     list<ANNidx>            processedIndices;
-    //list<ANNidx>::iterator  i = indices.begin();
     ANNidx                  i;
     unsigned int            j(0);
+    unsigned long           l(0);
 
-    // Split queries into N tracks each
-    while (!indices.empty()) {
-        while (!indices.empty() && j < tracksPerQuery) {
-            i = indices.front();
-            indices.pop_front();
-
-            // Check if index if valid
-            if (i >= tracks.size()) {
-                logger->log("[WARNING] Invalid index of track (");
-                logger->log(i);
-                logger->log(" > ");
-                logger->log(tracks.size());
-                logger->log(")\n\n");
+    for (l = 0; l < batch.size(); l++) {
+        i = batch[l];
 
-                continue;
-            }
+        // Check if index if valid
+        if (i >= tracks.getSize()) {
+            logger->log("[WARNING] Invalid index of track (");
+            logger->log(i);
+            logger->log(" > ");
+            logger->log(tracks.getSize());
+            logger->log(")\n\n");
+
+            continue;
+        }
 
-            // Build URL
-            ostringstream stream;
-            stream << j;
+        // Build URL
+        ostringstream stream;
+        stream << j;
 
-            if (!j)     URL += "?";
-            else        URL += "&";
+        if (!j)     URL += "?";
+        else        URL += "&";
 
-            URL += "artist[";
-            URL += stream.str();
-            URL += "]=";
-            URL += URLEncode(tracks[i].getArtist());
-            URL += "&title[";
-            URL += stream.str();
-            URL += "]=";
-            URL += URLEncode(tracks[i].getTitle());
+        URL += "artist[";
+        URL += stream.str();
+        URL += "]=";
+        URL += URLEncode(tracks.getArtist(i));
+        URL += "&title[";
+        URL += stream.str();
+        URL += "]=";
+        URL += URLEncode(tracks.getTitle(i));
 
-            // Remember current indices
-            processedIndices.push_back(i);
+        // Remember current indices
+        processedIndices.push_back(i);
 
-            j++;
-        }
+        j++;
+    }
 
-        // Setup the HTTP connection
-        CURL* curlSession = curl_easy_init();
-            curl_easy_setopt(curlSession, CURLOPT_URL, URL.c_str());
-            curl_easy_setopt(curlSession, CURLOPT_NOPROGRESS, 1L);          // Turn off progress meter
-            curl_easy_setopt(curlSession, CURLOPT_WRITEFUNCTION, writer);
-            curl_easy_setopt(curlSession, CURLOPT_WRITEDATA, &response);
-            //curl_easy_setopt(curlSession, CURLOPT_ERRORBUFFER, error);
+    if (processedIndices.empty())   return;
 
-        curl_easy_perform(curlSession);
-        curl_easy_cleanup(curlSession);
+    // Setup the HTTP connection
+    CURL* curlSession = curl_easy_init();
+        curl_easy_setopt(curlSession, CURLOPT_URL, URL.c_str());
+        curl_easy_setopt(curlSession, CURLOPT_NOPROGRESS, 1L);          // Turn off progress meter
+        curl_easy_setopt(curlSession, CURLOPT_WRITEFUNCTION, writer);
+        curl_easy_setopt(curlSession, CURLOPT_WRITEDATA, &response);
+        //curl_easy_setopt(curlSession, CURLOPT_ERRORBUFFER, error);
 
-        // TODO: test if response is valid
-        //MessageBoxA(plugin.hwndParent, response.c_str(), "RESPONSE", MB_OK);
+    curl_easy_perform(curlSession);
+    curl_easy_cleanup(curlSession);
 
-        /*char effectiveURL[500];
-        curl_easy_getinfo(curlSession, CURLINFO_EFFECTIVE_URL, effectiveURL);
-        MessageBoxA(plugin.hwndParent, effectiveURL, "EFFECTIVE URL", MB_OK);
+    // TODO: test if response is valid
+    //MessageBoxA(plugin.hwndParent, response.c_str(), "RESPONSE", MB_OK);
 
-        /*long responseCode;
-        curl_easy_getinfo(curlSession, CURLINFO_RESPONSE_CODE, responseCode);
-        MessageBoxA(plugin.hwndParent, responseCode, "responseCode", MB_OK);//*/
+    /*char effectiveURL[500];
+    curl_easy_getinfo(curlSession, CURLINFO_EFFECTIVE_URL, effectiveURL);
+    MessageBoxA(plugin.hwndParent, effectiveURL, "EFFECTIVE URL", MB_OK);
 
-        /*double sizedownload;
-        curl_easy_getinfo(curlSession, CURLINFO_SIZE_DOWNLOAD , sizedownload);
-        MessageBoxA(plugin.hwndParent, sizedownload, "sizedownload", MB_OK);//*/
+    /*long responseCode;
+    curl_easy_getinfo(curlSession, CURLINFO_RESPONSE_CODE, responseCode);
+    MessageBoxA(plugin.hwndParent, responseCode, "responseCode", MB_OK);//*/
 
-        /*char primaryIP[500];
-        curl_easy_getinfo(curlSession, CURLINFO_PRIMARY_IP , primaryIP);
-        MessageBoxA(plugin.hwndParent, primaryIP, "primaryIP", MB_OK);//*/
+    /*double sizedownload;
+    curl_easy_getinfo(curlSession, CURLINFO_SIZE_DOWNLOAD , sizedownload);
+    MessageBoxA(plugin.hwndParent, sizedownload, "sizedownload", MB_OK);//*/
 
-        // Log response
-        #ifdef DEBUG_HTTP_QUERY
-        logger->log("[HTTP response]\n" + response + "\n\n");
-        #endif
+    /*char primaryIP[500];
+    curl_easy_getinfo(curlSession, CURLINFO_PRIMARY_IP , primaryIP);
+    MessageBoxA(plugin.hwndParent, primaryIP, "primaryIP", MB_OK);//*/
 
-        parseResponse(response, processedIndices);
+    // Log response
+    #ifdef DEBUG_HTTP_QUERY
+    logger->log("[HTTP response]\n" + response + "\n\n");
+    #endif
+
+    parseResponse(response, processedIndices);
+}
 
-        // Post-processing
-        processedIndices.clear();
-        response.clear();
-        error.clear();
 
-        URL = SCRIPT_URL;
-        j   = 0;
+/**
+ * \brief Inserts a track without computing its coordinates (lazy behavior).
+ *
+ * The row of a removed track is reused if there is one; otherwise, storage for the point
+ * grows as needed (see setSize() to allocate it at once).
+ *
+ * \param path File location of the new track.
+ * \return The new track, whose other attributes may then be set.
+ */
+Track Map::insert(const string& path) {
+    unsigned long n(tracks.getSize());
+
+    indexing.wait();
+    compaction.wait();
+
+    if (!freeTracks.empty()) {
+        n = freeTracks.back();
+        freeTracks.pop_back();
+        tracks.setCode(n, UNTESTED);
+    } else {
+        points.resize(n + 1);
+        tracks.resize(n + 1);
     }
 
-    // Update k-dimensional tree
-    if (kDimensionalTree)   delete kDimensionalTree;
+    tracks.setPath(n, path);
 
-    kDimensionalTree = new ANNkd_tree(points, tracks.size(), dimensions);
+    missingCoordinates.mark(n);
+    pathIndex.insert(hashPath(path), n);
+    markDirty(n);
 
-    return true;
+    return getTrack(n);
 }
 
 
 /**
- * \brief Download coordinates for all tracks that still don't have ones.
+ * \brief Bring a track up to date with the media library, during a rescan.
  *
- * This method is provided only for convenience.
+ * A track already in the map with this path keeps its ID, code and coordinates, unless its
+ * file changed since the last scan: it is then queued for download again. Other tracks are
+ * inserted. A stamp of 0 stands for an unknown one, e.g. in maps written before stamps were
+ * stored; such tracks are assumed to be unchanged.
+ *
+ * \param path  File location of the track.
+ * \param stamp Stamp of the track file (see stampFile()).
+ * \return The track, whose other attributes may then be set.
  */
-bool Map::downloadMissingCoordinates() {
-    return downloadCoordinates(missingCoordinates);
+Track Map::update(const string& path, DWORD stamp) {
+    ANNidx i(0);
+
+    if (findPath(path, i)) {
+        DWORD previous(tracks.getStamp(i));
+
+        if (previous != stamp) {
+            tracks.setStamp(i, stamp);
+            markDirty(i);
+        }
+
+        // File edited: tags, and thus coordinates, may have changed
+        if (previous != 0 && previous != stamp) {
+            tracks.setCode(i, UNTESTED);
+            tracks.setArtistID(i, 0);
+            tracks.setTitleID(i, 0);
+            missingCoordinates.mark(i);
+            markChanged(i);
+        }
+
+        return getTrack(i);
+    }
+
+    Track newTrack(insert(path));
+    tracks.setStamp(newTrack.getId(), stamp);
+
+    return newTrack;
+}
+
+
+/**
+ * \brief Remove a track that is no longer in the media library.
+ *
+ * Other tracks keep their IDs: the row is marked as REMOVED, and reused by the next insert().
+ * Its point may remain in the search structure: markChanged() adds the track to the delta, so
+ * that searches skip it, until the background merge (see mergeDelta()) drops it for good.
+ *
+ * \param i Index of the track.
+ */
+void Map::remove(ANNidx i) {
+    indexing.wait();
+    compaction.wait();
+
+    if (tracks.getCode(i) == REMOVED)   return;
+
+    pathIndex.remove(hashPath(tracks.getPath(i)), i);
+
+    if (*tracks.getArtist(i) && *tracks.getTitle(i))
+        nameIndex.remove(hashName(normalizeName(tracks.getArtist(i)), normalizeName(tracks.getTitle(i))), i);
+
+    tracks.setPath(i, string());
+    tracks.setCode(i, REMOVED);
+    tracks.setArtistID(i, 0);
+    tracks.setTitleID(i, 0);
+    tracks.setLength(i, 0);
+    tracks.setStamp(i, 0);
+    tracks.setAlreadyPlayed(i, false);
+    tracks.setArtist(i, string());
+    tracks.setTitle(i, string());
+    tracks.setAlbum(i, string());
+    tracks.setGenre(i, string());
+    tracks.setYear(i, 0);
+
+    missingCoordinates.unmark(i);
+    freeTracks.push_back(i);
+    markDirty(i);
+    markChanged(i);
 }
 
 
-/// \brief Inserts a track without computing its coordinates (lazy behavior).
-void Map::insert(Track newTrack) {
-    unsigned long n(tracks.size());
+/**
+ * \brief Replace the tracks of this map by those of another one, with the same IDs.
+ *
+ * Paths, stamps, codes, Museek IDs, lengths and coordinates are copied; tags are not, as
+ * a rescan sets them again. Untested tracks are queued for download.
+ *
+ * \param map Map to copy tracks from; it must have the same number of dimensions.
+ */
+void Map::copyTracks(const Map& map) {
+    unsigned long   n(map.tracks.getSize()), i(0);
+    string          path;
 
-    if (newTrack.getId() != n)
-        newTrack.setId(n);
+    clear();
+    points.reserve(n);
+    points.resize(n);
+    tracks.reserve(n);
+    tracks.resize(n);
+
+    for (i = 0; i < n; i++) {
+        map.tracks.getPath(i, path);
+
+        tracks.setPath(i, path);
+        tracks.setStamp(i, map.tracks.getStamp(i));
+        tracks.setCode(i, map.tracks.getCode(i));
+        tracks.setArtistID(i, map.tracks.getArtistID(i));
+        tracks.setTitleID(i, map.tracks.getTitleID(i));
+        tracks.setLength(i, map.tracks.getLength(i));
+        memcpy(points[i], map.points[i], dimensions * sizeof(ANNcoord));
+
+        if (map.tracks.getCode(i) == UNTESTED)
+            missingCoordinates.mark(i);
+    }
 
-    missingCoordinates.push_back(n);
-    fileIndex[newTrack.getPath()] = n;
-    tracks.push_back(newTrack);
+    buildIndexes();
 }
 
 
@@ -353,7 +779,9 @@ void Map::parseResponse(string response, list<ANNidx>& indices) {
             if (newCode == 4) newCode = 3; // Codes 3 and 4 are equivalent
                 code = (MuseekCode)newCode;
 
-            tracks[i].setCode(code);
+            tracks.setCode(i, code);
+            markDirty(i);
+            markChanged(i);
 
             //  Next line
             if (code == ALL_FOUND)
@@ -380,7 +808,7 @@ void Map::parseResponse(string response, list<ANNidx>& indices) {
             if (stream.bad())
                 logger->log("[WARNING] Unable to read artist name from HTTP response.");
             else
-                tracks[i].setArtist(line);
+                tracks.setArtist(i, line);
 
             //  Next line
             if (code == ARTIST_APPROXIMATE || code == TITLE_NOT_FOUND)
@@ -399,7 +827,7 @@ void Map::parseResponse(string response, list<ANNidx>& indices) {
             if (stream.bad())
                 logger->log("[WARNING] Unable to read title from HTTP response.");
             else
-                tracks[i].setTitle(line);
+                tracks.setTitle(i, line);
 
             next = ARTIST_ID;
         }
@@ -411,7 +839,7 @@ void Map::parseResponse(string response, list<ANNidx>& indices) {
             stringstream ss(line);
             ss >> buffer;
 
-            tracks[i].setArtistID(buffer);
+            tracks.setArtistID(i, buffer);
 
             //  Next line
             if (code == ALL_FOUND || code == TITLE_APPROXIMATE || code == ARTIST_APPROXIMATE || code == ARTIST_TITLE_APPROXIMATE)
@@ -429,7 +857,7 @@ void Map::parseResponse(string response, list<ANNidx>& indices) {
             stringstream ss(line);
             ss >> buffer;
 
-            tracks[i].setTitleID(buffer);
+            tracks.setTitleID(i, buffer);
             next = COORDINATE;
         }
 
@@ -445,7 +873,10 @@ void Map::parseResponse(string response, list<ANNidx>& indices) {
             k++;
 
             if (k == dimensions) {
-                missingCoordinates.remove(i);
+                missingCoordinates.unmark(i);
+
+                // Again, now that the point is written, in case a merge read it meanwhile
+                markChanged(i);
                 
                 // Switch to next track
                 indices.pop_front();
@@ -462,392 +893,2389 @@ void Map::parseResponse(string response, list<ANNidx>& indices) {
 
 ///
 void Map::setNearestNeighborErrorBound(double newBound) {
-    errorBound = newBound;
+    errorBound          = newBound;
+    searchErrorBound    = newBound;
 }
 
 
-///
-void Map::setDimensions(unsigned short newDimensions) {
-    dimensions = newDimensions;
+/**
+ * \brief Set the number of candidates considered by searches of the graph of INDEX_HNSW.
+ *
+ * More candidates give better recall, at the cost of speed; at least as many candidates
+ * as neighbors searched are considered. Takes effect immediately.
+ */
+void Map::setGraphEf(int ef) {
+    graphEf = max(ef, 1);
 }
 
 
-///
-void Map::setCoordinate(ANNidx i, unsigned short k, ANNcoord coordinate) {
-    (points[i])[k] = coordinate;
+/**
+ * \brief Set the number of candidates considered when inserting a track into the graph of INDEX_HNSW.
+ *
+ * Takes effect when the search structure is rebuilt (see buildTree()).
+ */
+void Map::setGraphEfConstruction(unsigned short ef) {
+    graphEfConstruction = ef;
 }
 
 
-///
-void Map::setParent(Shuffler* newParent) {
-    parent = newParent;
+/**
+ * \brief Set the number of neighbors per track of the graph of INDEX_HNSW, on levels above 0 (M).
+ *
+ * Tracks have twice as many neighbors on level 0. Takes effect when the search structure is
+ * rebuilt (see buildTree()).
+ */
+void Map::setGraphLinks(unsigned short links) {
+    graphLinks = links;
 }
 
 
 /**
- * \brief Allocates memory for coordinates.
+ * \brief Set a latency target for tree searches.
  *
- * ANN cannot allocate memory dynamically; therefore, this function has to
- * be used each time the size of the map changes.
- * 
- * \param n New size for the map.
+ * Whenever the search structure is rebuilt, the error bound and the number of points visited
+ * are calibrated so that the 99th percentile of tree searches meets the target, if possible
+ * (see calibrateSearch()). The error bound set by the user is the lowest used.
+ *
+ * \param microseconds Target 99th percentile, in microseconds; 0 for none.
  */
-void Map::setSize(unsigned long n) {
-    if (points)     annDeallocPts(points);
-
-    points = annAllocPts(n, dimensions);
-    allocatedPoints = n;
-
-    // TODO: extend vectors<> if necessary ?
-    // tracks.reserve()
+void Map::setLatencyTarget(unsigned long microseconds) {
+    latencyTarget = microseconds;
 }
 
 
-///
-void Map::setTracksPerQuery(unsigned short n) {
-    tracksPerQuery = n;
+/**
+ * \brief Choose the search structure built in COORDINATES_DOUBLE mode.
+ *
+ * Takes effect when the search structure is rebuilt (see buildTree()).
+ */
+void Map::setIndexBackend(IndexBackend newBackend) {
+    indexBackend = newBackend;
 }
 
 
-void Map::clear() {
-    if (points)     annDeallocPts(points);
-    fileIndex.clear();
-    missingCoordinates.clear();
-    tracks.clear();
-    
-    allocatedPoints = 0;
+/**
+ * \brief Choose the rule used to split cells of trees (see ANNsplitRule).
+ *
+ * Takes effect when the search structure is rebuilt (see buildTree()).
+ */
+void Map::setSplitRule(ANNsplitRule newRule) {
+    splitRule = newRule;
 }
 
 
 /**
- * \brief   Find a track by its title and filename.
- * 
- * \param   title       Title of the track.
- * \param   filename    Full path to the track file.
- * \return  Pointer to the track in map.
+ * \brief Choose the rule used to shrink cells of box-decomposition trees (see ANNshrinkRule).
+ *
+ * Takes effect when the search structure is rebuilt (see buildTree()).
  */
-Track* Map::findTrack(string title, string filename) {
-    // TODO: we should perform some check using title
-    // For now, title remains unused
-    return getTrack(fileIndex[filename]);
+void Map::setShrinkRule(ANNshrinkRule newRule) {
+    shrinkRule = newRule;
 }
 
 
 /**
- * \brief   Find a track by its title and filename.
- *
- * This function is only provided for convenience.
+ * \brief Choose how trees are searched.
  *
- * \param   title       Title of the track.
- * \param   filename    Full path to the track file.
- * \return  Pointer to the track in map.
+ * Priority search visits cells by increasing distance to the query, rather than in the order
+ * of the tree; it tends to be faster with a non-zero error bound. It does not apply to brute force.
  */
-Track* Map::findTrack(wstring title, wstring filename) {
-    return findTrack(narrow(title), narrow(filename));
+void Map::setPrioritySearch(bool enabled) {
+    prioritySearch = enabled;
 }
 
 
-/**
- * \brief Find nearest neighbors of a given point among the map.
- * 
- * \param   point   Reference point from which nearest neighbor has to be found.
- * \param   k       Number of nearest neighbors to search.
- * \return          Indices of ordered nearest neighbors.
- */
-const ANNidxArray Map::findNearestNeighbors(ANNpoint point, unsigned short k) {
-    // Pre-processing
-    unsigned short n(max(k,2));
+///
+void Map::setDimensions(unsigned short newDimensions) {
+    indexing.wait();
+    compaction.wait();
+    releasePoints();
 
-    if (resultsID && distances) {
-        delete[] resultsID;
-        delete[] distances;
-    }
+    dimensions = newDimensions;
+    points.setDimensions(dimensions);
+}
 
-    //  Perform the search
-    resultsID   = new ANNidx[n];
-    distances   = new ANNdist[n];
 
-    kDimensionalTree->annkSearch(point, n, resultsID, distances, errorBound);
+///
+void Map::setCoordinate(ANNidx i, unsigned short k, ANNcoord coordinate) {
+    indexing.wait();
+    compaction.wait();
 
-    return resultsID;
+    (points[i])[k] = coordinate;
+    markDirty(i);
+    markChanged(i);
 }
 
 
 /**
- * \brief Find nearest neighbors of a track among the map.
+ * \brief Set the format of map files written from now on.
  *
- * Only provided for convenience.
- *
- * \param i Index of the track in the map.
- * \param k Number of nearest neighbors to search.
- * \return  Indices of ordered nearest neighbors.
+ * COMPRESSION_NONE writes binary map files, which are mapped in memory when read; other codecs write
+ * packed map files, which are smaller but have to be decoded (see mapformat.h). Both are read either way.
  */
-const ANNidxArray Map::findNearestNeighbors(ANNidx i, unsigned short k) {
-    return findNearestNeighbors(points[i], k);
+void Map::setMapCompression(CompressionCodec newCompression) {
+    mapCompression = newCompression;
 }
 
 
 /**
- * \brief Find nearest neighbors of a track among the map.
- *
- * Only provided for convenience.
+ * \brief Set the representation of coordinates nearest neighbors are searched on.
  *
- * \param track Pointer to a track in the map.
- * \param k     Number of nearest neighbors to search.
- * \return      Indices of ordered nearest neighbors.
+ * COORDINATES_DOUBLE, the default, searches the points themselves with the structure set by
+ * setIndexBackend(); other modes keep a compact copy of the points besides them, and scan it.
+ * Takes effect when the search structure is rebuilt (see buildTree()).
  */
-const ANNidxArray Map::findNearestNeighbors(const Track* track, unsigned short k) {
-    return findNearestNeighbors(points[track->getId()], k);
+void Map::setCoordinateMode(CoordinateMode newMode) {
+    coordinateMode = newMode;
 }
 
 
-ANNidx Map::findNearestNeighbor(ANNidx i) {
-    const ANNidxArray indices = findNearestNeighbors(points[i]);
-
-    return indices[1];
+/**
+ * \brief Choose whether load() builds the search structure in background.
+ *
+ * Binary map files are mapped in memory, so that coordinates are only read from disk when
+ * used. With lazy loading, load() returns as soon as tracks are read; until the search
+ * structure is built, nearest neighbors are searched by brute force over a window of
+ * LAZY_SEARCH_WINDOW consecutive tracks, which only reads the coordinates of this window.
+ *
+ * \param enabled True to build the search structure in background, false to build it in load().
+ */
+void Map::setLazyLoading(bool enabled) {
+    lazyLoading = enabled;
+}
+
+
+///
+void Map::setParent(Shuffler* newParent) {
+    parent = newParent;
+}
+
+
+/**
+ * \brief Allocates memory for n tracks at once.
+ *
+ * Storage grows as tracks are inserted anyway; this only saves reallocations,
+ * and keeps coordinates contiguous.
+ * 
+ * \param n Expected size for the map.
+ */
+void Map::setSize(unsigned long n) {
+    indexing.wait();
+    compaction.wait();
+
+    points.reserve(n);
+    tracks.reserve(n);
+}
+
+
+///
+void Map::setTracksPerQuery(unsigned short n) {
+    tracksPerQuery = n;
+}
+
+
+/**
+ * \brief Build lookup structures over all tracks at once, and list rows of removed tracks.
+ *
+ * This must be called once tracks are loaded or scanned: tracks inserted afterwards can be
+ * found by path, but artist names and titles set since the last call are not indexed.
+ */
+void Map::buildIndexes() {
+    unsigned long   n(tracks.getSize()), i(0);
+    string          path;
+
+    indexing.wait();
+    compaction.wait();
+    tracks.rebuildPaths();
+
+    pathIndex.clear();
+    nameIndex.clear();
+    freeTracks.clear();
+    pathIndex.reserve(n);
+
+    for (i = 0; i < n; i++) {
+        if (tracks.getCode(i) == REMOVED) {
+            freeTracks.push_back(i);
+            continue;
+        }
+
+        tracks.getPath(i, path);
+        if (!path.empty())  pathIndex.insert(hashPath(path), i);
+
+        // Artist names and titles are only known after a library scan
+        if (*tracks.getArtist(i) && *tracks.getTitle(i))
+            nameIndex.insert(hashName(normalizeName(tracks.getArtist(i)), normalizeName(tracks.getTitle(i))), i);
+    }
+}
+
+
+void Map::clear() {
+    indexing.wait();
+    compaction.wait();
+    releasePoints();
+    missingCoordinates.clear();
+    freeTracks.clear();
+    pathIndex.clear();
+    nameIndex.clear();
+    tracks.clear();
+
+    // The map no longer matches any map file
+    basePath.clear();
+    generation  = 0;
+    baseSize    = 0;
+    dirtyFlags.clear();
+    dirtyTracks.clear();
+    memset(&library, 0, sizeof(library));
+}
+
+
+/**
+ * \brief Remember the current state of the media library, as the one the map is built from.
+ *
+ * To be called when the map is rebuilt from the library.
+ */
+void Map::updateLibraryFingerprint() {
+    if (!fingerprintLibrary(library))
+        memset(&library, 0, sizeof(library));
+}
+
+
+/**
+ * \brief Release storage for points, whether it was allocated or mapped from a file.
+ *
+ * The k-dimensional tree is deleted as well, since it refers to the points.
+ */
+void Map::releasePoints() {
+    pthread_rwlock_wrlock(&searchLock);
+    InterlockedExchange(&searchReady, 0);
+
+    deleteTree();
+    quantizedPoints.clear();
+    points.clear();
+    delete mappedFile;
+
+    for (size_t i = 0; i < retiredMappings.size(); i++)
+        delete retiredMappings[i];
+
+    mappedFile          = NULL;
+    retiredMappings.clear();
+    pthread_rwlock_unlock(&searchLock);
+}
+
+
+/// \brief Delete the search structure, and its own points if it was read from a tree file; its indexed points and delta go with it.
+void Map::deleteTree() {
+    ANNpointArray treePoints(searchIndex && treeOwnsPoints ? searchIndex->thePoints() : NULL);
+
+    delete searchIndex;
+    if (treePoints)     annDeallocPts(treePoints);
+
+    searchIndex         = NULL;
+    kDimensionalTree    = NULL;
+    simdScan            = false;
+    graph.clear();
+    treeOwnsPoints      = false;
+    indexedPoints.clear();
+    indexedTracks.clear();
+    deltaTracks.clear();
+    deltaFlags.clear();
+}
+
+
+/**
+ * \brief Hash the tracks with coordinates, indices and points, to tie a tree file to them.
+ *
+ * \return Checksum of the points.
+ */
+DWORD Map::hashPoints() {
+    unsigned long   hash(hashBytes(NULL, 0)), i(0);
+
+    for (i = 0; i < tracks.getSize(); i++) {
+        if (!tracks.hasCoordinates(i))
+            continue;
+
+        hash = hashBytes(&i, sizeof(i), hash);
+        hash = hashBytes(points[i], dimensions * sizeof(ANNcoord), hash);
+    }
+
+    return hash;
+}
+
+
+/**
+ * \brief Copy mapped coordinates into memory owned by the map, then close the map file.
+ *
+ * Needed before the map file can be overwritten. The points array itself is kept,
+ * so that the k-dimensional tree remains valid. Readers that pinned the map may still refer
+ * to mapped points: the map file is only closed once they release the map.
+ */
+void Map::detachMappedFile() {
+    if (!mappedFile)    return;
+
+    // Searches may be reading the mapped coordinates
+    pthread_rwlock_wrlock(&searchLock);
+
+    points.detach();
+
+    // Indexed points refer to the coordinates themselves
+    for (size_t j = 0; j < indexedPoints.size(); j++)
+        indexedPoints[j] = points[indexedTracks[j]];
+
+    // Readers that pinned the map may still hold points of the mapping
+    retiredMappings.push_back(mappedFile);
+    mappedFile = NULL;
+
+    pthread_rwlock_unlock(&searchLock);
+
+    if (readers == 0)   releaseRetiredMappings();
+}
+
+
+/// \brief Unmap the map files detached by detachMappedFile(), once no reader pinned the map (see release()).
+void Map::releaseRetiredMappings() {
+    pthread_rwlock_wrlock(&searchLock);
+
+    for (size_t i = 0; i < retiredMappings.size(); i++)
+        delete retiredMappings[i];
+
+    retiredMappings.clear();
+    pthread_rwlock_unlock(&searchLock);
+}
+
+
+/**
+ * \brief Wait until the map files detached by detachMappedFile() have been unmapped.
+ *
+ * A map file cannot be overwritten while it is mapped.
+ *
+ * \param timeout  Maximum time to wait, in milliseconds.
+ * \return True if no detached map file remains, false on timeout.
+ */
+bool Map::waitRetiredMappings(DWORD timeout) {
+    DWORD start(GetTickCount());
+
+    while (true) {
+        pthread_rwlock_rdlock(&searchLock);
+        bool released(retiredMappings.empty());
+        pthread_rwlock_unlock(&searchLock);
+
+        if (released)                               return true;
+        if (GetTickCount() - start >= timeout)      return false;
+
+        Sleep(10);
+    }
+}
+
+
+/**
+ * \brief (Re)build the search structure over all points of the map.
+ *
+ * That is the structure chosen with setIndexBackend() in COORDINATES_DOUBLE mode, a compact copy
+ * of the points otherwise.
+ */
+void Map::buildTree() {
+    pthread_rwlock_wrlock(&searchLock);
+    InterlockedExchange(&searchReady, 0);
+
+    deleteTree();
+    quantizedPoints.clear();
+
+    // No tree refers to former point arrays anymore
+    points.releaseRetired();
+    pthread_rwlock_unlock(&searchLock);
+
+    simdScan = coordinateMode == COORDINATES_DOUBLE && indexBackend == INDEX_SIMD_SCAN;
+    buildIndex(searchIndex, kDimensionalTree, graph, quantizedPoints, indexedPoints, indexedTracks);
+
+    calibrateSearch();
+
+    InterlockedExchange(&searchReady, 1);
+}
+
+
+/**
+ * \brief List the tracks with coordinates, which search structures are built over.
+ *
+ * Other tracks have no meaningful point: left at the origin, they would be returned as
+ * neighbors of one another, and of real tracks nearby.
+ *
+ * \param rows  Points of these tracks (modified).
+ * \param ids   Indices of these tracks, in increasing order (modified).
+ */
+void Map::collectIndexedPoints(vector<ANNpoint>& rows, vector<ANNidx>& ids) {
+    unsigned long i(0);
+
+    rows.clear();
+    ids.clear();
+
+    for (i = 0; i < tracks.getSize(); i++) {
+        if (!tracks.hasCoordinates(i))
+            continue;
+
+        rows.push_back(points[i]);
+        ids.push_back(i);
+    }
+}
+
+
+/**
+ * \brief Build a search structure over the tracks with coordinates, as set by setCoordinateMode() and setIndexBackend().
+ *
+ * Only the structure of the current settings is built; the others are left as they are, empty.
+ * Structures refer to indexed points, whose tracks are listed apart (see collectIndexedPoints()),
+ * except the graph of INDEX_HNSW, which refers to tracks directly. Nothing is built for
+ * INDEX_SIMD_SCAN, which scans the indexed points.
+ *
+ * \param index     ANN structure (modified).
+ * \param tree      Same as index if it is a tree, NULL otherwise (modified).
+ * \param hnsw      Graph of INDEX_HNSW (modified).
+ * \param quantized Compact copy of the points, in other modes than COORDINATES_DOUBLE (modified).
+ * \param rows      Indexed points (modified).
+ * \param ids       Track of each indexed point (modified).
+ */
+void Map::buildIndex(ANNpointSet*& index, ANNkd_tree*& tree, HnswIndex& hnsw, QuantizedPoints& quantized, vector<ANNpoint>& rows, vector<ANNidx>& ids) {
+    index   = NULL;
+    tree    = NULL;
+    rows.clear();
+    ids.clear();
+
+    if (coordinateMode != COORDINATES_DOUBLE || indexBackend != INDEX_HNSW)
+        collectIndexedPoints(rows, ids);
+
+    ANNpointArray   array(rows.empty() ? NULL : &rows[0]);
+    int             n((int)rows.size());
+
+    if (coordinateMode != COORDINATES_DOUBLE) {
+        quantized.build(coordinateMode, array, n, dimensions);
+        return;
+    }
+
+    // ANN structures need points
+    if (n == 0 && indexBackend != INDEX_HNSW)   return;
+
+    switch (indexBackend) {
+        case INDEX_BD_TREE:
+            tree = new ANNbd_tree(array, n, dimensions, 1, splitRule, shrinkRule);
+            index = tree;
+            break;
+
+        case INDEX_BRUTE_FORCE:
+            index = new ANNbruteForce(array, n, dimensions);
+            break;
+
+        case INDEX_SIMD_SCAN:
+            break;
+
+        case INDEX_HNSW:
+            hnsw.reset(dimensions, graphLinks, graphEfConstruction);
+            hnsw.reserve(tracks.getSize());
+
+            for (ANNidx i = 0; i < (ANNidx)tracks.getSize(); i++) {
+                if (tracks.hasCoordinates(i))
+                    hnsw.insert(i, points.getArray());
+            }
+            break;
+
+        default:
+            tree = new ANNkd_tree(array, n, dimensions, 1, splitRule);
+            index = tree;
+    }
+}
+
+
+/**
+ * \brief Bring the search structure up to date with tracks whose coordinates or code changed.
+ *
+ * Changed tracks are noted by markChanged() and searched by brute force meanwhile, so that
+ * resolving a track does not rebuild the structure. The compact copy of other modes than
+ * COORDINATES_DOUBLE is updated in place, and tracks new to the graph of INDEX_HNSW are inserted
+ * into it. Once DELTA_MERGE_SIZE tracks are left, the structure is rebuilt in background
+ * (see mergeDelta()), unless a merge already goes on: tracks changed meanwhile are then merged
+ * by the next one. The structure is built at once if it was not yet.
+ */
+void Map::indexCoordinates() {
+    vector<ANNidx>  left;
+    size_t          i(0);
+    unsigned short  j(0);
+
+    compaction.wait();
+
+    // Not built yet: it may be prepared in background after a lazy load
+    if (!searchReady) {
+        indexing.wait();
+
+        if (!searchReady) {
+            buildTree();
+            return;
+        }
+    }
+
+    if (deltaTracks.empty())    return;
+
+    pthread_rwlock_wrlock(&searchLock);
+
+    for (i = 0; i < deltaTracks.size(); i++) {
+        ANNidx      id(deltaTracks[i]);
+        bool        hasCoordinates(tracks.hasCoordinates(id));
+
+        vector<ANNidx>::const_iterator position(lower_bound(indexedTracks.begin(), indexedTracks.end(), id));
+        bool        indexed(position != indexedTracks.end() && *position == id);
+
+        if (coordinateMode != COORDINATES_DOUBLE && hasCoordinates && indexed) {
+            for (j = 0; j < dimensions; j++)
+                quantizedPoints.set((ANNidx)(position - indexedTracks.begin()), j, points[id][j]);
+        } else if (graph.getSize() > 0 && !graph.contains(id)) {
+            if (hasCoordinates) {
+                graph.reserve(tracks.getSize());
+                graph.insert(id, points.getArray());
+            }
+        } else {
+            left.push_back(id);
+            continue;
+        }
+
+        deltaFlags[id] = false;
+    }
+
+    deltaTracks.swap(left);
+
+    // Tracks changed from now on are kept in the delta of the merged structure
+    bool merge(deltaTracks.size() >= DELTA_MERGE_SIZE && !merging);
+
+    if (merge) {
+        mergeTracks.clear();
+        InterlockedExchange(&merging, 1);
+    }
+
+    pthread_rwlock_unlock(&searchLock);
+
+    if (merge) {
+        indexing.wait();    // Previous merge, swapped already
+        indexing.setMerge(true);
+        indexing.start();
+    }
+}
+
+
+/**
+ * \brief Rebuild the search structure aside, then replace the current one and its delta with it.
+ *
+ * Runs in background (see indexCoordinates()): searches go on with the current structure and
+ * delta meanwhile, as do downloads of coordinates, which append to the delta. Tracks changed
+ * since the merge started may be missing from the new structure, so they make its delta.
+ * Other methods modifying the map wait for the merge to be done.
+ */
+void Map::mergeDelta() {
+    ANNpointSet*        newIndex(NULL);
+    ANNkd_tree*         newTree(NULL);
+    HnswIndex           newGraph;
+    QuantizedPoints     newQuantizedPoints;
+    vector<ANNpoint>    newIndexedPoints;
+    vector<ANNidx>      newIndexedTracks;
+
+    buildIndex(newIndex, newTree, newGraph, newQuantizedPoints, newIndexedPoints, newIndexedTracks);
+
+    pthread_rwlock_wrlock(&searchLock);
+
+    deleteTree();
+    points.releaseRetired();
+
+    searchIndex         = newIndex;
+    kDimensionalTree    = newTree;
+    simdScan            = coordinateMode == COORDINATES_DOUBLE && indexBackend == INDEX_SIMD_SCAN;
+    graph.swap(newGraph);
+    quantizedPoints.swap(newQuantizedPoints);
+    indexedPoints.swap(newIndexedPoints);
+    indexedTracks.swap(newIndexedTracks);
+
+    deltaFlags.resize(tracks.getSize(), false);
+
+    for (size_t i = 0; i < mergeTracks.size(); i++) {
+        if (!deltaFlags[mergeTracks[i]]) {
+            deltaFlags[mergeTracks[i]] = true;
+            deltaTracks.push_back(mergeTracks[i]);
+        }
+    }
+
+    mergeTracks.clear();
+    InterlockedExchange(&merging, 0);
+
+    pthread_rwlock_unlock(&searchLock);
+
+    calibrateSearch();
+}
+
+
+/**
+ * \brief Note that the coordinates or code of a track changed since the search structure was built.
+ *
+ * The structure may still hold the track at its former place; it is searched by brute force
+ * instead, until indexCoordinates() takes it into account. A structure not built yet needs no
+ * such note.
+ *
+ * \param i Index of the track.
+ */
+void Map::markChanged(ANNidx i) {
+    if (!searchReady)   return;
+
+    pthread_rwlock_wrlock(&searchLock);
+
+    if ((unsigned long)i >= deltaFlags.size())
+        deltaFlags.resize(tracks.getSize() > (unsigned long)i ? tracks.getSize() : i + 1, false);
+
+    if (!deltaFlags[i]) {
+        deltaFlags[i] = true;
+        deltaTracks.push_back(i);
+    }
+
+    if (merging)    mergeTracks.push_back(i);
+
+    pthread_rwlock_unlock(&searchLock);
+}
+
+
+/// \return True if the track changed since the search structure was built (see markChanged()).
+bool Map::isChanged(ANNidx i) const {
+    return (unsigned long)i < deltaFlags.size() && deltaFlags[i];
+}
+
+
+/**
+ * \brief Build the search structure, or read it from the tree file of the map file.
+ *
+ * Only trees and graphs are stored (COORDINATES_DOUBLE mode, linear scans aside). The tree file is read if
+ * it was written from the current points with the current settings; otherwise the tree is built,
+ * then written to the tree file for next time.
+ *
+ * \return True if the search structure was read from the tree file, false if it was built.
+ */
+bool Map::prepareTree() {
+    Logger* logger(Logger::getInstance());
+    string  path(basePath + MAP_TREE_EXTENSION);
+
+    if (coordinateMode != COORDINATES_DOUBLE || indexBackend == INDEX_BRUTE_FORCE || indexBackend == INDEX_SIMD_SCAN
+    ||  basePath.empty() || tracks.getSize() == 0) {
+        buildTree();
+        return false;
+    }
+
+    if (readTree(path))     return true;
+
+    buildTree();
+
+    if (!writeTree(path))
+        logger->log("[WARNING] Unable to write search structure (" + path + ").\n\n");
+
+    return false;
+}
+
+/**
+ * \brief   Find a track by its title and filename.
+ *
+ * Filenames are compared regardless of case, as Windows does. If no track has this filename,
+ * the title is assumed to read "Artist - Title", as Winamp displays it by default,
+ * and looked up among artist names and titles (regardless of case and blanks).
+ * 
+ * \param   title       Title of the track.
+ * \param   filename    Full path to the track file.
+ * \return  The track in map; an invalid track if there is none (see Track::isValid()).
+ */
+Track Map::findTrack(string title, string filename) {
+    ANNidx              i(0);
+    string::size_type   separator(title.find(" - "));
+
+    if (findPath(filename, i))  return getTrack(i);
+
+    if (separator != string::npos
+    &&  findName(title.substr(0, separator), title.substr(separator + 3), i))
+        return getTrack(i);
+
+    return Track();
+}
+
+
+/**
+ * \brief   Find a track by its title and filename.
+ *
+ * This function is only provided for convenience.
+ *
+ * \param   title       Title of the track.
+ * \param   filename    Full path to the track file.
+ * \return  The track in map; an invalid track if there is none.
+ */
+Track Map::findTrack(wstring title, wstring filename) {
+    return findTrack(narrow(title), narrow(filename));
+}
+
+
+/**
+ * \brief   Find a track of another map in this one, by its path.
+ *
+ * \param   track   Track of any map.
+ * \return  The same track in this map; an invalid track if there is none.
+ */
+Track Map::findTrack(const Track& track) {
+    ANNidx i(0);
+
+    if (!track.isValid())           return Track();
+    if (track.getMap() == this)     return track;
+
+    if (findPath(track.getPath(), i))
+        return getTrack(i);
+
+    return Track();
+}
+
+
+/// \return Hash of a path, regardless of case.
+DWORD Map::hashPath(const string& path) {
+    return hashFolded(path.data(), path.size());
+}
+
+
+/// \return Hash of an artist name and a title, both normalized (see normalizeName()).
+DWORD Map::hashName(const string& artist, const string& title) {
+    unsigned long hash(hashBytes(artist.data(), artist.size()));
+
+    hash = hashBytes("\n", 1, hash);
+
+    return hashBytes(title.data(), title.size(), hash);
+}
+
+
+/**
+ * \brief Find a track by its path, regardless of case.
+ *
+ * \param path  Full path to the track file.
+ * \param i     Index of the track (modified only on success).
+ * \return True if the track was found, false otherwise.
+ */
+bool Map::findPath(const string& path, ANNidx& i) {
+    DWORD           hash(hashPath(path));
+    unsigned long   slot(pathIndex.first(hash));
+    ANNidx          candidate(0);
+    string          candidatePath;
+
+    while (pathIndex.next(hash, slot, candidate)) {
+        tracks.getPath(candidate, candidatePath);
+
+        if (equalFolded(candidatePath, path)) {
+            i = candidate;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/**
+ * \brief Find a track by its artist name and title, regardless of case and blanks.
+ *
+ * \param artist    Artist name.
+ * \param title     Title of the track.
+ * \param i         Index of the track (modified only on success).
+ * \return True if the track was found, false otherwise.
+ */
+bool Map::findName(const string& artist, const string& title, ANNidx& i) {
+    string          normalizedArtist(normalizeName(artist)), normalizedTitle(normalizeName(title));
+    DWORD           hash(hashName(normalizedArtist, normalizedTitle));
+    unsigned long   slot(nameIndex.first(hash));
+    ANNidx          candidate(0);
+
+    while (nameIndex.next(hash, slot, candidate)) {
+        if (normalizeName(tracks.getArtist(candidate)) == normalizedArtist
+        &&  normalizeName(tracks.getTitle(candidate)) == normalizedTitle) {
+            i = candidate;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/**
+ * \brief Find nearest neighbors of a given point among the map.
+ *
+ * Results go to a context owned by the caller, so that threads may search at once, each with
+ * its own context; reusing a context avoids allocating memory.
+ *
+ * Scanning searches (other modes than COORDINATES_DOUBLE, INDEX_SIMD_SCAN, or while the search
+ * structure is being built) and the graph of INDEX_HNSW only consider tracks accepted by the
+ * filter; ANN structures ignore it, so that callers must still check results (see NeighborIterator).
+ * Tracks changed since the structure was built are searched apart (see searchDelta()). ANN trees
+ * keep their search state in globals, so that tree searches are serialized; brute force is not.
+ *
+ * The number of points a tree search visits is limited by calibrateSearch() for unfiltered
+ * queries only: a tree may then return fewer than k neighbors. Filtered queries, whose results
+ * are mostly rejected, and queries which are not budgeted visit as many points as needed.
+ * 
+ * \param   point       Reference point from which nearest neighbor has to be found.
+ * \param   k           Number of nearest neighbors to search.
+ * \param   query       Indices of ordered nearest neighbors, and their squared distances (modified).
+ * \param   filter      Tracks to consider, NULL for all of them.
+ * \param   budgeted    False to ignore the visit budget, as NeighborIterator does.
+ * \return              Number of neighbors found, fewer than k if the map is too small, if the filter
+ *                      rejects too many tracks, if the visit budget runs out, or while the search
+ *                      structure is being built.
+ */
+int Map::findNearestNeighbors(ANNpoint point, int k, NeighborQuery& query, const NeighborFilter* filter, bool budgeted) {
+    query.reset(max(k, 0));
+    if (k <= 0)     return 0;
+
+    pthread_rwlock_rdlock(&searchLock);
+
+    int maxVisited(budgeted && !filter ? maxPointsVisited : 0);
+
+    //  Perform the search
+    if (!searchReady)
+        searchWindow(point, k, query.getIdArray(), query.getDistanceArray(), filter);
+    else if (deltaTracks.empty())
+        searchStructure(point, k, query, filter, maxVisited);
+    else
+        searchDelta(point, k, query, filter, maxVisited);
+
+    pthread_rwlock_unlock(&searchLock);
+
+    return query.countResults();
+}
+
+
+/**
+ * \brief Search nearest neighbors with the search structure alone, once it is built.
+ *
+ * Structures other than the graph of INDEX_HNSW return indexed points, translated to tracks here.
+ *
+ * \param maxVisited    Points visited at most by tree searches, 0 for no limit.
+ */
+void Map::searchStructure(ANNpoint point, int k, NeighborQuery& query, const NeighborFilter* filter, int maxVisited) {
+    IndexFilter     indexFilter(filter, indexedTracks);
+    ANNpointArray   rows(indexedPoints.empty() ? NULL : &indexedPoints[0]);
+    ANNidxArray     ids(query.getIdArray());
+    int             n(min(k, (int)indexedPoints.size())), j(0);
+
+    if (graph.getSize() > 0) {
+        graph.search(point, k, graphEf, query, points.getArray(), filter);
+        return;
+    }
+
+    // ANN fails on more neighbors than points
+    if (kDimensionalTree)
+        searchTree(point, n, ids, query.getDistanceArray(), searchErrorBound, maxVisited);
+    else if (searchIndex)
+        searchIndex->annkSearch(point, n, ids, query.getDistanceArray(), searchErrorBound);
+    else if (simdScan)
+        DistanceEngine::getInstance()->search(point, k, query, rows, indexedPoints.size(), dimensions, filter ? &indexFilter : NULL);
+    else
+        quantizedPoints.search(point, k, query, rows, filter ? &indexFilter : NULL);
+
+    for (j = 0; j < k && ids[j] != ANN_NULL_IDX; j++)
+        ids[j] = indexedTracks[ids[j]];
+}
+
+
+/**
+ * \brief Search nearest neighbors with the search structure and its delta (see markChanged()).
+ *
+ * The structure may return changed tracks at their former place: these are dropped, and the
+ * structure searched for more neighbors until k of its results are up to date, or none is left.
+ * Changed tracks with coordinates are then compared to the point one by one, which takes
+ * O(d) per track.
+ *
+ * \param maxVisited    Points visited at most by tree searches, 0 for no limit.
+ */
+void Map::searchDelta(ANNpoint point, int k, NeighborQuery& query, const NeighborFilter* filter, int maxVisited) {
+    vector<pair<ANNdist, ANNidx> >& ranked(query.getRanked());
+    DistanceEngine*                 engine(DistanceEngine::getInstance());
+    int                             limit(graph.getSize() > 0 ? (int)tracks.getSize() : (int)indexedPoints.size());
+    int                             wanted(k), found(0), stale(0), j(0);
+    size_t                          i(0);
+
+    for (;;) {
+        query.reset(wanted);
+        searchStructure(point, wanted, query, filter, maxVisited);
+        found = query.countResults();
+
+        for (j = 0, stale = 0; j < found; j++) {
+            if (isChanged(query.getId(j)))  stale++;
+        }
+
+        if (found - stale >= k || found < wanted || wanted >= limit)    break;
+
+        wanted = min(wanted + stale, limit);
+    }
+
+    ranked.clear();
+
+    for (j = 0; j < found; j++) {
+        if (!isChanged(query.getId(j)))
+            ranked.push_back(make_pair(query.getDistance(j), query.getId(j)));
+    }
+
+    for (i = 0; i < deltaTracks.size(); i++) {
+        ANNidx      id(deltaTracks[i]);
+        if (!tracks.hasCoordinates(id))
+            continue;
+
+        if (filter && !filter->accept(id))  continue;
+
+        ranked.push_back(make_pair(engine->distance(point, points[id], dimensions), id));
+    }
+
+    found = min(k, (int)ranked.size());
+    partial_sort(ranked.begin(), ranked.begin() + found, ranked.end());
+
+    query.reset(k);
+
+    for (j = 0; j < found; j++) {
+        query.getIdArray()[j]       = ranked[j].second;
+        query.getDistanceArray()[j] = ranked[j].first;
+    }
+}
+
+
+/**
+ * \brief Search nearest neighbors with the tree, as set by setPrioritySearch().
+ *
+ * \param bound         Error bound.
+ * \param maxVisited    Points visited at most, 0 for no limit.
+ */
+void Map::searchTree(ANNpoint point, int k, ANNidxArray ids, ANNdistArray dists, double bound, int maxVisited) {
+    pthread_mutex_lock(&treeSearchLock);
+    annMaxPtsVisit(maxVisited);
+
+    if (prioritySearch)
+        kDimensionalTree->annkPriSearch(point, k, ids, dists, bound);
+    else
+        kDimensionalTree->annkSearch(point, k, ids, dists, bound);
+
+    annMaxPtsVisit(0);
+    pthread_mutex_unlock(&treeSearchLock);
+}
+
+
+/**
+ * \brief Calibrate tree searches to the latency target (see setLatencyTarget()).
+ *
+ * CALIBRATION_QUERIES random indexed points are searched with each setting, from the most accurate
+ * one: the error bound is doubled up to CALIBRATION_MAX_ERROR_BOUND first, as results then remain
+ * close to the nearest ones; then the number of points visited is halved, down to a few times
+ * the number of neighbors. The first setting whose 99th percentile meets the target is kept,
+ * the fastest one otherwise. Recall is measured against exact searches of the same tree.
+ *
+ * The visit budget only applies to unfiltered queries which are budgeted (see
+ * findNearestNeighbors()): filtered ones, and NeighborIterator rounds, must reach their
+ * neighbors whatever the latency.
+ *
+ * Searches go on meanwhile with the previous setting: locks are only held for one probe query
+ * at a time, and the new setting is published at once under the write lock.
+ */
+void Map::calibrateSearch() {
+    Logger*         logger(Logger::getInstance());
+    unsigned long   m(indexedPoints.size());
+    int             k(min(CALIBRATION_NEIGHBORS, (int)m)), visited(0);
+    double          bound(errorBound), latency(0), recall(0);
+    vector<ANNidx>  targets, exact;
+    vector<ANNdist> distances(max(k, 1));
+    size_t          q(0);
+
+    if (latencyTarget != 0 && kDimensionalTree && k > 0) {
+        // Sample indexed points, which all have coordinates
+        for (q = 0; q < CALIBRATION_QUERIES; q++)
+            targets.push_back((ANNidx)((((unsigned long)rand() << 15) ^ rand()) % m));
+
+        exact.resize(targets.size() * k);
+
+        for (q = 0; q < targets.size(); q++) {
+            pthread_rwlock_rdlock(&searchLock);
+            searchTree(indexedPoints[targets[q]], k, &exact[q * k], &distances[0], 0, 0);
+            pthread_rwlock_unlock(&searchLock);
+        }
+
+        latency = timeSearches(targets, k, bound, visited, exact, recall);
+
+        while (latency * 1e6 > latencyTarget) {
+            if (bound < CALIBRATION_MAX_ERROR_BOUND)
+                bound = min(max(2 * bound, 0.25), CALIBRATION_MAX_ERROR_BOUND);
+            else if (visited == 0)
+                visited = (int)min(m / 2, (unsigned long)INT_MAX);
+            else if (visited / 2 >= 4 * k)
+                visited /= 2;
+            else
+                break;
+
+            latency = timeSearches(targets, k, bound, visited, exact, recall);
+        }
+    }
+
+    pthread_rwlock_wrlock(&searchLock);
+    searchErrorBound    = bound;
+    maxPointsVisited    = visited;
+    pthread_rwlock_unlock(&searchLock);
+
+    if (targets.empty())    return;
+
+    if (latency * 1e6 > latencyTarget)
+        logger->log("[WARNING] Latency target not reached by tree searches.\n");
+
+    logger->log("Tree searches calibrated: error bound ");
+    logger->log(bound);
+    logger->log(", ");
+    logger->log(visited);
+    logger->log(" points visited at most (0 for no limit), 99th percentile ");
+    logger->log(latency * 1e6);
+    logger->log(" us, recall ");
+    logger->log(recall);
+    logger->log("\n\n");
+}
+
+
+/**
+ * \brief Time tree searches of sample indexed points with a given setting.
+ *
+ * \param targets       Indexed points searched.
+ * \param k             Number of nearest neighbors per search.
+ * \param bound         Error bound.
+ * \param maxVisited    Points visited at most, 0 for no limit.
+ * \param exact         Exact nearest neighbors of targets, k per point.
+ * \param recall        Fraction of exact nearest neighbors found (modified).
+ * \return              99th percentile of search times, in seconds.
+ */
+double Map::timeSearches(const vector<ANNidx>& targets, int k, double bound, int maxVisited, const vector<ANNidx>& exact, double& recall) {
+    vector<double>  latencies(targets.size());
+    vector<ANNidx>  ids(k);
+    vector<ANNdist> distances(k);
+    unsigned long   found(0);
+    size_t          q(0);
+    int             j(0);
+    double          start(0);
+
+    for (q = 0; q < targets.size(); q++) {
+        pthread_rwlock_rdlock(&searchLock);
+        start = currentTime();
+        searchTree(indexedPoints[targets[q]], k, &ids[0], &distances[0], bound, maxVisited);
+        latencies[q] = currentTime() - start;
+        pthread_rwlock_unlock(&searchLock);
+
+        for (j = 0; j < k; j++) {
+            if (ids[j] != ANN_NULL_IDX && find(exact.begin() + q * k, exact.begin() + (q + 1) * k, ids[j]) != exact.begin() + (q + 1) * k)
+                found++;
+        }
+    }
+
+    recall = (double)found / (targets.size() * k);
+
+    sort(latencies.begin(), latencies.end());
+    return latencies[min(latencies.size() - 1, latencies.size() * 99 / 100)];
+}
+
+
+/**
+ * \brief Search nearest neighbors by brute force over a window of tracks.
+ *
+ * Used while the search structure is not built yet. The window is made of LAZY_SEARCH_WINDOW
+ * consecutive tracks, starting at a random one; tracks without coordinates are skipped.
+ *
+ * \param point     Query point.
+ * \param k         Number of nearest neighbors to search.
+ * \param ids       Indices of the nearest neighbors, ANN_NULL_IDX if there are fewer than k (modified).
+ * \param dists     Their squared distances to the query point, ANN_DIST_INF if there are fewer than k (modified).
+ * \param filter    Tracks to consider, NULL for all of them.
+ */
+void Map::searchWindow(ANNpoint point, int k, ANNidxArray ids, ANNdistArray dists, const NeighborFilter* filter) {
+    unsigned long   n(tracks.getSize()), window(min(n, (unsigned long)LAZY_SEARCH_WINDOW));
+    unsigned long   first(n > window ? (((unsigned long)rand() << 15) ^ rand()) % (n - window + 1) : 0), i(0);
+    DistanceEngine* engine(DistanceEngine::getInstance());
+    int             j(0);
+
+    for (j = 0; j < k; j++) {
+        ids[j]      = ANN_NULL_IDX;
+        dists[j]    = ANN_DIST_INF;
+    }
+
+    for (i = first; i < first + window; i++) {
+        if (!tracks.hasCoordinates(i))
+            continue;
+
+        if (filter && !filter->accept(i))   continue;
+
+        ANNdist distance(engine->distance(point, points[i], dimensions));
+        if (distance >= dists[k - 1])   continue;
+
+        // Insert into the sorted results
+        for (j = k - 1; j > 0 && dists[j - 1] > distance; j--) {
+            ids[j]      = ids[j - 1];
+            dists[j]    = dists[j - 1];
+        }
+
+        ids[j]      = i;
+        dists[j]    = distance;
+    }
+}
+
+
+
+/**
+ * \brief Find nearest neighbors of a track among the map.
+ *
+ * Only provided for convenience.
+ *
+ * \param i     Index of the track in the map.
+ * \param k     Number of nearest neighbors to search.
+ * \param query Indices of ordered nearest neighbors, and their squared distances (modified).
+ * \return      Number of neighbors found.
+ */
+int Map::findNearestNeighbors(ANNidx i, int k, NeighborQuery& query) {
+    return findNearestNeighbors(points[i], k, query);
+}
+
+
+/**
+ * \brief Find nearest neighbors of a track among the map.
+ *
+ * Only provided for convenience.
+ *
+ * \param track A track in the map.
+ * \param k     Number of nearest neighbors to search.
+ * \param query Indices of ordered nearest neighbors, and their squared distances (modified).
+ * \return      Number of neighbors found.
+ */
+int Map::findNearestNeighbors(const Track& track, int k, NeighborQuery& query) {
+    return findNearestNeighbors(points[track.getId()], k, query);
+}
+
+
+/**
+ * \brief Find tracks within a shell around a point.
+ *
+ * In COORDINATES_DOUBLE mode, the ball of the outer radius is searched by annkFRSearch(),
+ * trees visiting at most maxVisited points; if the ball holds more points than that, the nearest
+ * ones are kept, so that the outer part of the shell may be missed; tracks changed since the
+ * structure was built are compared one by one (see markChanged()). Otherwise, maxVisited
+ * tracks are scanned from a random one: as track indices do not follow coordinates, this
+ * gathers a uniform sample of the shell.
+ *
+ * \param point         Center of the shell.
+ * \param innerRadius   Inner radius of the shell.
+ * \param outerRadius   Outer radius of the shell.
+ * \param maxVisited    Largest number of points examined, so that dense regions cost no more than sparse ones.
+ * \param query         Tracks found and their squared distances to the center, in no particular order (modified).
+ * \param filter        Tracks to consider, NULL for all of them.
+ * \return              Number of tracks found.
+ */
+int Map::findInShell(ANNpoint point, double innerRadius, double outerRadius, int maxVisited, NeighborQuery& query, const NeighborFilter* filter) {
+    ANNdist         inner(max(innerRadius, 0.) * max(innerRadius, 0.)), outer(outerRadius * outerRadius);
+    unsigned long   n(tracks.getSize());
+
+    query.reset(0);
+    if (n == 0 || maxVisited <= 0 || outerRadius < 0)   return 0;
+
+    pthread_rwlock_rdlock(&searchLock);
+
+    if (searchReady && searchIndex) {
+        pthread_mutex_lock(&treeSearchLock);
+
+        // Count points within the ball, then get them; the limit applies to both searches
+        annMaxPtsVisit(maxVisited);
+        int inBall(searchIndex->annkFRSearch(point, outer, 0, NULL, NULL, searchErrorBound));
+        int k(min(inBall, maxVisited));
+
+        query.reset(k);
+        if (k > 0)
+            searchIndex->annkFRSearch(point, outer, k, query.getIdArray(), query.getDistanceArray(), searchErrorBound);
+
+        annMaxPtsVisit(0);
+        pthread_mutex_unlock(&treeSearchLock);
+
+        // Keep the shell, changed tracks aside
+        ANNidxArray     ids(query.getIdArray());
+        ANNdistArray    distances(query.getDistanceArray());
+        DistanceEngine* engine(DistanceEngine::getInstance());
+        int             j(0), kept(0);
+        size_t          d(0);
+
+        for (j = 0; j < k; j++) {
+            if (ids[j] == ANN_NULL_IDX || distances[j] < inner)     continue;
+
+            // Results are indexed points
+            ids[j] = indexedTracks[ids[j]];
+
+            if (filter && !filter->accept(ids[j]))                  continue;
+            if (isChanged(ids[j]))                                  continue;
+
+            ids[kept]       = ids[j];
+            distances[kept] = distances[j];
+            kept++;
+        }
+
+        query.truncate(kept);
+
+        for (d = 0; d < deltaTracks.size(); d++) {
+            ANNidx      id(deltaTracks[d]);
+            if (!tracks.hasCoordinates(id))
+                continue;
+
+            if (filter && !filter->accept(id))  continue;
+
+            ANNdist distance(engine->distance(point, points[id], dimensions));
+
+            if (distance >= inner && distance <= outer)
+                query.add(id, distance);
+        }
+
+        pthread_rwlock_unlock(&searchLock);
+
+        return query.getCount();
+    }
+
+    pthread_rwlock_unlock(&searchLock);
+
+    // Scan a random range of tracks
+    unsigned long   visited(min(n, (unsigned long)maxVisited));
+    unsigned long   first((((unsigned long)rand() << 15) ^ rand()) % n), i(0);
+    DistanceEngine* engine(DistanceEngine::getInstance());
+
+    for (i = 0; i < visited; i++) {
+        ANNidx      id((first + i) % n);
+        if (!tracks.hasCoordinates(id))
+            continue;
+
+        if (filter && !filter->accept(id))  continue;
+
+        ANNdist distance(engine->distance(point, points[id], dimensions));
+
+        if (distance >= inner && distance <= outer)
+            query.add(id, distance);
+    }
+
+    return query.getCount();
+}
+
+
+/**
+ * \brief Find nearest neighbors of a batch of points among the map.
+ *
+ * Queries are split into ranges searched in parallel, each by a thread with its own
+ * NeighborQuery; the calling thread handles the last range. Tree searches are serialized
+ * (see treeSearchLock), so batches are searched by the calling thread alone when the
+ * structure is a tree; scans, the HNSW graph and brute force are searched in parallel.
+ * Results are written row by row: neighbors of query i are at indices i * k to i * k + k - 1,
+ * ANN_NULL_IDX and ANN_DIST_INF standing for neighbors not found.
+ *
+ * \param queries   Reference points.
+ * \param count     Number of reference points.
+ * \param k         Number of nearest neighbors to search per point.
+ * \param ids       Storage for count * k indices of ordered nearest neighbors (modified).
+ * \param dists     Storage for count * k squared distances of these neighbors (modified).
+ * \param workers   Number of threads to use; 0 means one per processor.
+ */
+void Map::findNearestNeighbors(const ANNpoint* queries, unsigned long count, int k, ANNidxArray ids, ANNdistArray dists, unsigned short workers) {
+    if (count == 0 || k <= 0)   return;
+
+    if (workers == 0) {
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        workers = (unsigned short)max(info.dwNumberOfProcessors, (DWORD)1);
+    }
+
+    // Small batches are not worth many threads
+    workers = (unsigned short)max(min((unsigned long)workers, count / BATCH_MIN_QUERIES), 1UL);
+
+    // Threads would only wait for each other on treeSearchLock
+    pthread_rwlock_rdlock(&searchLock);
+    if (searchReady && kDimensionalTree && graph.getSize() == 0)
+        workers = 1;
+    pthread_rwlock_unlock(&searchLock);
+
+    BatchSearch*    searches(new BatchSearch[workers]);
+    vector<bool>    started(workers, false);
+    unsigned short  w(0);
+
+    for (w = 0; w < workers; w++) {
+        unsigned long first(w * count / workers), last((w + 1) * count / workers);
+
+        searches[w].setQueries(this, queries + first, last - first, k);
+        searches[w].setResults(ids + first * k, dists + first * k);
+    }
+
+    for (w = 0; w + 1 < workers; w++)
+        started[w] = searches[w].start();
+
+    for (w = 0; w < workers; w++) {
+        if (started[w])     searches[w].wait();
+        else                searches[w].run();
+    }
+
+    delete[] searches;
+}
+
+
+/**
+ * \brief Find nearest neighbors of a batch of tracks among the map.
+ *
+ * Only provided for convenience; see the batch of points version.
+ *
+ * \param tracks    Indices of the reference tracks.
+ * \param count     Number of reference tracks.
+ * \param k         Number of nearest neighbors to search per track.
+ * \param ids       Storage for count * k indices of ordered nearest neighbors (modified).
+ * \param dists     Storage for count * k squared distances of these neighbors (modified).
+ * \param workers   Number of threads to use; 0 means one per processor.
+ */
+void Map::findNearestNeighbors(const ANNidx* tracks, unsigned long count, int k, ANNidxArray ids, ANNdistArray dists, unsigned short workers) {
+    vector<ANNpoint>    queries(count);
+    unsigned long       i(0);
+
+    for (i = 0; i < count; i++)
+        queries[i] = points[tracks[i]];
+
+    findNearestNeighbors(queries.empty() ? NULL : &queries[0], count, k, ids, dists, workers);
+}
+
+
+ANNidx Map::findNearestNeighbor(ANNidx i) {
+    NeighborQuery query;
+
+    return findNearestNeighbors(points[i], 2, query) > 1 ? query.getId(1) : ANN_NULL_IDX;
+}
+
+
+Track Map::findNearestNeighbor(Track track) {
+    NeighborQuery query;
+
+    if (findNearestNeighbors(track.getCoordinates(), 2, query) < 2)
+        return Track();
+
+    return getTrack(query.getId(1));
+}
+
+
+
+
+/**
+ * \brief Fingerprint a file: size, last write time and hash of sampled blocks.
+ *
+ * \param path File to fingerprint.
+ * \param size Size of the file (modified).
+ * \param time Last write time of the file (modified).
+ * \param hash Hash of sampled blocks (modified).
+ * \return True if the file could be read, false otherwise.
+ */
+static bool fingerprintFile(const string& path, ULONGLONG& size, ULONGLONG& time, DWORD& hash) {
+    HANDLE file(CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL));
+    if (file == INVALID_HANDLE_VALUE)   return false;
+
+    FILETIME    lastWrite;
+    DWORD       sizeHigh(0), sizeLow(GetFileSize(file, &sizeHigh)), read(0);
+    char        block[LIBRARY_SAMPLE_SIZE];
+    unsigned    i(0);
+
+    GetFileTime(file, NULL, NULL, &lastWrite);
+
+    size = ((ULONGLONG)sizeHigh << 32) | sizeLow;
+    time = ((ULONGLONG)lastWrite.dwHighDateTime << 32) | lastWrite.dwLowDateTime;
+    hash = hashBytes(&size, sizeof(size));
+
+    // Blocks evenly spread over the file; the first one starts at 0, the last one ends at the end
+    ULONGLONG span(size > LIBRARY_SAMPLE_SIZE ? size - LIBRARY_SAMPLE_SIZE : 0);
+
+    while (i < LIBRARY_SAMPLE_COUNT) {
+        ULONGLONG   offset(span * i / (LIBRARY_SAMPLE_COUNT - 1));
+        LONG        offsetHigh((LONG)(offset >> 32));
+
+        SetFilePointer(file, (LONG)(offset & 0xFFFFFFFF), &offsetHigh, FILE_BEGIN);
+
+        if (!ReadFile(file, block, LIBRARY_SAMPLE_SIZE, &read, NULL))   break;
+        hash = hashBytes(block, read, hash);
+
+        i++;
+    }
+
+    CloseHandle(file);
+
+    return i == LIBRARY_SAMPLE_COUNT;
+}
+
+
+/**
+ * \brief Fingerprint the media library files, without opening the library itself.
+ *
+ * \param fingerprint Fingerprint of the library (modified).
+ * \return True if the library files could be read, false otherwise.
+ */
+bool Map::fingerprintLibrary(LibraryFingerprint& fingerprint) {
+    string directory(Shuffler::getInstance()->getConfigDirectory());
+
+    memset(&fingerprint, 0, sizeof(fingerprint));
+
+    // SENSITIVE: may depend on Winamp version !
+    return fingerprintFile(directory + "ml\\main.dat", fingerprint.dataSize, fingerprint.dataTime, fingerprint.dataHash)
+        && fingerprintFile(directory + "ml\\main.idx", fingerprint.indexSize, fingerprint.indexTime, fingerprint.indexHash);
+}
+
+
+/**
+ * \brief Open the media library to count its records.
+ *
+ * \return Number of records in the media library.
+ */
+long Map::countLibraryRecords() {
+    Shuffler*   shuffler(Shuffler::getInstance());
+
+    string directory = shuffler->getConfigDirectory();
+    char*  pathToDat = new char[directory.size() + 12];
+    char*  pathToIdx = new char[directory.size() + 12];
+
+    strcpy(pathToDat, directory.c_str());
+    strcpy(pathToIdx, directory.c_str());
+    strcat(pathToDat, "ml\\main.dat");      // SENSITIVE: may depend on Winamp version !
+    strcat(pathToIdx, "ml\\main.idx");      // SENSITIVE: may depend on Winamp version !
+
+    Database        db;
+	Table*          table(db.OpenTable(pathToDat, pathToIdx, false, false)); // Do not create table either index
+    Scanner         *scanner = table->NewScanner(0);
+    long            count(table->GetRecordsCount());
+
+    table->DeleteScanner(scanner);
+	db.CloseTable(table);
+
+    delete[] pathToDat;
+    delete[] pathToIdx;
+
+    return count;
+}
+
+
+/**
+ * \brief Compute the stamp of a track file, from what the media library knows about it.
+ *
+ * Stamps tell whether a file changed between two scans of the library (see update()).
+ *
+ * \param time  Last write time of the file.
+ * \param size  Size of the file.
+ * \return Stamp of the file; never 0, which stands for an unknown stamp.
+ */
+DWORD Map::stampFile(ULONGLONG time, ULONGLONG size) {
+    unsigned long stamp(hashBytes(&time, sizeof(time)));
+
+    stamp = hashBytes(&size, sizeof(size), stamp);
+
+    return stamp ? stamp : 1;
+}
+
+
+/**
+ * \brief Check whether the media library has changed since the map was built.
+ *
+ * The fingerprint of the library files is checked first; the library itself is only opened
+ * if it has changed. Then, if the number of records in the media library differs from the
+ * number of tracks (removed ones aside), the user is asked whether the library should be
+ * rescanned; otherwise, the new fingerprint is stored in the map file, so that the library
+ * is not opened again until it changes.
+ *
+ * \return True if a rescan has been started, false otherwise.
+ */
+bool Map::checkLibrary() {
+    Shuffler*           shuffler(Shuffler::getInstance());
+    Logger*             logger(Logger::getInstance());
+    LibraryFingerprint  current;
+
+    if (fingerprintLibrary(current) && !memcmp(&current, &library, sizeof(current))) {
+        #ifdef DEBUG
+        logger->log("Media library unchanged.\n\n");
+        #endif
+        return false;
+    }
+
+    // Winamp rewrites the library files for play counts too: only a different count of records is a change
+    if ((unsigned long)countLibraryRecords() == tracks.getSize() - freeTracks.size()) {
+        library = current;
+
+        if (!writeLibraryFingerprint() && !basePath.empty() && !writeBase(basePath))
+            logger->log("[WARNING] Unable to update library fingerprint (" + basePath + ").\n\n");
+
+        return false;
+    }
+
+    string question;
+    question += "Your media library has changed since last time.\n";
+    question += "Do you want to rescan it ?";
+
+    int answer(MessageBoxA(
+        plugin.hwndParent,
+        question.c_str(),
+        "Rescan library ?",
+        MB_YESNO | MB_ICONQUESTION
+    ));
+
+    if (answer == IDYES) {
+        shuffler->scanLibrary();
+        return true;
+    }
+
+    return false;
+}
+
+
+/**
+ * \brief Overwrite the library fingerprint in the header of the map file.
+ *
+ * Only possible if the map file is of the current version, and is the one the map was read from.
+ *
+ * \return True if the fingerprint was written, false otherwise.
+ */
+bool Map::writeLibraryFingerprint() {
+    if (basePath.empty())   return false;
+
+    HANDLE file(CreateFileA(basePath.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL));
+    if (file == INVALID_HANDLE_VALUE)   return false;
+
+    MapFileHeader   header;
+    DWORD           done(0);
+    bool            success(
+        ReadFile(file, &header, sizeof(header), &done, NULL)
+    &&  done == sizeof(header)
+    &&  header.version == MAP_FILE_VERSION
+    &&  header.generation == generation);
+
+    if (success) {
+        SetFilePointer(file, offsetof(MapFileHeader, library), NULL, FILE_BEGIN);
+        success = WriteFile(file, &library, sizeof(library), &done, NULL) && done == sizeof(library);
+    }
+
+    CloseHandle(file);
+
+    return success;
+}
+
+
+/**
+ * \brief Load map from a file.
+ *
+ * The file should be in the user's winamp directory;
+ * the absolute path to this directory is automatically generated and should not be provided in the argument.
+ * If the binary map file cannot be read, the legacy text map file (LEGACY_MAP_FILE) is read instead,
+ * and converted to the binary format.
+ *
+ * \param filename Name of the file.
+ * \return True if map was successfully loaded, false otherwise.
+ */
+bool Map::load(string filename) {
+    Shuffler*   shuffler(Shuffler::getInstance());
+    Logger*     logger(Logger::getInstance());
+    
+    string  path(shuffler->getConfigDirectory() + filename);
+    bool    migrated(false);
+
+    if (!readBinary(path)) {
+        // Fall back to the legacy text format
+        string legacyPath(shuffler->getConfigDirectory() + LEGACY_MAP_FILE);
+
+        if (!readText(legacyPath)) {
+            logger->log("[WARNING] Unable to open map file (" + path + ").\n\n");
+            return false;
+        }
+
+        migrated = true;
+    }
+
+    // Apply changes saved since the map file was written
+    if (!migrated)  replayJournal();
+
+    buildIndexes();
+
+    // Check if library needs to be rescanned
+    if (checkLibrary())     return true;
+
+    // Convert legacy map file
+    if (migrated && writeBase(path))
+        logger->log("Map converted to binary format (" + path + ").\n\n");
+
+    // Update k-dimensional tree, in background if loading lazily
+    if (lazyLoading) {
+        indexing.setMerge(false);
+        indexing.start();
+    } else
+        prepareTree();
+    
+    return true;
+}
+
+
+/**
+ * \brief Read map from a binary file (see mapformat.h).
+ *
+ * The file is mapped in memory, and points refer directly to the mapped coordinate block;
+ * the mapping is copy-on-write, so that coordinates can still be updated.
+ *
+ * \param path Absolute path to the file.
+ * \return True if map was successfully read, false otherwise.
+ */
+bool Map::readBinary(const string& path) {
+    Logger*     logger(Logger::getInstance());
+    MappedFile* file(new MappedFile);
+
+    if (!file->open(path, true)) {
+        delete file;
+        return false;
+    }
+
+    // Check header
+    const char*             data(file->getData());
+    const MapFileHeader*    header((const MapFileHeader*)data);
+    ULONGLONG               size(file->getSize());
+    unsigned long           recordSize(0);
+
+    if (size >= sizeof(header->magic) && !memcmp(header->magic, PACKED_MAP_MAGIC, sizeof(header->magic))) {
+        delete file;
+        return readPacked(path);
+    }
+
+    // Records of older versions have no stamp
+    if (size >= offsetof(MapFileHeader, library))
+        recordSize = header->version >= 3 ? sizeof(MapFileRecord) : offsetof(MapFileRecord, stamp);
+
+    if (size < offsetof(MapFileHeader, library)
+    ||  memcmp(header->magic, MAP_FILE_MAGIC, sizeof(header->magic))
+    ||  header->version < 1
+    ||  header->version > MAP_FILE_VERSION
+    ||  (header->version >= 2 && size < sizeof(MapFileHeader))
+    ||  header->dimensions != dimensions
+    ||  header->coordinatesOffset % MAP_FILE_ALIGNMENT
+    ||  header->coordinatesOffset + (ULONGLONG)header->trackCount * dimensions * sizeof(ANNcoord) > size
+    ||  header->recordsOffset + (ULONGLONG)header->trackCount * recordSize > size
+    ||  header->stringsOffset + header->stringsSize > size) {
+        logger->log("[WARNING] Invalid or incompatible binary map file (" + path + ").\n\n");
+        delete file;
+        return false;
+    }
+
+    // Points refer to the mapped coordinates
+    unsigned long           total(header->trackCount);
+    const char*             records(data + header->recordsOffset);
+    const char*             strings(data + header->stringsOffset);
+    vector<const char*>     paths(total);
+    vector<unsigned long>   pathLengths(total);
+    ANNidx                  i(0);
+
+    clear();
+
+    mappedFile      = file;
+    points.attach((ANNcoord*)(file->getData() + header->coordinatesOffset), total);
+
+    basePath        = path;
+    generation      = header->generation;
+    baseSize        = file->getSize();
+
+    if (header->version >= 2)   library = header->library;
+
+    tracks.resize(total);
+
+    while (i < total) {
+        MapFileRecord record;
+
+        memset(&record, 0, sizeof(record));
+        memcpy(&record, records + i * recordSize, recordSize);
+
+        if ((ULONGLONG)record.pathOffset + record.pathLength > header->stringsSize) {
+            logger->log("[WARNING] Invalid path in binary map file (" + path + ").\n\n");
+            clear();
+            return false;
+        }
+
+        tracks.setCode(i, (MuseekCode)record.code);
+        tracks.setArtistID(i, record.artistID);
+        tracks.setTitleID(i, record.titleID);
+        tracks.setLength(i, record.length);
+        tracks.setStamp(i, record.stamp);
+
+        paths[i]        = strings + record.pathOffset;
+        pathLengths[i]  = record.pathLength;
+
+        i++;
+    }
+
+    // Paths are written in sorted order, so this does not need to sort them
+    tracks.buildPaths(paths, pathLengths);
+
+    return true;
+}
+
+
+/**
+ * \brief Read map from a packed map file (see mapformat.h), one block at a time.
+ *
+ * \param path Absolute path to the file.
+ * \return True if map was successfully read, false otherwise.
+ */
+bool Map::readPacked(const string& path) {
+    Logger*         logger(Logger::getInstance());
+    PackedMapFile   file(dimensions);
+
+    clear();
+
+    if (!file.read(path, tracks, points)) {
+        logger->log("[WARNING] Invalid or incompatible packed map file (" + path + ").\n\n");
+        clear();
+        return false;
+    }
+
+    basePath        = path;
+    generation      = file.getGeneration();
+    baseSize        = file.getSize();
+    library         = file.getLibrary();
+
+    return true;
 }
 
 
-Track Map::findNearestNeighbor(Track track) {
-    const ANNidxArray indices = findNearestNeighbors(track.getCoordinates());
+/**
+ * \brief Read map from a text file (legacy format, see LegacyMapReader).
+ *
+ * \param path Absolute path to the file.
+ * \return True if map was successfully read, false otherwise.
+ */
+bool Map::readText(const string& path) {
+    LegacyMapReader reader(dimensions);
+
+    // Unable to open file
+    if (!reader.open(path))     return false;
+
+    // Allocate everything at once, then parse in place
+    unsigned long total(reader.getTotal());
+
+    clear();
+    points.resize(total);
 
-    return tracks[indices[1]];
+    points.resize(reader.read(tracks, points.getArray()));
+
+    return true;
 }
 
 
 /**
- * \brief Load map from a text file.
- *
- * The file should be in the user's winamp directory;
- * the absolute path to this directory is automatically generated and should not be provided in the argument.
+ * \brief Store current map in a binary file.
  *
  * \param filename Name of the file.
- * \return True if map was successfully loaded, false otherwise.
+ * 
+ * The file will be created, if necessary, in the user's Winamp directory;
+ * the absolute path to this directory is automatically generated and should not be provided in the argument.
+ * If the map was read from or written to this very file, only tracks changed since then are appended
+ * to its journal; once the journal grows past JOURNAL_COMPACTION_RATIO times the size of the file,
+ * the file is rewritten in the background.
  */
-bool Map::load(string filename) {
+bool Map::save(string filename) {
     Shuffler*   shuffler(Shuffler::getInstance());
     Logger*     logger(Logger::getInstance());
-    
-    // Open map file
+
+    #ifdef DEBUG
+    logger->log("Saving map...\n");
+    #endif
+
+    indexing.wait();
+    compaction.wait();
+
     string path = shuffler->getConfigDirectory() + filename;
 
-    ifstream file(path.c_str(), ios::in);
+    // Unable to create/overwrite map file
+    if (path != basePath) {
+        if (!writeBase(path)) {
+            logger->log("[ERROR] Unable to create/overwrite map file (" + path + ").\n");
+            return false;
+        }
+    }
 
-    // Unable to open file
-    if (!file) {
-        logger->log("[WARNING] Unable to open map file (" + path + ").\n\n");
+    // Unable to append to journal
+    else if (!appendJournal()) {
+        logger->log("[ERROR] Unable to write map journal (" + path + MAP_JOURNAL_EXTENSION + ").\n");
         return false;
     }
-    
-    // Pre-processing
-    string          line;
-    unsigned long   total(0);
 
-    clear();
-    getline(file, line);
-    {stringstream stream(line);
-    stream >> total;}
+    // Fold journal into the map file
+    else if (journal.getSize() > JOURNAL_COMPACTION_RATIO * baseSize) {
+        // The map file cannot be overwritten while it is mapped
+        detachMappedFile();
+        compaction.start();
+    }
 
+    #ifdef DEBUG
+    logger->log("Map successfully saved\n\n");
+    #endif
 
-    // Check if library needs to be rescanned
-    string directory = shuffler->getConfigDirectory();
-    char*  pathToDat = new char[directory.size() + 12];
-    char*  pathToIdx = new char[directory.size() + 12];
+    return true;
+}
 
-    strcpy(pathToDat, directory.c_str());
-    strcpy(pathToIdx, directory.c_str());
-    strcat(pathToDat, "ml\\main.dat");      // SENSITIVE: may depend on Winamp version !
-    strcat(pathToIdx, "ml\\main.idx");      // SENSITIVE: may depend on Winamp version !
 
-    Database        db;
-	Table*          table(db.OpenTable(pathToDat, pathToIdx, false, false)); // Do not create table either index
-    Scanner         *scanner = table->NewScanner(0);
-    unsigned long   mapRecordsCount(table->GetRecordsCount());
+/**
+ * \brief Remember that a track has changed since the last save.
+ *
+ * \param i Index of the track.
+ */
+void Map::markDirty(ANNidx i) {
+    if ((unsigned long)i >= dirtyFlags.size())
+        dirtyFlags.resize(tracks.getSize() > (unsigned long)i ? tracks.getSize() : i + 1, false);
 
-    table->DeleteScanner(scanner);
-	db.CloseTable(table);
-    
-    if (mapRecordsCount != total) {
-        string question;
-        question += "Your media library has changed since last time.\n";
-        question += "Do you want to rescan it ?";
-
-        int answer(MessageBoxA(
-            plugin.hwndParent,
-            question.c_str(),
-            "Rescan library ?",
-            MB_YESNO | MB_ICONQUESTION
-        ));
-
-        if (answer == IDYES) {
-            shuffler->scanLibrary();
-            return true;
-        }
-    }
-    
+    if (dirtyFlags[i])  return;
 
-    // No rescanning required => load from file
-    points = annAllocPts(total, dimensions);
+    dirtyFlags[i] = true;
+    dirtyTracks.push_back(i);
+}
 
-    ANNidx          i(0);
-    unsigned short  j(0);
-    unsigned int    ID(0);
-    unsigned long   length(0);
-    ANNcoord        coordinate;
-    short           code;
-    string          newPath;
-
-    // Read line by line
-    while (!file.eof() && i < total) {
-        Track newTrack(i);
-        getline(file, line);
-        stringstream stream(line);
-
-        // Extract MuseekCode
-        stream >> code;
-        newTrack.setCode((MuseekCode)code);
-
-        // Extract artist ID
-        if (code != ARTIST_NOT_FOUND && code != NOTHING_FOUND) {
-            stream >> ID;
-            newTrack.setArtistID(ID);
-        }
 
-        // Extract title ID
-        if (code != ARTIST_NOT_FOUND && code != TITLE_NOT_FOUND && code != NOTHING_FOUND) {
-            stream >> ID;
-            newTrack.setTitleID(ID);
-        }
+/**
+ * \brief Apply the journal of the map file to the map.
+ *
+ * Records refer to tracks by index; a record beyond the end of the map adds tracks to it.
+ */
+void Map::replayJournal() {
+    Logger*                 logger(Logger::getInstance());
+    vector<MapJournalEntry> entries;
+    unsigned long           i(0), n(tracks.getSize());
 
-        // Extract length
-        stream >> length;
-        newTrack.setLength(length);
+    journal.reset(basePath + MAP_JOURNAL_EXTENSION, generation, dimensions);
 
-        // Extract coordinates
-        if (newTrack.hasCoordinates()) {
-            while (j < dimensions) {
-                stream >> coordinate;
-                points[i][j] = coordinate;
+    if (!journal.read(entries) || entries.empty())  return;
 
-                j++;
-            }
+    // Grow the map at once
+    while (i < entries.size()) {
+        if ((unsigned long)entries[i].trackID >= n)
+            n = entries[i].trackID + 1;
+        i++;
+    }
 
-            j = 0;
-        }
+    if (n > tracks.getSize()) {
+        points.resize(n);
+        tracks.resize(n);
+    }
 
-        // Extract path
-        stream >> newPath;
-        newTrack.setPath(findAndReplace(newPath, "|", " "));
+    // Overwrite tracks
+    for (i = 0; i < entries.size(); i++) {
+        const MapJournalEntry&  entry(entries[i]);
+        ANNidx                  id(entry.trackID);
+
+        if (entry.path != tracks.getPath(id))
+            tracks.setPath(id, entry.path);
+
+        tracks.setCode(id, entry.code);
+        tracks.setArtistID(id, entry.artistID);
+        tracks.setTitleID(id, entry.titleID);
+        tracks.setLength(id, entry.length);
+        tracks.setStamp(id, entry.stamp);
+
+        memcpy(points[entry.trackID], &entry.coordinates[0], dimensions * sizeof(ANNcoord));
+    }
+
+    #ifdef DEBUG
+    logger->log("Map journal replayed (");
+    logger->log(journal.getRecords());
+    logger->log(" records).\n\n");
+    #endif
+}
 
-        tracks.push_back(newTrack);
-        fileIndex[newTrack.getPath()] = tracks.size() - 1;
 
-        /*#ifdef DEBUG
-        Logger* logger = Logger::getInstance();
-        logger->log(newTrack.getPath());
-        logger->log(" => ");
-        logger->log(tracks.size() - 1);
-        logger->log("\n");
-        #endif*/
+/**
+ * \brief Append tracks changed since the last save to the journal.
+ *
+ * \return True if all changes were written, false otherwise.
+ */
+bool Map::appendJournal() {
+    vector<MapJournalEntry> entries(dirtyTracks.size());
+    vector<ANNcoord>        zeros(dimensions, 0);
+    unsigned long           i(0);
+
+    while (i < dirtyTracks.size()) {
+        Track               track(getTrack(dirtyTracks[i]));
+        MapJournalEntry&    entry(entries[i]);
+        MuseekCode          code(track.getCode());
+
+        entry.trackID   = dirtyTracks[i];
+        entry.code      = code;
+        entry.artistID  = track.getArtistID();
+        entry.titleID   = track.getTitleID();
+        entry.length    = track.getLength();
+        entry.stamp     = tracks.getStamp(dirtyTracks[i]);
+        entry.path      = track.getPath();
+
+        if (!TrackStore::hasCoordinates(code))
+            entry.coordinates = zeros;
+        else
+            entry.coordinates.assign(points[dirtyTracks[i]], points[dirtyTracks[i]] + dimensions);
 
         i++;
     }
 
-    file.close();
+    if (!journal.append(entries))   return false;
 
-    // Update k-dimensional tree
-    if (kDimensionalTree)   delete kDimensionalTree;
+    dirtyFlags.clear();
+    dirtyTracks.clear();
 
-    kDimensionalTree = new ANNkd_tree(points, tracks.size(), dimensions);
-    
     return true;
 }
 
 
 /**
- * \brief Store current map in a text file.
+ * \brief Write the whole map to a new map file, and drop its journal.
  *
- * \param filename Name of the file.
- * 
- * The file will be created, if necessary, in the user's Winamp directory;
- * the absolute path to this directory is automatically generated and should not be provided in the argument.
- * Each track is stored in a different line with the following pattern:
- *      MuseekCode artistID titleID length coordinate1 coordinate2 ... coordinateN path
+ * The file is written under a temporary name first, so that the previous map file
+ * (and its journal) remains valid until the new one is complete.
+ *
+ * \param path Absolute path to the file.
+ * \return True if map was successfully written, false otherwise.
  */
-bool Map::save(string filename) {
-    Shuffler*   shuffler(Shuffler::getInstance());
-    Logger*     logger(Logger::getInstance());
+bool Map::writeBase(const string& path) {
+    string          temporaryPath(path + ".tmp");
+    unsigned long   oldGeneration(generation);
+    double          now(currentTime());
+
+    // New generation, so that the old journal no longer applies
+    generation = hashBytes(&now, sizeof(now), generation);
+    if (generation == oldGeneration)    generation++;
+
+    bool written(mapCompression == COMPRESSION_NONE ? writeBinary(temporaryPath) : writePacked(temporaryPath));
+
+    if (!written
+    ||  !waitRetiredMappings(MAP_RELEASE_TIMEOUT)
+    ||  !MoveFileExA(temporaryPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+        DeleteFileA(temporaryPath.c_str());
+        generation = oldGeneration;
+        return false;
+    }
 
-    #ifdef DEBUG
-    logger->log("Saving map...\n");
-    #endif
+    // Everything is in the map file now
+    journal.reset(path + MAP_JOURNAL_EXTENSION, generation, dimensions);
+    journal.remove();
 
-    // Create/overwrite file
-    string path = shuffler->getConfigDirectory() + filename;
-    ofstream file(path.c_str(), ios::out | ios::trunc);
- 
-    // Unable to create/overwrite map file
-    if (!file) {
-        logger->log("[ERROR] Unable to create/overwrite map file (" + path + ").\n");
+    HANDLE file(CreateFileA(path.c_str(), 0, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL));
+
+    basePath = path;
+    baseSize = GetFileSize(file, NULL);
+    CloseHandle(file);
+    dirtyFlags.clear();
+    dirtyTracks.clear();
+
+    return true;
+}
+
+
+/**
+ * \brief Write current map to a binary file (see mapformat.h), in a single pass.
+ *
+ * Coordinates of tracks that have none are written as zeros.
+ *
+ * \param path Absolute path to the file.
+ * \return True if map was successfully written, false otherwise.
+ */
+bool Map::writeBinary(const string& path) {
+    // The map file cannot be overwritten while it is mapped
+    detachMappedFile();
+
+    ofstream file(path.c_str(), ios::out | ios::binary | ios::trunc);
+    if (!file)  return false;
+
+    // Compute layout; paths are laid out in sorted order, which makes them faster to index on load
+    MapFileHeader           header;
+    unsigned long           total(tracks.getSize()), i(0);
+    ULONGLONG               stringsSize(0);
+    vector<ANNidx>          sortedIDs;
+    vector<DWORD>           pathOffsets(total, 0),
+                            pathLengths(total, 0);
+
+    tracks.getSortedPathIDs(sortedIDs);
+
+    while (i < sortedIDs.size()) {
+        ANNidx id(sortedIDs[i]);
+
+        pathOffsets[id] = (DWORD)stringsSize;
+        pathLengths[id] = tracks.getPath(id).size();
+        stringsSize    += pathLengths[id];
+        i++;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MAP_FILE_MAGIC, sizeof(header.magic));
+    header.version              = MAP_FILE_VERSION;
+    header.dimensions           = dimensions;
+    header.trackCount           = total;
+    header.generation           = generation;
+    header.library              = library;
+    header.coordinatesOffset    = (sizeof(MapFileHeader) + MAP_FILE_ALIGNMENT - 1) / MAP_FILE_ALIGNMENT * MAP_FILE_ALIGNMENT;
+    header.recordsOffset        = header.coordinatesOffset + (ULONGLONG)total * dimensions * sizeof(ANNcoord);
+    header.stringsOffset        = header.recordsOffset + (ULONGLONG)total * sizeof(MapFileRecord);
+    header.stringsSize          = stringsSize;
+
+    // Header
+    char padding[MAP_FILE_ALIGNMENT] = {0};
+
+    file.write((const char*)&header, sizeof(header));
+    file.write(padding, (streamsize)(header.coordinatesOffset - sizeof(header)));
+
+    // Coordinate block
+    vector<ANNcoord> zeros(dimensions, 0);
+
+    for (i = 0; i < total; i++) {
+        if (!tracks.hasCoordinates(i))
+            file.write((const char*)&zeros[0], dimensions * sizeof(ANNcoord));
+        else
+            file.write((const char*)points[i], dimensions * sizeof(ANNcoord));
+    }
+
+    // Record block
+    for (i = 0; i < total; i++) {
+        Track           track(getTrack(i));
+        MapFileRecord   record;
+
+        record.code         = track.getCode();
+        record.artistID     = track.getArtistID();
+        record.titleID      = track.getTitleID();
+        record.length       = track.getLength();
+        record.pathOffset   = pathOffsets[i];
+        record.pathLength   = pathLengths[i];
+        record.stamp        = tracks.getStamp(i);
+
+        file.write((const char*)&record, sizeof(record));
+    }
+
+    // String block
+    for (i = 0; i < sortedIDs.size(); i++) {
+        string trackPath(tracks.getPath(sortedIDs[i]));
+        file.write(trackPath.data(), trackPath.size());
+    }
+
+    file.close();
+
+    return !file.fail();
+}
+
+
+/**
+ * \brief Read the tree searched on from a tree file (see mapformat.h).
+ *
+ * The tree is only read if it was built from the current points, with the current backend and
+ * rules. The tree holds its own copy of the points of tracks with coordinates, read from the file
+ * as well (see collectIndexedPoints()); the graph of INDEX_HNSW searches the points of the map,
+ * and must also have been built with the current M.
+ *
+ * \param path Absolute path to the file.
+ * \return True if the tree was read, false otherwise.
+ */
+bool Map::readTree(const string& path) {
+    ifstream file(path.c_str(), ios::in | ios::binary);
+    if (!file)  return false;
+
+    MapTreeHeader header;
+    file.read((char*)&header, sizeof(header));
+
+    if (!file
+    ||  memcmp(header.magic, MAP_TREE_MAGIC, sizeof(header.magic))
+    ||  header.version != MAP_TREE_VERSION
+    ||  header.dimensions != dimensions
+    ||  header.trackCount != tracks.getSize()
+    ||  header.backend != (DWORD)indexBackend
+    ||  (indexBackend != INDEX_HNSW && header.splitRule != (DWORD)splitRule)
+    ||  (indexBackend == INDEX_BD_TREE && header.shrinkRule != (DWORD)shrinkRule)
+    ||  header.checksum != hashPoints())
         return false;
+
+    // ANN aborts on malformed dumps: at least make sure the dump is complete
+    file.seekg(0, ios::end);
+    if ((ULONGLONG)file.tellg() != sizeof(header) + header.dumpSize)    return false;
+    file.seekg(sizeof(header), ios::beg);
+
+    // The graph searches the points of the map, which the checksum ties it to
+    if (indexBackend == INDEX_HNSW) {
+        HnswIndex newGraph;
+        newGraph.reset(dimensions, graphLinks, graphEfConstruction);
+
+        unsigned short  links(newGraph.getMaxLinks()),
+                        efConstruction(newGraph.getEfConstruction());
+
+        if (!newGraph.read(file, tracks.getSize())
+        ||  newGraph.getMaxLinks() != links
+        ||  newGraph.getEfConstruction() != efConstruction)
+            return false;
+
+        pthread_rwlock_wrlock(&searchLock);
+        InterlockedExchange(&searchReady, 0);
+
+        deleteTree();
+        points.releaseRetired();
+        quantizedPoints.clear();
+        graph.swap(newGraph);
+
+        InterlockedExchange(&searchReady, 1);
+        pthread_rwlock_unlock(&searchLock);
+
+        return true;
     }
-    
-    // Download missing coordinates
-    downloadMissingCoordinates();
-    
 
-    // Write total number of tracks
-    file << tracks.size() << endl;
-
-    vector<Track>::iterator i(tracks.begin());
-    unsigned short          j(0);
-
-    while (i != tracks.end()) {
-        Track       track   = *i;
-        MuseekCode  code    = track.getCode();
-
-        file << code;
-
-        // Write artist ID
-        if (code == ALL_FOUND
-        ||  code == ARTIST_APPROXIMATE
-        ||  code == TITLE_APPROXIMATE
-        ||  code == ARTIST_TITLE_APPROXIMATE
-        ||  code == TITLE_NOT_FOUND)
-            file << " " << track.getArtistID();
-
-        // Write title ID
-        if (code == ALL_FOUND
-        ||  code == ARTIST_APPROXIMATE 
-        ||  code == TITLE_APPROXIMATE
-        ||  code == ARTIST_TITLE_APPROXIMATE)
-            file << " " << track.getTitleID();
-
-        // Write length
-        file << " " << track.getLength();
-
-        // Write coordinates
-        if (track.hasCoordinates()) {
-            while (j < dimensions) {
-                file << " " << track.getCoordinate(j);
-                j++;
-            }
-        
-            j = 0;
-        }
+    // A k-dimensional tree cannot read the shrink nodes of a box-decomposition tree
+    ANNkd_tree*         tree(indexBackend == INDEX_BD_TREE ? new ANNbd_tree(file) : new ANNkd_tree(file));
+    ANNpointArray       treePoints(tree->thePoints());
+    vector<ANNpoint>    rows;
+    vector<ANNidx>      ids;
+
+    collectIndexedPoints(rows, ids);
 
-        // Write path
-        file << " " << findAndReplace(track.getPath(), " ", "|");
-        
-        file << endl;
-        ++i;
+    if (tree->nPoints() != (int)ids.size() || tree->theDim() != dimensions) {
+        delete tree;
+        annDeallocPts(treePoints);
+        return false;
     }
 
+    pthread_rwlock_wrlock(&searchLock);
+    InterlockedExchange(&searchReady, 0);
+
+    deleteTree();
+    points.releaseRetired();
+    quantizedPoints.clear();
+
+    searchIndex         = tree;
+    kDimensionalTree    = tree;
+    treeOwnsPoints      = true;
+    indexedPoints.swap(rows);
+    indexedTracks.swap(ids);
+    pthread_rwlock_unlock(&searchLock);
+
+    calibrateSearch();
+
+    InterlockedExchange(&searchReady, 1);
+
+    return true;
+}
+
+
+/**
+ * \brief Write the tree searched on to a tree file (see mapformat.h).
+ *
+ * The file is written aside, then moved over the previous one.
+ *
+ * \param path Absolute path to the file.
+ * \return True if the tree was written, false otherwise.
+ */
+bool Map::writeTree(const string& path) {
+    if (!kDimensionalTree && graph.getSize() == 0)  return false;
+
+    string      temporaryPath(path + ".tmp");
+    ofstream    file(temporaryPath.c_str(), ios::out | ios::binary | ios::trunc);
+    if (!file)  return false;
+
+    MapTreeHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MAP_TREE_MAGIC, sizeof(header.magic));
+    header.version      = MAP_TREE_VERSION;
+    header.dimensions   = dimensions;
+    header.trackCount   = tracks.getSize();
+    header.checksum     = hashPoints();
+    header.backend      = indexBackend;
+    header.splitRule    = kDimensionalTree ? splitRule : 0;
+    header.shrinkRule   = indexBackend == INDEX_BD_TREE ? shrinkRule : ANN_BD_NONE;
+
+    file.write((const char*)&header, sizeof(header));
+
+    if (kDimensionalTree)   kDimensionalTree->Dump(ANNtrue, file);
+    else                    graph.write(file);
+
+    // Size of the dump is only known now
+    header.dumpSize = (ULONGLONG)file.tellp() - sizeof(header);
+    file.seekp(0, ios::beg);
+    file.write((const char*)&header, sizeof(header));
     file.close();
 
-    #ifdef DEBUG
-    logger->log("Map successfully saved\n\n");
-    #endif
+    if (file.fail()
+    ||  !MoveFileExA(temporaryPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+        DeleteFileA(temporaryPath.c_str());
+        return false;
+    }
 
     return true;
 }
+
+
+/**
+ * \brief Write current map to a packed map file (see mapformat.h), compressed as set by setMapCompression().
+ *
+ * \param path Absolute path to the file.
+ * \return True if map was successfully written, false otherwise.
+ */
+bool Map::writePacked(const string& path) {
+    Logger*         logger(Logger::getInstance());
+    PackedMapFile   file(dimensions);
+
+    // The map file cannot be overwritten while it is mapped
+    detachMappedFile();
+
+    file.setCodec(mapCompression);
+    file.setGeneration(generation);
+    file.setLibrary(library);
+
+    if (!Compressor::getInstance()->isAvailable(mapCompression)) {
+        logger->log("[WARNING] Compression library not available, map file is written uncompressed.\n\n");
+        file.setCodec(COMPRESSION_NONE);
+    }
+
+    return file.write(path, tracks, points);
+}
+
+
+/**
+ * \brief Default constructor.
+ *
+ * \param newParent Map to compact.
+ */
+Map::Compaction::Compaction(Map* newParent) :
+        parent(newParent) {
+}
+
+
+///
+Map::Compaction::~Compaction() {
+    wait();
+}
+
+
+/**
+ * \brief Rewrite the map file, so that its journal can be dropped.
+ *
+ * The map must not be modified meanwhile; methods modifying it wait for the compaction to be done.
+ */
+void Map::Compaction::run() {
+    Logger* logger(Logger::getInstance());
+
+    if (!parent->writeBase(parent->basePath))
+        logger->log("[WARNING] Unable to compact map file (" + parent->basePath + ").\n\n");
+}
+
+
+/**
+ * \brief Default constructor.
+ *
+ * \param newFilter Filter on tracks, if any.
+ * \param newTracks Track of each indexed point.
+ */
+Map::IndexFilter::IndexFilter(const NeighborFilter* newFilter, const vector<ANNidx>& newTracks) :
+        filter(newFilter),
+        tracks(newTracks) {
+}
+
+
+///
+Map::IndexFilter::~IndexFilter() {
+}
+
+
+/// \return True if the filter on tracks accepts the track of the indexed point, or there is none.
+bool Map::IndexFilter::accept(ANNidx i) const {
+    return !filter || filter->accept(tracks[i]);
+}
+
+
+/// \brief Default constructor; see setQueries() and setResults().
+Map::BatchSearch::BatchSearch() :
+        parent(NULL),
+        queries(NULL),
+        count(0),
+        k(0),
+        ids(NULL),
+        distances(NULL),
+        query() {
+}
+
+
+///
+Map::BatchSearch::~BatchSearch() {
+    wait();
+}
+
+
+/**
+ * \brief Set the range of queries to search.
+ *
+ * \param map           Map to search.
+ * \param newQueries    First reference point of the range.
+ * \param newCount      Number of reference points.
+ * \param newK          Number of nearest neighbors to search per point.
+ */
+void Map::BatchSearch::setQueries(Map* map, const ANNpoint* newQueries, unsigned long newCount, int newK) {
+    parent  = map;
+    queries = newQueries;
+    count   = newCount;
+    k       = newK;
+}
+
+
+/**
+ * \brief Set where results of the range go.
+ *
+ * \param newIds        Storage for count * k indices.
+ * \param newDistances  Storage for count * k squared distances.
+ */
+void Map::BatchSearch::setResults(ANNidxArray newIds, ANNdistArray newDistances) {
+    ids         = newIds;
+    distances   = newDistances;
+}
+
+
+/// \brief Search nearest neighbors of the range, and copy them to the results.
+void Map::BatchSearch::run() {
+    unsigned long   i(0);
+    int             j(0);
+
+    for (i = 0; i < count; i++) {
+        parent->findNearestNeighbors(queries[i], k, query);
+
+        // Neighbors not found are ANN_NULL_IDX already
+        const ANNidxArray   foundIds(query.getIdArray());
+        const ANNdistArray  foundDistances(query.getDistanceArray());
+
+        for (j = 0; j < k; j++) {
+            ids[i * k + j]          = foundIds[j];
+            distances[i * k + j]    = foundDistances[j];
+        }
+    }
+}
+
+
+///
+Map::Indexing::Indexing(Map* newParent) :
+        parent(newParent),
+        merge(false) {
+}
+
+
+///
+Map::Indexing::~Indexing() {
+    wait();
+}
+
+
+/// \brief Choose between preparing the search structure after a lazy load, and merging its delta (see Map::mergeDelta()).
+void Map::Indexing::setMerge(bool newMerge) {
+    merge = newMerge;
+}
+
+
+/**
+ * \brief Build the search structure after a lazy load, or merge its delta.
+ *
+ * Methods modifying the map wait for this to be done.
+ */
+void Map::Indexing::run() {
+    Logger* logger(Logger::getInstance());
+    double  start(currentTime());
+
+    if (merge) {
+        parent->mergeDelta();
+
+        logger->log("Search structure rebuilt in ");
+        logger->log((currentTime() - start) * 1000);
+        logger->log(" ms.\n\n");
+        return;
+    }
+
+    bool    read(parent->prepareTree());
+
+    logger->log(read ? "Search structure read in " : "Search structure built in ");
+    logger->log((currentTime() - start) * 1000);
+    logger->log(" ms.\n\n");
+}
\ No newline at end of file
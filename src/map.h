@@ -17,37 +17,159 @@
     #include "constants.h"
     #include "cthread.h"
     #include "gen_museek.h"
+    #include "hashindex.h"
+    #include "hnswindex.h"
+    #include "mapformat.h"
+    #include "mapjournal.h"
+    #include "missingset.h"
+    #include "neighborfilter.h"
+    #include "neighborquery.h"
+    #include "pointstore.h"
+    #include "quantizedpoints.h"
+    #include "trackstore.h"
 
+    class MappedFile;
     class Track;
     class Shuffler;
 
+    #define MAP_RELEASE_TIMEOUT     10000   ///< Time to wait for readers of a replaced map, in milliseconds
+    #define LAZY_SEARCH_WINDOW      4096    ///< Tracks searched while the search structure is being built
+    #define BATCH_MIN_QUERIES       64      ///< Fewest queries of a batch worth a thread of their own
+    #define SHELL_MAX_VISITED       10000   ///< Default number of points examined by findInShell()
+    #define CALIBRATION_QUERIES     200     ///< Queries timed per setting by calibrateSearch()
+    #define DELTA_MERGE_SIZE        1024    ///< Changed tracks searched by brute force, beyond which the search structure is rebuilt in background
+    #define CALIBRATION_NEIGHBORS   8       ///< Neighbors per calibration query, as the first round of NeighborIterator
+    #define CALIBRATION_MAX_ERROR_BOUND 2.  ///< Highest error bound calibrateSearch() sets before limiting points visited
+
     
     /**
      * \brief Class to manage sets of tracks, including the shuffle mode.
      * 
-     * This class is a singleton.
+     * One map is current at a time (see getInstance()). Maps are reference counted, so that a
+     * rescan can build a new map aside and publish() it while other threads keep reading the
+     * previous one: a reader pins the current map with acquire() and unpins it with release(),
+     * and tracks pin the map they belong to (see addReference()). A replaced map is deleted once
+     * no one refers to it.
+     *
+     * Only rescans build new maps; smaller changes (coordinates of a track, played tracks)
+     * still apply to the current map in place.
      */
     class Map {
         static Map*                     instance;
+        static pthread_mutex_t          instanceLock;   ///< Guards instance and retiredMaps
+        static pthread_mutex_t          treeSearchLock; ///< Serializes k-dimensional tree searches, ANN keeping their state in globals
+        pthread_rwlock_t                searchLock;     ///< Held for reading by searches, for writing while the search structure or its delta change
+        static unsigned long            retiredMaps;    ///< Maps replaced by publish() and still referenced
         Shuffler*                       parent;
+        volatile LONG                   references;
+        volatile LONG                   readers;        ///< Pins taken by acquire(), whose holders may keep points of a detached map file
+        bool                            retired;        ///< True once the map has been replaced by publish()
 
-        unsigned long                   allocatedPoints;
         unsigned short
             dimensions,
             tracksPerQuery;
 
-        ANNpointArray                   points;
-        std::vector<Track>              tracks;
-        std::list<ANNidx>               missingCoordinates;
-        std::map<std::string, ANNidx>   fileIndex;
-        ANNkd_tree*                     kDimensionalTree;
+        PointStore                      points;
+        MappedFile*                     mappedFile;     ///< Map file the first points refer to, if any
+        std::vector<MappedFile*>        retiredMappings;        ///< Map files detached while readers may still refer to their points
+        TrackStore                      tracks;
+        HashIndex                       pathIndex;      ///< Tracks by case-folded path
+        HashIndex                       nameIndex;      ///< Tracks by normalized artist and title
+        MissingSet                      missingCoordinates;     ///< Tracks whose coordinates are still to be downloaded
+        std::vector<ANNidx>             freeTracks;     ///< Rows of removed tracks, reused by insert()
+        CoordinateMode                  coordinateMode;
+        IndexBackend                    indexBackend;           ///< Search structure built in COORDINATES_DOUBLE mode
+        ANNsplitRule                    splitRule;
+        ANNshrinkRule                   shrinkRule;
+        bool                            prioritySearch;         ///< Search trees with annkPriSearch() rather than annkSearch()
+        ANNpointSet*                    searchIndex;            ///< Search structure in COORDINATES_DOUBLE mode
+        ANNkd_tree*                     kDimensionalTree;       ///< Same as searchIndex if it is a tree, NULL otherwise
+        bool                            simdScan;               ///< True if nearest neighbors are searched by DistanceEngine
+        HnswIndex                       graph;                  ///< Search structure for INDEX_HNSW
+        unsigned short                  graphLinks,             ///< M of the graph, see HnswIndex
+                                        graphEfConstruction;
+        int                             graphEf;                ///< Candidates considered by searches of the graph
+        bool                            treeOwnsPoints;         ///< True if the tree was read from a tree file, with its own points
+        QuantizedPoints                 quantizedPoints;        ///< Search structure in other modes
+        volatile LONG                   searchReady;            ///< Non-zero once the search structure is built
+        std::vector<ANNpoint>           indexedPoints;          ///< Points of the tracks with coordinates, which the search structure is built over
+        std::vector<ANNidx>             indexedTracks;          ///< Track of each indexed point, by increasing index
+        std::vector<ANNidx>             deltaTracks;            ///< Tracks changed since the search structure was built, searched by brute force
+        std::vector<bool>               deltaFlags;
+        std::vector<ANNidx>             mergeTracks;            ///< Tracks changed while the delta is merged, kept in the delta of the new structure
+        volatile LONG                   merging;                ///< Non-zero while the delta is merged in background
+        bool                            lazyLoading;            ///< Build the search structure in background on load
+
+        std::string                     basePath;       ///< Map file the map was read from or written to, if any
+        unsigned long                   generation,     ///< Generation of this map file
+                                        baseSize;       ///< Size of this map file, in bytes
+        MapJournal                      journal;
+        std::vector<bool>               dirtyFlags;
+        std::vector<ANNidx>             dirtyTracks;    ///< Tracks changed since the last save
+        LibraryFingerprint              library;        ///< Media library the map was built from
+        CompressionCodec                mapCompression; ///< Format of map files written, see setMapCompression()
         
-        double                          errorBound;
-        ANNidxArray                     resultsID;
-        ANNdistArray                    distances;
+        double                          errorBound;     ///< Error bound set by the user, see setNearestNeighborErrorBound()
+        double                          searchErrorBound;       ///< Error bound of tree searches, calibrated from errorBound
+        int                             maxPointsVisited;       ///< Points visited per tree search, 0 for no limit
+        unsigned long                   latencyTarget;  ///< Target 99th percentile of tree searches, in microseconds; 0 for none
 
         //HWND                            progressBarHandle;
 
+        // Threads
+        class Compaction : public CThread {
+            Map* parent;
+
+            public:
+            Compaction(Map*);
+            ~Compaction();
+
+            void run();
+        } compaction;
+
+        class Indexing : public CThread {
+            Map* parent;
+            bool merge;             ///< Merge the delta into a rebuilt structure, rather than prepare the structure after a lazy load
+
+            public:
+            Indexing(Map*);
+            ~Indexing();
+
+            void setMerge(bool);
+            void run();
+        } indexing;
+
+        /// \brief Filter on indexed points, accepting those whose track a filter on tracks accepts.
+        class IndexFilter : public NeighborFilter {
+            const NeighborFilter*       filter;
+            const std::vector<ANNidx>&  tracks;
+
+            public:
+            IndexFilter(const NeighborFilter*, const std::vector<ANNidx>&);
+            ~IndexFilter();
+
+            bool    accept(ANNidx)  const;
+        };
+
+        /// \brief Thread searching nearest neighbors of a range of queries of a batch.
+        class BatchSearch : public CThread {
+            Map*            parent;
+            const ANNpoint* queries;
+            unsigned long   count;
+            int             k;
+            ANNidxArray     ids;
+            ANNdistArray    distances;
+            NeighborQuery   query;
+
+            public:
+            BatchSearch();
+            ~BatchSearch();
+
+            void    setQueries(Map*, const ANNpoint*, unsigned long, int);
+            void    setResults(ANNidxArray, ANNdistArray);
+            void    run();
+        };
+
         // Private methods
         Map();
         Map(const Map&);
@@ -55,39 +177,124 @@
 
         void                operator=(const Map &);
         void                parseResponse(std::string, std::list<ANNidx>&);
+        void                queryCoordinates(const std::vector<ANNidx>&);
+
+        void                releasePoints();
+        void                deleteTree();
+        void                collectIndexedPoints(std::vector<ANNpoint>&, std::vector<ANNidx>&);
+        void                buildIndex(ANNpointSet*&, ANNkd_tree*&, HnswIndex&, QuantizedPoints&, std::vector<ANNpoint>&, std::vector<ANNidx>&);
+        void                mergeDelta();
+        void                markChanged(ANNidx);
+        bool                isChanged(ANNidx)       const;
+        DWORD               hashPoints();
+        bool                prepareTree();
+        void                searchWindow(ANNpoint, int, ANNidxArray, ANNdistArray, const NeighborFilter*);
+        void                searchTree(ANNpoint, int, ANNidxArray, ANNdistArray, double, int);
+        void                searchStructure(ANNpoint, int, NeighborQuery&, const NeighborFilter*, int);
+        void                searchDelta(ANNpoint, int, NeighborQuery&, const NeighborFilter*, int);
+        void                calibrateSearch();
+        double              timeSearches(const std::vector<ANNidx>&, int, double, int, const std::vector<ANNidx>&, double&);
+        void                detachMappedFile();
+        void                releaseRetiredMappings();
+        bool                waitRetiredMappings(DWORD);
+        bool                checkLibrary();
+        bool                writeLibraryFingerprint();
+
+        void                markDirty(ANNidx);
+        void                replayJournal();
+        bool                appendJournal();
+        bool                writeBase(const std::string&);
+
+        static DWORD        hashPath(const std::string&);
+        static DWORD        hashName(const std::string&, const std::string&);
+        bool                findPath(const std::string&, ANNidx&);
+        bool                findName(const std::string&, const std::string&, ANNidx&);
 
         public:
         static Map*         getInstance();
         static void         kill();
+        static Map*         create();
+        static Map*         acquire();
+        static void         publish(Map*);
+        static bool         synchronize(DWORD);
+        static bool         fingerprintLibrary(LibraryFingerprint&);
+        static DWORD        stampFile(ULONGLONG, ULONGLONG);
+        static long         countLibraryRecords();
 
+        CoordinateMode      getCoordinateMode()     const;
         unsigned short      getDimensions()         const;
+        IndexBackend        getIndexBackend()       const;
+        int                 getGraphEf()            const;
+        unsigned long       getLatencyTarget()      const;
+        ANNsplitRule        getSplitRule()          const;
+        ANNshrinkRule       getShrinkRule()         const;
+        MuseekCode          getCode(ANNidx)         const;
         ANNpoint            getPoint(ANNidx);
         unsigned int        getSize()			    const;
-        Track*              getTrack(ANNidx);
+        bool                hasCoordinates(ANNidx)  const;
+        bool                isAlreadyPlayed(ANNidx) const;
+        bool                isLazyLoading()         const;
+        bool                isPrioritySearch()      const;
+        bool                isSearchReady()         const;
+        Track               getTrack(ANNidx);
+        Track               getRandomTrack();
 
         void                setCoordinate(ANNidx, unsigned short, ANNcoord);
+        void                setCoordinateMode(CoordinateMode);
         void                setDimensions(unsigned short);
+        void                setIndexBackend(IndexBackend);
+        void                setGraphEf(int);
+        void                setGraphEfConstruction(unsigned short);
+        void                setGraphLinks(unsigned short);
+        void                setLatencyTarget(unsigned long);
+        void                setLazyLoading(bool);
+        void                setMapCompression(CompressionCodec);
         void                setNearestNeighborErrorBound(double);
         void                setParent(Shuffler*);
+        void                setPrioritySearch(bool);
+        void                setShrinkRule(ANNshrinkRule);
+        void                setSplitRule(ANNsplitRule);
         void                setSize(unsigned long);
         void                setTracksPerQuery(unsigned short);
 
         void                addTrack(std::string, std::string, std::string path = std::string(""));
         bool                downloadCoordinates(ANNidx);
-        bool                downloadCoordinates(std::list<ANNidx>);
+        bool                downloadCoordinates(const std::vector<ANNidx>&);
         bool                downloadMissingCoordinates();
-        void                insert(Track);
+        Track               insert(const std::string&);
+        Track               update(const std::string&, DWORD);
+        void                remove(ANNidx);
+        void                copyTracks(const Map&);
+
+        void                addReference();
+        void                removeReference();
+        void                release();
 
+        void                buildIndexes();
+        void                buildTree();
+        void                indexCoordinates();
         void                clear();
+        void                updateLibraryFingerprint();
         bool                load(std::string filename = std::string(MAP_FILE));
         bool                save(std::string filename = std::string(MAP_FILE));
+        bool                readBinary(const std::string&);
+        bool                readPacked(const std::string&);
+        bool                readText(const std::string&);
+        bool                writeBinary(const std::string&);
+        bool                readTree(const std::string&);
+        bool                writeTree(const std::string&);
+        bool                writePacked(const std::string&);
 
-        Track*              findTrack(std::string, std::string);
-        Track*              findTrack(std::wstring, std::wstring);
-        const ANNidxArray   findNearestNeighbors(ANNpoint, unsigned short k = 2);
-        const ANNidxArray   findNearestNeighbors(ANNidx, unsigned short k = 2);
-        const ANNidxArray   findNearestNeighbors(const Track*, unsigned short k = 2);
+        Track               findTrack(std::string, std::string);
+        Track               findTrack(std::wstring, std::wstring);
+        Track               findTrack(const Track&);
+        int                 findNearestNeighbors(ANNpoint, int, NeighborQuery&, const NeighborFilter* filter = NULL, bool budgeted = true);
+        int                 findNearestNeighbors(ANNidx, int, NeighborQuery&);
+        int                 findNearestNeighbors(const Track&, int, NeighborQuery&);
+        void                findNearestNeighbors(const ANNpoint*, unsigned long, int, ANNidxArray, ANNdistArray, unsigned short workers = 0);
+        void                findNearestNeighbors(const ANNidx*, unsigned long, int, ANNidxArray, ANNdistArray, unsigned short workers = 0);
+        int                 findInShell(ANNpoint, double, double, int, NeighborQuery&, const NeighborFilter* filter = NULL);
         Track               findNearestNeighbor(Track);
         ANNidx              findNearestNeighbor(ANNidx);
     };
-#endif
+#endif
\ No newline at end of file
@@ -0,0 +1,203 @@
+#ifndef MAPFORMAT_H
+    #define MAPFORMAT_H
+
+    /**
+     * \file mapformat.h
+     * \brief Binary map file format.
+     *
+     * A binary map file is made of the following blocks, in this order:
+     *  - a MapFileHeader;
+     *  - the coordinate block: trackCount * dimensions ANNcoord values, one point after the other;
+     *  - the record block: trackCount MapFileRecord structures;
+     *  - the string block: paths of all tracks, neither separated nor NUL-terminated.
+     *
+     * Offsets are relative to the beginning of the file. The coordinate block is
+     * aligned on MAP_FILE_ALIGNMENT bytes, so that it can be used in place once mapped.
+     * Version 1 headers end right before the library fingerprint; they are still read,
+     * as if the fingerprint was empty. Records of version 1 and 2 files end right before
+     * the stamp; they are still read, as if stamps were unknown.
+     *
+     * Changes made after a map file was written are appended to a journal file, stored
+     * next to it with MAP_JOURNAL_EXTENSION appended to its name. A journal is made of a
+     * MapJournalHeader followed by MapJournalRecord entries, each of them followed by the
+     * coordinates (dimensions ANNcoord values) and path of the track. A record holds the
+     * whole state of a track, so that replaying it simply overwrites the track. Records of
+     * version 1 journals end right before the stamp; they are still read, as if stamps were
+     * unknown, and appended to in that version.
+     *
+     * In COORDINATES_DOUBLE mode, the tree searched on (see IndexBackend) is stored next to the
+     * map file, with MAP_TREE_EXTENSION appended to its name, so that it need not be rebuilt on load.
+     * A tree file is made of a MapTreeHeader followed by the dump of the tree (see ANNkd_tree::Dump()),
+     * points included; these are the points of the tracks with coordinates only, by index, so that
+     * point i of the tree is the i-th such track. It only applies to the points whose checksum it
+     * holds, and to the backend and rules it was built with. For INDEX_HNSW, the dump is the graph instead: a MapGraphHeader,
+     * the level of each point (a signed char, -1 for points not inserted), the links of each point
+     * on level 0 (a count followed by 2M indices, as ANNidx), then the links of each point with
+     * a level above 0, by point then by level (a count followed by M indices).
+     *
+     * A packed map file holds the same data in less space, but has to be decoded on load.
+     * It starts with a PackedMapHeader, followed by a PackedMapScale per dimension, then by
+     * blocks, each made of a PackedMapBlock followed by its data, compressed as stated in the
+     * header (see CompressionCodec). Decompressed, the data of a block is:
+     *  - for a PACKED_BLOCK_TRACKS block, the next count tracks by index: their coordinates,
+     *    quantized as signed 16-bit values, dimension after dimension; then their codes, as
+     *    signed bytes; then their artist IDs, title IDs, lengths and stamps, as DWORD values
+     *    (version 1 files have no stamps);
+     *  - for a PACKED_BLOCK_PATHS block, the next count paths in sorted order: their track IDs
+     *    and lengths, as DWORD values, then the paths themselves, neither separated nor
+     *    NUL-terminated.
+     * All track blocks come before path blocks. Journals apply to packed map files as well.
+     */
+
+    #include "constants.h"
+
+    #define MAP_FILE_MAGIC          "MUSEEKMP"
+    #define MAP_FILE_VERSION        3
+    #define MAP_FILE_ALIGNMENT      16
+
+    #define PACKED_MAP_MAGIC        "MUSEEKPK"
+    #define PACKED_MAP_VERSION      2
+    #define PACKED_MAP_BLOCK_SIZE   4096    ///< Number of tracks or paths per block
+    #define PACKED_COORDINATE_MAX   32767   ///< Largest quantized coordinate, in absolute value
+
+    #define MAP_JOURNAL_MAGIC       "MUSEEKJL"
+    #define MAP_JOURNAL_VERSION     2
+    #define MAP_JOURNAL_EXTENSION   ".journal"
+
+    #define MAP_TREE_MAGIC          "MUSEEKKD"
+    #define MAP_TREE_VERSION        3
+    #define MAP_TREE_EXTENSION      ".tree"
+
+    #define LIBRARY_SAMPLE_COUNT    16      ///< Number of blocks hashed per library file
+    #define LIBRARY_SAMPLE_SIZE     4096    ///< Size of these blocks, in bytes
+
+
+    /**
+     * \brief Cheap fingerprint of the media library files.
+     *
+     * Used to detect changes of the library without opening it. Hashes are computed over
+     * LIBRARY_SAMPLE_COUNT blocks evenly spread over each file, the last block included.
+     */
+    struct LibraryFingerprint {
+        ULONGLONG   dataSize;           ///< Size of main.dat, in bytes
+        ULONGLONG   dataTime;           ///< Last write time of main.dat (FILETIME)
+        ULONGLONG   indexSize;          ///< Size of main.idx, in bytes
+        ULONGLONG   indexTime;          ///< Last write time of main.idx (FILETIME)
+        DWORD       dataHash;           ///< Hash of sampled blocks of main.dat
+        DWORD       indexHash;          ///< Hash of sampled blocks of main.idx
+    };
+
+
+    /// \brief Header of a binary map file.
+    struct MapFileHeader {
+        char        magic[8];           ///< Always MAP_FILE_MAGIC
+        DWORD       version;            ///< Format version, see MAP_FILE_VERSION
+        DWORD       dimensions;         ///< Number of coordinates per track
+        DWORD       trackCount;         ///< Number of tracks
+        DWORD       generation;         ///< Random stamp, ties journals to this very file
+        ULONGLONG   coordinatesOffset;  ///< Offset of the coordinate block
+        ULONGLONG   recordsOffset;      ///< Offset of the record block
+        ULONGLONG   stringsOffset;      ///< Offset of the string block
+        ULONGLONG   stringsSize;        ///< Size of the string block, in bytes
+        LibraryFingerprint  library;    ///< Media library the map was built from (version 2)
+    };
+
+
+    /// \brief Fixed-size part of a track in a binary map file.
+    struct MapFileRecord {
+        LONG        code;               ///< MuseekCode of the track
+        DWORD       artistID;
+        DWORD       titleID;
+        DWORD       length;             ///< Length of the track, in seconds
+        DWORD       pathOffset;         ///< Offset of the path, relative to the string block
+        DWORD       pathLength;         ///< Length of the path, in bytes
+        DWORD       stamp;              ///< Stamp of the track file, 0 if unknown (version 3)
+    };
+
+
+    /// \brief Header of a packed map file.
+    struct PackedMapHeader {
+        char        magic[8];           ///< Always PACKED_MAP_MAGIC
+        DWORD       version;            ///< Format version, see PACKED_MAP_VERSION
+        DWORD       dimensions;         ///< Number of coordinates per track
+        DWORD       trackCount;         ///< Number of tracks
+        DWORD       generation;         ///< Random stamp, ties journals to this very file
+        DWORD       codec;              ///< CompressionCodec of blocks
+        DWORD       blockCount;         ///< Number of blocks
+        LibraryFingerprint  library;    ///< Media library the map was built from
+    };
+
+
+    /// \brief Quantization of a dimension: coordinate = offset + scale * value.
+    struct PackedMapScale {
+        double      offset;
+        double      scale;
+    };
+
+
+    /// \brief Kinds of blocks of a packed map file.
+    enum PackedBlockType {
+        PACKED_BLOCK_TRACKS = 1,
+        PACKED_BLOCK_PATHS  = 2
+    };
+
+
+    /// \brief Header of a block of a packed map file.
+    struct PackedMapBlock {
+        DWORD       type;               ///< PackedBlockType
+        DWORD       count;              ///< Number of tracks or paths in the block
+        DWORD       rawSize;            ///< Size of the data, in bytes, once decompressed
+        DWORD       packedSize;         ///< Size of the data, in bytes, as stored
+        DWORD       checksum;           ///< Hash of the decompressed data
+    };
+
+
+    /// \brief Header of a journal file.
+    struct MapJournalHeader {
+        char        magic[8];           ///< Always MAP_JOURNAL_MAGIC
+        DWORD       version;            ///< Format version, see MAP_JOURNAL_VERSION
+        DWORD       dimensions;         ///< Number of coordinates per track
+        DWORD       generation;         ///< Generation of the map file the journal applies to
+        DWORD       reserved;
+    };
+
+
+    /// \brief Fixed-size part of a journal record.
+    struct MapJournalRecord {
+        DWORD       size;               ///< Size of the record, including coordinates and path
+        DWORD       checksum;           ///< Hash of the record, computed with this field set to 0
+        DWORD       trackID;            ///< Index of the track in the map
+        LONG        code;               ///< MuseekCode of the track
+        DWORD       artistID;
+        DWORD       titleID;
+        DWORD       length;             ///< Length of the track, in seconds
+        DWORD       pathLength;         ///< Length of the path, in bytes
+        DWORD       stamp;              ///< Stamp of the track file, 0 if unknown (version 2)
+    };
+
+
+    /// \brief Header of a tree file.
+    struct MapTreeHeader {
+        char        magic[8];           ///< Always MAP_TREE_MAGIC
+        DWORD       version;            ///< Format version, see MAP_TREE_VERSION
+        DWORD       dimensions;         ///< Number of coordinates per track
+        DWORD       trackCount;         ///< Number of tracks of the map, with coordinates or not
+        DWORD       checksum;           ///< Hash of the tracks with coordinates the tree was built from, indices and points
+        DWORD       backend;            ///< INDEX_KD_TREE, INDEX_BD_TREE or INDEX_HNSW, see IndexBackend
+        DWORD       splitRule;          ///< See ANNsplitRule, trees only
+        DWORD       shrinkRule;         ///< See ANNshrinkRule, INDEX_BD_TREE only
+        DWORD       reserved;           ///< Always 0
+        ULONGLONG   dumpSize;           ///< Size of the dump following the header, in bytes
+    };
+
+
+    /// \brief Header of the graph of a tree file, for INDEX_HNSW (see HnswIndex).
+    struct MapGraphHeader {
+        DWORD       maxLinks;           ///< Neighbors per point on levels above 0 (M)
+        DWORD       efConstruction;     ///< Candidates considered when inserting a point
+        DWORD       capacity;           ///< Number of points, inserted or not
+        DWORD       size;               ///< Number of points inserted
+        DWORD       entryPoint;         ///< Point searches start from
+        DWORD       topLevel;           ///< Level of the entry point; meaningless if size is 0
+    };
+#endif
\ No newline at end of file
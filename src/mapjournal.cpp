@@ -0,0 +1,225 @@
+/**
+ * \file mapjournal.cpp
+ * \brief MapJournal class implementation.
+ */
+
+#include <cstddef>
+#include <cstring>
+
+#include "mapformat.h"
+#include "mapjournal.h"
+#include "mappedfile.h"
+#include "utils.h"
+
+using namespace std;
+
+
+/// \brief Default constructor.
+MapJournal::MapJournal() :
+        path(),
+        generation(0),
+        version(MAP_JOURNAL_VERSION),
+        size(0),
+        records(0),
+        dimensions(0) {
+}
+
+
+/// \brief Destructor.
+MapJournal::~MapJournal() {
+}
+
+
+/// \return Number of valid records in the journal.
+unsigned long MapJournal::getRecords() const {
+    return records;
+}
+
+
+/// \return Size of the valid part of the journal, in bytes.
+unsigned long MapJournal::getSize() const {
+    return size;
+}
+
+
+/**
+ * \brief Attach the journal to a map file.
+ *
+ * Nothing is read nor written until read() or append() is called.
+ *
+ * \param newPath           Absolute path to the journal file.
+ * \param newGeneration     Generation of the map file (see MapFileHeader).
+ * \param newDimensions     Number of coordinates per track.
+ */
+void MapJournal::reset(const string& newPath, unsigned long newGeneration, unsigned short newDimensions) {
+    path        = newPath;
+    generation  = newGeneration;
+    dimensions  = newDimensions;
+    version     = MAP_JOURNAL_VERSION;
+    size        = 0;
+    records     = 0;
+}
+
+
+/**
+ * \brief Read all valid records of the journal.
+ *
+ * A journal written for another generation of the map file is ignored.
+ *
+ * \param entries Read entries, in the order they were appended (modified).
+ * \return True if a journal matching the map file was found, false otherwise.
+ */
+bool MapJournal::read(vector<MapJournalEntry>& entries) {
+    MappedFile  file;
+
+    size    = 0;
+    records = 0;
+
+    if (!file.open(path))   return false;
+
+    const char*             data(file.getData());
+    const MapJournalHeader* header((const MapJournalHeader*)data);
+    unsigned long           position(sizeof(MapJournalHeader));
+    unsigned long           coordinatesSize(dimensions * sizeof(ANNcoord));
+
+    if (file.getSize() < sizeof(MapJournalHeader)
+    ||  memcmp(header->magic, MAP_JOURNAL_MAGIC, sizeof(header->magic))
+    ||  header->version < 1
+    ||  header->version > MAP_JOURNAL_VERSION
+    ||  header->dimensions != dimensions
+    ||  header->generation != generation)
+        return false;
+
+    // Version 1 records have no stamp
+    unsigned long recordSize(header->version >= 2 ? sizeof(MapJournalRecord) : offsetof(MapJournalRecord, stamp));
+
+    version = header->version;
+    size    = position;
+
+    // Read records until the end of the file, or the first invalid one
+    while (position + recordSize <= file.getSize()) {
+        MapJournalRecord record;
+        memset(&record, 0, sizeof(record));
+        memcpy(&record, data + position, recordSize);
+
+        if (record.size != recordSize + coordinatesSize + record.pathLength
+        ||  record.size > file.getSize() - position)
+            break;
+
+        DWORD checksum(record.checksum);
+        record.checksum = 0;
+
+        unsigned long hash(hashBytes(&record, recordSize));
+        hash = hashBytes(data + position + recordSize, record.size - recordSize, hash);
+
+        if (hash != checksum)   break;
+
+        MapJournalEntry entry;
+        entry.trackID   = record.trackID;
+        entry.code      = (MuseekCode)record.code;
+        entry.artistID  = record.artistID;
+        entry.titleID   = record.titleID;
+        entry.length    = record.length;
+        entry.stamp     = record.stamp;
+        entry.coordinates.resize(dimensions);
+        memcpy(&entry.coordinates[0], data + position + recordSize, coordinatesSize);
+        entry.path.assign(data + position + recordSize + coordinatesSize, record.pathLength);
+
+        entries.push_back(entry);
+
+        position   += record.size;
+        size        = position;
+        records++;
+    }
+
+    return true;
+}
+
+
+/**
+ * \brief Append records to the journal, and flush them to disk.
+ *
+ * The journal is created if necessary; an invalid tail left by a previous crash is overwritten.
+ * Records are written in the version of the journal read, stamps being dropped in version 1.
+ *
+ * \param entries Entries to append.
+ * \return True if all entries were written, false otherwise.
+ */
+bool MapJournal::append(const vector<MapJournalEntry>& entries) {
+    HANDLE file(CreateFileA(path.c_str(), GENERIC_WRITE, 0, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL));
+    if (file == INVALID_HANDLE_VALUE)   return false;
+
+    // Drop anything after the valid part
+    SetFilePointer(file, size, NULL, FILE_BEGIN);
+    SetEndOfFile(file);
+
+    // Serialize everything in memory, then write it at once
+    vector<char>    buffer;
+    unsigned long   coordinatesSize(dimensions * sizeof(ANNcoord));
+    unsigned long   i(0);
+
+    if (size == 0)  version = MAP_JOURNAL_VERSION;
+
+    unsigned long   recordSize(version >= 2 ? sizeof(MapJournalRecord) : offsetof(MapJournalRecord, stamp));
+
+    if (size == 0) {
+        MapJournalHeader header;
+
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, MAP_JOURNAL_MAGIC, sizeof(header.magic));
+        header.version      = MAP_JOURNAL_VERSION;
+        header.dimensions   = dimensions;
+        header.generation   = generation;
+
+        buffer.insert(buffer.end(), (const char*)&header, (const char*)&header + sizeof(header));
+    }
+
+    while (i < entries.size()) {
+        const MapJournalEntry&  entry(entries[i]);
+        MapJournalRecord        record;
+        unsigned long           position(buffer.size());
+
+        record.size         = recordSize + coordinatesSize + entry.path.size();
+        record.checksum     = 0;
+        record.trackID      = entry.trackID;
+        record.code         = entry.code;
+        record.artistID     = entry.artistID;
+        record.titleID      = entry.titleID;
+        record.length       = entry.length;
+        record.pathLength   = entry.path.size();
+        record.stamp        = entry.stamp;
+
+        buffer.resize(position + record.size);
+        memcpy(&buffer[position + recordSize], &entry.coordinates[0], coordinatesSize);
+        memcpy(&buffer[position + recordSize + coordinatesSize], entry.path.data(), entry.path.size());
+
+        unsigned long hash(hashBytes(&record, recordSize));
+        record.checksum = hashBytes(&buffer[position + recordSize], record.size - recordSize, hash);
+        memcpy(&buffer[position], &record, recordSize);
+
+        i++;
+    }
+
+    DWORD   written(0);
+    bool    success(buffer.empty() || (WriteFile(file, &buffer[0], buffer.size(), &written, NULL) && written == buffer.size()));
+
+    if (success) {
+        FlushFileBuffers(file);
+
+        size       += buffer.size();
+        records    += entries.size();
+    }
+
+    CloseHandle(file);
+
+    return success;
+}
+
+
+/// \brief Delete the journal file.
+void MapJournal::remove() {
+    DeleteFileA(path.c_str());
+
+    size    = 0;
+    records = 0;
+}
@@ -0,0 +1,57 @@
+#ifndef MAPJOURNAL_H
+    #define MAPJOURNAL_H
+
+    /**
+     * \file mapjournal.h
+     * \brief MapJournal class headers.
+     */
+
+    #include <string>
+    #include <vector>
+
+    #include "ANN.h"
+
+    #include "constants.h"
+
+
+    /// \brief State of a track, as stored in a journal record.
+    struct MapJournalEntry {
+        ANNidx                  trackID;
+        MuseekCode              code;
+        unsigned long           artistID,
+                                titleID,
+                                length;
+        DWORD                   stamp;
+        std::vector<ANNcoord>   coordinates;
+        std::string             path;
+    };
+
+
+    /**
+     * \brief Append-only journal of changes made to a map file (see mapformat.h).
+     *
+     * Records are appended and flushed to disk one batch at a time. When reading,
+     * the journal stops at the first incomplete or corrupted record, which is then
+     * overwritten by the next append; hence a crash can only lose the last batch.
+     */
+    class MapJournal {
+        std::string     path;
+        unsigned long   generation,
+                        version,
+                        size,
+                        records;
+        unsigned short  dimensions;
+
+        public:
+        MapJournal();
+        ~MapJournal();
+
+        unsigned long   getRecords()    const;
+        unsigned long   getSize()       const;
+
+        void            reset(const std::string&, unsigned long, unsigned short);
+        bool            read(std::vector<MapJournalEntry>&);
+        bool            append(const std::vector<MapJournalEntry>&);
+        void            remove();
+    };
+#endif
@@ -0,0 +1,91 @@
+/**
+ * \file mappedfile.cpp
+ * \brief MappedFile class implementation.
+ */
+
+#include "mappedfile.h"
+
+using namespace std;
+
+
+/// \brief Default constructor.
+MappedFile::MappedFile() :
+        file(INVALID_HANDLE_VALUE),
+        mapping(NULL),
+        data(NULL),
+        size(0) {
+}
+
+
+/// \brief Destructor.
+MappedFile::~MappedFile() {
+    close();
+}
+
+
+/// \return Address of the first byte of the file, or NULL if no file is mapped.
+char* MappedFile::getData() const {
+    return data;
+}
+
+
+/// \return Size of the mapped file, in bytes.
+unsigned long MappedFile::getSize() const {
+    return size;
+}
+
+
+/// \return True if a file is currently mapped, false otherwise.
+bool MappedFile::isOpen() const {
+    return data != NULL;
+}
+
+
+/**
+ * \brief Map the whole file in memory.
+ *
+ * \param path          Absolute path to the file.
+ * \param copyOnWrite   If true, mapped pages can be written to (changes are not saved to the file).
+ * \return True if the file was successfully mapped, false otherwise.
+ */
+bool MappedFile::open(const string& path, bool copyOnWrite) {
+    close();
+
+    // Writers are allowed, so that the header can be updated in place
+    file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)   return false;
+
+    // Empty files cannot be mapped
+    size = GetFileSize(file, NULL);
+    if (size == 0 || size == INVALID_FILE_SIZE) {
+        close();
+        return false;
+    }
+
+    mapping = CreateFileMappingA(file, NULL, copyOnWrite ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL) {
+        close();
+        return false;
+    }
+
+    data = (char*)MapViewOfFile(mapping, copyOnWrite ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0);
+    if (data == NULL) {
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+
+/// \brief Unmap the file; pointers to mapped data become invalid.
+void MappedFile::close() {
+    if (data)                           UnmapViewOfFile(data);
+    if (mapping)                        CloseHandle(mapping);
+    if (file != INVALID_HANDLE_VALUE)   CloseHandle(file);
+
+    file    = INVALID_HANDLE_VALUE;
+    mapping = NULL;
+    data    = NULL;
+    size    = 0;
+}
\ No newline at end of file
@@ -0,0 +1,39 @@
+#ifndef MAPPEDFILE_H
+    #define MAPPEDFILE_H
+
+    /**
+     * \file mappedfile.h
+     * \brief MappedFile class headers.
+     */
+
+    #include <string>
+
+    #include "constants.h"
+
+    /**
+     * \brief Read-only memory mapping of a whole file.
+     *
+     * When opened in copy-on-write mode, the mapped data may be modified;
+     * modifications remain private to the process and never reach the file.
+     */
+    class MappedFile {
+        HANDLE          file,
+                        mapping;
+        char*           data;
+        unsigned long   size;
+
+        MappedFile(const MappedFile&);
+        void operator=(const MappedFile&);
+
+        public:
+        MappedFile();
+        ~MappedFile();
+
+        char*           getData()   const;
+        unsigned long   getSize()   const;
+        bool            isOpen()    const;
+
+        bool            open(const std::string&, bool copyOnWrite = false);
+        void            close();
+    };
+#endif
\ No newline at end of file
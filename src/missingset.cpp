@@ -0,0 +1,161 @@
+/**
+ * \file missingset.cpp
+ * \brief MissingSet class implementation.
+ */
+
+#include "missingset.h"
+
+using namespace std;
+
+
+/// \brief Default constructor.
+MissingSet::MissingSet() :
+        marked(),
+        queued(),
+        queue(),
+        head(0),
+        count(0) {
+}
+
+
+/// \brief Destructor.
+MissingSet::~MissingSet() {
+}
+
+
+/// \return Number of marked tracks.
+unsigned long MissingSet::getCount() const {
+    return count;
+}
+
+
+/// \return Approximate number of bytes allocated by the set.
+unsigned long MissingSet::getMemoryUsage() const {
+    return (marked.capacity() + queued.capacity()) / 8 + queue.capacity() * sizeof(DWORD);
+}
+
+
+/// \return True if coordinates of the track are still to be downloaded, false otherwise.
+bool MissingSet::isMarked(ANNidx i) const {
+    return (unsigned long)i < marked.size() && marked[i];
+}
+
+
+/**
+ * \brief Mark a track as missing coordinates, and queue it unless it already is.
+ *
+ * \param i Index of the track; the set grows as needed.
+ */
+void MissingSet::mark(ANNidx i) {
+    if ((unsigned long)i >= marked.size())
+        resize(i + 1);
+
+    if (!marked[i]) {
+        marked[i] = true;
+        count++;
+    }
+
+    if (!queued[i]) {
+        queued[i] = true;
+        queue.push_back(i);
+    }
+}
+
+
+/**
+ * \brief Mark a track as no longer missing coordinates.
+ *
+ * If it is still queued, it is skipped when its turn comes.
+ *
+ * \param i Index of the track.
+ */
+void MissingSet::unmark(ANNidx i) {
+    if (!isMarked(i))   return;
+
+    marked[i] = false;
+    count--;
+}
+
+
+/**
+ * \brief Take the next tracks from the queue.
+ *
+ * \param n     Maximal number of tracks.
+ * \param batch Tracks taken, which remain marked (modified).
+ * \return True if at least one track was taken, false if the queue is empty.
+ */
+bool MissingSet::nextBatch(unsigned long n, vector<ANNidx>& batch) {
+    batch.clear();
+
+    while (batch.size() < n && head < queue.size()) {
+        DWORD i(queue[head]);
+
+        queued[i] = false;
+        if (marked[i])  batch.push_back(i);
+
+        head++;
+    }
+
+    // Drop the consumed part of the queue once it makes up most of it
+    if (head == queue.size()) {
+        queue.clear();
+        head = 0;
+    } else if (head > queue.size() / 2) {
+        queue.erase(queue.begin(), queue.begin() + head);
+        head = 0;
+    }
+
+    return !batch.empty();
+}
+
+
+/// \brief Queue again all marked tracks which are not queued anymore, by order of index.
+void MissingSet::requeue() {
+    unsigned long i(0);
+
+    for (i = 0; i < marked.size(); i++) {
+        if (marked[i] && !queued[i]) {
+            queued[i] = true;
+            queue.push_back(i);
+        }
+    }
+}
+
+
+/**
+ * \brief Set the number of tracks.
+ *
+ * New tracks are not marked; removed tracks are unmarked.
+ *
+ * \param n New number of tracks.
+ */
+void MissingSet::resize(unsigned long n) {
+    if (n < marked.size()) {
+        vector<DWORD>   kept;
+        unsigned long   i(n);
+
+        for (i = n; i < marked.size(); i++)
+            unmark(i);
+
+        // Forget queued tracks which no longer exist
+        for (i = head; i < queue.size(); i++) {
+            if (queue[i] < n)   kept.push_back(queue[i]);
+        }
+
+        queue.swap(kept);
+        head = 0;
+    }
+
+    marked.resize(n, false);
+    queued.resize(n, false);
+}
+
+
+/// \brief Unmark all tracks, and free memory.
+void MissingSet::clear() {
+    vector<bool>().swap(marked);
+    vector<bool>().swap(queued);
+    vector<DWORD>().swap(queue);
+    head    = 0;
+    count   = 0;
+}
\ No newline at end of file
@@ -0,0 +1,49 @@
+#ifndef MISSINGSET_H
+    #define MISSINGSET_H
+
+    /**
+     * \file missingset.h
+     * \brief MissingSet class headers.
+     */
+
+    #include <vector>
+
+    #include "ANN.h"
+
+    #include "constants.h"
+
+
+    /**
+     * \brief Set of tracks whose coordinates are still to be downloaded.
+     *
+     * Membership is kept in a bitmap, so that marking and unmarking a track take constant time.
+     * Marked tracks are also appended to a work queue, from which the downloader takes batches
+     * in the order tracks were queued; tracks unmarked meanwhile are skipped. A batch leaves
+     * the queue, but its tracks remain marked until they are unmarked; see requeue() to retry
+     * the ones that never were.
+     *
+     * This class is not thread-safe.
+     */
+    class MissingSet {
+        std::vector<bool>   marked,
+                            queued;
+        std::vector<DWORD>  queue;
+        unsigned long       head,           ///< Position of the first queued track
+                            count;          ///< Number of marked tracks
+
+        public:
+        MissingSet();
+        ~MissingSet();
+
+        unsigned long   getCount()                                      const;
+        unsigned long   getMemoryUsage()                                const;
+        bool            isMarked(ANNidx)                                const;
+
+        void            mark(ANNidx);
+        void            unmark(ANNidx);
+        bool            nextBatch(unsigned long, std::vector<ANNidx>&);
+        void            requeue();
+        void            resize(unsigned long);
+        void            clear();
+    };
+#endif
\ No newline at end of file
@@ -0,0 +1,13 @@
+/**
+ * \file neighborfilter.cpp
+ * \brief NeighborFilter class implementation.
+ */
+
+#include "neighborfilter.h"
+
+using namespace std;
+
+
+/// \brief Destructor.
+NeighborFilter::~NeighborFilter() {
+}
\ No newline at end of file
@@ -0,0 +1,27 @@
+#ifndef NEIGHBORFILTER_H
+    #define NEIGHBORFILTER_H
+
+    /**
+     * \file neighborfilter.h
+     * \brief NeighborFilter class headers.
+     */
+
+    #include "ANN.h"
+
+    #include "constants.h"
+
+
+    /**
+     * \brief Predicate on tracks, restricting nearest neighbor searches to the tracks it accepts.
+     *
+     * Searches that scan tracks evaluate it before computing distances, so that rejected tracks
+     * cost next to nothing (see Map::findNearestNeighbors()). It may be called from several
+     * threads at once.
+     */
+    class NeighborFilter {
+        public:
+        virtual ~NeighborFilter();
+
+        virtual bool    accept(ANNidx)      const = 0;
+    };
+#endif
\ No newline at end of file
@@ -0,0 +1,90 @@
+/**
+ * \file neighboriterator.cpp
+ * \brief NeighborIterator class implementation.
+ */
+
+#include <algorithm>
+
+#include "map.h"
+#include "neighborfilter.h"
+#include "neighboriterator.h"
+
+using namespace std;
+
+
+/// \brief Default constructor; see start().
+NeighborIterator::NeighborIterator() :
+        map(NULL),
+        point(NULL),
+        filter(NULL),
+        query(),
+        k(0),
+        position(0),
+        exhausted(true) {
+}
+
+
+/// \brief Destructor.
+NeighborIterator::~NeighborIterator() {
+}
+
+
+/**
+ * \brief Start iterating over the nearest neighbors of a point.
+ *
+ * \param newMap    Map to search; must remain pinned while iterating.
+ * \param newPoint  Reference point; must remain valid while iterating.
+ * \param newFilter Tracks to consider, NULL for all of them.
+ */
+void NeighborIterator::start(Map* newMap, ANNpoint newPoint, const NeighborFilter* newFilter) {
+    map         = newMap;
+    point       = newPoint;
+    filter      = newFilter;
+    k           = 0;
+    position    = 0;
+    exhausted   = (map == NULL || point == NULL);
+
+    query.reset(0);
+}
+
+
+/**
+ * \brief Get the next nearest neighbor, searching further if needed.
+ *
+ * \param id        Index of the neighbor (modified).
+ * \param distance  Squared distance from the reference point to the neighbor (modified).
+ * \return True if there was a neighbor left, false otherwise.
+ */
+bool NeighborIterator::next(ANNidx& id, ANNdist& distance) {
+    while (true) {
+        while (position < query.getCount()) {
+            ANNidx candidate(query.getId(position));
+            ANNdist candidateDistance(query.getDistance(position));
+
+            position++;
+
+            // Scanning searches filtered already, but the k-dimensional tree does not
+            if (filter && !filter->accept(candidate))   continue;
+
+            id          = candidate;
+            distance    = candidateDistance;
+            return true;
+        }
+
+        if (exhausted)  return false;
+
+        // Next round, twice as large; neighbors of the previous round were yielded already
+        int size((int)map->getSize());
+        int previous(query.getCount());
+
+        k = min(k ? 2 * k : NEIGHBOR_ITERATOR_FIRST_K, size);
+
+        // Without the visit budget of calibrateSearch(), which would end rounds early
+        int found(map->findNearestNeighbors(point, k, query, filter, false));
+
+        // Fewer results than searched may come from the filter or the window searched while
+        // the structure is built: only the round covering the whole map is the last one
+        exhausted   = (k >= size);
+        position    = min(previous, found);
+    }
+}
\ No newline at end of file
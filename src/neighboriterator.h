@@ -0,0 +1,52 @@
+#ifndef NEIGHBORITERATOR_H
+    #define NEIGHBORITERATOR_H
+
+    /**
+     * \file neighboriterator.h
+     * \brief NeighborIterator class headers.
+     */
+
+    #include "ANN.h"
+
+    #include "constants.h"
+    #include "neighborquery.h"
+
+    class Map;
+    class NeighborFilter;
+
+    #define NEIGHBOR_ITERATOR_FIRST_K   8   ///< Neighbors searched by the first round
+
+
+    /**
+     * \brief Nearest neighbors of a point, in distance order, found on demand.
+     *
+     * Neighbors are searched by rounds of growing size: each round searches twice as many
+     * neighbors as the previous one, and only yields the ones beyond it. The cost of reaching
+     * a neighbor is thus about the cost of searching its rank, and the last round covers the
+     * whole map, so that every accepted track is eventually yielded.
+     *
+     * An optional filter restricts neighbors to the tracks it accepts. Scanning searches apply it
+     * while they run, so that rejected tracks do not even count towards the rounds.
+     *
+     * Rounds are assumed to agree on the order of neighbors, which holds for exact searches;
+     * with approximate ones (error bound, int8 coordinates, or while the search structure is
+     * being built), a neighbor may be yielded twice or skipped. The map must remain pinned and
+     * unchanged while iterating. Buffers are kept from one start() to the next.
+     */
+    class NeighborIterator {
+        Map*                    map;
+        ANNpoint                point;
+        const NeighborFilter*   filter;
+        NeighborQuery           query;
+        int                     k,              ///< Neighbors searched by the current round
+                                position;       ///< Rank of the next neighbor of the current round
+        bool                    exhausted;      ///< True once the current round is the last one
+
+        public:
+        NeighborIterator();
+        ~NeighborIterator();
+
+        void    start(Map*, ANNpoint, const NeighborFilter* filter = NULL);
+        bool    next(ANNidx&, ANNdist&);
+    };
+#endif
\ No newline at end of file
@@ -0,0 +1,185 @@
+/**
+ * \file neighborquery.cpp
+ * \brief NeighborQuery class implementation.
+ */
+
+#include <algorithm>
+
+#include "neighborquery.h"
+
+using namespace std;
+
+
+/// \brief Default constructor.
+NeighborQuery::NeighborQuery() :
+        ids(),
+        distances(),
+        count(0),
+        candidates(),
+        ranked(),
+        target(),
+        weights(),
+        frontier(),
+        marks(),
+        mark(0) {
+}
+
+
+/// \brief Destructor.
+NeighborQuery::~NeighborQuery() {
+}
+
+
+/// \return Number of neighbors found by the last search.
+int NeighborQuery::getCount() const {
+    return count;
+}
+
+
+/**
+ * \param i Rank of the neighbor, from 0 (nearest) to getCount() - 1.
+ * \return Index of the neighbor.
+ */
+ANNidx NeighborQuery::getId(int i) const {
+    return ids[i];
+}
+
+
+/**
+ * \param i Rank of the neighbor, from 0 (nearest) to getCount() - 1.
+ * \return Squared distance from the query point to the neighbor.
+ */
+ANNdist NeighborQuery::getDistance(int i) const {
+    return distances[i];
+}
+
+
+/**
+ * \brief Prepare for a search; no neighbor is found yet.
+ *
+ * \param k Number of nearest neighbors to search.
+ */
+void NeighborQuery::reset(int k) {
+    ids.resize(k);
+    distances.resize(k);
+    count = 0;
+
+    for (int i = 0; i < k; i++) {
+        ids[i]          = ANN_NULL_IDX;
+        distances[i]    = ANN_DIST_INF;
+    }
+}
+
+
+/**
+ * \brief Append a neighbor to the results; for searches whose number of results is not known beforehand.
+ *
+ * \param id        Index of the neighbor.
+ * \param distance  Squared distance from the query point to the neighbor.
+ */
+void NeighborQuery::add(ANNidx id, ANNdist distance) {
+    ids.push_back(id);
+    distances.push_back(distance);
+    count++;
+}
+
+
+/**
+ * \brief Keep the first neighbors only, so that more can be add()ed after them.
+ *
+ * \param n Number of neighbors kept; at most the size of the arrays.
+ */
+void NeighborQuery::truncate(int n) {
+    ids.resize(n);
+    distances.resize(n);
+    count = n;
+}
+
+
+/**
+ * \brief Count the neighbors found, once a search filled the arrays.
+ *
+ * \return Number of neighbors found, the first ANN_NULL_IDX ending them.
+ */
+int NeighborQuery::countResults() {
+    count = 0;
+
+    while (count < (int)ids.size() && ids[count] != ANN_NULL_IDX)
+        count++;
+
+    return count;
+}
+
+
+/// \return Indices of neighbors, to be filled by a search (see reset()).
+ANNidxArray NeighborQuery::getIdArray() {
+    return ids.empty() ? NULL : &ids[0];
+}
+
+
+/// \return Squared distances of neighbors, to be filled by a search (see reset()).
+ANNdistArray NeighborQuery::getDistanceArray() {
+    return distances.empty() ? NULL : &distances[0];
+}
+
+
+/// \return Candidates of a quantized search.
+vector<pair<float, ANNidx> >& NeighborQuery::getCandidates() {
+    return candidates;
+}
+
+
+/// \return Candidates of a quantized search ranked at full precision, or best points of a scan or graph search.
+vector<pair<ANNdist, ANNidx> >& NeighborQuery::getRanked() {
+    return ranked;
+}
+
+
+/// \return Query point, in the units of quantized coordinates.
+vector<float>& NeighborQuery::getTarget() {
+    return target;
+}
+
+
+/// \return Weights of dimensions, in the units of quantized coordinates.
+vector<float>& NeighborQuery::getWeights() {
+    return weights;
+}
+
+
+/// \return Points of a graph search whose neighbors are still to be visited.
+vector<pair<ANNdist, ANNidx> >& NeighborQuery::getFrontier() {
+    return frontier;
+}
+
+
+/**
+ * \brief Forget points visited by the previous search (see visit()).
+ *
+ * Visits are marked with a number that changes with every search, so that marks need
+ * not be cleared but once in 2^32 searches.
+ *
+ * \param n Number of points that may be visited.
+ */
+void NeighborQuery::startVisits(unsigned long n) {
+    if (marks.size() < n)   marks.resize(n, 0);
+
+    if (++mark == 0) {
+        fill(marks.begin(), marks.end(), 0);
+        mark = 1;
+    }
+}
+
+
+/**
+ * \brief Mark a point as visited by the current search (see startVisits()).
+ *
+ * \param i Index of the point.
+ * \return True if the point was not visited yet, false otherwise.
+ */
+bool NeighborQuery::visit(ANNidx i) {
+    if (marks[i] == mark)   return false;
+
+    marks[i] = mark;
+    return true;
+}
\ No newline at end of file
@@ -0,0 +1,63 @@
+#ifndef NEIGHBORQUERY_H
+    #define NEIGHBORQUERY_H
+
+    /**
+     * \file neighborquery.h
+     * \brief NeighborQuery class headers.
+     */
+
+    #include <utility>
+    #include <vector>
+
+    #include "ANN.h"
+
+    #include "constants.h"
+
+
+    /**
+     * \brief Context of nearest neighbor searches, owned by the caller (see Map::findNearestNeighbors()).
+     *
+     * Holds the results of the last search, indices along with squared distances, and the
+     * scratch space searches need. Buffers only grow, so that a context reused for searches
+     * of similar sizes no longer allocates memory.
+     *
+     * A context must not be shared between threads, but distinct contexts may be used at once.
+     */
+    class NeighborQuery {
+        std::vector<ANNidx>                         ids;
+        std::vector<ANNdist>                        distances;
+        int                                         count;          ///< Number of neighbors found
+        std::vector<std::pair<float, ANNidx> >      candidates;     ///< Scratch space of QuantizedPoints::search()
+        std::vector<std::pair<ANNdist, ANNidx> >    ranked;         ///< Scratch space of QuantizedPoints::search(), DistanceEngine::search() and HnswIndex::search()
+        std::vector<float>                          target,         ///< Scratch space of QuantizedPoints::search()
+                                                    weights;        ///< Scratch space of QuantizedPoints::search()
+        std::vector<std::pair<ANNdist, ANNidx> >    frontier;       ///< Scratch space of HnswIndex::search()
+        std::vector<unsigned long>                  marks;          ///< Visits of points by HnswIndex::search()
+        unsigned long                               mark;           ///< Mark of points visited by the current search
+
+        public:
+        NeighborQuery();
+        ~NeighborQuery();
+
+        int             getCount()                                          const;
+        ANNidx          getId(int)                                          const;
+        ANNdist         getDistance(int)                                    const;
+
+        // For searches
+        void            reset(int);
+        void            add(ANNidx, ANNdist);
+        void            truncate(int);
+        int             countResults();
+        ANNidxArray     getIdArray();
+        ANNdistArray    getDistanceArray();
+
+        std::vector<std::pair<float, ANNidx> >&     getCandidates();
+        std::vector<std::pair<ANNdist, ANNidx> >&   getRanked();
+        std::vector<float>&                         getTarget();
+        std::vector<float>&                         getWeights();
+        std::vector<std::pair<ANNdist, ANNidx> >&   getFrontier();
+
+        void            startVisits(unsigned long);
+        bool            visit(ANNidx);
+    };
+#endif
\ No newline at end of file
@@ -0,0 +1,441 @@
+/**
+ * \file packedmapfile.cpp
+ * \brief PackedMapFile class implementation.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "compressor.h"
+#include "logger.h"
+#include "packedmapfile.h"
+#include "pointstore.h"
+#include "trackstore.h"
+#include "utils.h"
+
+using namespace std;
+
+
+/// \return Size of the decompressed data of a block, in a file of the given version.
+static unsigned long blockSize(PackedBlockType type, unsigned long count, unsigned short dimensions, unsigned long version) {
+    if (type == PACKED_BLOCK_TRACKS)
+        return count * (dimensions * sizeof(short) + sizeof(char) + (version >= 2 ? 4 : 3) * sizeof(DWORD));
+
+    return count * 2 * sizeof(DWORD);   // Without the paths themselves
+}
+
+
+/**
+ * \brief Constructor.
+ *
+ * \param newDimensions Number of coordinates per track.
+ */
+PackedMapFile::PackedMapFile(unsigned short newDimensions) :
+        dimensions(newDimensions),
+        codec(COMPRESSION_ZLIB),
+        generation(0),
+        size(0),
+        peakBlockSize(0) {
+    memset(&library, 0, sizeof(library));
+}
+
+
+/// \brief Destructor.
+PackedMapFile::~PackedMapFile() {
+}
+
+
+/// \return Compression of blocks.
+CompressionCodec PackedMapFile::getCodec() const {
+    return codec;
+}
+
+
+/// \return Generation of the file.
+unsigned long PackedMapFile::getGeneration() const {
+    return generation;
+}
+
+
+/// \return Media library the map was built from.
+const LibraryFingerprint& PackedMapFile::getLibrary() const {
+    return library;
+}
+
+
+/// \return Largest block read or written, compressed and decompressed, in bytes.
+unsigned long PackedMapFile::getPeakBlockSize() const {
+    return peakBlockSize;
+}
+
+
+/// \return Size of the file read or written, in bytes.
+unsigned long PackedMapFile::getSize() const {
+    return size;
+}
+
+
+///
+void PackedMapFile::setCodec(CompressionCodec newCodec) {
+    codec = newCodec;
+}
+
+
+///
+void PackedMapFile::setGeneration(unsigned long newGeneration) {
+    generation = newGeneration;
+}
+
+
+///
+void PackedMapFile::setLibrary(const LibraryFingerprint& newLibrary) {
+    library = newLibrary;
+}
+
+
+/**
+ * \brief Read a map from a packed map file.
+ *
+ * Tracks and points are replaced, unless the file is not a valid packed map file; they are
+ * left in an undefined state if it is found to be corrupted on the way.
+ *
+ * \param path      Absolute path to the file.
+ * \param tracks    Tracks of the map (modified).
+ * \param points    Points of the map (modified).
+ * \return True if map was successfully read, false otherwise.
+ */
+bool PackedMapFile::read(const string& path, TrackStore& tracks, PointStore& points) {
+    Logger*         logger(Logger::getInstance());
+    ifstream        file(path.c_str(), ios::in | ios::binary);
+    PackedMapHeader header;
+
+    if (!file)  return false;
+
+    // Check header
+    file.read((char*)&header, sizeof(header));
+
+    if (!file
+    ||  memcmp(header.magic, PACKED_MAP_MAGIC, sizeof(header.magic))
+    ||  header.version < 1
+    ||  header.version > PACKED_MAP_VERSION
+    ||  header.dimensions != dimensions
+    ||  header.codec > COMPRESSION_ZSTD)
+        return false;
+
+    if (!Compressor::getInstance()->isAvailable((CompressionCodec)header.codec)) {
+        logger->log("[WARNING] Compression library of map file is not available (" + path + ").\n\n");
+        return false;
+    }
+
+    vector<PackedMapScale> scales(dimensions);
+
+    file.read((char*)&scales[0], dimensions * sizeof(PackedMapScale));
+    if (!file)  return false;
+
+    codec       = (CompressionCodec)header.codec;
+    generation  = header.generation;
+    library     = header.library;
+    size        = sizeof(header) + dimensions * sizeof(PackedMapScale);
+
+    // Read blocks one after the other
+    unsigned long           total(header.trackCount), tracksRead(0), pathsRead(0), block(0), i(0);
+    unsigned short          j(0);
+    PackedMapBlock          blockHeader;
+    vector<char>            packed, raw;
+    string                  pathData;
+    vector<unsigned long>   pathOffsets(total, 0),
+                            pathLengths(total, 0);
+
+    points.reserve(total);
+    points.resize(total);
+    tracks.reserve(total);
+    tracks.resize(total);
+
+    for (block = 0; block < header.blockCount; block++) {
+        if (!readBlock(file, blockHeader, packed, raw))     return false;
+
+        unsigned long   count(blockHeader.count);
+        const char*     data(raw.empty() ? NULL : &raw[0]);
+
+        // Tracks: quantized coordinates, then codes, artist IDs, title IDs, lengths and stamps (version 2)
+        if (blockHeader.type == PACKED_BLOCK_TRACKS) {
+            if (tracksRead + count > total
+            ||  raw.size() != blockSize(PACKED_BLOCK_TRACKS, count, dimensions, header.version))
+                return false;
+
+            const char* codes(data + count * dimensions * sizeof(short));
+            const char* artistIDs(codes + count);
+            const char* titleIDs(artistIDs + count * sizeof(DWORD));
+            const char* lengths(titleIDs + count * sizeof(DWORD));
+            const char* stamps(lengths + count * sizeof(DWORD));
+
+            for (i = 0; i < count; i++) {
+                ANNidx      id(tracksRead + i);
+                MuseekCode  code((MuseekCode)codes[i]);
+                DWORD       value;
+
+                tracks.setCode(id, code);
+                memcpy(&value, artistIDs + i * sizeof(DWORD), sizeof(DWORD));
+                tracks.setArtistID(id, value);
+                memcpy(&value, titleIDs + i * sizeof(DWORD), sizeof(DWORD));
+                tracks.setTitleID(id, value);
+                memcpy(&value, lengths + i * sizeof(DWORD), sizeof(DWORD));
+                tracks.setLength(id, value);
+
+                if (header.version >= 2) {
+                    memcpy(&value, stamps + i * sizeof(DWORD), sizeof(DWORD));
+                    tracks.setStamp(id, value);
+                }
+
+                ANNpoint point(points[id]);
+
+                for (j = 0; j < dimensions; j++) {
+                    short quantized;
+
+                    memcpy(&quantized, data + (j * count + i) * sizeof(short), sizeof(short));
+                    point[j] = TrackStore::hasCoordinates(code) ? scales[j].offset + scales[j].scale * quantized : 0;
+                }
+            }
+
+            tracksRead += count;
+        }
+
+        // Paths, in sorted order: track IDs, lengths, then the paths themselves
+        else if (blockHeader.type == PACKED_BLOCK_PATHS) {
+            unsigned long   offset(blockSize(PACKED_BLOCK_PATHS, count, dimensions, PACKED_MAP_VERSION));
+
+            if (pathsRead + count > total || raw.size() < offset)
+                return false;
+
+            const char* ids(data);
+            const char* lengths(data + count * sizeof(DWORD));
+
+            for (i = 0; i < count; i++) {
+                DWORD id, length;
+
+                memcpy(&id, ids + i * sizeof(DWORD), sizeof(DWORD));
+                memcpy(&length, lengths + i * sizeof(DWORD), sizeof(DWORD));
+
+                if (id >= total || pathLengths[id] || length > raw.size() - offset)
+                    return false;
+
+                pathOffsets[id] = pathData.size();
+                pathLengths[id] = length;
+                pathData.append(data + offset, length);
+                offset         += length;
+            }
+
+            pathsRead += count;
+        }
+
+        else
+            return false;
+
+        size += sizeof(blockHeader) + blockHeader.packedSize;
+    }
+
+    if (tracksRead != total)    return false;
+
+    // Paths are normally appended in sorted order, which saves sorting them again
+    vector<const char*> paths(total);
+
+    for (i = 0; i < total; i++)
+        paths[i] = pathData.data() + pathOffsets[i];
+
+    tracks.buildPaths(paths, pathLengths);
+
+    return true;
+}
+
+
+/**
+ * \brief Write a map to a packed map file, with the codec set by setCodec().
+ *
+ * Coordinates of tracks that have none are written as zeros.
+ *
+ * \param path      Absolute path to the file.
+ * \param tracks    Tracks of the map.
+ * \param points    Points of the map.
+ * \return True if map was successfully written, false otherwise.
+ */
+bool PackedMapFile::write(const string& path, const TrackStore& tracks, const PointStore& points) {
+    if (!Compressor::getInstance()->isAvailable(codec))     return false;
+
+    ofstream file(path.c_str(), ios::out | ios::binary | ios::trunc);
+    if (!file)  return false;
+
+    unsigned long           total(tracks.getSize()), first(0), count(0), i(0);
+    unsigned short          j(0);
+    PackedMapHeader         header;
+    vector<PackedMapScale>  scales(dimensions);
+    vector<char>            raw, packed;
+    vector<ANNidx>          sortedIDs;
+    string                  trackPath;
+
+    // Tracks without a path are left out of path blocks
+    tracks.getSortedPathIDs(sortedIDs);
+
+    // Quantize each dimension over its range
+    for (j = 0; j < dimensions; j++) {
+        ANNcoord    low(0), high(0);
+        bool        found(false);
+
+        for (i = 0; i < total; i++) {
+            if (!tracks.hasCoordinates(i))     continue;
+
+            low     = found ? min(low, points[i][j]) : points[i][j];
+            high    = found ? max(high, points[i][j]) : points[i][j];
+            found   = true;
+        }
+
+        scales[j].offset    = (low + high) / 2;
+        scales[j].scale     = high > low ? (high - low) / (2 * PACKED_COORDINATE_MAX) : 1;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PACKED_MAP_MAGIC, sizeof(header.magic));
+    header.version      = PACKED_MAP_VERSION;
+    header.dimensions   = dimensions;
+    header.trackCount   = total;
+    header.generation   = generation;
+    header.codec        = codec;
+    header.blockCount   = (total + PACKED_MAP_BLOCK_SIZE - 1) / PACKED_MAP_BLOCK_SIZE
+                        + (sortedIDs.size() + PACKED_MAP_BLOCK_SIZE - 1) / PACKED_MAP_BLOCK_SIZE;
+    header.library      = library;
+
+    file.write((const char*)&header, sizeof(header));
+    file.write((const char*)&scales[0], dimensions * sizeof(PackedMapScale));
+
+    size = sizeof(header) + dimensions * sizeof(PackedMapScale);
+
+    // Track blocks
+    for (first = 0; first < total; first += count) {
+        count = min(total - first, (unsigned long)PACKED_MAP_BLOCK_SIZE);
+        raw.resize(blockSize(PACKED_BLOCK_TRACKS, count, dimensions, PACKED_MAP_VERSION));
+
+        char* coordinates(&raw[0]);
+        char* codes(coordinates + count * dimensions * sizeof(short));
+        char* artistIDs(codes + count);
+        char* titleIDs(artistIDs + count * sizeof(DWORD));
+        char* lengths(titleIDs + count * sizeof(DWORD));
+        char* stamps(lengths + count * sizeof(DWORD));
+
+        for (i = 0; i < count; i++) {
+            ANNidx      id(first + i);
+            MuseekCode  code(tracks.getCode(id));
+            DWORD       value;
+
+            codes[i] = (char)code;
+            value = tracks.getArtistID(id);
+            memcpy(artistIDs + i * sizeof(DWORD), &value, sizeof(DWORD));
+            value = tracks.getTitleID(id);
+            memcpy(titleIDs + i * sizeof(DWORD), &value, sizeof(DWORD));
+            value = tracks.getLength(id);
+            memcpy(lengths + i * sizeof(DWORD), &value, sizeof(DWORD));
+            value = tracks.getStamp(id);
+            memcpy(stamps + i * sizeof(DWORD), &value, sizeof(DWORD));
+
+            for (j = 0; j < dimensions; j++) {
+                double  scaled(TrackStore::hasCoordinates(code) ? (points[id][j] - scales[j].offset) / scales[j].scale : 0);
+                short   quantized((short)max(-(double)PACKED_COORDINATE_MAX, min((double)PACKED_COORDINATE_MAX, floor(scaled + .5))));
+
+                memcpy(coordinates + (j * count + i) * sizeof(short), &quantized, sizeof(short));
+            }
+        }
+
+        if (!writeBlock(file, PACKED_BLOCK_TRACKS, count, raw, packed))     return false;
+    }
+
+    // Path blocks, in sorted order
+    for (first = 0; first < sortedIDs.size(); first += count) {
+        count = min(sortedIDs.size() - first, (unsigned long)PACKED_MAP_BLOCK_SIZE);
+        raw.resize(blockSize(PACKED_BLOCK_PATHS, count, dimensions, PACKED_MAP_VERSION));
+
+        for (i = 0; i < count; i++) {
+            DWORD id(sortedIDs[first + i]), length;
+
+            tracks.getPath(id, trackPath);
+            length = trackPath.size();
+
+            memcpy(&raw[i * sizeof(DWORD)], &id, sizeof(DWORD));
+            memcpy(&raw[(count + i) * sizeof(DWORD)], &length, sizeof(DWORD));
+            raw.insert(raw.end(), trackPath.begin(), trackPath.end());
+        }
+
+        if (!writeBlock(file, PACKED_BLOCK_PATHS, count, raw, packed))  return false;
+    }
+
+    file.close();
+
+    return !file.fail();
+}
+
+
+/**
+ * \brief Compress and write a block.
+ *
+ * \param file      Packed map file.
+ * \param type      Type of the block.
+ * \param count     Number of tracks or paths in the block.
+ * \param raw       Data of the block.
+ * \param packed    Buffer for the compressed data (modified).
+ * \return True if the block was written, false otherwise.
+ */
+bool PackedMapFile::writeBlock(ofstream& file, PackedBlockType type, unsigned long count, const vector<char>& raw, vector<char>& packed) {
+    PackedMapBlock header;
+
+    if (!Compressor::getInstance()->compress(codec, raw, packed))   return false;
+
+    header.type         = type;
+    header.count        = count;
+    header.rawSize      = raw.size();
+    header.packedSize   = packed.size();
+    header.checksum     = hashBytes(raw.empty() ? NULL : &raw[0], raw.size());
+
+    file.write((const char*)&header, sizeof(header));
+    if (!packed.empty())    file.write(&packed[0], packed.size());
+
+    size           += sizeof(header) + packed.size();
+    peakBlockSize   = max(peakBlockSize, (unsigned long)(raw.size() + packed.size()));
+
+    return !file.fail();
+}
+
+
+/**
+ * \brief Read and decompress the next block.
+ *
+ * \param file      Packed map file.
+ * \param header    Header of the block (modified).
+ * \param packed    Buffer for the compressed data (modified).
+ * \param raw       Data of the block (modified).
+ * \return True if the block was read and found valid, false otherwise.
+ */
+bool PackedMapFile::readBlock(ifstream& file, PackedMapBlock& header, vector<char>& packed, vector<char>& raw) {
+    file.read((char*)&header, sizeof(header));
+    if (!file)  return false;
+
+    // Sizes must be consistent with the number of items, so that corrupted files do not allocate the world
+    unsigned long minimum(blockSize((PackedBlockType)header.type, header.count, dimensions, 1));
+
+    if (header.count > PACKED_MAP_BLOCK_SIZE
+    ||  header.rawSize < minimum
+    ||  header.rawSize > minimum + header.count * MAX_PATH * 4
+    ||  header.packedSize > header.rawSize + header.rawSize / 8 + 1024)
+        return false;
+
+    packed.resize(header.packedSize);
+    raw.resize(header.rawSize);
+
+    if (!packed.empty())    file.read(&packed[0], packed.size());
+
+    if (!file
+    ||  !Compressor::getInstance()->decompress(codec, packed, raw)
+    ||  hashBytes(raw.empty() ? NULL : &raw[0], raw.size()) != header.checksum)
+        return false;
+
+    peakBlockSize = max(peakBlockSize, (unsigned long)(raw.size() + packed.size()));
+
+    return true;
+}
\ No newline at end of file
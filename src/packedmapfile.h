@@ -0,0 +1,58 @@
+#ifndef PACKEDMAPFILE_H
+    #define PACKEDMAPFILE_H
+
+    /**
+     * \file packedmapfile.h
+     * \brief PackedMapFile class headers.
+     */
+
+    #include <fstream>
+    #include <string>
+    #include <vector>
+
+    #include "ANN.h"
+
+    #include "constants.h"
+    #include "mapformat.h"
+
+    class PointStore;
+    class TrackStore;
+
+
+    /**
+     * \brief Reader and writer of packed map files (see mapformat.h).
+     *
+     * Files are read as a stream, one block at a time, so that only one block is held in memory
+     * besides the map itself; paths are the exception, as the path dictionary is built from all
+     * of them at once. Coordinates read back differ from the ones written by at most half a
+     * quantization step, that is 1 / 65534 of the range of their dimension.
+     */
+    class PackedMapFile {
+        unsigned short      dimensions;
+        CompressionCodec    codec;
+        unsigned long       generation;
+        LibraryFingerprint  library;
+        unsigned long       size;               ///< Size of the file, in bytes
+        unsigned long       peakBlockSize;      ///< Largest block, compressed and decompressed, in bytes
+
+        bool            writeBlock(std::ofstream&, PackedBlockType, unsigned long, const std::vector<char>&, std::vector<char>&);
+        bool            readBlock(std::ifstream&, PackedMapBlock&, std::vector<char>&, std::vector<char>&);
+
+        public:
+        PackedMapFile(unsigned short);
+        ~PackedMapFile();
+
+        CompressionCodec            getCodec()              const;
+        unsigned long               getGeneration()         const;
+        const LibraryFingerprint&   getLibrary()            const;
+        unsigned long               getPeakBlockSize()      const;
+        unsigned long               getSize()               const;
+
+        void            setCodec(CompressionCodec);
+        void            setGeneration(unsigned long);
+        void            setLibrary(const LibraryFingerprint&);
+
+        bool            read(const std::string&, TrackStore&, PointStore&);
+        bool            write(const std::string&, const TrackStore&, const PointStore&);
+    };
+#endif
\ No newline at end of file
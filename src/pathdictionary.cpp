@@ -0,0 +1,373 @@
+/**
+ * \file pathdictionary.cpp
+ * \brief PathDictionary class implementation.
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include "pathdictionary.h"
+
+using namespace std;
+
+
+/// \brief Compare two byte strings, as std::string does.
+static int compareBytes(const char* a, unsigned long aLength, const char* b, unsigned long bLength) {
+    int result(memcmp(a, b, min(aLength, bLength)));
+
+    if (result)     return result;
+    if (aLength == bLength) return 0;
+
+    return aLength < bLength ? -1 : 1;
+}
+
+
+/// \brief Append a variable-length integer (7 bits per byte, lowest first).
+static void writeVarint(vector<unsigned char>& data, unsigned long value) {
+    while (value >= 0x80) {
+        data.push_back((unsigned char)(value | 0x80));
+        value >>= 7;
+    }
+
+    data.push_back((unsigned char)value);
+}
+
+
+/// \brief Read a variable-length integer, and move the cursor after it.
+static unsigned long readVarint(const unsigned char*& p) {
+    unsigned long   value(0);
+    unsigned short  shift(0);
+
+    while (*p & 0x80) {
+        value |= (unsigned long)(*p & 0x7F) << shift;
+        shift += 7;
+        p++;
+    }
+
+    value |= (unsigned long)*p << shift;
+    p++;
+
+    return value;
+}
+
+
+/// \brief Orders IDs by the address of their path.
+struct AddressLess {
+    const vector<const char*>& paths;
+
+    AddressLess(const vector<const char*>& newPaths) : paths(newPaths) {}
+
+    bool operator()(DWORD a, DWORD b) const {
+        return paths[a] < paths[b];
+    }
+};
+
+
+/// \brief Orders IDs by their path.
+struct PathLess {
+    const vector<const char*>&      paths;
+    const vector<unsigned long>&    lengths;
+
+    PathLess(const vector<const char*>& newPaths, const vector<unsigned long>& newLengths) :
+            paths(newPaths),
+            lengths(newLengths) {
+    }
+
+    bool operator()(DWORD a, DWORD b) const {
+        return compareBytes(paths[a], lengths[a], paths[b], lengths[b]) < 0;
+    }
+};
+
+
+/// \brief Pending path and its ID.
+typedef pair<const string*, ANNidx> PendingPath;
+
+
+/// \brief Orders pending paths by their path only.
+struct PendingLess {
+    bool operator()(const PendingPath& a, const PendingPath& b) const {
+        return *a.first < *b.first;
+    }
+};
+
+
+/// \brief Default constructor.
+PathDictionary::PathDictionary() {
+}
+
+
+/// \brief Destructor.
+PathDictionary::~PathDictionary() {
+}
+
+
+/// \return Number of IDs.
+unsigned long PathDictionary::getSize() const {
+    return positions.size();
+}
+
+
+/// \return Approximate number of bytes allocated by the dictionary.
+unsigned long PathDictionary::getMemoryUsage() const {
+    unsigned long usage(data.capacity());
+
+    usage += (buckets.capacity() + ids.capacity() + positions.capacity()) * sizeof(DWORD);
+
+    // Pending paths cost a tree node and a string each
+    map<ANNidx, string>::const_iterator i(pendingPaths.begin());
+
+    while (i != pendingPaths.end()) {
+        usage += 4 * sizeof(void*) + sizeof(ANNidx) + sizeof(string) + i->second.capacity() + 1;
+        i++;
+    }
+
+    return usage;
+}
+
+
+/// \return Number of paths set since the last build.
+unsigned long PathDictionary::getPendingCount() const {
+    return pendingPaths.size();
+}
+
+
+/**
+ * \brief Decode the path at a given sorted position.
+ *
+ * \param p         Cursor on the encoded path; moved to the next one.
+ * \param position  Sorted position of the path.
+ * \param path      Path at the previous position, for positions which do not start a bucket;
+ *                  replaced by the decoded path.
+ */
+void PathDictionary::decode(const unsigned char*& p, unsigned long position, string& path) const {
+    unsigned long prefix(0);
+
+    if (position % PATH_BUCKET_SIZE)
+        prefix = readVarint(p);
+
+    unsigned long length(readVarint(p));
+
+    path.resize(prefix);
+    path.append((const char*)p, length);
+    p += length;
+}
+
+
+/**
+ * \param id ID of a track.
+ * \return The path of the track; an empty string if it has none.
+ */
+string PathDictionary::get(ANNidx id) const {
+    string path;
+
+    get(id, path);
+
+    return path;
+}
+
+
+/**
+ * \brief Get the path of an ID into an existing string, so that its storage can be reused.
+ *
+ * \param id    ID of a track.
+ * \param path  The path of the track; an empty string if it has none (modified).
+ */
+void PathDictionary::get(ANNidx id, string& path) const {
+    path.clear();
+
+    if ((unsigned long)id >= positions.size())  return;
+
+    // Not in the sorted part
+    if (positions[id] == PATH_UNSORTED) {
+        map<ANNidx, string>::const_iterator i(pendingPaths.find(id));
+
+        if (i != pendingPaths.end())
+            path = i->second;
+
+        return;
+    }
+
+    // Decode the bucket up to the path
+    unsigned long           position(positions[id]), k(position - position % PATH_BUCKET_SIZE);
+    const unsigned char*    p(&data[0] + buckets[k / PATH_BUCKET_SIZE]);
+
+    path.reserve(MAX_PATH);
+
+    while (k <= position) {
+        decode(p, k, path);
+        k++;
+    }
+}
+
+
+/**
+ * \brief List IDs by order of their paths.
+ *
+ * IDs whose path was set since the last build come last, in order of their paths, then of IDs.
+ * IDs without path are left out.
+ *
+ * \param sortedIDs IDs (modified).
+ */
+void PathDictionary::getSortedIDs(vector<ANNidx>& sortedIDs) const {
+    unsigned long                       i(0);
+    vector<PendingPath>                 pending;
+    map<ANNidx, string>::const_iterator j(pendingPaths.begin());
+
+    sortedIDs.clear();
+    sortedIDs.reserve(ids.size() + pendingPaths.size());
+
+    while (i < ids.size()) {
+        if (ids[i] != PATH_UNSORTED)
+            sortedIDs.push_back(ids[i]);
+        i++;
+    }
+
+    // Several IDs may share a path, the empty one of removed tracks in particular
+    pending.reserve(pendingPaths.size());
+
+    while (j != pendingPaths.end()) {
+        pending.push_back(PendingPath(&j->second, j->first));
+        j++;
+    }
+
+    stable_sort(pending.begin(), pending.end(), PendingLess());
+
+    for (i = 0; i < pending.size(); i++)
+        sortedIDs.push_back(pending[i].second);
+}
+
+
+/**
+ * \brief Set the path of an ID.
+ *
+ * The new path is kept apart from the sorted ones until the next call to rebuild().
+ *
+ * \param id        ID, lower than getSize().
+ * \param path      New path; it needs not be NUL-terminated.
+ * \param length    Length of the new path, in bytes.
+ */
+void PathDictionary::set(ANNidx id, const char* path, unsigned long length) {
+    // Forget the previous sorted path; a previous pending one is overwritten
+    if (positions[id] != PATH_UNSORTED) {
+        ids[positions[id]] = PATH_UNSORTED;
+        positions[id] = PATH_UNSORTED;
+    }
+
+    pendingPaths[id].assign(path, length);
+}
+
+
+/**
+ * \brief Build the dictionary from scratch.
+ *
+ * If paths are laid out in memory in sorted order, as in binary map files, sorting them only
+ * takes a check; otherwise, they are sorted.
+ *
+ * \param paths     Path of each ID; they need not be NUL-terminated.
+ * \param lengths   Length of each path, in bytes.
+ */
+void PathDictionary::build(const vector<const char*>& paths, const vector<unsigned long>& lengths) {
+    unsigned long   n(paths.size()), i(0);
+    vector<DWORD>   order(n);
+
+    clear();
+
+    for (i = 0; i < n; i++)
+        order[i] = i;
+
+    // Try the memory layout first
+    sort(order.begin(), order.end(), AddressLess(paths));
+
+    PathLess less(paths, lengths);
+
+    for (i = 1; i < n; i++) {
+        if (less(order[i], order[i - 1]))   break;
+    }
+
+    if (i < n)
+        sort(order.begin(), order.end(), less);
+
+    // Front-code paths
+    positions.resize(n, PATH_UNSORTED);
+    ids.resize(n);
+    buckets.reserve(n / PATH_BUCKET_SIZE + 1);
+
+    for (i = 0; i < n; i++) {
+        DWORD           id(order[i]);
+        const char*     path(paths[id]);
+        unsigned long   length(lengths[id]), prefix(0);
+
+        positions[id]   = i;
+        ids[i]          = id;
+
+        if (i % PATH_BUCKET_SIZE == 0) {
+            buckets.push_back(data.size());
+        } else {
+            const char*     previous(paths[order[i - 1]]);
+            unsigned long   previousLength(lengths[order[i - 1]]);
+
+            while (prefix < length && prefix < previousLength && path[prefix] == previous[prefix])
+                prefix++;
+
+            writeVarint(data, prefix);
+        }
+
+        writeVarint(data, length - prefix);
+        data.insert(data.end(), (const unsigned char*)path + prefix, (const unsigned char*)path + length);
+    }
+}
+
+
+/// \brief Merge paths set since the last build into the sorted ones.
+void PathDictionary::rebuild() {
+    if (pendingPaths.empty())   return;
+
+    unsigned long           n(positions.size()), i(0);
+    vector<string>          all(n);
+    vector<const char*>     paths(n);
+    vector<unsigned long>   lengths(n);
+
+    for (i = 0; i < n; i++)
+        all[i] = get(i);
+
+    for (i = 0; i < n; i++) {
+        paths[i]    = all[i].data();
+        lengths[i]  = all[i].size();
+    }
+
+    build(paths, lengths);
+}
+
+
+/**
+ * \brief Set the number of IDs.
+ *
+ * New IDs have no path; paths of removed IDs are forgotten.
+ *
+ * \param n New number of IDs.
+ */
+void PathDictionary::resize(unsigned long n) {
+    unsigned long i(n);
+
+    while (i < positions.size()) {
+        if (positions[i] != PATH_UNSORTED)
+            ids[positions[i]] = PATH_UNSORTED;
+
+        i++;
+    }
+
+    // Drop pending paths of removed IDs
+    pendingPaths.erase(pendingPaths.lower_bound((ANNidx)n), pendingPaths.end());
+
+    positions.resize(n, PATH_UNSORTED);
+}
+
+
+/// \brief Remove all paths.
+void PathDictionary::clear() {
+    data.clear();
+    buckets.clear();
+    ids.clear();
+    positions.clear();
+    pendingPaths.clear();
+}
\ No newline at end of file
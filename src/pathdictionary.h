@@ -0,0 +1,62 @@
+#ifndef PATHDICTIONARY_H
+    #define PATHDICTIONARY_H
+
+    /**
+     * \file pathdictionary.h
+     * \brief PathDictionary class headers.
+     */
+
+    #include <map>
+    #include <string>
+    #include <vector>
+
+    #include "ANN.h"
+
+    #include "constants.h"
+
+    #define PATH_BUCKET_SIZE    16              ///< Number of paths per front-coded bucket
+    #define PATH_UNSORTED       0xFFFFFFFFUL    ///< Position of an ID whose path is not in the sorted part
+
+
+    /**
+     * \brief Compressed dictionary of file paths, indexed by track ID.
+     *
+     * Paths are sorted, then front-coded: they are split into buckets of PATH_BUCKET_SIZE paths;
+     * the first path of a bucket is stored as is, and the following ones as the length of the
+     * prefix they share with the previous path, followed by the remaining suffix. Since paths
+     * of a library share long directory prefixes, this takes a fraction of the plain size.
+     *
+     * Getting the path of an ID decodes at most one bucket. The dictionary only stores paths:
+     * tracks are found by path through the hash index of Map.
+     *
+     * Paths set after the dictionary was built are kept apart, as plain strings, until the next
+     * call to rebuild(). This class is not thread-safe.
+     */
+    class PathDictionary {
+        std::vector<unsigned char>      data;           ///< Front-coded buckets, one after the other
+        std::vector<DWORD>              buckets;        ///< Offset of each bucket in data
+        std::vector<DWORD>              ids;            ///< ID of each sorted path, or PATH_UNSORTED if replaced
+        std::vector<DWORD>              positions;      ///< Sorted position of the path of each ID, or PATH_UNSORTED
+        std::map<ANNidx, std::string>   pendingPaths;   ///< Paths set since the last build, by ID
+
+        void            decode(const unsigned char*&, unsigned long, std::string&)  const;
+
+        public:
+        PathDictionary();
+        ~PathDictionary();
+
+        unsigned long   getSize()                                           const;
+        unsigned long   getMemoryUsage()                                    const;
+        unsigned long   getPendingCount()                                   const;
+
+        std::string     get(ANNidx)                                         const;
+        void            get(ANNidx, std::string&)                           const;
+        void            getSortedIDs(std::vector<ANNidx>&)                  const;
+
+        void            set(ANNidx, const char*, unsigned long);
+        void            build(const std::vector<const char*>&, const std::vector<unsigned long>&);
+        void            rebuild();
+        void            resize(unsigned long);
+        void            clear();
+    };
+#endif
\ No newline at end of file
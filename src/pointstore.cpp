@@ -0,0 +1,222 @@
+/**
+ * \file pointstore.cpp
+ * \brief PointStore class implementation.
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include "pointstore.h"
+
+using namespace std;
+
+
+/// \brief Default constructor.
+PointStore::PointStore() :
+        dimensions(0),
+        size(0),
+        capacity(0),
+        points(NULL),
+        arraySize(0),
+        chunks(),
+        retired(),
+        retiredSize(0),
+        external(NULL),
+        externalSize(0) {
+}
+
+
+/// \brief Destructor.
+PointStore::~PointStore() {
+    clear();
+}
+
+
+/// \return Point at the given index.
+ANNpoint PointStore::operator[](ANNidx i) const {
+    return points[i];
+}
+
+
+/// \return Number of points.
+unsigned long PointStore::getSize() const {
+    return size;
+}
+
+
+/// \return Number of points that can be stored without allocating memory.
+unsigned long PointStore::getCapacity() const {
+    return capacity;
+}
+
+
+/// \return Number of bytes allocated by the store, external coordinates excluded.
+unsigned long PointStore::getMemoryUsage() const {
+    unsigned long usage((arraySize + retiredSize) * sizeof(ANNpoint));
+
+    usage += (capacity - externalSize) * dimensions * sizeof(ANNcoord);
+
+    return usage;
+}
+
+
+/// \return Array of points, as needed by ANN; it may change when the store grows.
+ANNpointArray PointStore::getArray() const {
+    return points;
+}
+
+
+/// \return True if some points refer to an external block of coordinates, false otherwise.
+bool PointStore::isAttached() const {
+    return external != NULL;
+}
+
+
+/**
+ * \brief Set the number of coordinates of points.
+ *
+ * All points are removed.
+ */
+void PointStore::setDimensions(unsigned short newDimensions) {
+    clear();
+    dimensions = newDimensions;
+}
+
+
+/**
+ * \brief Make the first points refer to an external block of coordinates.
+ *
+ * All previous points are removed. The block must remain valid until detach() or clear() is called.
+ *
+ * \param block Coordinates of the points, one point after the other.
+ * \param n     Number of points in the block.
+ */
+void PointStore::attach(ANNcoord* block, unsigned long n) {
+    unsigned long i(0);
+
+    clear();
+    growArray(n);
+
+    for (i = 0; i < n; i++)
+        points[i] = block + i * dimensions;
+
+    external        = block;
+    externalSize    = n;
+    capacity        = n;
+    size            = n;
+}
+
+
+/**
+ * \brief Copy external coordinates into memory owned by the store.
+ *
+ * The point array is updated in place, so that k-dimensional trees built on it remain valid.
+ */
+void PointStore::detach() {
+    if (!external)  return;
+
+    ANNcoord*       chunk(new ANNcoord[externalSize * dimensions]);
+    unsigned long   i(0);
+
+    memcpy(chunk, external, externalSize * dimensions * sizeof(ANNcoord));
+
+    for (i = 0; i < externalSize; i++)
+        points[i] = chunk + i * dimensions;
+
+    chunks.push_back(chunk);
+    external        = NULL;
+    externalSize    = 0;
+}
+
+
+/**
+ * \brief Allocate storage for n points at once, so that they are contiguous.
+ *
+ * \param n Number of points.
+ */
+void PointStore::reserve(unsigned long n) {
+    if (n <= capacity)  return;
+
+    ANNcoord*       chunk(new ANNcoord[(n - capacity) * dimensions]);
+    unsigned long   i(capacity);
+
+    growArray(n);
+
+    for (i = capacity; i < n; i++)
+        points[i] = chunk + (i - capacity) * dimensions;
+
+    chunks.push_back(chunk);
+    capacity = n;
+}
+
+
+/**
+ * \brief Set the number of points.
+ *
+ * Coordinates of new points are undefined; removed points keep their storage.
+ *
+ * \param n New number of points.
+ */
+void PointStore::resize(unsigned long n) {
+    if (n > capacity)
+        reserve(max(n, capacity + POINT_CHUNK_SIZE));
+
+    size = n;
+}
+
+
+/// \brief Free point arrays retired since the last call; they must no longer be referred to.
+void PointStore::releaseRetired() {
+    unsigned long i(0);
+
+    for (i = 0; i < retired.size(); i++)
+        delete[] retired[i];
+
+    retired.clear();
+    retiredSize = 0;
+}
+
+
+/// \brief Remove all points, and free their storage; the external block is left untouched.
+void PointStore::clear() {
+    unsigned long i(0);
+
+    releaseRetired();
+
+    for (i = 0; i < chunks.size(); i++)
+        delete[] chunks[i];
+
+    delete[] points;
+
+    chunks.clear();
+    points          = NULL;
+    arraySize       = 0;
+    size            = 0;
+    capacity        = 0;
+    external        = NULL;
+    externalSize    = 0;
+}
+
+
+/**
+ * \brief Make room for at least n entries in the point array.
+ *
+ * The array grows geometrically; the previous one is retired, not freed.
+ *
+ * \param n Number of entries.
+ */
+void PointStore::growArray(unsigned long n) {
+    if (n <= arraySize)     return;
+
+    unsigned long   newSize(max(n, 2 * arraySize));
+    ANNpointArray   newPoints(new ANNpoint[newSize]);
+
+    if (points) {
+        memcpy(newPoints, points, capacity * sizeof(ANNpoint));
+        retired.push_back(points);
+        retiredSize += arraySize;
+    }
+
+    points      = newPoints;
+    arraySize   = newSize;
+}
\ No newline at end of file
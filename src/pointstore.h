@@ -0,0 +1,71 @@
+#ifndef POINTSTORE_H
+    #define POINTSTORE_H
+
+    /**
+     * \file pointstore.h
+     * \brief PointStore class headers.
+     */
+
+    #include <vector>
+
+    #include "ANN.h"
+
+    #include "constants.h"
+
+    #define POINT_CHUNK_SIZE    4096    ///< Minimal number of points per allocated chunk
+
+
+    /**
+     * \brief Growable storage for the points of a map.
+     *
+     * Coordinates are allocated in chunks of at least POINT_CHUNK_SIZE points, which are never
+     * moved: the address of a point remains valid until the store is cleared. Points are
+     * referred to by an ANNpointArray, as ANN requires, which grows geometrically; appending
+     * a point therefore takes amortized O(d) time.
+     *
+     * A k-dimensional tree refers to the ANNpointArray it was built on. When the array grows,
+     * the previous one is retired rather than freed, so that trees built on it remain usable;
+     * retired arrays are freed by releaseRetired(), once such trees are deleted.
+     *
+     * The first points may also refer to an external block of coordinates, such as a mapped
+     * file (see attach()). This class is not thread-safe.
+     */
+    class PointStore {
+        unsigned short              dimensions;
+        unsigned long               size,
+                                    capacity;       ///< Number of points with storage
+        ANNpointArray               points;
+        unsigned long               arraySize;      ///< Number of entries of points
+        std::vector<ANNcoord*>      chunks;         ///< Owned blocks of coordinates
+        std::vector<ANNpointArray>  retired;        ///< Previous point arrays
+        unsigned long               retiredSize;    ///< Total number of entries of these arrays
+        ANNcoord*                   external;       ///< External block of coordinates, if any
+        unsigned long               externalSize;   ///< Number of points in this block
+
+        PointStore(const PointStore&);
+        void operator=(const PointStore&);
+
+        void            growArray(unsigned long);
+
+        public:
+        PointStore();
+        ~PointStore();
+
+        ANNpoint        operator[](ANNidx)      const;
+
+        unsigned long   getSize()               const;
+        unsigned long   getCapacity()           const;
+        unsigned long   getMemoryUsage()        const;
+        ANNpointArray   getArray()              const;
+        bool            isAttached()            const;
+
+        void            setDimensions(unsigned short);
+
+        void            attach(ANNcoord*, unsigned long);
+        void            detach();
+        void            reserve(unsigned long);
+        void            resize(unsigned long);
+        void            releaseRetired();
+        void            clear();
+    };
+#endif
\ No newline at end of file
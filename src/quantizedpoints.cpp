@@ -0,0 +1,254 @@
+/**
+ * \file quantizedpoints.cpp
+ * \brief QuantizedPoints class implementation.
+ */
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#include "neighborfilter.h"
+#include "quantizedpoints.h"
+
+using namespace std;
+
+
+/// \brief Default constructor.
+QuantizedPoints::QuantizedPoints() :
+        mode(COORDINATES_DOUBLE),
+        dimensions(0),
+        size(0),
+        values(),
+        codes(),
+        offsets(),
+        scales() {
+}
+
+
+/// \brief Destructor.
+QuantizedPoints::~QuantizedPoints() {
+}
+
+
+/// \return Representation of the copy; COORDINATES_DOUBLE if it is empty.
+CoordinateMode QuantizedPoints::getMode() const {
+    return mode;
+}
+
+
+/// \return Number of points.
+unsigned long QuantizedPoints::getSize() const {
+    return size;
+}
+
+
+/// \return Number of bytes allocated by the copy.
+unsigned long QuantizedPoints::getMemoryUsage() const {
+    return values.capacity() * sizeof(float) + codes.capacity()
+        + (offsets.capacity() + scales.capacity()) * sizeof(float);
+}
+
+
+/**
+ * \brief Copy points in the given representation.
+ *
+ * \param newMode       Representation; the copy is left empty in COORDINATES_DOUBLE mode.
+ * \param points        Original points.
+ * \param n             Number of points.
+ * \param newDimensions Number of coordinates per point.
+ */
+void QuantizedPoints::build(CoordinateMode newMode, ANNpointArray points, unsigned long n, unsigned short newDimensions) {
+    unsigned long   i(0);
+    unsigned short  j(0);
+
+    clear();
+    if (newMode == COORDINATES_DOUBLE)  return;
+
+    mode        = newMode;
+    dimensions  = newDimensions;
+    size        = n;
+
+    if (mode == COORDINATES_FLOAT) {
+        values.resize(n * dimensions);
+
+        for (i = 0; i < n; i++) {
+            for (j = 0; j < dimensions; j++)
+                values[i * dimensions + j] = (float)points[i][j];
+        }
+
+        return;
+    }
+
+    // Range of each dimension, mapped onto codes -127 to 127
+    offsets.resize(dimensions);
+    scales.resize(dimensions);
+
+    for (j = 0; j < dimensions; j++) {
+        ANNcoord low(n ? points[0][j] : 0), high(low);
+
+        for (i = 1; i < n; i++) {
+            low     = min(low, points[i][j]);
+            high    = max(high, points[i][j]);
+        }
+
+        offsets[j]  = (float)((low + high) / 2);
+        scales[j]   = high > low ? (float)((high - low) / 254) : 1.f;
+    }
+
+    codes.resize(n * dimensions);
+
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < dimensions; j++)
+            codes[i * dimensions + j] = encode(j, points[i][j]);
+    }
+}
+
+
+/**
+ * \brief Update a coordinate of a point.
+ *
+ * In COORDINATES_INT8 mode, coordinates out of the range computed by build() are clamped.
+ *
+ * \param i             Index of the point; ignored if it is not part of the copy.
+ * \param j             Index of the coordinate.
+ * \param coordinate    New value.
+ */
+void QuantizedPoints::set(ANNidx i, unsigned short j, ANNcoord coordinate) {
+    if (i < 0 || (unsigned long)i >= size || j >= dimensions)     return;
+
+    if (mode == COORDINATES_FLOAT)
+        values[i * dimensions + j] = (float)coordinate;
+    else
+        codes[i * dimensions + j] = encode(j, coordinate);
+}
+
+
+/// \brief Remove all points, and free memory.
+void QuantizedPoints::clear() {
+    vector<float>().swap(values);
+    vector<signed char>().swap(codes);
+    vector<float>().swap(offsets);
+    vector<float>().swap(scales);
+
+    mode        = COORDINATES_DOUBLE;
+    dimensions  = 0;
+    size        = 0;
+}
+
+
+/// \brief Exchange the contents of two copies.
+void QuantizedPoints::swap(QuantizedPoints& other) {
+    std::swap(mode, other.mode);
+    std::swap(dimensions, other.dimensions);
+    std::swap(size, other.size);
+    values.swap(other.values);
+    codes.swap(other.codes);
+    offsets.swap(other.offsets);
+    scales.swap(other.scales);
+}
+
+
+/**
+ * \brief Find nearest neighbors of a point.
+ *
+ * Points are compared linearly in the compact representation; the best candidates
+ * (QUANTIZED_RERANK_FACTOR per neighbor in COORDINATES_INT8 mode) are then re-ranked
+ * using the original points. Scratch space is taken from the context, which must have been
+ * reset() for k neighbors.
+ *
+ * \param query     Reference point.
+ * \param k         Number of nearest neighbors to search.
+ * \param context   Indices of ordered nearest neighbors and their squared distances to the
+ *                  reference point; ANN_NULL_IDX if there are fewer than k points (modified).
+ * \param points    Original points.
+ * \param filter    Points to consider, NULL for all of them; others are skipped before any distance is computed.
+ */
+void QuantizedPoints::search(ANNpoint query, int k, NeighborQuery& context, ANNpointArray points, const NeighborFilter* filter) const {
+    unsigned long                       candidates(mode == COORDINATES_INT8 ? k * QUANTIZED_RERANK_FACTOR : k);
+    vector<pair<float, ANNidx> >&       heap(context.getCandidates());      // Best candidates so far, worst first
+    vector<pair<ANNdist, ANNidx> >&     ranked(context.getRanked());
+    vector<float>&                      target(context.getTarget());
+    vector<float>&                      weights(context.getWeights());
+    ANNidxArray                         ids(context.getIdArray());
+    ANNdistArray                        distances(context.getDistanceArray());
+    unsigned long                       i(0);
+    unsigned short                      j(0);
+
+    candidates = min(candidates, size);
+    heap.clear();
+    heap.reserve(candidates + 1);
+    ranked.clear();
+    target.resize(dimensions);
+    weights.assign(dimensions, 1.f);
+
+    // Express the query in the units of codes
+    for (j = 0; j < dimensions; j++) {
+        if (mode == COORDINATES_INT8) {
+            target[j]   = (float)((query[j] - offsets[j]) / scales[j]);
+            weights[j]  = scales[j] * scales[j];
+        } else
+            target[j]   = (float)query[j];
+    }
+
+    for (i = 0; i < size && candidates; i++) {
+        if (filter && !filter->accept(i))   continue;
+
+        float distance(0), worst(heap.size() < candidates ? FLT_MAX : heap.front().first);
+
+        // Give up on a point as soon as it is farther than the worst candidate
+        if (mode == COORDINATES_FLOAT) {
+            const float* value(&values[i * dimensions]);
+
+            for (j = 0; j < dimensions && distance < worst; j++) {
+                float difference(target[j] - value[j]);
+                distance += difference * difference;
+            }
+        } else {
+            const signed char* code(&codes[i * dimensions]);
+
+            for (j = 0; j < dimensions && distance < worst; j++) {
+                float difference(target[j] - code[j]);
+                distance += weights[j] * difference * difference;
+            }
+        }
+
+        if (distance >= worst)  continue;
+
+        if (heap.size() < candidates) {
+            heap.push_back(make_pair(distance, (ANNidx)i));
+            push_heap(heap.begin(), heap.end());
+        } else {
+            pop_heap(heap.begin(), heap.end());
+            heap.back() = make_pair(distance, (ANNidx)i);
+            push_heap(heap.begin(), heap.end());
+        }
+    }
+
+    // Re-rank candidates at full precision
+    ranked.reserve(heap.size());
+
+    for (i = 0; i < heap.size(); i++) {
+        ANNpoint    point(points[heap[i].second]);
+        ANNdist     distance(0);
+
+        for (j = 0; j < dimensions; j++)
+            distance += ANN_POW(query[j] - point[j]);
+
+        ranked.push_back(make_pair(distance, heap[i].second));
+    }
+
+    sort(ranked.begin(), ranked.end());
+
+    for (i = 0; i < (unsigned long)k; i++) {
+        ids[i]          = i < ranked.size() ? ranked[i].second : ANN_NULL_IDX;
+        distances[i]    = i < ranked.size() ? ranked[i].first : ANN_DIST_INF;
+    }
+}
+
+
+/// \return Code of a coordinate, in COORDINATES_INT8 mode.
+signed char QuantizedPoints::encode(unsigned short j, ANNcoord coordinate) const {
+    double code(floor((coordinate - offsets[j]) / scales[j] + .5));
+
+    return (signed char)max(-127., min(127., code));
+}
\ No newline at end of file
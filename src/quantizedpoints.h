@@ -0,0 +1,60 @@
+#ifndef QUANTIZEDPOINTS_H
+    #define QUANTIZEDPOINTS_H
+
+    /**
+     * \file quantizedpoints.h
+     * \brief QuantizedPoints class headers.
+     */
+
+    #include <vector>
+
+    #include "ANN.h"
+
+    #include "constants.h"
+    #include "neighborquery.h"
+
+    class NeighborFilter;
+
+    #define QUANTIZED_RERANK_FACTOR     8   ///< Candidates re-ranked per requested neighbor, in COORDINATES_INT8 mode
+
+
+    /**
+     * \brief Compact copy of the points of a map, searched linearly for nearest neighbors.
+     *
+     * In COORDINATES_FLOAT mode, coordinates are stored as float. In COORDINATES_INT8 mode,
+     * each coordinate is stored as a signed 8-bit code, such that
+     *      coordinate ~ offset[j] + scale[j] * code
+     * where offset and scale are computed per dimension from the range of the points; searches
+     * then compare the query with codes, and re-rank the best candidates using the original
+     * points. Distances returned are always squared distances between original points, as ANN does.
+     *
+     * The copy does not follow changes of the original points: see set(), or build() again.
+     * Searches may run concurrently, each with its own NeighborQuery; other methods are not thread-safe.
+     */
+    class QuantizedPoints {
+        CoordinateMode              mode;
+        unsigned short              dimensions;
+        unsigned long               size;
+        std::vector<float>          values;         ///< Coordinates, in COORDINATES_FLOAT mode
+        std::vector<signed char>    codes;          ///< Codes, in COORDINATES_INT8 mode
+        std::vector<float>          offsets,
+                                    scales;
+
+        signed char     encode(unsigned short, ANNcoord)                                const;
+
+        public:
+        QuantizedPoints();
+        ~QuantizedPoints();
+
+        CoordinateMode  getMode()                                                       const;
+        unsigned long   getSize()                                                       const;
+        unsigned long   getMemoryUsage()                                                const;
+
+        void            build(CoordinateMode, ANNpointArray, unsigned long, unsigned short);
+        void            set(ANNidx, unsigned short, ANNcoord);
+        void            clear();
+        void            swap(QuantizedPoints&);
+
+        void            search(ANNpoint, int, NeighborQuery&, ANNpointArray, const NeighborFilter* filter = NULL)  const;
+    };
+#endif
\ No newline at end of file
@@ -11,6 +11,8 @@
 #include "wa_ipc.h"
 #include "nde/NDE.h"
 
+#include "benchmark.h"
+#include "distanceengine.h"
 #include "gen_museek.h"
 #include "logger.h"
 #include "shuffler.h"
@@ -27,23 +29,29 @@ extern winampGeneralPurposePlugin   plugin;
 extern DWORD                        WA_MENUITEM_SHUFFLE_ON_LIBRARY;
 extern DWORD                        WA_MENUITEM_SHUFFLE_ON_PLAYLIST;
 extern DWORD                        WA_MENUITEM_RESCAN_LIBRARY;
+extern DWORD                        WA_IPC_MAP_PUBLISHED;
 
 
 /// \brief Default constructor.
 Shuffler::Shuffler() :
         configDirectory(),
-        playingTrack(NULL),
-        localNextTrack(NULL),
-        remoteNextTrack(NULL),
+        playingTrack(),
+        localNextTrack(),
+        remoteNextTrack(),
         remoteScale(pow(5, 1./16.)),
         remoteConstant(0.3),
         remoteBound(sqrt(32.)/2.),
         remoteRadius(0),
+        localNextDistance(-1),
+        shellWidth(0.2),
+        initTime(0),
+        shellMaxVisited(SHELL_MAX_VISITED),
         paused(false),
         playlistLength(0),
         playlistPosition(0),
         winampVersion(0),
         mode(OFF),
+        remoteMode(REMOTE_SPHERE),
         menu_item_position_file(0),
         menu_item_position_option(0),
 		startTime(0),
@@ -53,8 +61,7 @@ Shuffler::Shuffler() :
         libraryScan(this),
         mapLoad(this),
         nextTrackPreparation(this) {
-    		map = Map::getInstance();
-    		map->setParent(this); // KLUDGE
+    		Map::getInstance()->setParent(this); // KLUDGE
 
     		// Initialize curl
     		curl_global_init(CURL_GLOBAL_WIN32);
@@ -93,14 +100,44 @@ void Shuffler::kill() {
  * \param track2 Second track.
  * \return Squared distance between given tracks.
  */
-ANNdist Shuffler::distanceBetween(const Track* track1, const Track* track2) {
-    Map* map(Map::getInstance());
+ANNdist Shuffler::distanceBetween(const Track& track1, const Track& track2) {
+    Map*    map(Map::acquire());
+    Track   first(map->findTrack(track1));
+    Track   second(map->findTrack(track2));
+    ANNdist distance(0);
 
-    ANNpoint
-        point1(map->getPoint(track1->getId())),
-        point2(map->getPoint(track2->getId()));
+    if (first.isValid() && second.isValid())
+        distance = sqrt(DistanceEngine::getInstance()->distance(map->getPoint(first.getId()), map->getPoint(second.getId()), map->getDimensions()));
 
-    return sqrt(annDist(map->getDimensions(), point1, point2));
+    map->release();
+    return distance;
+}
+
+
+/**
+ * \brief Refer the tracks held by the shuffler to the current map, once a rescan has replaced it.
+ *
+ * Tracks that are no longer in the library are dropped; played tracks are marked again.
+ */
+void Shuffler::followMap() {
+    Map*            map(Map::acquire());
+    deque<Track>    history;
+
+    for (deque<Track>::iterator it = lastPlayedTracks.begin(); it != lastPlayedTracks.end(); ++it) {
+        Track track(map->findTrack(*it));
+
+        if (track.isValid()) {
+            track.setAlreadyPlayed(true);
+            history.push_back(track);
+        }
+    }
+
+    lastPlayedTracks.swap(history);
+    playingTrack    = map->findTrack(playingTrack);
+    localNextTrack  = map->findTrack(localNextTrack);
+    remoteNextTrack = map->findTrack(remoteNextTrack);
+
+    map->release();
 }
 
 
@@ -141,21 +178,20 @@ int Shuffler::getListPosition() {
 
 
 ///
-const Track* Shuffler::getLocalNextTrack() const {
+Track Shuffler::getLocalNextTrack() const {
     return localNextTrack;
 }
 
 
 ///
-const Track* Shuffler::getRemoteNextTrack() const {
+Track Shuffler::getRemoteNextTrack() const {
     return remoteNextTrack;
 }
 
 
 ///
-Track* Shuffler::getPlayingTrack() const {
-    Map* map(Map::getInstance());
-    return map->getTrack(playingTrack->getId());
+Track Shuffler::getPlayingTrack() const {
+    return playingTrack;
 }
 
 
@@ -179,6 +215,12 @@ bool Shuffler::isPlaying() const {
 }
 
 
+/// \brief Record the time init() was called, to measure the time to the first shuffle (see logFirstShuffle()).
+void Shuffler::setInitTime(double newTime) {
+    initTime = newTime;
+}
+
+
 void Shuffler::setListPosition(unsigned int newPosition) {
     if (!checkWinampVersion(0x2000))    exit(1);
     SendMessage(plugin.hwndParent, WM_WA_IPC, newPosition, IPC_SETPLAYLISTPOS);
@@ -186,12 +228,12 @@ void Shuffler::setListPosition(unsigned int newPosition) {
 
 
 ///
-void Shuffler::appendToPlaylist(const Track* track) {
+void Shuffler::appendToPlaylist(const Track& track) {
     enqueueFileWithMetaStruct nextItem = {0};
     Map* map(Map::getInstance());
 
     // Don't know why, but using path.c_str() doesn't work...
-    string path = track->getPath();
+    string path = track.getPath();
     char*  path_ = new char[path.size() + 1];
     strcpy(path_, path.c_str());
 
@@ -295,6 +337,7 @@ void Shuffler::enable() {
 ///
 bool Shuffler::loadConfig(string filename) {
     Logger* logger(Logger::getInstance());
+    Map*    map(Map::getInstance());
 
     // Open config file
     string      path(getConfigDirectory() + filename);
@@ -348,6 +391,144 @@ bool Shuffler::loadConfig(string filename) {
             logger->log("\n");
         }
 
+        // Extract latency target of nearest neighbor searches
+        else if (parameter == "LATENCY_TARGET") {
+            line >> intBuffer;
+            map->setLatencyTarget(intBuffer);
+
+            logger->log("[CONFIG] Latency target set to ");
+            logger->log(intBuffer);
+            logger->log(" us\n");
+        }
+
+        // Extract representation of coordinates for nearest neighbor searches
+        else if (parameter == "COORDINATE_MODE") {
+            line >> stringBuffer;
+
+            if (stringBuffer == "double")       map->setCoordinateMode(COORDINATES_DOUBLE);
+            else if (stringBuffer == "float")   map->setCoordinateMode(COORDINATES_FLOAT);
+            else if (stringBuffer == "int8")    map->setCoordinateMode(COORDINATES_INT8);
+            else {
+                logger->log("[WARNING] Unknown coordinate mode (" + stringBuffer + ").\n");
+                continue;
+            }
+
+            logger->log("[CONFIG] Coordinate mode set to " + stringBuffer + "\n");
+        }
+
+        // Extract search structure built in COORDINATES_DOUBLE mode
+        else if (parameter == "INDEX_BACKEND") {
+            line >> stringBuffer;
+
+            if (stringBuffer == "kd")           map->setIndexBackend(INDEX_KD_TREE);
+            else if (stringBuffer == "bd")      map->setIndexBackend(INDEX_BD_TREE);
+            else if (stringBuffer == "brute")   map->setIndexBackend(INDEX_BRUTE_FORCE);
+            else if (stringBuffer == "scan")    map->setIndexBackend(INDEX_SIMD_SCAN);
+            else if (stringBuffer == "hnsw")    map->setIndexBackend(INDEX_HNSW);
+            else {
+                logger->log("[WARNING] Unknown index backend (" + stringBuffer + ").\n");
+                continue;
+            }
+
+            logger->log("[CONFIG] Index backend set to " + stringBuffer + "\n");
+        }
+
+        // Extract rule used to split cells of trees
+        else if (parameter == "SPLIT_RULE") {
+            line >> stringBuffer;
+
+            if (stringBuffer == "std")              map->setSplitRule(ANN_KD_STD);
+            else if (stringBuffer == "midpt")       map->setSplitRule(ANN_KD_MIDPT);
+            else if (stringBuffer == "fair")        map->setSplitRule(ANN_KD_FAIR);
+            else if (stringBuffer == "sl_midpt")    map->setSplitRule(ANN_KD_SL_MIDPT);
+            else if (stringBuffer == "sl_fair")     map->setSplitRule(ANN_KD_SL_FAIR);
+            else if (stringBuffer == "suggest")     map->setSplitRule(ANN_KD_SUGGEST);
+            else {
+                logger->log("[WARNING] Unknown split rule (" + stringBuffer + ").\n");
+                continue;
+            }
+
+            logger->log("[CONFIG] Split rule set to " + stringBuffer + "\n");
+        }
+
+        // Extract rule used to shrink cells of box-decomposition trees
+        else if (parameter == "SHRINK_RULE") {
+            line >> stringBuffer;
+
+            if (stringBuffer == "none")             map->setShrinkRule(ANN_BD_NONE);
+            else if (stringBuffer == "simple")      map->setShrinkRule(ANN_BD_SIMPLE);
+            else if (stringBuffer == "centroid")    map->setShrinkRule(ANN_BD_CENTROID);
+            else if (stringBuffer == "suggest")     map->setShrinkRule(ANN_BD_SUGGEST);
+            else {
+                logger->log("[WARNING] Unknown shrink rule (" + stringBuffer + ").\n");
+                continue;
+            }
+
+            logger->log("[CONFIG] Shrink rule set to " + stringBuffer + "\n");
+        }
+
+        // Extract whether trees are searched by priority
+        else if (parameter == "PRIORITY_SEARCH") {
+            line >> intBuffer;
+            map->setPrioritySearch(intBuffer != 0);
+
+            logger->log("[CONFIG] Priority search set to ");
+            logger->log(intBuffer);
+            logger->log("\n");
+        }
+
+        else if (parameter == "HNSW_M") {
+            line >> intBuffer;
+            map->setGraphLinks((unsigned short)intBuffer);
+
+            logger->log("[CONFIG] HNSW links set to ");
+            logger->log(intBuffer);
+            logger->log("\n");
+        }
+
+        else if (parameter == "HNSW_EF_CONSTRUCTION") {
+            line >> intBuffer;
+            map->setGraphEfConstruction((unsigned short)intBuffer);
+
+            logger->log("[CONFIG] HNSW construction candidates set to ");
+            logger->log(intBuffer);
+            logger->log("\n");
+        }
+
+        else if (parameter == "HNSW_EF") {
+            line >> intBuffer;
+            map->setGraphEf((int)intBuffer);
+
+            logger->log("[CONFIG] HNSW search candidates set to ");
+            logger->log(intBuffer);
+            logger->log("\n");
+        }
+
+        // Extract whether the search structure is built in background on load
+        else if (parameter == "LAZY_LOAD") {
+            line >> intBuffer;
+            map->setLazyLoading(intBuffer != 0);
+
+            logger->log("[CONFIG] Lazy loading set to ");
+            logger->log(intBuffer);
+            logger->log("\n");
+        }
+
+        // Extract compression of map files
+        else if (parameter == "MAP_COMPRESSION") {
+            line >> stringBuffer;
+
+            if (stringBuffer == "none")         map->setMapCompression(COMPRESSION_NONE);
+            else if (stringBuffer == "zlib")    map->setMapCompression(COMPRESSION_ZLIB);
+            else if (stringBuffer == "zstd")    map->setMapCompression(COMPRESSION_ZSTD);
+            else {
+                logger->log("[WARNING] Unknown map compression (" + stringBuffer + ").\n");
+                continue;
+            }
+
+            logger->log("[CONFIG] Map compression set to " + stringBuffer + "\n");
+        }
+
         // Extract remote scale factor
         else if (parameter == "REMOTE_SCALE") {
             line >> doubleBuffer;
@@ -378,6 +559,40 @@ bool Shuffler::loadConfig(string filename) {
             logger->log("\n");
         }
 
+        // Extract remote selection mode
+        else if (parameter == "REMOTE_MODE") {
+            line >> stringBuffer;
+
+            if (stringBuffer == "sphere")       remoteMode = REMOTE_SPHERE;
+            else if (stringBuffer == "shell")   remoteMode = REMOTE_SHELL;
+            else {
+                logger->log("[WARNING] Unknown remote mode (" + stringBuffer + ").\n");
+                continue;
+            }
+
+            logger->log("[CONFIG] Remote mode set to " + stringBuffer + "\n");
+        }
+
+        // Extract relative half-width of the remote shell
+        else if (parameter == "SHELL_WIDTH") {
+            line >> doubleBuffer;
+            shellWidth = doubleBuffer;
+
+            logger->log("[CONFIG] Shell width set to ");
+            logger->log(doubleBuffer);
+            logger->log("\n");
+        }
+
+        // Extract number of tracks examined per remote pick
+        else if (parameter == "SHELL_MAX_VISITED") {
+            line >> intBuffer;
+            shellMaxVisited = intBuffer;
+
+            logger->log("[CONFIG] Shell visits limited to ");
+            logger->log(intBuffer);
+            logger->log("\n");
+        }
+
         // Extract database host
         else if (parameter == "DATABASE_HOST") {
             line >> stringBuffer;
@@ -393,6 +608,15 @@ bool Shuffler::loadConfig(string filename) {
             
             logger->log("[CONFIG] Database script path set to " + stringBuffer + "\n");
         }
+
+        #ifdef BENCHMARK
+        // Extract benchmark to run at startup
+        else if (parameter == "BENCHMARK") {
+            line >> benchmark;
+
+            logger->log("[CONFIG] Benchmark set to " + benchmark + "\n");
+        }
+        #endif
     }
 
     file.close();
@@ -415,8 +639,6 @@ void Shuffler::prepareNextTrack() {
 
 ///
 bool Shuffler::retrievePlayingTrack() {
-    Map* map(Map::getInstance());
-
     // Check if Winamp is playing
     if (!isPlaying())   return false;
 
@@ -439,14 +661,24 @@ bool Shuffler::retrievePlayingTrack() {
         IPC_GETOUTPUTTIME
     );
 
-    /*if (playingTrack) {
-        if (playingTrack->getPath().compare(narrow(filename)))// */
-            playingTrack = map->findTrack(title, filename);
-    //}
+    Map*    map(Map::acquire());
+    Track   track(map->findTrack(title, filename));
+    map->release();
 
     playlistPosition = getListPosition();
     playlistLength   = getListLength();
 
+    // The playing track may not be part of the map
+    if (!track.isValid()) {
+        #ifdef DEBUG
+        Logger* logger = Logger::getInstance();
+        logger->log("[WARNING] Playing track not found in map (" + narrow(filename) + ").\n\n");
+        #endif
+        return false;
+    }
+
+    playingTrack = track;
+
     return true;
 }
 
@@ -549,7 +781,9 @@ void Shuffler::onEndTrack() {
     if (playlistPosition == playlistLength - 1) {    // playlistPosition starts from 0
         appendToPlaylist(localNextTrack);
 
-        if (playingTrack->hasCoordinates() && localNextTrack->hasCoordinates())
+        if (localNextDistance >= 0)
+            remoteRadius = localNextDistance;
+        else if (playingTrack.hasCoordinates() && localNextTrack.hasCoordinates())
             remoteRadius = distanceBetween(playingTrack, localNextTrack);
         
         setListPosition(playlistPosition + 1);
@@ -559,6 +793,32 @@ void Shuffler::onEndTrack() {
 }
 
 
+/**
+ * \brief Log the time from init() to the first next track picked, once.
+ *
+ * Only in DEBUG builds, where init() records its time (see setInitTime()).
+ */
+void Shuffler::logFirstShuffle() {
+    if (initTime <= 0)  return;
+
+    Logger* logger(Logger::getInstance());
+
+    logger->log("Time to first shuffle: ");
+    logger->log((currentTime() - initTime) * 1000);
+    logger->log(" ms.\n\n");
+
+    initTime = 0;
+}
+
+
+/// \brief Called on the Winamp thread once a library scan has published a new map.
+void Shuffler::onMapPublished() {
+    // The preparation reads the tracks being replaced
+    nextTrackPreparation.wait();
+    followMap();
+}
+
+
 ///
 void Shuffler::onNextTrack() {
     // Check for mode
@@ -585,7 +845,7 @@ void Shuffler::onNextTrack() {
 
 	// Calculating Song Played Ratio
 	float timePlayed = (endTime - startTime) - (pauseEndTime - pauseStartTime);
-	float playedRatio = timePlayed / (float)playingTrack->getLength();
+	float playedRatio = timePlayed / (float)playingTrack.getLength();
 
     // Last track of playlist => switch to next remote track
     if (playlistPosition == playlistLength - 1) {    // playlistPosition starts from 0
@@ -719,7 +979,9 @@ void Shuffler::onStart() {
     // Get playing track
     mapLoad.wait();
     if (!retrievePlayingTrack()) {
-        playingTrack = map->getTrack(rand() % map->getSize());
+        Map* map(Map::acquire());
+        playingTrack = map->getRandomTrack();
+        map->release();
     }
 
     // Flush playlist
@@ -734,18 +996,26 @@ void Shuffler::onStartPlaying() {
     // Check for mode
     if (mode == OFF)    return;
 
-    // Retrieve information about playing track
-    retrievePlayingTrack();
+    // Retrieve information about playing track; if it is unknown, the previous one remains the reference
+    bool known(retrievePlayingTrack());
+    Map* map(Map::acquire());
+
+    if (!playingTrack.isValid())
+        playingTrack = map->getRandomTrack();
     
     // Manage history
-    lastPlayedTracks.push_back(playingTrack);
-    playingTrack->setAlreadyPlayed(true);
+    if (known) {
+        lastPlayedTracks.push_back(playingTrack);
+        playingTrack.setAlreadyPlayed(true);
 
-    if (lastPlayedTracks.size() > log((double)map->getSize()) + 1) {
-        lastPlayedTracks.front()->setAlreadyPlayed(false);
-        lastPlayedTracks.pop_front();
+        if (lastPlayedTracks.size() > log((double)map->getSize()) + 1) {
+            lastPlayedTracks.front().setAlreadyPlayed(false);
+            lastPlayedTracks.pop_front();
+        }
     }
 
+    map->release();
+
     // Prepare next track
     prepareNextTrack();
 
@@ -764,9 +1034,9 @@ void Shuffler::onStartPlaying() {
     #ifdef DEBUG
     Logger* logger = Logger::getInstance();
     logger->log("[PLAYING] [");
-    logger->log(playingTrack->getId());
+    logger->log(playingTrack.getId());
     logger->log("] (");
-    logger->log(playingTrack->getLength());
+    logger->log(playingTrack.getLength());
     logger->log("s)\nSize of history: ");
     logger->log(lastPlayedTracks.size());
     logger->log("\nCurrent position = ");
@@ -826,8 +1096,9 @@ void Shuffler::LibraryScan::run() {
     Logger* logger(Logger::getInstance());
     logger->log("Scanning library...\n");
 
-    // Disable shuffler
-    parent->disable();
+    // Shuffle goes on with the current map meanwhile; only another rescan is forbidden
+    EnableMenuItem(parent->windowsMenu, WA_MENUITEM_RESCAN_LIBRARY, MF_GRAYED);
+    EnableMenuItem(parent->altMenu,     WA_MENUITEM_RESCAN_LIBRARY, MF_GRAYED);
 
     //  Build path to Media Library files
     string directory = parent->getConfigDirectory();
@@ -843,12 +1114,19 @@ void Shuffler::LibraryScan::run() {
     //  Pre-processing
     Database        db;
 	Table*          table(db.OpenTable(pathToDat, pathToIdx, false, false)); // Do not create table either index
-    Map*            map(Map::getInstance());
+    Map*            previous(Map::acquire());
+    Map*            map(Map::create());     // Built aside, then published
     Scanner         *scanner = table->NewScanner(0);
+    vector<bool>    seen;                   // Tracks found in the library
     unsigned long   i(0);
-    
-    map->clear();
-    map->setSize(table->GetRecordsCount()); // ANN cannot allocate dynamically
+
+    // Start from the current map, so that unchanged tracks keep their IDs and coordinates
+    map->copyTracks(*previous);
+    previous->release();
+
+    map->updateLibraryFingerprint();
+    map->setSize(max((unsigned long)table->GetRecordsCount(), (unsigned long)map->getSize())); // Allocate everything at once
+    seen.resize(map->getSize(), false);
 
 
 	//  A scanner lets us iterate through the records
@@ -867,6 +1145,8 @@ void Shuffler::LibraryScan::run() {
 		IntegerField*   year        = (IntegerField*)scanner->GetFieldByName("year");
 		StringField*    genre       = (StringField*)scanner->GetFieldByName("genre");
         IntegerField*   length      = (IntegerField*)scanner->GetFieldByName("length");
+		IntegerField*   fileTime    = (IntegerField*)scanner->GetFieldByName("filetime");
+		IntegerField*   fileSize    = (IntegerField*)scanner->GetFieldByName("filesize");
 		IntegerField*   lastPlay    = (IntegerField*)scanner->GetFieldByName("lastplay"); // time_t
 		IntegerField*   rating      = (IntegerField*)scanner->GetFieldByName("rating");
 		IntegerField*   playCount   = (IntegerField*)scanner->GetFieldByName("playCount");
@@ -876,9 +1156,20 @@ void Shuffler::LibraryScan::run() {
 		so we need to check.
 		*/
 
-        Track newTrack(i);
+        string path;
 		if (fileName && fileName->GetString())
-			newTrack.setPath(fileName->GetString());
+			path = fileName->GetString();
+
+        // Only new tracks, and tracks whose file changed, are queued for download
+        DWORD stamp(0);
+        if (fileTime && fileSize)
+            stamp = Map::stampFile(fileTime->GetValue(), fileSize->GetValue());
+
+        Track newTrack(map->update(path, stamp));
+        if ((unsigned long)newTrack.getId() >= seen.size())
+            seen.resize(newTrack.getId() + 1, false);
+        seen[newTrack.getId()] = true;
+
         if (title && title->GetString())
 			newTrack.setTitle(title->GetString());
         if (artist && artist->GetString())
@@ -901,12 +1192,27 @@ void Shuffler::LibraryScan::run() {
 			cout << "rating="<< rating->GetValue() << endl;
 		if (playCount)
 			cout << "playCount="<< playCount->GetValue() << endl; // */
-        
-        map->insert(newTrack);
 	}
 
-    // Download coordinates and save them
+    // Tracks no longer in the library; other tracks keep their IDs
+    for (i = 0; i < seen.size(); i++) {
+        if (!seen[i])   map->remove(i);
+    }
+
+    map->buildIndexes();
+
+    // Download coordinates of new and edited tracks
     map->downloadMissingCoordinates();
+
+    // Switch to the new map; the previous one is deleted once its last reader is done
+    // The shuffler tracks are only touched by the Winamp thread, so it switches them itself
+    Map::publish(map);
+    SendMessage(plugin.hwndParent, WM_WA_IPC, 0, WA_IPC_MAP_PUBLISHED);
+
+    // The previous map may still map the map file
+    if (!Map::synchronize(MAP_RELEASE_TIMEOUT))
+        logger->log("[WARNING] Previous map still in use, the map file may not be overwritten.\n");
+
     map->save();
 
 	//  Cleanup
@@ -946,8 +1252,28 @@ void Shuffler::MapLoad::run() {
     // Disable shuffler first
     parent->disable();
 
-    Map* map(Map::getInstance());
-    if (map->load(filename)) {
+    #ifdef BENCHMARK
+    if (!parent->benchmark.empty())
+        runBenchmark(parent->benchmark);
+    #endif
+
+    Map*    map(Map::getInstance());
+
+    #ifdef DEBUG
+    Logger* logger(Logger::getInstance());
+    double  start(currentTime());
+    #endif
+
+    bool    loaded(map->load(filename));
+
+    // Startup time
+    #ifdef DEBUG
+    logger->log("Map load took ");
+    logger->log((currentTime() - start) * 1000);
+    logger->log(" ms.\n\n");
+    #endif
+
+    if (loaded) {
         parent->enable();
         return;
     }
@@ -982,9 +1308,36 @@ void Shuffler::MapLoad::run() {
 }
 
 
+/**
+ * \brief Constructor.
+ *
+ * \param newMap        Map the tracks belong to; must remain pinned while the filter is used.
+ * \param newExcluded   Track rejected in any case, ANN_NULL_IDX for none.
+ */
+Shuffler::UnplayedFilter::UnplayedFilter(const Map* newMap, ANNidx newExcluded) :
+        map(newMap),
+        excluded(newExcluded) {
+}
+
+
+///
+Shuffler::UnplayedFilter::~UnplayedFilter() {
+}
+
+
+/// \return True if the track has coordinates, was not played recently, and is not the excluded one.
+bool Shuffler::UnplayedFilter::accept(ANNidx i) const {
+    if (i == excluded || map->isAlreadyPlayed(i))   return false;
+
+    return map->hasCoordinates(i);
+}
+
+
 ///
 Shuffler::NextTrackPreparation::NextTrackPreparation(Shuffler* newParent) :
-        parent(newParent) {
+        parent(newParent),
+        neighbors(),
+        localNeighbors() {
 }
 
 
@@ -996,82 +1349,91 @@ Shuffler::NextTrackPreparation::~NextTrackPreparation() {
 
 ///
 void Shuffler::NextTrackPreparation::run() {
-    Map* map(Map::getInstance());
+    Map* map(Map::acquire());   // Remains valid even if a rescan publishes a new map meanwhile
     srand(time(NULL));
 
-    unsigned int n(parent->lastPlayedTracks.size());
+    unsigned int    n(parent->lastPlayedTracks.size());
+    Track           playingTrack(map->findTrack(parent->playingTrack));
+
+    parent->localNextDistance = -1;
 
     // Current track has no coordinate => next is random
-    if (!parent->playingTrack->hasCoordinates()) {
-        parent->localNextTrack  = map->getTrack(rand() % map->getSize());
+    if (!playingTrack.isValid() || !playingTrack.hasCoordinates()) {
+        parent->localNextTrack  = map->getRandomTrack();
         parent->remoteNextTrack = parent->localNextTrack;
 
         // Debug logging
         #ifdef DEBUG
         Logger* logger = Logger::getInstance();
         logger->log("Local next track : [");
-        logger->log(parent->localNextTrack->getId());
+        logger->log(parent->localNextTrack.getId());
         logger->log("]");
-        if (parent->playingTrack->hasCoordinates()) {
+        if (parent->playingTrack.hasCoordinates()) {
             logger->log(" (distance = ");
             logger->log(parent->distanceBetween(parent->playingTrack, parent->localNextTrack));
             logger->log(")");
         }
         logger->log("\nRemote next track : [");
-        logger->log(parent->remoteNextTrack->getId());
+        logger->log(parent->remoteNextTrack.getId());
         logger->log("]");
-        if (parent->playingTrack->hasCoordinates() && parent->remoteNextTrack->hasCoordinates()) {
+        if (parent->playingTrack.hasCoordinates() && parent->remoteNextTrack.hasCoordinates()) {
             logger->log(" (distance = ");
             logger->log(parent->distanceBetween(parent->playingTrack, parent->remoteNextTrack));
             logger->log(")");
         }
         logger->log("\n");
+
+        parent->logFirstShuffle();
         #endif DEBUG
 
+        map->release();
         return;
     }
     
-    // Next track within local area
-    const ANNidxArray   nearestTracks(map->findNearestNeighbors(parent->playingTrack, n+1));
-    unsigned long       i(1);
-
-    while (i < n+1) {
-        if (!map->getTrack(nearestTracks[i])->isAlreadyPlayed()) {
-            parent->localNextTrack = map->getTrack(nearestTracks[i]);
-            break;
-        }
+    // Next track within local area: nearest one not played recently, whatever the history length
+    UnplayedFilter  unplayed(map, playingTrack.getId());
+    ANNidx          neighbor(ANN_NULL_IDX);
+    ANNdist         neighborDistance(0);
 
-        i++;
-    }
+    localNeighbors.start(map, map->getPoint(playingTrack.getId()), &unplayed);
+
+    if (localNeighbors.next(neighbor, neighborDistance)) {
+        parent->localNextTrack      = map->getTrack(neighbor);
+        parent->localNextDistance   = sqrt(neighborDistance);
+    } else
+        parent->localNextTrack      = map->getRandomTrack();
 
 
     // No reference to compute distance => next remote is random
-    if ((n > 1 && !parent->lastPlayedTracks[n-2]->hasCoordinates())
-    ||  !parent->playingTrack->hasCoordinates()) {
-        parent->remoteNextTrack = map->getTrack(rand() % map->getSize());
+    if ((n > 1 && !parent->lastPlayedTracks[n-2].hasCoordinates())
+    ||  !parent->playingTrack.hasCoordinates()) {
+        parent->remoteNextTrack = map->getRandomTrack();
 
         // Debug logging
         #ifdef DEBUG
         Logger* logger = Logger::getInstance();
         logger->log("Local next track : [");
-        logger->log(parent->localNextTrack->getId());
+        logger->log(parent->localNextTrack.getId());
         logger->log("]");
-        if (parent->playingTrack->hasCoordinates()) {
+        if (parent->playingTrack.hasCoordinates()) {
             logger->log(" (distance = ");
             logger->log(parent->distanceBetween(parent->playingTrack, parent->localNextTrack));
             logger->log(")");
         }
         logger->log("\nRemote next track : [");
-        logger->log(parent->remoteNextTrack->getId());
+        logger->log(parent->remoteNextTrack.getId());
         logger->log("]");
-        if (parent->playingTrack->hasCoordinates() && parent->remoteNextTrack->hasCoordinates()) {
+        if (parent->playingTrack.hasCoordinates() && parent->remoteNextTrack.hasCoordinates()) {
             logger->log(" (distance = ");
             logger->log(parent->distanceBetween(parent->playingTrack, parent->remoteNextTrack));
             logger->log(")");
         }
         logger->log("\n");
+
+        parent->logFirstShuffle();
         #endif DEBUG
 
+        map->release();
         return;
     }
     
@@ -1086,34 +1448,66 @@ void Shuffler::NextTrackPreparation::run() {
         parent->remoteRadius = min(parent->remoteRadius, parent->remoteBound);
     }
        
-    ANNpoint            remotePoint(randomPointOnSphere(map->getDimensions(), parent->remoteRadius));
-    const ANNidxArray   results(map->findNearestNeighbors(remotePoint, 3));
-    unsigned int        j(1);
+    // Random unplayed track within a shell around the playing one
+    int shellTracks(0);
+
+    if (parent->remoteMode == REMOTE_SHELL) {
+        shellTracks = map->findInShell(
+            map->getPoint(playingTrack.getId()),
+            parent->remoteRadius * (1 - parent->shellWidth),
+            parent->remoteRadius * (1 + parent->shellWidth),
+            parent->shellMaxVisited,
+            neighbors,
+            &unplayed
+        );
+
+        if (shellTracks > 0)
+            parent->remoteNextTrack = map->getTrack(neighbors.getId((((unsigned long)rand() << 15) ^ rand()) % shellTracks));
+    }
 
-    if (results[j] == parent->playingTrack->getId())    j = 2;
-        
-    parent->remoteNextTrack = map->getTrack(results[j]);
+    // Nearest track to a random point of the sphere; also when the shell is empty
+    if (shellTracks == 0) {
+        ANNpoint    remotePoint(randomPointOnSphere(map->getDimensions(), parent->remoteRadius));
+        int         results(map->findNearestNeighbors(remotePoint, 3, neighbors));
+        int         j(1);
+
+        delete[] remotePoint;
+
+        while (j < 2 && j < results
+        &&  (neighbors.getId(j) == playingTrack.getId() || map->getTrack(neighbors.getId(j)).getCode() == REMOVED))
+            j++;
+
+        // Fewer results while the search structure is being built (see Map::setLazyLoading())
+        if (j >= results)
+            parent->remoteNextTrack = map->getRandomTrack();
+        else
+            parent->remoteNextTrack = map->getTrack(neighbors.getId(j));
+    }
 
     // Debug logging
     #ifdef DEBUG
     Logger* logger = Logger::getInstance();
     logger->log("Local next track : [");
-    logger->log(parent->localNextTrack->getId());
+    logger->log(parent->localNextTrack.getId());
     logger->log("]");
-    if (parent->playingTrack->hasCoordinates()) {
+    if (parent->playingTrack.hasCoordinates()) {
         logger->log(" (distance = ");
         logger->log(parent->distanceBetween(parent->playingTrack, parent->localNextTrack));
         logger->log(")");
     }
     logger->log("\nRemote next track : [");
-    logger->log(parent->remoteNextTrack->getId());
+    logger->log(parent->remoteNextTrack.getId());
     logger->log("]");
-    if (parent->playingTrack->hasCoordinates()) {
+    if (parent->playingTrack.hasCoordinates()) {
         logger->log(" (distance = ");
         //logger->log(parent->distanceBetween(parent->playingTrack, parent->remoteNextTrack));
         logger->log(parent->remoteRadius);
         logger->log(")");
     }
     logger->log("\n");
+
+    parent->logFirstShuffle();
     #endif DEBUG
-}
+
+    map->release();
+}
\ No newline at end of file
@@ -13,6 +13,8 @@
 
     #include "constants.h"
     #include "map.h"
+    #include "neighborfilter.h"
+    #include "neighboriterator.h"
     #include "track.h"
 
 
@@ -24,24 +26,37 @@
     };
 
 
+    /// \brief How the remote next track is chosen, at remoteRadius.
+    enum RemoteMode {
+        REMOTE_SPHERE,      ///< Nearest track to a random point at remoteRadius from the origin
+        REMOTE_SHELL        ///< Random unplayed track at about remoteRadius from the playing one
+    };
+
+
     /**
      * \brief Class to handle shuffle mode algorithm.
      */
     class Shuffler {
         static Shuffler*            instance;
         std::string                 configDirectory;
-        Map*                        map;
-        std::deque<Track*>          lastPlayedTracks;
+        std::deque<Track>           lastPlayedTracks;
         ShuffleMode                 mode;
+        RemoteMode                  remoteMode;
         ULARGE_INTEGER              uli;
-        Track*                      playingTrack;
-        Track*                      localNextTrack;
-        Track*                      remoteNextTrack;
+        Track                       playingTrack;
+        Track                       localNextTrack;
+        Track                       remoteNextTrack;
         ANNdist
             remoteScale,
             remoteConstant,
             remoteBound,
-            remoteRadius;
+            remoteRadius,
+            localNextDistance,          ///< Distance from the playing track to localNextTrack, negative if unknown
+            shellWidth;                 ///< Relative half-width of the shell, in REMOTE_SHELL mode
+        double
+            initTime;                   ///< Time init() was called, 0 once the first next track is picked (DEBUG builds)
+        int
+            shellMaxVisited;            ///< Largest number of tracks examined per remote pick, in REMOTE_SHELL mode
         bool
             paused;    
         int
@@ -68,6 +83,22 @@
             enTime,
             pstTime,
             penTime;
+        #ifdef BENCHMARK
+        std::string                 benchmark;  ///< Name of the benchmark to run at startup
+        #endif
+
+
+        /// \brief Accept tracks that have coordinates and were not played recently.
+        class UnplayedFilter : public NeighborFilter {
+            const Map*  map;
+            ANNidx      excluded;           ///< Track rejected in any case, usually the playing one
+
+            public:
+            UnplayedFilter(const Map*, ANNidx);
+            ~UnplayedFilter();
+
+            bool    accept(ANNidx)      const;
+        };
 
 
         // Threads
@@ -93,7 +124,9 @@
         } mapLoad;
 
         class NextTrackPreparation : public CThread {
-            Shuffler*   parent;
+            Shuffler*       parent;
+            NeighborQuery       neighbors;          ///< Reused from one preparation to the next
+            NeighborIterator    localNeighbors;     ///< Reused from one preparation to the next
 
             public:
             NextTrackPreparation(Shuffler*);
@@ -117,15 +150,16 @@
 		std::string			getConfigDirectory();
         int                 getListLength();
         int                 getListPosition();
-        Track*              getPlayingTrack()           const;
-        const Track*              getLocalNextTrack()         const;
-        const Track*              getRemoteNextTrack()        const;
+        Track               getPlayingTrack()           const;
+        Track               getLocalNextTrack()         const;
+        Track               getRemoteNextTrack()        const;
         bool                isPlaying()                 const;
         bool                databaseAvailable();
 
+        void                setInitTime(double);
         void                setListPosition(unsigned int);
         
-        void                appendToPlaylist(const Track*);
+        void                appendToPlaylist(const Track&);
         bool                checkWinampVersion(int);
         void                createMenuEntries();
         void                disable();
@@ -139,6 +173,7 @@
         void                toggleMode();
 
         void                onEndTrack();
+        void                onMapPublished();
         void                onNextTrack();
         void                onPausePlaying();
         void                onPreviousTrack();
@@ -149,7 +184,9 @@
         void                onStopPlaying();
 
         private:
-        ANNdist             distanceBetween(const Track*, const Track*);
+        ANNdist             distanceBetween(const Track&, const Track&);
+        void                followMap();
+        void                logFirstShuffle();
         void                setMenuItem(ShuffleMode, bool);
     };
-#endif
+#endif
\ No newline at end of file
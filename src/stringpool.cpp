@@ -0,0 +1,133 @@
+/**
+ * \file stringpool.cpp
+ * \brief StringPool class implementation.
+ */
+
+#include "stringpool.h"
+
+using namespace std;
+
+
+/// \brief Default constructor.
+StringPool::StringPool() :
+        blockSize(0),
+        blockUsed(0),
+        allocated(0) {
+    strings.push_back("");
+}
+
+
+/// \brief Destructor.
+StringPool::~StringPool() {
+    clear();
+}
+
+
+/**
+ * \param id ID of an interned string.
+ * \return The interned string.
+ */
+const char* StringPool::get(unsigned long id) const {
+    return strings[id];
+}
+
+
+/// \return Number of interned strings, the empty one included.
+unsigned long StringPool::getCount() const {
+    return strings.size();
+}
+
+
+/// \return Approximate number of bytes allocated by the pool.
+unsigned long StringPool::getMemoryUsage() const {
+    unsigned long usage(allocated);
+
+    usage += blocks.capacity() * sizeof(char*);
+    usage += strings.capacity() * sizeof(const char*);
+
+    // Tree nodes hold 3 pointers and a color besides the value
+    usage += ids.size() * (4 * sizeof(void*) + sizeof(const char*) + sizeof(unsigned long));
+
+    return usage;
+}
+
+
+/**
+ * \brief Copy a string into the pool.
+ *
+ * \param data      First character of the string; it needs not be NUL-terminated.
+ * \param length    Length of the string, in bytes.
+ * \return The copy, NUL-terminated.
+ */
+const char* StringPool::store(const char* data, unsigned long length) {
+    if (length == 0)    return strings[0];
+
+    // Start a new block; long strings get a block of their own
+    if (blockUsed + length + 1 > blockSize) {
+        blockSize = max(length + 1, (unsigned long)STRING_POOL_BLOCK_SIZE);
+        blockUsed = 0;
+        blocks.push_back(new char[blockSize]);
+        allocated += blockSize;
+    }
+
+    char* copy(blocks.back() + blockUsed);
+
+    memcpy(copy, data, length);
+    copy[length] = '\0';
+    blockUsed   += length + 1;
+
+    return copy;
+}
+
+
+/// \brief Copy a string into the pool.
+const char* StringPool::store(const string& value) {
+    return store(value.data(), value.size());
+}
+
+
+/**
+ * \brief Store a string once, and identify it.
+ *
+ * \param value NUL-terminated string.
+ * \return ID of the string, the same for all equal strings.
+ */
+unsigned long StringPool::intern(const char* value) {
+    if (*value == '\0')     return 0;
+
+    map<const char*, unsigned long, StringLess>::iterator i(ids.find(value));
+    if (i != ids.end())     return i->second;
+
+    const char*     copy(store(value, strlen(value)));
+    unsigned long   id(strings.size());
+
+    strings.push_back(copy);
+    ids[copy] = id;
+
+    return id;
+}
+
+
+/// \brief Store a string once, and identify it.
+unsigned long StringPool::intern(const string& value) {
+    return intern(value.c_str());
+}
+
+
+/// \brief Free all strings; pointers and IDs previously returned become invalid.
+void StringPool::clear() {
+    unsigned long i(0);
+
+    while (i < blocks.size()) {
+        delete[] blocks[i];
+        i++;
+    }
+
+    blocks.clear();
+    ids.clear();
+    strings.resize(1);
+
+    blockSize = 0;
+    blockUsed = 0;
+    allocated = 0;
+}
\ No newline at end of file
@@ -0,0 +1,62 @@
+#ifndef STRINGPOOL_H
+    #define STRINGPOOL_H
+
+    /**
+     * \file stringpool.h
+     * \brief StringPool class headers.
+     */
+
+    #include <cstring>
+    #include <map>
+    #include <string>
+    #include <vector>
+
+    #include "constants.h"
+
+    #define STRING_POOL_BLOCK_SIZE  65536   ///< Size of storage blocks, in bytes
+
+
+    /// \brief Order of NUL-terminated strings, for use as std::map keys.
+    struct StringLess {
+        bool operator()(const char* a, const char* b) const {
+            return strcmp(a, b) < 0;
+        }
+    };
+
+
+    /**
+     * \brief Storage for many small strings.
+     *
+     * Strings are copied, NUL-terminated, into big blocks, and are never moved nor freed
+     * until the pool is cleared; hence returned pointers remain valid until then.
+     * Interned strings are stored only once, and identified by a small integer;
+     * ID 0 is always the empty string.
+     *
+     * This class is not thread-safe.
+     */
+    class StringPool {
+        std::vector<char*>                                  blocks;
+        unsigned long                                       blockSize,
+                                                            blockUsed,
+                                                            allocated;  ///< Total size of blocks, in bytes
+        std::vector<const char*>                            strings;    ///< Interned strings, by ID
+        std::map<const char*, unsigned long, StringLess>    ids;        ///< IDs of interned strings
+
+        StringPool(const StringPool&);
+        void operator=(const StringPool&);
+
+        public:
+        StringPool();
+        ~StringPool();
+
+        const char*         get(unsigned long)  const;
+        unsigned long       getCount()          const;
+        unsigned long       getMemoryUsage()    const;
+
+        const char*         store(const char*, unsigned long);
+        const char*         store(const std::string&);
+        unsigned long       intern(const char*);
+        unsigned long       intern(const std::string&);
+        void                clear();
+    };
+#endif
\ No newline at end of file
@@ -12,6 +12,7 @@
 
 #include "gen_museek.h"
 #include "track.h"
+#include "trackstore.h"
 #include "utils.h"
 
 using namespace std;
@@ -23,87 +24,110 @@ extern winampGeneralPurposePlugin plugin;
 /**
  * \brief Default constructor.
  *
- * Allocate storage for coordinates.
+ * The track refers to nothing; see isValid().
  */
 Track::Track() :
-        artistID(),
-        titleID(),
-        year(0),
-        length(0), 
-        path(), 
-        id(),
-        code(UNTESTED),
-        alreadyPlayed(false) {
+        map(NULL),
+        store(NULL),
+        id(0) {
 }
 
 
 /**
- * \brief Constructor from map and ANNpoint index.
+ * \brief Constructor from a track store and a row index.
  *
- * \param i Index of the corresponding ANNpoint in the ANNpointArray of the parent map.
+ * The track belongs to no map; its coordinates are looked up in the current map.
+ *
+ * \param newStore  Store holding the track.
+ * \param i         Index of the track in the store, and of the corresponding ANNpoint in the map.
  */
-Track::Track(ANNidx i) :
-        artist(),
-        artistID(),
-        title(),
-        titleID(),
-        length(0),
-        path(),
-        id(i),
-        code(UNTESTED),
-        alreadyPlayed(false) {
-};
+Track::Track(TrackStore* newStore, ANNidx i) :
+        map(NULL),
+        store(newStore),
+        id(i) {
+}
 
 
 /**
- * \brief Constructor from artist, title and path.
+ * \brief Constructor from a map, its track store and a row index.
  *
- * \param newArtist Artist's name.
- * \param newTitle  Title of the track.
- * \param newPath   File location (facultative).
+ * \param newMap    Map the track belongs to; it is pinned until the track is destroyed.
+ * \param newStore  Store of this map.
+ * \param i         Index of the track in the store, and of the corresponding ANNpoint in the map.
  */
-Track::Track(string newArtist, string newTitle, string newPath) :
-        artist(newArtist),
-        artistID(),
-        title(newTitle),
-        titleID(),
-        path(newPath),
-        id(),
-        code(UNTESTED),
-        alreadyPlayed(false) {
-};
+Track::Track(Map* newMap, TrackStore* newStore, ANNidx i) :
+        map(newMap),
+        store(newStore),
+        id(i) {
+    if (map)    map->addReference();
+}
+
+
+/// \brief Copy constructor.
+Track::Track(const Track& track) :
+        map(track.map),
+        store(track.store),
+        id(track.id) {
+    if (map)    map->addReference();
+}
 
 
 /**
  * \brief Destructor.
  *
- * Does nothing.
+ * Unpin the map of the track, if any.
  */
 Track::~Track() {
-};
+    if (map)    map->removeReference();
+}
+
+
+/// \brief Assignment operator.
+Track& Track::operator=(const Track& track) {
+    if (track.map)  track.map->addReference();
+    if (map)        map->removeReference();
+
+    map     = track.map;
+    store   = track.store;
+    id      = track.id;
+
+    return *this;
+}
+
+
+/// \return True if both tracks refer to the same row of the same store.
+bool Track::operator==(const Track& track) const {
+    return store == track.store && id == track.id;
+}
+
+
+/// \return True if tracks refer to different rows.
+bool Track::operator!=(const Track& track) const {
+    return !(*this == track);
+}
 
 
 /// \return Album of the track.
-string Track::getAlbum() const {
-    return album;
+const char* Track::getAlbum() const {
+    return store->getAlbum(id);
 }
 
 
 /// \return Artist's name.
-string Track::getArtist() const {
-    return artist;
+const char* Track::getArtist() const {
+    return store->getArtist(id);
 }
 
 
 /// \return Artist ID in Museek database.
 unsigned int Track::getArtistID() const {
-    return artistID;
+    return store->getArtistID(id);
 }
 
 
 /// \return Genre of the song.
-string Track::getGenre() const {
-    return genre;
+const char* Track::getGenre() const {
+    return store->getGenre(id);
 }
 
 
@@ -115,68 +139,72 @@ ANNidx Track::getId() const {
 
 /// \return Length of the track, in seconds.
 unsigned long Track::getLength() const {
-    return length;
+    return store->getLength(id);
+}
+
+
+/// \return Map the track belongs to; NULL if it only refers to a track store.
+Map* Track::getMap() const {
+    return map;
 }
 
 
 /// \return File location.
 string Track::getPath() const {
-    return path;
+    return store->getPath(id);
 }
 
 
 /// \return Title of the track.
-string Track::getTitle() const {
-    return title;
+const char* Track::getTitle() const {
+    return store->getTitle(id);
 }
 
 
 /// \return Title ID in Museek database.
 unsigned int Track::getTitleID() const {
-    return titleID;
+    return store->getTitleID(id);
 }
 
 
 /// \return Year of the track.
 unsigned int Track::getYear() const {
-    return year;
+    return store->getYear(id);
 }
 
 
 /// \return The so-called Museek code, corresponding to the response code from the server.
 MuseekCode Track::getCode() const {
-    return code;
+    return store->getCode(id);
 }
 
 
 /// \return Requested coordinate for the track; if not retrieved from the server yet, perform the adequate HTTP query.
-ANNcoord Track::getCoordinate(unsigned short i) {
+ANNcoord Track::getCoordinate(unsigned short i) const {
     if (!hasCoordinates())
         return NULL;
 
-    Map* map = Map::getInstance();
-    return (map->getPoint(id))[i];
+    return (getOwner()->getPoint(id))[i];
 }
 
 
 /// \return Coordinates array for the track; if not retrieved from the server yet, perform the adequate HTTP query.
-ANNpoint Track::getCoordinates() {
+ANNpoint Track::getCoordinates() const {
     if (!hasCoordinates())
         return NULL;
 
-    Map* map = Map::getInstance();
-    return map->getPoint(id);
+    return getOwner()->getPoint(id);
 }
 
 
 /// \return True if coordinates were found in server, false otherwise.
-bool Track::hasCoordinates() {
+bool Track::hasCoordinates() const {
     // Try to download coordinates, if necessary
-    if (code == UNTESTED)
+    if (getCode() == UNTESTED)
         downloadCoordinates();
 
     // Check if coordinates were found
-    if (code == NOTHING_FOUND || code == ARTIST_NOT_FOUND)
+    if (getCode() == REMOVED || getCode() == NOTHING_FOUND || getCode() == ARTIST_NOT_FOUND)
         return false;
     
     return true;
@@ -185,7 +213,13 @@ bool Track::hasCoordinates() {
 
 /// \return True if this tracks has already been played, false otherwise.
 bool Track::isAlreadyPlayed() const {
-    return alreadyPlayed;
+    return store->isAlreadyPlayed(id);
+}
+
+
+/// \return True if the track refers to a row of a store, false otherwise.
+bool Track::isValid() const {
+    return store != NULL;
 }
 
 
@@ -195,7 +229,7 @@ bool Track::isAlreadyPlayed() const {
  * \param newState 
  */
 void Track::setAlreadyPlayed(bool newState) {
-    alreadyPlayed = newState;
+    store->setAlreadyPlayed(id, newState);
 }
 
 
@@ -204,8 +238,8 @@ void Track::setAlreadyPlayed(bool newState) {
  * 
  * \param newAlbum New album for the track.
  */
-void Track::setAlbum(string newAlbum) {
-    album = newAlbum;
+void Track::setAlbum(const string& newAlbum) {
+    store->setAlbum(id, newAlbum);
 }
 
 
@@ -214,8 +248,8 @@ void Track::setAlbum(string newAlbum) {
  * 
  * \param newArtist New artist name.
  */
-void Track::setArtist(string newArtist) {
-    artist = newArtist;
+void Track::setArtist(const string& newArtist) {
+    store->setArtist(id, newArtist);
 }
 
 
@@ -225,7 +259,7 @@ void Track::setArtist(string newArtist) {
  * \param newID New artist ID.
  */
 void Track::setArtistID(unsigned int newID) {
-    artistID = newID;
+    store->setArtistID(id, newID);
 }
 
 
@@ -235,7 +269,7 @@ void Track::setArtistID(unsigned int newID) {
  * \param newCode New code.
  */
 void Track::setCode(MuseekCode newCode) {
-    code = newCode;
+    store->setCode(id, newCode);
 }
 
 
@@ -244,18 +278,8 @@ void Track::setCode(MuseekCode newCode) {
  *
  * \param newGenre New genre.
  */
-void Track::setGenre(string newGenre) {
-    genre = newGenre;
-}
-
-
-/**
- * \brief Set the ID of the track, index of its corresponding point.
- *
- * \param n New id.
- */
-void Track::setId(ANNidx n) {
-    id = n;
+void Track::setGenre(const string& newGenre) {
+    store->setGenre(id, newGenre);
 }
 
 
@@ -265,18 +289,7 @@ void Track::setId(ANNidx n) {
  * \param newLength New length.
  */
 void Track::setLength(unsigned long newLength) {
-    length = newLength;
-}
-
-
-/**
- * \brief Set the file location.
- * 
- * \param newPath New location.
- */
-void Track::setPath(string newPath) {
-    path = newPath;
-    //transform(path.begin(), path.end(), path.begin(), ::tolower);
+    store->setLength(id, newLength);
 }
 
 
@@ -285,8 +298,8 @@ void Track::setPath(string newPath) {
  * 
  * \param newTitle New title.
  */
-void Track::setTitle(string newTitle) {
-    title = newTitle;
+void Track::setTitle(const string& newTitle) {
+    store->setTitle(id, newTitle);
 }
 
 
@@ -296,7 +309,7 @@ void Track::setTitle(string newTitle) {
  * \param newID New title ID.
  */
 void Track::setTitleID(unsigned int newID) {
-    titleID = newID;
+    store->setTitleID(id, newID);
 }
 
 
@@ -306,7 +319,7 @@ void Track::setTitleID(unsigned int newID) {
  * \param newYear New year for the track.
  */
 void Track::setYear(unsigned int newYear) {
-    year = newYear;
+    store->setYear(id, newYear);
 }
 
 
@@ -315,9 +328,8 @@ void Track::setYear(unsigned int newYear) {
  * 
  * \return Nothing.
  */
-void Track::downloadCoordinates() {
-    Map* map = Map::getInstance();
-    map->downloadCoordinates(id);
+void Track::downloadCoordinates() const {
+    getOwner()->downloadCoordinates(id);
 }
 
 
@@ -330,6 +342,11 @@ void Track::downloadCoordinates() {
  * \return Nothing.
  */
 void Track::setCoordinate(unsigned short k, ANNcoord coordinate) {
-    Map* map = Map::getInstance();
-    map->setCoordinate(id, k, coordinate);
+    getOwner()->setCoordinate(id, k, coordinate);
+}
+
+
+/// \return Map holding the coordinates of the track: its own, or the current one.
+Map* Track::getOwner() const {
+    return map ? map : Map::getInstance();
 }
\ No newline at end of file
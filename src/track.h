@@ -13,59 +13,63 @@
     #include "constants.h"
     #include "map.h"
 
+    class TrackStore;
+
     /**
-     * \brief Class to manipulate tracks and their coordinates.
+     * \brief Lightweight view over a track of a map, and its coordinates.
+     *
+     * Tracks are stored in a TrackStore; a Track only refers to a row of it,
+     * so that it can be copied around freely. A track of a map holds a reference
+     * to that map, which remains valid as long as the track exists.
      */
     class Track {
-        unsigned long   artistID,
-                        length,
-                        titleID,
-                        year;
-        std::string     album,
-                        artist,
-                        genre,
-                        path,
-                        title;
+        Map*            map;
+        TrackStore*     store;
         ANNidx          id;
-        MuseekCode      code;
-        bool            alreadyPlayed;
+
+        Map*            getOwner()          const;
 
         public:
         Track();
-        Track(ANNidx);
-        Track(std::string, std::string, std::string path = std::string(""));
+        Track(TrackStore*, ANNidx);
+        Track(Map*, TrackStore*, ANNidx);
+        Track(const Track&);
         ~Track();
 
-        std::string     getAlbum()          const;
-        std::string     getArtist()         const;
+        Track&          operator=(const Track&);
+        bool            operator==(const Track&)    const;
+        bool            operator!=(const Track&)    const;
+
+        const char*     getAlbum()          const;
+        const char*     getArtist()         const;
         unsigned int    getArtistID()       const;
-        std::string     getGenre()          const;
+        const char*     getGenre()          const;
         ANNidx          getId()             const;
         unsigned long   getLength()         const;
+        Map*            getMap()            const;
         std::string     getPath()           const;
-        std::string     getTitle()          const;
+        const char*     getTitle()          const;
         unsigned int    getTitleID()        const;
         unsigned int    getYear()           const;
         MuseekCode      getCode()           const;
-        ANNcoord        getCoordinate(unsigned short);
-        ANNpoint        getCoordinates();
-        bool            hasCoordinates();
+        ANNcoord        getCoordinate(unsigned short)   const;
+        ANNpoint        getCoordinates()    const;
+        bool            hasCoordinates()    const;
         bool            isAlreadyPlayed()   const;
+        bool            isValid()           const;
         
         void            setAlreadyPlayed(bool);
-        void            setAlbum(std::string);
-        void            setArtist(std::string);
+        void            setAlbum(const std::string&);
+        void            setArtist(const std::string&);
         void            setArtistID(unsigned int);
         void            setCode(MuseekCode);
-        void            setGenre(std::string);
-        void            setId(ANNidx);
+        void            setGenre(const std::string&);
         void            setLength(unsigned long);
-        void            setPath(std::string);
-        void            setTitle(std::string);
+        void            setTitle(const std::string&);
         void            setTitleID(unsigned int);
         void            setYear(unsigned int);
 
-        void            downloadCoordinates();
+        void            downloadCoordinates()   const;
 
         private:
         void            setCoordinate(unsigned short, ANNcoord);
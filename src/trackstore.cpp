@@ -0,0 +1,305 @@
+/**
+ * \file trackstore.cpp
+ * \brief TrackStore class implementation.
+ */
+
+#include "trackstore.h"
+
+using namespace std;
+
+
+/// \brief Default constructor.
+TrackStore::TrackStore() {
+}
+
+
+/// \brief Destructor.
+TrackStore::~TrackStore() {
+}
+
+
+/// \return Number of tracks.
+unsigned long TrackStore::getSize() const {
+    return codes.size();
+}
+
+
+/// \return Approximate number of bytes allocated by the store, strings included.
+unsigned long TrackStore::getMemoryUsage() const {
+    unsigned long usage(strings.getMemoryUsage() + paths.getMemoryUsage());
+
+    usage += (artistIDs.capacity() + titleIDs.capacity() + lengths.capacity() + stamps.capacity()) * sizeof(DWORD);
+    usage += (artists.capacity() + albums.capacity() + genres.capacity() + years.capacity()) * sizeof(DWORD);
+    usage += codes.capacity() + flags.capacity();
+    usage += titles.capacity() * sizeof(const char*);
+
+    return usage;
+}
+
+
+/// \return Album of the track.
+const char* TrackStore::getAlbum(ANNidx i) const {
+    return strings.get(albums[i]);
+}
+
+
+/// \return Artist's name.
+const char* TrackStore::getArtist(ANNidx i) const {
+    return strings.get(artists[i]);
+}
+
+
+/// \return Artist ID in Museek database.
+unsigned int TrackStore::getArtistID(ANNidx i) const {
+    return artistIDs[i];
+}
+
+
+/// \return The so-called Museek code, corresponding to the response code from the server.
+MuseekCode TrackStore::getCode(ANNidx i) const {
+    return (MuseekCode)codes[i];
+}
+
+
+/**
+ * Unlike Track::hasCoordinates(), never downloads coordinates of untested tracks.
+ * \return True if tracks with this code have coordinates in the map, false otherwise.
+ */
+bool TrackStore::hasCoordinates(MuseekCode code) {
+    return code != REMOVED && code != UNTESTED && code != NOTHING_FOUND && code != ARTIST_NOT_FOUND;
+}
+
+
+/// \return True if the track has coordinates in the map, see hasCoordinates(MuseekCode).
+bool TrackStore::hasCoordinates(ANNidx i) const {
+    return hasCoordinates(getCode(i));
+}
+
+
+/// \return Genre of the song.
+const char* TrackStore::getGenre(ANNidx i) const {
+    return strings.get(genres[i]);
+}
+
+
+/// \return Length of the track, in seconds.
+unsigned long TrackStore::getLength(ANNidx i) const {
+    return lengths[i];
+}
+
+
+/// \return Stamp of the track file; 0 if unknown.
+DWORD TrackStore::getStamp(ANNidx i) const {
+    return stamps[i];
+}
+
+
+/// \return File location.
+string TrackStore::getPath(ANNidx i) const {
+    return paths.get(i);
+}
+
+
+/// \brief Get the file location into an existing string, so that its storage can be reused.
+void TrackStore::getPath(ANNidx i, string& path) const {
+    paths.get(i, path);
+}
+
+
+/// \return Title of the track.
+const char* TrackStore::getTitle(ANNidx i) const {
+    return titles[i];
+}
+
+
+/// \return Title ID in Museek database.
+unsigned int TrackStore::getTitleID(ANNidx i) const {
+    return titleIDs[i];
+}
+
+
+/// \return Year of the track.
+unsigned int TrackStore::getYear(ANNidx i) const {
+    return years[i];
+}
+
+
+/// \return True if this tracks has already been played, false otherwise.
+bool TrackStore::isAlreadyPlayed(ANNidx i) const {
+    return (flags[i] & TRACK_ALREADY_PLAYED) != 0;
+}
+
+
+/// \brief List indexes of tracks by order of their file location.
+void TrackStore::getSortedPathIDs(vector<ANNidx>& ids) const {
+    paths.getSortedIDs(ids);
+}
+
+
+///
+void TrackStore::setAlbum(ANNidx i, const string& newAlbum) {
+    albums[i] = strings.intern(newAlbum);
+}
+
+
+///
+void TrackStore::setAlreadyPlayed(ANNidx i, bool newState) {
+    if (newState)   flags[i] |= TRACK_ALREADY_PLAYED;
+    else            flags[i] &= ~TRACK_ALREADY_PLAYED;
+}
+
+
+///
+void TrackStore::setArtist(ANNidx i, const string& newArtist) {
+    artists[i] = strings.intern(newArtist);
+}
+
+
+///
+void TrackStore::setArtistID(ANNidx i, unsigned int newID) {
+    artistIDs[i] = newID;
+}
+
+
+///
+void TrackStore::setCode(ANNidx i, MuseekCode newCode) {
+    codes[i] = (signed char)newCode;
+}
+
+
+///
+void TrackStore::setGenre(ANNidx i, const string& newGenre) {
+    genres[i] = strings.intern(newGenre);
+}
+
+
+///
+void TrackStore::setLength(ANNidx i, unsigned long newLength) {
+    lengths[i] = newLength;
+}
+
+
+/**
+ * \brief Set the file location.
+ *
+ * The new location is kept apart from the compressed ones until rebuildPaths() is called.
+ *
+ * \param i         Index of the track.
+ * \param newPath   New location; it needs not be NUL-terminated.
+ * \param length    Length of the new location, in bytes.
+ */
+void TrackStore::setPath(ANNidx i, const char* newPath, unsigned long length) {
+    paths.set(i, newPath, length);
+}
+
+
+///
+void TrackStore::setPath(ANNidx i, const string& newPath) {
+    paths.set(i, newPath.data(), newPath.size());
+}
+
+
+///
+void TrackStore::setStamp(ANNidx i, DWORD newStamp) {
+    stamps[i] = newStamp;
+}
+
+
+/**
+ * \brief Set the track title.
+ *
+ * The previous title is not freed until the store is cleared.
+ */
+void TrackStore::setTitle(ANNidx i, const string& newTitle) {
+    titles[i] = strings.store(newTitle);
+}
+
+
+///
+void TrackStore::setTitleID(ANNidx i, unsigned int newID) {
+    titleIDs[i] = newID;
+}
+
+
+///
+void TrackStore::setYear(ANNidx i, unsigned int newYear) {
+    years[i] = newYear;
+}
+
+
+/**
+ * \brief Set the file location of all tracks at once, and compress them.
+ *
+ * This is much faster than setting them one by one, especially if they are laid out in memory
+ * in sorted order.
+ *
+ * \param newPaths  File location of each track; they need not be NUL-terminated.
+ * \param lengths   Length of each location, in bytes.
+ */
+void TrackStore::buildPaths(const vector<const char*>& newPaths, const vector<unsigned long>& lengths) {
+    paths.build(newPaths, lengths);
+    paths.resize(getSize());
+}
+
+
+/// \brief Compress file locations set since the last build.
+void TrackStore::rebuildPaths() {
+    paths.rebuild();
+}
+
+
+/// \brief Remove all tracks, and free their strings.
+void TrackStore::clear() {
+    artistIDs.clear();
+    titleIDs.clear();
+    lengths.clear();
+    stamps.clear();
+    artists.clear();
+    albums.clear();
+    genres.clear();
+    years.clear();
+    codes.clear();
+    flags.clear();
+    paths.clear();
+    titles.clear();
+    strings.clear();
+}
+
+
+/// \brief Allocate columns for n tracks at once.
+void TrackStore::reserve(unsigned long n) {
+    artistIDs.reserve(n);
+    titleIDs.reserve(n);
+    lengths.reserve(n);
+    stamps.reserve(n);
+    artists.reserve(n);
+    albums.reserve(n);
+    genres.reserve(n);
+    years.reserve(n);
+    codes.reserve(n);
+    flags.reserve(n);
+    titles.reserve(n);
+}
+
+
+/**
+ * \brief Set the number of tracks.
+ *
+ * New tracks have empty strings, null attributes, and the UNTESTED code.
+ *
+ * \param n New number of tracks.
+ */
+void TrackStore::resize(unsigned long n) {
+    artistIDs.resize(n, 0);
+    titleIDs.resize(n, 0);
+    lengths.resize(n, 0);
+    stamps.resize(n, 0);
+    artists.resize(n, 0);
+    albums.resize(n, 0);
+    genres.resize(n, 0);
+    years.resize(n, 0);
+    codes.resize(n, (signed char)UNTESTED);
+    flags.resize(n, 0);
+    paths.resize(n);
+    titles.resize(n, strings.get(0));
+}
\ No newline at end of file
@@ -0,0 +1,96 @@
+#ifndef TRACKSTORE_H
+    #define TRACKSTORE_H
+
+    /**
+     * \file trackstore.h
+     * \brief TrackStore class headers.
+     */
+
+    #include <string>
+    #include <vector>
+
+    #include "ANN.h"
+
+    #include "constants.h"
+    #include "pathdictionary.h"
+    #include "stringpool.h"
+
+    #define TRACK_ALREADY_PLAYED    0x01    ///< Flag: the track has been played recently
+
+
+    /**
+     * \brief Storage for all tracks of a map, one column per attribute.
+     *
+     * Numeric attributes are stored in fixed-width columns. Artist, album and genre names,
+     * which repeat a lot, are interned and stored as IDs; titles are stored once in a string
+     * pool. String getters return pointers into this pool, which remain valid until the store
+     * is cleared. Paths are front-coded in a PathDictionary, and returned by value.
+     *
+     * Rows are identified by the index of the track in the map; see Track for a view over a row.
+     * Different rows may be written to by different threads, as long as the store is not resized
+     * and no string is set meanwhile.
+     */
+    class TrackStore {
+        std::vector<DWORD>          artistIDs,
+                                    titleIDs,
+                                    lengths,
+                                    stamps,         ///< Stamps of track files, see Map::update()
+                                    artists,        ///< Interned artist names
+                                    albums,         ///< Interned album names
+                                    genres,         ///< Interned genres
+                                    years;
+        std::vector<signed char>    codes;          ///< MuseekCode of tracks
+        std::vector<unsigned char>  flags;          ///< TRACK_* flags
+        std::vector<const char*>    titles;
+        StringPool                  strings;
+        PathDictionary              paths;
+
+        TrackStore(const TrackStore&);
+        void operator=(const TrackStore&);
+
+        public:
+        TrackStore();
+        ~TrackStore();
+
+        unsigned long   getSize()                   const;
+        unsigned long   getMemoryUsage()            const;
+
+        const char*     getAlbum(ANNidx)            const;
+        const char*     getArtist(ANNidx)           const;
+        unsigned int    getArtistID(ANNidx)         const;
+        MuseekCode      getCode(ANNidx)             const;
+        const char*     getGenre(ANNidx)            const;
+        unsigned long   getLength(ANNidx)           const;
+        DWORD           getStamp(ANNidx)            const;
+        std::string     getPath(ANNidx)             const;
+        void            getPath(ANNidx, std::string&)           const;
+        const char*     getTitle(ANNidx)            const;
+        unsigned int    getTitleID(ANNidx)          const;
+        unsigned int    getYear(ANNidx)             const;
+        bool            hasCoordinates(ANNidx)      const;
+        bool            isAlreadyPlayed(ANNidx)     const;
+        void            getSortedPathIDs(std::vector<ANNidx>&)  const;
+
+        void            setAlbum(ANNidx, const std::string&);
+        void            setAlreadyPlayed(ANNidx, bool);
+        void            setArtist(ANNidx, const std::string&);
+        void            setArtistID(ANNidx, unsigned int);
+        void            setCode(ANNidx, MuseekCode);
+        void            setGenre(ANNidx, const std::string&);
+        void            setLength(ANNidx, unsigned long);
+        void            setPath(ANNidx, const char*, unsigned long);
+        void            setPath(ANNidx, const std::string&);
+        void            setStamp(ANNidx, DWORD);
+        void            setTitle(ANNidx, const std::string&);
+        void            setTitleID(ANNidx, unsigned int);
+        void            setYear(ANNidx, unsigned int);
+
+        void            buildPaths(const std::vector<const char*>&, const std::vector<unsigned long>&);
+        void            rebuildPaths();
+        void            clear();
+        void            reserve(unsigned long);
+        void            resize(unsigned long);
+
+        static bool     hasCoordinates(MuseekCode);
+    };
+#endif
\ No newline at end of file
@@ -130,4 +130,178 @@ string char2hex(char dec) {
     r.append( &dig1, 1);
     r.append( &dig2, 1);
     return r;
+}
+
+
+/// \return Time elapsed since an arbitrary origin, in seconds (high resolution timer).
+double currentTime() {
+    LARGE_INTEGER counter, frequency;
+
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+}
+
+
+/**
+ * \brief Compute a 32-bit FNV-1a hash of a memory block.
+ *
+ * \param data Block to hash.
+ * \param size Size of the block, in bytes.
+ * \param seed Initial value; pass the hash of a previous block to hash several blocks as a whole.
+ * \return The hash.
+ */
+unsigned long hashBytes(const void* data, unsigned long size, unsigned long seed) {
+    const unsigned char*    bytes((const unsigned char*)data);
+    unsigned long           hash(seed), i(0);
+
+    while (i < size) {
+        hash = ((hash ^ bytes[i]) * 16777619UL) & 0xFFFFFFFFUL;
+        i++;
+    }
+
+    return hash;
+}
+
+
+/// \return Table converting characters of the ANSI code page to lowercase.
+static const unsigned char* caseFoldTable() {
+    static unsigned char    table[256];
+    static bool             initialized(false);
+
+    if (!initialized) {
+        unsigned short i(0);
+
+        for (i = 0; i < 256; i++)
+            table[i] = (unsigned char)i;
+
+        CharLowerBuffA((char*)table, 256);
+        initialized = true;
+    }
+
+    return table;
+}
+
+
+/**
+ * \brief Convert a string to lowercase, as Windows compares file names.
+ *
+ * \param str String in the ANSI code page.
+ * \return The lowercase string.
+ */
+string foldCase(const string& str) {
+    const unsigned char*    table(caseFoldTable());
+    string                  folded(str);
+    unsigned long           i(0);
+
+    for (i = 0; i < folded.size(); i++)
+        folded[i] = table[(unsigned char)folded[i]];
+
+    return folded;
+}
+
+
+/// \brief Rotate a 32-bit value to the left.
+static unsigned long rotateLeft(unsigned long value, unsigned short bits) {
+    return ((value << bits) | (value >> (32 - bits))) & 0xFFFFFFFFUL;
+}
+
+
+/**
+ * \brief Compute a 32-bit hash of a string converted to lowercase, without converting it.
+ *
+ * This is MurmurHash3 (x86, 32 bits) of foldCase() of the string. It processes 4 bytes at a time,
+ * which makes it several times faster than hashBytes() on long strings such as paths.
+ *
+ * \param data  String to hash.
+ * \param size  Length of the string, in bytes.
+ * \param seed  Initial value.
+ * \return The hash.
+ */
+unsigned long hashFolded(const char* data, unsigned long size, unsigned long seed) {
+    const unsigned char*    table(caseFoldTable());
+    const unsigned char*    bytes((const unsigned char*)data);
+    unsigned long           hash(seed & 0xFFFFFFFFUL), block(0), i(0);
+
+    for (i = 0; i + 4 <= size; i += 4) {
+        block = table[bytes[i]]
+            |   (unsigned long)table[bytes[i + 1]] << 8
+            |   (unsigned long)table[bytes[i + 2]] << 16
+            |   (unsigned long)table[bytes[i + 3]] << 24;
+
+        block   = rotateLeft((block * 0xCC9E2D51UL) & 0xFFFFFFFFUL, 15);
+        hash   ^= (block * 0x1B873593UL) & 0xFFFFFFFFUL;
+        hash    = (rotateLeft(hash, 13) * 5 + 0xE6546B64UL) & 0xFFFFFFFFUL;
+    }
+
+    // Remaining bytes
+    block = 0;
+
+    switch (size & 3) {
+        case 3: block ^= (unsigned long)table[bytes[i + 2]] << 16;
+        case 2: block ^= (unsigned long)table[bytes[i + 1]] << 8;
+        case 1: block ^= table[bytes[i]];
+                block   = rotateLeft((block * 0xCC9E2D51UL) & 0xFFFFFFFFUL, 15);
+                hash   ^= (block * 0x1B873593UL) & 0xFFFFFFFFUL;
+    }
+
+    // Final mix
+    hash ^= size & 0xFFFFFFFFUL;
+    hash ^= hash >> 16;
+    hash  = (hash * 0x85EBCA6BUL) & 0xFFFFFFFFUL;
+    hash ^= hash >> 13;
+    hash  = (hash * 0xC2B2AE35UL) & 0xFFFFFFFFUL;
+    hash ^= hash >> 16;
+
+    return hash;
+}
+
+
+/// \return True if both strings are equal regardless of case, false otherwise.
+bool equalFolded(const string& a, const string& b) {
+    const unsigned char*    table(caseFoldTable());
+    unsigned long           i(0);
+
+    if (a.size() != b.size())   return false;
+
+    while (i < a.size() && table[(unsigned char)a[i]] == table[(unsigned char)b[i]])
+        i++;
+
+    return i == a.size();
+}
+
+
+/**
+ * \brief Normalize an artist name or a title, so that trivial differences do not matter.
+ *
+ * The string is converted to lowercase, leading and trailing blanks are removed,
+ * and other runs of blanks are replaced by a single space.
+ *
+ * \param str String in the ANSI code page.
+ * \return The normalized string.
+ */
+string normalizeName(const string& str) {
+    string          folded(foldCase(str)), normalized;
+    unsigned long   i(0);
+    bool            blank(false);
+
+    normalized.reserve(folded.size());
+
+    while (i < folded.size()) {
+        char c(folded[i]);
+
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\n')
+            blank = true;
+        else {
+            if (blank && !normalized.empty())   normalized += ' ';
+
+            normalized += c;
+            blank = false;
+        }
+
+        i++;
+    }
+
+    return normalized;
 }
\ No newline at end of file
@@ -16,4 +16,10 @@
     ANNpoint                    randomPointOnSphere(unsigned short, double);
     std::string                 URLEncode(const std::string&);
     std::string                 char2hex(char);
+    double                      currentTime();
+    unsigned long               hashBytes(const void*, unsigned long, unsigned long seed = 2166136261UL);
+    std::string                 foldCase(const std::string&);
+    unsigned long               hashFolded(const char*, unsigned long, unsigned long seed = 0);
+    bool                        equalFolded(const std::string&, const std::string&);
+    std::string                 normalizeName(const std::string&);
 #endif
\ No newline at end of file